@@ -67,6 +67,13 @@ endif
 LOCAL_SRC_FILES += SensorBase.cpp
 LOCAL_SRC_FILES += MPLSensor.cpp
 LOCAL_SRC_FILES += MPLSupport.cpp
+LOCAL_SRC_FILES += FifoPacketDecoder.cpp
+LOCAL_SRC_FILES += SysfsAttrCache.cpp
+LOCAL_SRC_FILES += SensorEventRing.cpp
+LOCAL_SRC_FILES += FlushQueue.cpp
+LOCAL_SRC_FILES += FlushTracker.cpp
+LOCAL_SRC_FILES += SampleMerger.cpp
+LOCAL_SRC_FILES += LatencyHistogram.cpp
 LOCAL_SRC_FILES += InputEventReader.cpp
 LOCAL_SRC_FILES += PressureSensor.IIO.secondary.cpp
 
@@ -76,6 +83,7 @@ LOCAL_SRC_FILES += AkmSensor.cpp
 LOCAL_SRC_FILES += CompassSensor.AKM.cpp
 else ifeq ($(COMPILE_INVENSENSE_SENSOR_ON_PRIMARY_BUS), 1)
 LOCAL_SRC_FILES += CompassSensor.IIO.primary.cpp
+LOCAL_SRC_FILES += inv_iio_buffer.c
 LOCAL_CFLAGS += -DSENSOR_ON_PRIMARY_BUS
 else
 LOCAL_SRC_FILES += CompassSensor.IIO.9150.cpp
@@ -163,6 +171,7 @@ LOCAL_CFLAGS += -DTHIRD_PARTY_ACCEL
 endif
 ifeq ($(COMPILE_INVENSENSE_SENSOR_ON_PRIMARY_BUS), 1)
 LOCAL_SRC_FILES += CompassSensor.IIO.primary.cpp
+LOCAL_SRC_FILES += inv_iio_buffer.c
 LOCAL_CFLAGS += -DSENSOR_ON_PRIMARY_BUS
 else
 LOCAL_SRC_FILES += CompassSensor.IIO.9150.cpp
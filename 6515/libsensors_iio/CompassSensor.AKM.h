@@ -56,6 +56,7 @@ public:
     //       reference (look into .cpp for detailed information, also refer to
     //       3rd-party's readEvents() for relevant APIs)
     int readSample(long *data, int64_t *timestamp);
+    bool hasBufferedSamples() const { return false; }
     int readRawSample(float *data, int64_t *timestamp);
     void fillList(struct sensor_t *list);
     void getOrientationMatrix(signed char *orient);
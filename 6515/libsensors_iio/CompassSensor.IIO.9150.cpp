@@ -63,7 +63,7 @@ CompassSensor::CompassSensor()
                   : SensorBase(NULL, NULL),
                     compass_fd(-1),
                     mCompassTimestamp(0),
-                    mCompassInputReader(8)
+                    mCompassInputReader(32)
 {
     VFUNC_LOG;
 
@@ -249,32 +249,53 @@ int CompassSensor::readSample(long *data, int64_t *timestamp)
 {
     VHANDLER_LOG;
 
-    int numEventReceived = 0, done = 0;
+    return readSamples(data, timestamp, 1);
+}
+
+/**
+    @brief         Decodes up to count EV_SYN terminated frames straight
+                   from the input event ring. The driver is only read
+                   again once every complete frame is handed out.
+    @param[out]    data       3 values per sample
+    @param[out]    timestamps one timestamp per sample
+    @param[in]     count      maximum number of samples
+    @return        number of samples read, 0 if none, negative if error
+ */
+int CompassSensor::readSamples(long *data, int64_t *timestamps, int count)
+{
+    VHANDLER_LOG;
 
-    ssize_t n = mCompassInputReader.fill(compass_fd);
-    if (n < 0) {
-        LOGE("HAL:no compass events read");
-        return n;
+    int num = 0;
+
+    if (!mCompassInputReader.hasFrame()) {
+        ssize_t n = mCompassInputReader.fill(compass_fd);
+        if (n < 0) {
+            LOGE("HAL:no compass events read");
+            return n;
+        }
     }
 
-    input_event const* event;
+    input_event const* events;
+    ssize_t n = mCompassInputReader.readFrames(&events);
+    ssize_t i;
 
-    while (done == 0 && mCompassInputReader.readEvent(&event)) {
-        int type = event->type;
+    for (i = 0; i < n && num < count; i++) {
+        int type = events[i].type;
         if (type == EV_REL) {
-            processCompassEvent(event);
+            processCompassEvent(&events[i]);
         } else if (type == EV_SYN) {
-            *timestamp = mCompassTimestamp;
-            memcpy(data, mCachedCompassData, sizeof(mCachedCompassData));
-            done = 1;
+            timestamps[num] = mCompassTimestamp;
+            memcpy(&data[num * 3], mCachedCompassData,
+                   sizeof(mCachedCompassData));
+            num++;
         } else {
             LOGE("HAL:Compass Sensor: unknown event (type=%d, code=%d)",
-                 type, event->code);
+                 type, events[i].code);
         }
-        mCompassInputReader.next();
     }
+    mCompassInputReader.next(i);
 
-    return done;
+    return num;
 }
 
 /**
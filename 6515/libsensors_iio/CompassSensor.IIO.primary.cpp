@@ -47,6 +47,8 @@ CompassSensor::CompassSensor()
                   : SensorBase(COMPASS_NAME, NULL),
                     mCompassTimestamp(0),
                     mCompassInputReader(8),
+                    mIIOReadOffset(0),
+                    mIIOReadSize(0),
                     mCoilsResetFd(0)
 {
     FILE *fptr;
@@ -93,6 +95,7 @@ CompassSensor::CompassSensor()
     }
 
     memset(mCachedCompassData, 0, sizeof(mCachedCompassData));
+    memset(&mBufferScan, 0, sizeof(mBufferScan));
 
     if (!isIntegrated()) {
         enable(ID_M, 0);
@@ -244,6 +247,7 @@ int CompassSensor::enable(int32_t handle, int en)
     VFUNC_LOG;
 
     mEnable = en;
+    mIIOReadOffset = mIIOReadSize = 0;
     int tempFd;
     int res = 0;
 
@@ -264,6 +268,8 @@ int CompassSensor::enable(int32_t handle, int en)
                 en, compassSysFs.compass_z_fifo_enable, getTimestamp());
         res += write_sysfs_int(compassSysFs.compass_z_fifo_enable, en);
 
+        scan_iio_buffer();
+
         res = masterEnable(en);
         if (res < en) {
             return res;
@@ -273,6 +279,43 @@ int CompassSensor::enable(int32_t handle, int en)
     return res;
 }
 
+/* parse the scan layout once, readSamples() only decodes with it */
+void CompassSensor::scan_iio_buffer(void)
+{
+    VFUNC_LOG;
+
+    inv_iio_buffer_scan_channel(compassSysFs.compass_x_fifo_enable,
+                                compassSysFs.compass_x_fifo_index,
+                                compassSysFs.compass_x_fifo_type,
+                                NULL, NULL,
+                                &mBufferScan.channels[MAG_X_CHANNEL]);
+    inv_iio_buffer_scan_channel(compassSysFs.compass_y_fifo_enable,
+                                compassSysFs.compass_y_fifo_index,
+                                compassSysFs.compass_y_fifo_type,
+                                NULL, NULL,
+                                &mBufferScan.channels[MAG_Y_CHANNEL]);
+    inv_iio_buffer_scan_channel(compassSysFs.compass_z_fifo_enable,
+                                compassSysFs.compass_z_fifo_index,
+                                compassSysFs.compass_z_fifo_type,
+                                NULL, NULL,
+                                &mBufferScan.channels[MAG_Z_CHANNEL]);
+    inv_iio_buffer_scan_channel(compassSysFs.in_timestamp_en,
+                                compassSysFs.in_timestamp_index,
+                                compassSysFs.in_timestamp_type,
+                                NULL, NULL,
+                                &mBufferScan.channels[TIMESTAMP_CHANNEL]);
+    if (inv_iio_buffer_layout_init(&mBufferScan, CHANNELS_NB) < 0) {
+        LOGE("HAL:compass buffer has no enabled channel");
+        return;
+    }
+    LOGV_IF(PROCESS_VERBOSE, "HAL:compass scan size=%zu format=%d "
+            "x@%zd y@%zd z@%zd ts@%zd", mBufferScan.size, mBufferScan.format,
+            mBufferScan.addresses[MAG_X_CHANNEL],
+            mBufferScan.addresses[MAG_Y_CHANNEL],
+            mBufferScan.addresses[MAG_Z_CHANNEL],
+            mBufferScan.addresses[TIMESTAMP_CHANNEL]);
+}
+
 int CompassSensor::masterEnable(int en)
 {
     VFUNC_LOG;
@@ -363,28 +406,69 @@ long CompassSensor::getSensitivity()
 int CompassSensor::readSample(long *data, int64_t *timestamp) {
     VFUNC_LOG;
 
-    int i;
-    char *rdata = mIIOBuffer;
+    return readSamples(data, timestamp, 1);
+}
 
-    size_t rsize = read(compass_fd, rdata, (8 * mEnable + 8) * 1);
+/**
+    @brief         Reads up to count samples in FIFO order. One read()
+                   drains every scan queued in the driver into mIIOBuffer,
+                   the driver is only read again once they are all handed
+                   out.
+    @param[out]    data       3 values per sample. Scaled such that
+                              1 uT = 2^16
+    @param[out]    timestamps one timestamp per sample
+    @param[in]     count      maximum number of samples
+    @return        number of samples read, 0 if none, negative if error
+ */
+int CompassSensor::readSamples(long *data, int64_t *timestamps, int count) {
+    VFUNC_LOG;
+
+    int scan_size = mBufferScan.size;
+    int64_t raw[CHANNELS_NB * 16];
+    int n = 0;
 
-    if (!mEnable) {
-        rsize = read(compass_fd, rdata, (8 + 8) * IIO_BUFFER_LENGTH);
-        // LOGI("clear buffer with size: %d", rsize);
+    if (!mEnable || scan_size == 0) {
+        /* clear buffer */
+        read(compass_fd, mIIOBuffer, sizeof(mIIOBuffer));
+        mIIOReadOffset = mIIOReadSize = 0;
+        return 0;
     }
-/*
-    LOGI("get one sample of AMI IIO data with size: %d", rsize);
-    LOGI_IF(mEnable, "compass x/y/z: %d/%d/%d", *((short *) (rdata + 0)),
-        *((short *) (rdata + 2)), *((short *) (rdata + 4)));
-*/
-    if (mEnable) {
-        for (i = 0; i < 3; i++) {
-            data[i] = *((short *) (rdata + i * 2));
+
+    if (mIIOReadOffset >= mIIOReadSize) {
+        ssize_t rsize = read(compass_fd, mIIOBuffer,
+                             sizeof(mIIOBuffer) / scan_size * scan_size);
+        mIIOReadOffset = 0;
+        if (rsize < 0) {
+            int err = errno;
+            mIIOReadSize = 0;
+            LOGE("HAL:compass read failed (%s)", strerror(err));
+            return -err;
         }
-        *timestamp = *((long long *) (rdata + 8 * mEnable));
+        mIIOReadSize = rsize - rsize % scan_size;
+        LOGV_IF(INPUT_DATA, "HAL:compass read %d scans",
+                mIIOReadSize / scan_size);
     }
 
-    return mEnable;
+    while (n < count && mIIOReadOffset < mIIOReadSize) {
+        size_t want = count - n;
+        if (want > sizeof(raw) / sizeof(raw[0]) / CHANNELS_NB)
+            want = sizeof(raw) / sizeof(raw[0]) / CHANNELS_NB;
+        size_t got = inv_iio_buffer_layout_decode(&mBufferScan,
+                        mIIOBuffer + mIIOReadOffset,
+                        mIIOReadSize - mIIOReadOffset, raw, want);
+        if (got == 0)
+            break;
+        for (size_t k = 0; k < got; k++, n++) {
+            const int64_t *scan = raw + k * CHANNELS_NB;
+            data[n * 3 + 0] = scan[MAG_X_CHANNEL];
+            data[n * 3 + 1] = scan[MAG_Y_CHANNEL];
+            data[n * 3 + 2] = scan[MAG_Z_CHANNEL];
+            timestamps[n] = scan[TIMESTAMP_CHANNEL];
+        }
+        mIIOReadOffset += got * scan_size;
+    }
+
+    return n;
 }
 
 /**
@@ -559,6 +643,14 @@ int CompassSensor::inv_init_sysfs_attributes(void)
     sprintf(compassSysFs.compass_x_fifo_enable, "%s%s", sysfs_path, "/scan_elements/in_magn_x_en");
     sprintf(compassSysFs.compass_y_fifo_enable, "%s%s", sysfs_path, "/scan_elements/in_magn_y_en");
     sprintf(compassSysFs.compass_z_fifo_enable, "%s%s", sysfs_path, "/scan_elements/in_magn_z_en");
+    sprintf(compassSysFs.compass_x_fifo_index, "%s%s", sysfs_path, "/scan_elements/in_magn_x_index");
+    sprintf(compassSysFs.compass_y_fifo_index, "%s%s", sysfs_path, "/scan_elements/in_magn_y_index");
+    sprintf(compassSysFs.compass_z_fifo_index, "%s%s", sysfs_path, "/scan_elements/in_magn_z_index");
+    sprintf(compassSysFs.in_timestamp_index, "%s%s", sysfs_path, "/scan_elements/in_timestamp_index");
+    sprintf(compassSysFs.compass_x_fifo_type, "%s%s", sysfs_path, "/scan_elements/in_magn_x_type");
+    sprintf(compassSysFs.compass_y_fifo_type, "%s%s", sysfs_path, "/scan_elements/in_magn_y_type");
+    sprintf(compassSysFs.compass_z_fifo_type, "%s%s", sysfs_path, "/scan_elements/in_magn_z_type");
+    sprintf(compassSysFs.in_timestamp_type, "%s%s", sysfs_path, "/scan_elements/in_timestamp_type");
     sprintf(compassSysFs.compass_rate, "%s%s", sysfs_path, "/sampling_frequency");
     sprintf(compassSysFs.compass_scale, "%s%s", sysfs_path, "/in_magn_scale");
     sprintf(compassSysFs.compass_orient, "%s%s", sysfs_path, "/compass_matrix");
@@ -0,0 +1,60 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <stddef.h>
+
+#include "FifoPacketDecoder.h"
+
+/* indexed by INV_FIFO_TARGET_xxx - 1, see INV_FIFO_DESC() */
+const struct inv_fifo_desc inv_fifo_desc_table[] = {
+    { DATA_FORMAT_STEP,           BYTES_PER_SENSOR_PACKET,
+      INV_FIFO_LAYOUT_TIMESTAMP,  INV_FIFO_TARGET_STEP,
+      DATA_FORMAT_STEP },
+    { DATA_FORMAT_MARKER,         BYTES_PER_SENSOR,
+      INV_FIFO_LAYOUT_NONE,       INV_FIFO_TARGET_MARKER,
+      DATA_FORMAT_MARKER },
+    { DATA_FORMAT_EMPTY_MARKER,   BYTES_PER_SENSOR,
+      INV_FIFO_LAYOUT_NONE,       INV_FIFO_TARGET_EMPTY_MARKER,
+      DATA_FORMAT_EMPTY_MARKER },
+    { DATA_FORMAT_PED_STANDALONE, BYTES_PER_SENSOR_PACKET,
+      INV_FIFO_LAYOUT_TIMESTAMP,  INV_FIFO_TARGET_PED_STANDALONE,
+      DATA_FORMAT_PED_STANDALONE },
+    { DATA_FORMAT_PED_QUAT,       BYTES_PER_SENSOR_PACKET,
+      INV_FIFO_LAYOUT_S16X3,      INV_FIFO_TARGET_PED_QUAT,
+      DATA_FORMAT_PED_QUAT },
+    { DATA_FORMAT_6_AXIS,         BYTES_QUAT_DATA,
+      INV_FIFO_LAYOUT_S32X3,      INV_FIFO_TARGET_6_AXIS,
+      DATA_FORMAT_6_AXIS },
+    { DATA_FORMAT_QUAT,           BYTES_QUAT_DATA,
+      INV_FIFO_LAYOUT_S32X3,      INV_FIFO_TARGET_QUAT,
+      DATA_FORMAT_QUAT },
+    { DATA_FORMAT_COMPASS,        BYTES_PER_SENSOR_PACKET,
+      INV_FIFO_LAYOUT_S16X3,      INV_FIFO_TARGET_COMPASS,
+      DATA_FORMAT_COMPASS },
+    /* overflow flag only, the driver does not send data with it */
+    { DATA_FORMAT_COMPASS_OF,     BYTES_PER_SENSOR,
+      INV_FIFO_LAYOUT_NONE,       INV_FIFO_TARGET_COMPASS_OF,
+      DATA_FORMAT_COMPASS_OF },
+    { DATA_FORMAT_GYRO,           BYTES_PER_SENSOR_PACKET,
+      INV_FIFO_LAYOUT_S16X3,      INV_FIFO_TARGET_GYRO,
+      DATA_FORMAT_GYRO },
+    { DATA_FORMAT_ACCEL,          BYTES_PER_SENSOR_PACKET,
+      INV_FIFO_LAYOUT_S16X3,      INV_FIFO_TARGET_ACCEL,
+      DATA_FORMAT_ACCEL },
+    { DATA_FORMAT_PRESSURE,       BYTES_PER_SENSOR_PACKET,
+      INV_FIFO_LAYOUT_PRESSURE,   INV_FIFO_TARGET_PRESSURE,
+      DATA_FORMAT_PRESSURE },
+};
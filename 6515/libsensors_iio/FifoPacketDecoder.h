@@ -0,0 +1,256 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef ANDROID_FIFO_PACKET_DECODER_H
+#define ANDROID_FIFO_PACKET_DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+/* FIFO packet decoder shared by the MPU65xx and MPU6515 HALs.
+ *
+ * The kernel driver writes a stream of packets into the iio buffer, each
+ * starting with a 16 bit header. The header selects a descriptor in a
+ * constant table which gives the packet size, the payload layout and the
+ * cache the payload is meant for. Packets are handed out as typed views
+ * over the read buffer, nothing is copied.
+ *****************************************************************************/
+
+// data header format used by kernel driver.
+#define DATA_FORMAT_STEP           0x0001
+#define DATA_FORMAT_MARKER         0x0010
+#define DATA_FORMAT_EMPTY_MARKER   0x0020
+#define DATA_FORMAT_PED_STANDALONE 0x0100
+#define DATA_FORMAT_PED_QUAT       0x0200
+#define DATA_FORMAT_6_AXIS         0x0400
+#define DATA_FORMAT_QUAT           0x0800
+#define DATA_FORMAT_COMPASS        0x1000
+#define DATA_FORMAT_COMPASS_OF     0x1800
+#define DATA_FORMAT_GYRO           0x2000
+#define DATA_FORMAT_ACCEL          0x4000
+#define DATA_FORMAT_PRESSURE       0x8000
+#define DATA_FORMAT_MASK           0xffff
+
+#define BYTES_PER_SENSOR                8
+#define BYTES_PER_SENSOR_PACKET         16
+#define QUAT_ONLY_LAST_PACKET_OFFSET    16
+#define BYTES_QUAT_DATA                 24
+
+/* payload layout of a packet */
+enum {
+    INV_FIFO_LAYOUT_NONE = 0,   /* header only, 8 bytes */
+    INV_FIFO_LAYOUT_TIMESTAMP,  /* header + timestamp */
+    INV_FIFO_LAYOUT_S16X3,      /* 3 x s16 + timestamp */
+    INV_FIFO_LAYOUT_S32X3,      /* 3 x s32 + timestamp */
+    INV_FIFO_LAYOUT_PRESSURE,   /* s16 high + u16 low word + timestamp */
+};
+
+/* HAL cache the payload of a packet is stored into */
+enum {
+    INV_FIFO_TARGET_NONE = 0,
+    INV_FIFO_TARGET_STEP,
+    INV_FIFO_TARGET_MARKER,
+    INV_FIFO_TARGET_EMPTY_MARKER,
+    INV_FIFO_TARGET_PED_STANDALONE,
+    INV_FIFO_TARGET_PED_QUAT,
+    INV_FIFO_TARGET_6_AXIS,
+    INV_FIFO_TARGET_QUAT,
+    INV_FIFO_TARGET_COMPASS,
+    INV_FIFO_TARGET_COMPASS_OF,
+    INV_FIFO_TARGET_GYRO,
+    INV_FIFO_TARGET_ACCEL,
+    INV_FIFO_TARGET_PRESSURE,
+    INV_FIFO_TARGET_NUM
+};
+
+struct inv_fifo_desc {
+    unsigned short header;      /* DATA_FORMAT_xxx */
+    unsigned char size;         /* bytes, header and timestamp included */
+    unsigned char layout;       /* INV_FIFO_LAYOUT_xxx */
+    unsigned char target;       /* INV_FIFO_TARGET_xxx */
+    unsigned short mask;        /* bit reported in the parse mask */
+};
+
+/* typed views over the raw packet bytes */
+struct inv_fifo_ts_packet {
+    unsigned short header;
+    unsigned char reserved[6];
+    int64_t timestamp;
+} __attribute__((packed));
+
+struct inv_fifo_s16_packet {
+    unsigned short header;
+    short data[3];
+    int64_t timestamp;
+} __attribute__((packed));
+
+struct inv_fifo_s32_packet {
+    unsigned short header;
+    unsigned short reserved;
+    int data[3];
+    int64_t timestamp;
+} __attribute__((packed));
+
+struct inv_fifo_pressure_packet {
+    unsigned short header;
+    unsigned short reserved;
+    short data_hi;
+    unsigned short data_lo;
+    int64_t timestamp;
+} __attribute__((packed));
+
+struct inv_fifo_packet {
+    const struct inv_fifo_desc *desc;
+    unsigned short flags;       /* DATA_FORMAT_STEP and/or DATA_FORMAT_MARKER
+                                   tagged along a payload header */
+    const char *raw;
+};
+
+static inline const struct inv_fifo_ts_packet *
+inv_fifo_ts(const struct inv_fifo_packet *p)
+{
+    return (const struct inv_fifo_ts_packet *)p->raw;
+}
+
+static inline const struct inv_fifo_s16_packet *
+inv_fifo_s16(const struct inv_fifo_packet *p)
+{
+    return (const struct inv_fifo_s16_packet *)p->raw;
+}
+
+static inline const struct inv_fifo_s32_packet *
+inv_fifo_s32(const struct inv_fifo_packet *p)
+{
+    return (const struct inv_fifo_s32_packet *)p->raw;
+}
+
+static inline const struct inv_fifo_pressure_packet *
+inv_fifo_pressure(const struct inv_fifo_packet *p)
+{
+    return (const struct inv_fifo_pressure_packet *)p->raw;
+}
+
+static inline long inv_fifo_pressure_value(const struct inv_fifo_packet *p)
+{
+    return ((long)inv_fifo_pressure(p)->data_hi << 16) +
+            inv_fifo_pressure(p)->data_lo;
+}
+
+static inline unsigned short inv_fifo_header(const char *buf)
+{
+    return ((const struct inv_fifo_ts_packet *)buf)->header;
+}
+
+/* one descriptor per INV_FIFO_TARGET_xxx, in that order */
+extern const struct inv_fifo_desc inv_fifo_desc_table[];
+
+#define INV_FIFO_DESC(target) (&inv_fifo_desc_table[(target) - 1])
+
+/* Descriptor for a header, NULL when the header is not valid. A switch
+   rather than an index table: the packet size then follows from a
+   predicted branch instead of a chain of dependent loads, which is what
+   bounds the parse loop. */
+static inline const struct inv_fifo_desc *
+inv_fifo_lookup(unsigned short header, unsigned short *flags)
+{
+    const struct inv_fifo_desc *desc;
+    unsigned short tag = 0;
+
+    /* the step bit tags along any other header */
+    if (header != DATA_FORMAT_STEP) {
+        tag = header & DATA_FORMAT_STEP;
+        header &= ~DATA_FORMAT_STEP;
+    }
+    /* so can the marker bit on data packets */
+    if (header & 0xff00) {
+        tag |= header & DATA_FORMAT_MARKER;
+        header &= ~DATA_FORMAT_MARKER;
+    }
+
+    switch (header) {
+    case DATA_FORMAT_STEP:
+        desc = INV_FIFO_DESC(INV_FIFO_TARGET_STEP);
+        break;
+    case DATA_FORMAT_MARKER:
+        desc = INV_FIFO_DESC(INV_FIFO_TARGET_MARKER);
+        break;
+    case DATA_FORMAT_EMPTY_MARKER:
+        desc = INV_FIFO_DESC(INV_FIFO_TARGET_EMPTY_MARKER);
+        break;
+    case DATA_FORMAT_PED_STANDALONE:
+        desc = INV_FIFO_DESC(INV_FIFO_TARGET_PED_STANDALONE);
+        break;
+    case DATA_FORMAT_PED_QUAT:
+        desc = INV_FIFO_DESC(INV_FIFO_TARGET_PED_QUAT);
+        break;
+    case DATA_FORMAT_6_AXIS:
+        desc = INV_FIFO_DESC(INV_FIFO_TARGET_6_AXIS);
+        break;
+    case DATA_FORMAT_QUAT:
+        desc = INV_FIFO_DESC(INV_FIFO_TARGET_QUAT);
+        break;
+    case DATA_FORMAT_COMPASS:
+        desc = INV_FIFO_DESC(INV_FIFO_TARGET_COMPASS);
+        break;
+    case DATA_FORMAT_COMPASS_OF:
+        desc = INV_FIFO_DESC(INV_FIFO_TARGET_COMPASS_OF);
+        break;
+    case DATA_FORMAT_GYRO:
+        desc = INV_FIFO_DESC(INV_FIFO_TARGET_GYRO);
+        break;
+    case DATA_FORMAT_ACCEL:
+        desc = INV_FIFO_DESC(INV_FIFO_TARGET_ACCEL);
+        break;
+    case DATA_FORMAT_PRESSURE:
+        desc = INV_FIFO_DESC(INV_FIFO_TARGET_PRESSURE);
+        break;
+    default:
+        return NULL;
+    }
+
+    if (flags)
+        *flags = tag;
+    return desc;
+}
+
+/* Decode the packet at the start of buf.
+   Returns the packet size when complete, 0 when buf only holds part
+   of a valid packet (pkt is still filled in) and -1 for a bad header. */
+static inline ssize_t inv_fifo_decode(const char *buf, size_t len,
+                                      struct inv_fifo_packet *pkt)
+{
+    const struct inv_fifo_desc *desc;
+
+    pkt->desc = NULL;
+    pkt->flags = 0;
+    pkt->raw = buf;
+
+    if (len < sizeof(unsigned short))
+        return 0;
+
+    desc = inv_fifo_lookup(inv_fifo_header(buf), &pkt->flags);
+    if (desc == NULL)
+        return -1;
+
+    pkt->desc = desc;
+    if (len < desc->size)
+        return 0;
+    return desc->size;
+}
+
+#endif  // ANDROID_FIFO_PACKET_DECODER_H
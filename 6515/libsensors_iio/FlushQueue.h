@@ -0,0 +1,58 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef ANDROID_FLUSH_QUEUE_H
+#define ANDROID_FLUSH_QUEUE_H
+
+#include <stdint.h>
+
+/*
+ * Sensor handles waiting for a flush complete event.
+ *
+ * Bounded queue, any thread may push() and a single thread pop()s.
+ * Neither side takes a lock or allocates: each slot carries a sequence
+ * number telling whether it is free for the producer that claimed its
+ * position or filled for the consumer.
+ */
+class FlushQueue {
+public:
+    enum {
+        /* power of 2, room for every sensor handle several times over */
+        CAPACITY = 64,
+    };
+
+    FlushQueue();
+
+    /* false if the queue is full */
+    bool push(int handle);
+
+    /* consumer only */
+    bool pop(int *handle);
+    bool empty() const;
+
+private:
+    struct Slot {
+        uint32_t seq;
+        int handle;
+    };
+
+    Slot mSlots[CAPACITY];
+    uint32_t mHead;
+    char mPad[64 - sizeof(uint32_t)];
+    uint32_t mTail;
+};
+
+#endif  // ANDROID_FLUSH_QUEUE_H
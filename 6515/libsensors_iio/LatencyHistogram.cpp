@@ -0,0 +1,85 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "SensorBase.h"
+#include "LatencyHistogram.h"
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+void LatencyHistogram::reset()
+{
+    memset(mBuckets, 0, sizeof(mBuckets));
+    mCount = 0;
+    mTotal = 0;
+    mMax = 0;
+}
+
+void LatencyHistogram::add(int64_t ns)
+{
+    uint64_t us;
+    int bucket;
+
+    /* sample and host clocks disagree, nothing to learn from it */
+    if (ns < 0)
+        return;
+
+    us = ns / 1000;
+    bucket = us ? 64 - __builtin_clzll(us) : 0;
+    if (bucket >= NUM_BUCKETS)
+        bucket = NUM_BUCKETS - 1;
+    mBuckets[bucket]++;
+    mCount++;
+    mTotal += ns;
+    if (ns > mMax)
+        mMax = ns;
+}
+
+int64_t LatencyHistogram::percentile(int pct) const
+{
+    uint64_t want = ((uint64_t)mCount * pct + 99) / 100;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        seen += mBuckets[i];
+        if (seen >= want && seen)
+            return (int64_t)1 << i;
+    }
+    return (int64_t)1 << (NUM_BUCKETS - 1);
+}
+
+void LatencyHistogram::dump(const char *name) const
+{
+    char buckets[NUM_BUCKETS * 11 + 1];
+    int len = 0;
+
+    if (!mCount)
+        return;
+
+    for (int i = 0; i < NUM_BUCKETS; i++)
+        len += snprintf(buckets + len, sizeof(buckets) - len, " %u",
+                        mBuckets[i]);
+    LOGI("HAL DEBUG:latency %-10s n=%u avg=%lldus p50<%lldus p99<%lldus "
+         "max=%lldus |%s",
+         name, mCount, mTotal / mCount / 1000, percentile(50),
+         percentile(99), mMax / 1000, buckets);
+}
@@ -0,0 +1,49 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef ANDROID_LATENCY_HISTOGRAM_H
+#define ANDROID_LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * Fixed bucket latency histogram. Bucket 0 counts samples under 1us and
+ * bucket i samples in [2^(i-1), 2^i) us, the last bucket takes the rest.
+ * Nothing is allocated or locked, a dump racing with add() may be off
+ * by a sample.
+ */
+class LatencyHistogram {
+public:
+    enum {
+        NUM_BUCKETS = 16,
+    };
+
+    LatencyHistogram();
+
+    void add(int64_t ns);
+    void reset();
+    /* upper bound of the bucket holding the given percentile, in us */
+    int64_t percentile(int pct) const;
+    void dump(const char *name) const;
+
+private:
+    uint32_t mBuckets[NUM_BUCKETS];
+    uint32_t mCount;
+    int64_t mTotal;
+    int64_t mMax;
+};
+
+#endif  // ANDROID_LATENCY_HISTOGRAM_H
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <sys/select.h>
 #include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <dlfcn.h>
 #include <pthread.h>
 #include <cutils/atomic.h>
@@ -38,6 +39,7 @@
 #include <string.h>
 #include <linux/input.h>
 #include <utils/SystemClock.h>
+#include <cutils/properties.h>
 
 #include "MPLSensor.h"
 #include "PressureSensor.IIO.secondary.h"
@@ -50,6 +52,10 @@
 #include "ml_load_dmp.h"
 #include "ml_sysfs_helper.h"
 
+/* not in the prebuilt libmllite.so, only in one built from these sources */
+extern "C" void inv_set_fast_trig(int enable) __attribute__((weak));
+extern "C" int inv_get_fast_trig(void) __attribute__((weak));
+
 #define ENABLE_MULTI_RATE
 // #define TESTING
 #define USE_LPQ_AT_FASTEST
@@ -71,6 +77,9 @@
 // This allows 100mS for events to propogate
 #define MIN_TRIGGER_TIME_AFTER_VIBRATOR_NS 100000000
 
+/* gyro temperature is sent to MPL every 0.5 seconds */
+#define TEMP_READ_PERIOD_NS 500000000LL
+
 
 /******************************************************************************/
 /*  MPL Interface                                                             */
@@ -87,6 +96,35 @@ static FILE *logfile = NULL;
 
 static int64_t mt_pre_ns;
 
+/* fires delay ns from now then every interval ns if not 0,
+   a delay of 0 disarms it */
+static int armTimerFd(int fd, int64_t delay, int64_t interval = 0)
+{
+    struct itimerspec spec;
+
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = delay / 1000000000LL;
+    spec.it_value.tv_nsec = delay % 1000000000LL;
+    spec.it_interval.tv_sec = interval / 1000000000LL;
+    spec.it_interval.tv_nsec = interval % 1000000000LL;
+    return timerfd_settime(fd, 0, &spec, NULL);
+}
+
+/* a longer suspend than this is taken as a possible chip reset */
+#define SUSPEND_RESET_MIN_NS 10000000LL
+
+/* time spent suspended since boot: CLOCK_BOOTTIME keeps counting while
+   the system sleeps, CLOCK_MONOTONIC does not */
+static int64_t getSuspendTime(void)
+{
+    struct timespec mono, boot;
+
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_BOOTTIME, &boot);
+    return (int64_t)(boot.tv_sec - mono.tv_sec) * 1000000000LL +
+           (boot.tv_nsec - mono.tv_nsec);
+}
+
 // following extended initializer list would only be available with -std=c++11
 //  or -std=gnu+11
 MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *))
@@ -106,6 +144,8 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
                          dmp_pedometer_fd(-1),
                          mDmpPedometerEnabled(0),
                          mDmpStepCountEnabled(0),
+                         mStepCountTimerFd(-1),
+                         mStepCountTimerArmed(false),
                          mEnabled(0),
                          mEnabledCached(0),
                          mBatchEnabled(0),
@@ -115,6 +155,8 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
                          mTempScale(0),
                          mTempOffset(0),
                          mTempCurrentTime(0),
+                         mTempTimerFd(-1),
+                         mTempPending(false),
                          mAccelScale(2),
                          mAccelSelfTestScale(2),
                          mGyroScale(2000),
@@ -151,6 +193,11 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
                          mStepSensorTimestamp(0),
                          mLastStepCount(-1),
                          mLeftOverBufferSize(0),
+                         mIIOReadOffset(0),
+                         mIIOReadSize(0),
+                         mIIOReadCount(0),
+                         mIIOPacketCount(0),
+                         mPollCount(0),
                          mInitial6QuatValueAvailable(0),
                          mSkipReadEvents(0),
                          mSkipExecuteOnData(0),
@@ -173,17 +220,45 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
 
     pthread_mutex_init(&mMplMutex, NULL);
     pthread_mutex_init(&mHALMutex, NULL);
+    mReconfigDepth = 0;
+    mReconfigApplying = false;
+    mChipIdle = true;
+    mSuspendTime = getSuspendTime();
+    mReconfigCount = 0;
+    mMasterEnableCalls = 0;
+    mMasterEnableWrites = 0;
+    mReconfigMaxTime = 0;
+    memset(mActivationStart, 0, sizeof(mActivationStart));
+    memset(mActivationLatency, 0, sizeof(mActivationLatency));
+    memset(mActivationMaxLatency, 0, sizeof(mActivationMaxLatency));
+    mLatencyWakeup = 0;
+    mDumpCheckTime = 0;
+    {
+        char value[PROPERTY_VALUE_MAX];
+        property_get("invn.hal.debug.dump", value, "0");
+        mDumpRequest = atoi(value);
+    }
     mFlushBatchSet = 0;
+    mFlushCompleteHandle = -1;
+    mFlushCompleteCount = 0;
     memset(mGyroOrientation, 0, sizeof(mGyroOrientation));
     memset(mAccelOrientation, 0, sizeof(mAccelOrientation));
     memset(mInitial6QuatValue, 0, sizeof(mInitial6QuatValue));
-    mFlushSensorEnabledVector.setCapacity(NumSensors);
     memset(mEnabledTime, 0, sizeof(mEnabledTime));
     memset(mLastTimestamp, 0, sizeof(mLastTimestamp));
 
     /* setup sysfs paths */
     inv_init_sysfs_attributes();
 
+    /* attributes the driver acts on every time they are written */
+    mSysfs.setFlags(mpu.master_enable, SysfsAttrCache::FLAG_VOLATILE);
+    mSysfs.setFlags(mpu.firmware_loaded, SysfsAttrCache::FLAG_VOLATILE);
+    mSysfs.setFlags(mpu.dmp_on, SysfsAttrCache::FLAG_VOLATILE);
+    /* one shot, cleared by the driver when it fires */
+    mSysfs.setFlags(mpu.smd_enable, SysfsAttrCache::FLAG_VOLATILE);
+    mSysfs.setFlags(mpu.flush_batch, SysfsAttrCache::FLAG_VOLATILE);
+    mSysfs.setFlags(mpu.chip_enable, SysfsAttrCache::FLAG_VOLATILE);
+
     /* get chip name */
     if (inv_get_chip_name(chip_ID) != INV_SUCCESS) {
         LOGE("HAL:ERR- Failed to get chip ID\n");
@@ -212,6 +287,10 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
     } else {
         LOGV_IF(EXTRA_VERBOSE,
                 "HAL:temperature_fd opened: %s", mpu.temperature);
+        mTempTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (mTempTimerFd < 0) {
+            LOGE("HAL:ERR couldn't create temperature timer");
+        }
     }
 
     /* read gyro FSR to calculate accel scale later */
@@ -382,13 +461,13 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
     int motionThreshold = 3000;
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 motionThreshold, mpu.smd_threshold, getTimestamp());
-        res = write_sysfs_int(mpu.smd_threshold, motionThreshold);
+        res = mSysfs.write(mpu.smd_threshold, motionThreshold);
 
 #if 0
     int StepCounterThreshold = 5;
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 StepCounterThreshold, mpu.pedometer_step_thresh, getTimestamp());
-        res = write_sysfs_int(mpu.pedometer_step_thresh, StepCounterThreshold);
+        res = mSysfs.write(mpu.pedometer_step_thresh, StepCounterThreshold);
 #endif
 
     dmp_pedometer_fd = open(mpu.event_pedometer, O_RDONLY | O_NONBLOCK);
@@ -399,6 +478,11 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
                 "HAL:dmp_pedometer_fd opened : %d", dmp_pedometer_fd);
     }
 
+    mStepCountTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (mStepCountTimerFd < 0) {
+        LOGE("HAL:ERR couldn't create step count timer, polling instead");
+    }
+
     initBias();
 
     (void)inv_get_version(&ver_str);
@@ -608,6 +692,9 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
         openDmpOrientFd();
         enableDmpOrientation(!isDmpScreenAutoRotationEnabled());
     }
+
+    /* chip may stay off, write out what was queued */
+    mSysfs.commit();
 }
 
 void MPLSensor::enable_iio_sysfs(void)
@@ -650,17 +737,11 @@ void MPLSensor::enable_iio_sysfs(void)
 
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             1, mpu.chip_enable, getTimestamp());
-    tempFp = fopen(mpu.chip_enable, "w");
-    if (tempFp == NULL) {
-        LOGE("HAL:could not open chip enable");
-    } else {
-        if (fprintf(tempFp, "%d", 1) < 0) {
-            LOGE("HAL:could not write chip enable");
-        }
-        if (fclose(tempFp) < 0) {
-            LOGE("HAL:could not close chip enable");
-        }
+    if (mSysfs.write(mpu.chip_enable, 1) < 0) {
+        LOGE("HAL:could not write chip enable");
     }
+    /* the chip comes up with the driver defaults */
+    mSysfs.invalidate();
 
     inv_get_iio_device_node(iio_device_node);
     iio_fd = open(iio_device_node, O_RDONLY);
@@ -739,6 +820,14 @@ ANY VIOLATION OF SUCH TERMS AND CONDITIONS WILL BE STRICTLY ENFORCED.
         return result;
     }
 
+    if (inv_set_fast_trig && inv_get_fast_trig) {
+        char value[PROPERTY_VALUE_MAX];
+        property_get("invn.hal.fast.trig", value, "0");
+        inv_set_fast_trig(atoi(value));
+        LOGV_IF(ENG_VERBOSE, "HAL:fast trig for orientation %s",
+                inv_get_fast_trig() ? "on" : "off");
+    }
+
     if (!mCompassSensor->providesCalibration()) {
         /* Invensense compass calibration */
         LOGV_IF(ENG_VERBOSE, "HAL:Invensense vector compass cal enabled");
@@ -863,6 +952,8 @@ void MPLSensor::loadDMP(void)
                 if (fclose(fptr) < 0) {
                     LOGE("HAL:could not close dmp firmware");
                 }
+                /* the driver resets its DMP state behind the cache */
+                mSysfs.invalidate();
             }
         } else {
             LOGV_IF(ENG_VERBOSE, "HAL:DMP is already loaded");
@@ -987,11 +1078,18 @@ MPLSensor::~MPLSensor()
         close(gyro_z_offset_fd);
     }
 
+    if (mStepCountTimerFd >= 0) {
+        close(mStepCountTimerFd);
+    }
+    if (mTempTimerFd >= 0) {
+        close(mTempTimerFd);
+    }
+
     /* Turn off Gyro master enable          */
     /* A workaround until driver handles it */
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             0, mpu.master_enable, getTimestamp());
-    write_sysfs_int(mpu.master_enable, 0);
+    mSysfs.write(mpu.master_enable, 0);
 
 #ifdef INV_PLAYBACK_DBG
     inv_turn_off_data_logging();
@@ -1055,18 +1153,18 @@ int MPLSensor::onDmp(int en)
 
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:cat %s (%lld)",
             mpu.firmware_loaded, getTimestamp());
-    if(read_sysfs_int(mpu.firmware_loaded, &status) < 0){
+    if(mSysfs.read(mpu.firmware_loaded, &status) < 0){
         LOGE("HAL:ERR can't get firmware_loaded status");
     } else if (status == 1) {
         //Write only if curr DMP state <> request
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:cat %s (%lld)",
                 mpu.dmp_on, getTimestamp());
-        if (read_sysfs_int(mpu.dmp_on, &status) < 0) {
+        if (mSysfs.read(mpu.dmp_on, &status) < 0) {
             LOGE("HAL:ERR can't read DMP state");
         } else if (status != en) {
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     en, mpu.dmp_on, getTimestamp());
-            if (write_sysfs_int(mpu.dmp_on, en) < 0) {
+            if (mSysfs.write(mpu.dmp_on, en) < 0) {
                 LOGE("HAL:ERR can't write dmp_on");
             } else {
                 mDmpOn = en;
@@ -1078,7 +1176,7 @@ int MPLSensor::onDmp(int en)
             //Enable DMP interrupt
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     en, mpu.dmp_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.dmp_int_on, en) < 0) {
+            if (mSysfs.write(mpu.dmp_int_on, en) < 0) {
                 LOGE("HAL:ERR can't en/dis DMP interrupt");
             }
 
@@ -1086,7 +1184,7 @@ int MPLSensor::onDmp(int en)
             if (!en) {
                 LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                         en, mpu.dmp_event_int_on, getTimestamp());
-                if (write_sysfs_int(mpu.dmp_event_int_on, en) < 0) {
+                if (mSysfs.write(mpu.dmp_event_int_on, en) < 0) {
                     res = -1;
                     LOGE("HAL:ERR can't enable DMP event interrupt");
                 }
@@ -1153,7 +1251,7 @@ int MPLSensor::setDmpFeature(int en)
     uint32_t dataInterrupt = (mEnabled || (mFeatureActiveMask & INV_DMP_BATCH_MODE));
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 !dataInterrupt, mpu.dmp_event_int_on, getTimestamp());
-    if (write_sysfs_int(mpu.dmp_event_int_on, !dataInterrupt) < 0) {
+    if (mSysfs.write(mpu.dmp_event_int_on, !dataInterrupt) < 0) {
         res = -1;
         LOGE("HAL:ERR can't enable DMP event interrupt");
     }
@@ -1200,7 +1298,7 @@ int MPLSensor::SetDmpState(bool dmpState)
         // set DMP rate to 200Hz
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 200, mpu.accel_fifo_rate, getTimestamp());
-        if (write_sysfs_int(mpu.accel_fifo_rate, 200) < 0) {
+        if (mSysfs.write(mpu.accel_fifo_rate, 200) < 0) {
             res = -1;
             LOGE("HAL:ERR can't set rate to 200Hz");
             return res;
@@ -1237,7 +1335,7 @@ int MPLSensor::enablePedIndicator(int en)
             //Disable DMP Pedometer Interrupt
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                         0, mpu.pedometer_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.pedometer_int_on, 0) < 0) {
+            if (mSysfs.write(mpu.pedometer_int_on, 0) < 0) {
                LOGE("HAL:ERR can't enable Android Pedometer Interrupt");
                res = -1;   // indicate an err
                return res;
@@ -1270,7 +1368,7 @@ int MPLSensor::enablePedIndicator(int en)
     LOGV_IF(ENG_VERBOSE, "HAL:Toggling step indicator to %d", en);
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 en, mpu.step_indicator_on, getTimestamp());
-    if (write_sysfs_int(mpu.step_indicator_on, en) < 0) {
+    if (mSysfs.write(mpu.step_indicator_on, en) < 0) {
         res = -1;
         LOGE("HAL:ERR can't write to DMP step_indicator_on");
     }
@@ -1313,7 +1411,7 @@ int MPLSensor::enablePedStandalone(int en)
              //Re-enable DMP Pedometer Interrupt
              LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                      1, mpu.pedometer_int_on, getTimestamp());
-             if (write_sysfs_int(mpu.pedometer_int_on, 1) < 0) {
+             if (mSysfs.write(mpu.pedometer_int_on, 1) < 0) {
                  LOGE("HAL:ERR can't enable Android Pedometer Interrupt");
                  return (-1);
              }
@@ -1321,7 +1419,7 @@ int MPLSensor::enablePedStandalone(int en)
             if (mEnabled == 0) {
                 LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                        1, mpu.dmp_event_int_on, getTimestamp());
-                if (write_sysfs_int(mpu.dmp_event_int_on, 1) < 0) {
+                if (mSysfs.write(mpu.dmp_event_int_on, 1) < 0) {
                     LOGE("HAL:ERR can't enable DMP event interrupt");
                     return (-1);
                 }
@@ -1336,14 +1434,14 @@ int MPLSensor::enablePedStandalone(int en)
             //Disable DMP Pedometer Interrupt
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     0, mpu.pedometer_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.pedometer_int_on, 0) < 0) {
+            if (mSysfs.write(mpu.pedometer_int_on, 0) < 0) {
                 LOGE("HAL:ERR can't disable Android Pedometer Interrupt");
                 return (-1);
             }
             //Enable Data Interrupt
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                        0, mpu.dmp_event_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.dmp_event_int_on, 0) < 0) {
+            if (mSysfs.write(mpu.dmp_event_int_on, 0) < 0) {
                 LOGE("HAL:ERR can't enable DMP event interrupt");
                 return (-1);
             }
@@ -1362,7 +1460,7 @@ int MPLSensor:: enablePedStandaloneData(int en)
     // Set DMP Ped standalone
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.step_detector_on, getTimestamp());
-    if (write_sysfs_int(mpu.step_detector_on, en) < 0) {
+    if (mSysfs.write(mpu.step_detector_on, en) < 0) {
         LOGE("HAL:ERR can't write DMP step_detector_on");
         res = -1;   //Indicate an err
     }
@@ -1370,7 +1468,7 @@ int MPLSensor:: enablePedStandaloneData(int en)
     // Set DMP Step indicator
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.step_indicator_on, getTimestamp());
-    if (write_sysfs_int(mpu.step_indicator_on, en) < 0) {
+    if (mSysfs.write(mpu.step_indicator_on, en) < 0) {
         LOGE("HAL:ERR can't write DMP step_indicator_on");
         res = -1;   //Indicate an err
     }
@@ -1431,7 +1529,7 @@ int MPLSensor::enablePedQuaternion(int en)
              //Re-enable DMP Pedometer Interrupt
              LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                      1, mpu.pedometer_int_on, getTimestamp());
-             if (write_sysfs_int(mpu.pedometer_int_on, 1) < 0) {
+             if (mSysfs.write(mpu.pedometer_int_on, 1) < 0) {
                  LOGE("HAL:ERR can't enable Android Pedometer Interrupt");
                  return (-1);
              }
@@ -1439,7 +1537,7 @@ int MPLSensor::enablePedQuaternion(int en)
             if (mEnabled == 0) {
                 LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                        1, mpu.dmp_event_int_on, getTimestamp());
-                if (write_sysfs_int(mpu.dmp_event_int_on, en) < 0) {
+                if (mSysfs.write(mpu.dmp_event_int_on, en) < 0) {
                     LOGE("HAL:ERR can't enable DMP event interrupt");
                     return (-1);
                 }
@@ -1454,14 +1552,14 @@ int MPLSensor::enablePedQuaternion(int en)
             //Disable DMP Pedometer Interrupt
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     0, mpu.pedometer_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.pedometer_int_on, 0) < 0) {
+            if (mSysfs.write(mpu.pedometer_int_on, 0) < 0) {
                 LOGE("HAL:ERR can't disable Android Pedometer Interrupt");
                 return (-1);
             }
             //Enable Data Interrupt
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                        0, mpu.dmp_event_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.dmp_event_int_on, 0) < 0) {
+            if (mSysfs.write(mpu.dmp_event_int_on, 0) < 0) {
                 LOGE("HAL:ERR can't enable DMP event interrupt");
                 return (-1);
             }
@@ -1480,7 +1578,7 @@ int MPLSensor::enablePedQuaternionData(int en)
     // Enable DMP quaternion
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.ped_q_on, getTimestamp());
-    if (write_sysfs_int(mpu.ped_q_on, en) < 0) {
+    if (mSysfs.write(mpu.ped_q_on, en) < 0) {
         LOGE("HAL:ERR can't write DMP ped_q_on");
         res = -1;   //Indicate an err
     }
@@ -1503,8 +1601,8 @@ int MPLSensor::enablePedQuaternionData(int en)
                 return res;
         }
         if (mFeatureActiveMask & INV_DMP_QUATERNION) {
-            res = write_sysfs_int(mpu.gyro_fifo_enable, 1);
-            res += write_sysfs_int(mpu.accel_fifo_enable, 1);
+            res = mSysfs.write(mpu.gyro_fifo_enable, 1);
+            res += mSysfs.write(mpu.accel_fifo_enable, 1);
             if (res < 0)
                 return res;
         }
@@ -1562,7 +1660,7 @@ int MPLSensor::setPedQuaternionRate(int64_t wanted)
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 int(1000000000.f / wanted), mpu.ped_q_rate,
                 getTimestamp());
-    res = write_sysfs_int(mpu.ped_q_rate, 1000000000.f / wanted);
+    res = mSysfs.write(mpu.ped_q_rate, 1000000000.f / wanted);
     LOGV_IF(PROCESS_VERBOSE,
                 "HAL:DMP ped quaternion rate %.2f Hz", 1000000000.f / wanted);
 
@@ -1608,7 +1706,7 @@ int MPLSensor::enable6AxisQuaternionData(int en)
     // Enable DMP quaternion
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.six_axis_q_on, getTimestamp());
-    if (write_sysfs_int(mpu.six_axis_q_on, en) < 0) {
+    if (mSysfs.write(mpu.six_axis_q_on, en) < 0) {
         LOGE("HAL:ERR can't write DMP six_axis_q_on");
         res = -1;   //Indicate an err
     }
@@ -1633,10 +1731,10 @@ int MPLSensor::enable6AxisQuaternionData(int en)
         if (mFeatureActiveMask & INV_DMP_QUATERNION) {
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     1, mpu.gyro_fifo_enable, getTimestamp());
-            res = write_sysfs_int(mpu.gyro_fifo_enable, 1);
+            res = mSysfs.write(mpu.gyro_fifo_enable, 1);
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     1, mpu.accel_fifo_enable, getTimestamp());
-            res += write_sysfs_int(mpu.accel_fifo_enable, 1);
+            res += mSysfs.write(mpu.accel_fifo_enable, 1);
             if (res < 0)
                 return res;
         }
@@ -1646,8 +1744,8 @@ int MPLSensor::enable6AxisQuaternionData(int en)
             if (!(mFeatureActiveMask & INV_DMP_PED_QUATERNION)) {
                 mLocalSensorMask |= INV_THREE_AXIS_GYRO;
                 mLocalSensorMask |= INV_THREE_AXIS_ACCEL;
-                res = write_sysfs_int(mpu.gyro_fifo_enable, 1);
-                res += write_sysfs_int(mpu.accel_fifo_enable, 1);
+                res = mSysfs.write(mpu.gyro_fifo_enable, 1);
+                res += mSysfs.write(mpu.accel_fifo_enable, 1);
                 if (res < 0)
                     return res;
             }
@@ -1706,7 +1804,7 @@ int MPLSensor::set6AxisQuaternionRate(int64_t wanted)
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 int(1000000000.f / wanted), mpu.six_axis_q_rate,
                 getTimestamp());
-    res = write_sysfs_int(mpu.six_axis_q_rate, 1000000000.f / wanted);
+    res = mSysfs.write(mpu.six_axis_q_rate, 1000000000.f / wanted);
     LOGV_IF(PROCESS_VERBOSE,
                 "HAL:DMP six axis rate %.2f Hz", 1000000000.f / wanted);
 
@@ -1761,7 +1859,7 @@ int MPLSensor::enableQuaternionData(int en)
     // Enable DMP quaternion
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.three_axis_q_on, getTimestamp());
-    if (write_sysfs_int(mpu.three_axis_q_on, en) < 0) {
+    if (mSysfs.write(mpu.three_axis_q_on, en) < 0) {
         LOGE("HAL:ERR can't write DMP three_axis_q__on");
         res = -1;   //Indicates an err
     }
@@ -1784,7 +1882,7 @@ int MPLSensor::setQuaternionRate(int64_t wanted)
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             int(1000000000.f / wanted), mpu.three_axis_q_rate,
             getTimestamp());
-    res = write_sysfs_int(mpu.three_axis_q_rate, 1000000000.f / wanted);
+    res = mSysfs.write(mpu.three_axis_q_rate, 1000000000.f / wanted);
     LOGV_IF(PROCESS_VERBOSE,
             "HAL:DMP three axis rate %.2f Hz", 1000000000.f / wanted);
 
@@ -1810,18 +1908,19 @@ int MPLSensor::enableDmpPedometer(int en, int interruptMode)
         //Enable DMP Pedometer Function
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 en, mpu.pedometer_on, getTimestamp());
-        if (write_sysfs_int(mpu.pedometer_on, en) < 0) {
+        if (mSysfs.write(mpu.pedometer_on, en) < 0) {
             LOGE("HAL:ERR can't enable Android Pedometer");
             res = -1;   // indicate an err
             return res;
         }
 
-        if (interruptMode) {
+        /* step counter reads the count when a step interrupt comes in */
+        if (interruptMode || isStepCountEventDriven()) {
             if(!checkPedStandaloneBatched()) {
                 //Enable DMP Pedometer Interrupt
                 LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                         en, mpu.pedometer_int_on, getTimestamp());
-                if (write_sysfs_int(mpu.pedometer_int_on, en) < 0) {
+                if (mSysfs.write(mpu.pedometer_int_on, en) < 0) {
                     LOGE("HAL:ERR can't enable Android Pedometer Interrupt");
                     res = -1;   // indicate an err
                     return res;
@@ -1850,18 +1949,20 @@ int MPLSensor::enableDmpPedometer(int en, int interruptMode)
         if (!(mFeatureActiveMask & (INV_DMP_PEDOMETER | INV_DMP_PEDOMETER_STEP))) {
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     en, mpu.pedometer_on, getTimestamp());
-            if (write_sysfs_int(mpu.pedometer_on, en) < 0) {
+            if (mSysfs.write(mpu.pedometer_on, en) < 0) {
                 LOGE("HAL:ERR can't enable Android Pedometer");
                 res = -1;
                 return res;
             }
         }
 
-        /* if feature is not step detector */
-        if (!(mFeatureActiveMask & INV_DMP_PEDOMETER)) {
+        /* if feature is not step detector nor event driven step counter */
+        if (!(mFeatureActiveMask & INV_DMP_PEDOMETER) &&
+                !((mFeatureActiveMask & INV_DMP_PEDOMETER_STEP) &&
+                  isStepCountEventDriven())) {
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     en, mpu.pedometer_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.pedometer_int_on, en) < 0) {
+            if (mSysfs.write(mpu.pedometer_int_on, en) < 0) {
                 LOGE("HAL:ERR can't enable Android Pedometer Interrupt");
                 res = -1;
                 return res;
@@ -1888,10 +1989,145 @@ int MPLSensor::masterEnable(int en)
 {
     VFUNC_LOG;
 
+    mMasterEnableCalls++;
+    if (inReconfig()) {
+        /* the chip goes off once for the whole reconfiguration and
+           endReconfig() turns it back on if it was asked to */
+        mReconfigMasterTouched = true;
+        mReconfigMasterOn = !!en;
+        if (en || mReconfigMasterOff)
+            return 0;
+        mReconfigMasterOff = true;
+    }
+    return writeMasterEnable(en);
+}
+
+/*
+ * enable(), setDelay() and batch() each turn the chip off and on several
+ * times, once per helper they call (enableSensors(), setBatch(),
+ * update_delay(), enableDmpPedometer() ...). Between beginReconfig() and
+ * endReconfig() only the first masterEnable(0) reaches the driver, the
+ * FIFO rates are computed once at the end and the chip is turned back on
+ * once with the final configuration.
+ *
+ * Deferring masterEnable(1) is safe for every helper called inside the
+ * window: enableDmpPedometer(), enableSensors(), setBatch(),
+ * update_delay(), enableDmpOrientation(), enableDmpSignificantMotion()
+ * and writeSignificantMotionParams() all turn the chip back on as their
+ * last step, only to hand it back running, and nothing they do in between
+ * reads the FIFO or waits for the chip. batch() turns it back on right
+ * before its own endReconfig().
+ *
+ * enable(), setDelay() and batch() are serialized by the framework, so
+ * one thread owns the window. Only that thread is coalesced; the poll thread
+ * (e.g. readDmpSignificantMotionEvents() disarming the one-shot SMD)
+ * still talks to the driver directly.
+ */
+bool MPLSensor::inReconfig() const
+{
+    return mReconfigDepth && pthread_equal(mReconfigThread, pthread_self());
+}
+
+void MPLSensor::beginReconfig()
+{
+    if (mReconfigDepth++)
+        return;
+    mReconfigThread = pthread_self();
+    mReconfigMasterTouched = false;
+    mReconfigMasterOff = false;
+    mReconfigMasterOn = false;
+    mReconfigDelayDirty = false;
+    mReconfigStart = getTimestamp();
+}
+
+int MPLSensor::endReconfig()
+{
+    int res = 0, err;
+    int64_t elapsed;
+
+    if (--mReconfigDepth)
+        return 0;
+
+    if (mReconfigDelayDirty) {
+        /* still inside the window, update_delay() leaves the chip off */
+        mReconfigDepth = 1;
+        mReconfigApplying = true;
+        res = update_delay();
+        mReconfigApplying = false;
+        mReconfigDelayDirty = false;
+        mReconfigDepth = 0;
+    }
+    if (mReconfigMasterTouched && mReconfigMasterOn) {
+        err = writeMasterEnable(1);
+        if (err < 0)
+            res = err;
+    } else if (mReconfigMasterTouched) {
+        /* nothing left enabled, the driver powers the chip down */
+        mChipIdle = true;
+    }
+
+    if (mReconfigMasterOff) {
+        elapsed = getTimestamp() - mReconfigStart;
+        mReconfigCount++;
+        if (elapsed > mReconfigMaxTime)
+            mReconfigMaxTime = elapsed;
+        LOGV_IF(ENG_VERBOSE, "HAL:reconfig chip off for %lld ns", elapsed);
+    }
+    if (res < 0)
+        LOGE("HAL:ERR reconfiguration failed (%d)", res);
+    return res;
+}
+
+/* first event delivered since the sensor was enabled */
+void MPLSensor::recordActivation(int what)
+{
+    int64_t latency = getTimestamp() - mActivationStart[what];
+
+    mActivationStart[what] = 0;
+    mActivationLatency[what] = latency;
+    if (latency > mActivationMaxLatency[what])
+        mActivationMaxLatency[what] = latency;
+    LOGV_IF(PROCESS_VERBOSE, "HAL:sensor %d first event %lld ns after enable",
+            what, latency);
+}
+
+int MPLSensor::writeMasterEnable(int en)
+{
     int res = 0;
+    mMasterEnableWrites++;
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.master_enable, getTimestamp());
-    res = write_sysfs_int(mpu.master_enable, en);
+    /* the driver only latches the configuration while the chip is off,
+       queue it and write it out right before turning the chip back on */
+    if (en) {
+        SysfsAttrCache::Failure failed[SysfsAttrCache::MAX_PENDING];
+        int numFailed;
+        int64_t suspendTime = getSuspendTime();
+
+        /* the driver may have reset the chip while it was left off or
+           the system was suspended, don't skip writes that match what
+           was written before */
+        if (mChipIdle || suspendTime - mSuspendTime > SUSPEND_RESET_MIN_NS) {
+            LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:chip may have been reset");
+            mSysfs.invalidate();
+            mSuspendTime = suspendTime;
+        }
+        mChipIdle = false;
+
+        res = mSysfs.commit(failed, &numFailed);
+        for (int i = 0; i < numFailed; i++) {
+            LOGE("HAL:ERR can't write %lld to %s (%d)",
+                 failed[i].value, failed[i].path, failed[i].err);
+        }
+        /* same as the helper that queued it failing: the chip stays off */
+        if (res < 0) {
+            mSysfs.begin();
+            return res;
+        }
+    }
+    res = mSysfs.write(mpu.master_enable, en);
+    if (!en)
+        mSysfs.begin();
     return res;
 }
 
@@ -1904,16 +2140,24 @@ int MPLSensor::enableGyro(int en)
     /* need to also turn on/off the master enable */
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.gyro_enable, getTimestamp());
-    res = write_sysfs_int(mpu.gyro_enable, en);
+    res = mSysfs.write(mpu.gyro_enable, en);
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.gyro_fifo_enable, getTimestamp());
-    res += write_sysfs_int(mpu.gyro_fifo_enable, en);
+    res += mSysfs.write(mpu.gyro_fifo_enable, en);
 
     if (!en) {
         LOGV_IF(EXTRA_VERBOSE, "HAL:MPL:inv_gyro_was_turned_off");
         inv_gyro_was_turned_off();
     }
 
+    /* the poll loop reads the temperature while the gyro runs */
+    if (mTempTimerFd >= 0) {
+        int64_t period = en ? TEMP_READ_PERIOD_NS : 0;
+        if (armTimerFd(mTempTimerFd, period, period) < 0) {
+            LOGE("HAL:ERR couldn't arm temperature timer");
+        }
+    }
+
     return res;
 }
 
@@ -1924,7 +2168,7 @@ int MPLSensor::enableLowPowerAccel(int en)
     int res;
 
     /* need to also turn on/off the master enable */
-    res = write_sysfs_int(mpu.motion_lpa_on, en);
+    res = mSysfs.write(mpu.motion_lpa_on, en);
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                         en, mpu.motion_lpa_on, getTimestamp());
     return res;
@@ -1939,10 +2183,10 @@ int MPLSensor::enableAccel(int en)
     /* need to also turn on/off the master enable */
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.accel_enable, getTimestamp());
-    res = write_sysfs_int(mpu.accel_enable, en);
+    res = mSysfs.write(mpu.accel_enable, en);
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.accel_fifo_enable, getTimestamp());
-    res += write_sysfs_int(mpu.accel_fifo_enable, en);
+    res += mSysfs.write(mpu.accel_fifo_enable, en);
 
     if (!en) {
         LOGV_IF(EXTRA_VERBOSE, "HAL:MPL:inv_accel_was_turned_off");
@@ -1963,6 +2207,9 @@ int MPLSensor::enableCompass(int en, int rawSensorRequested)
     } else {
         res = mCompassSensor->enable(ID_M, en);
     }
+    /* samples from before the switch are stale */
+    mCompassMerger.reset(MergeCompass);
+    mCompassMerger.setActive(MergeCompass, en && !res);
     if (en == 0 || res != 0) {
         LOGV_IF(EXTRA_VERBOSE, "HAL:MPL:inv_compass_was_turned_off %d", res);
         inv_compass_was_turned_off();
@@ -1992,12 +2239,12 @@ int MPLSensor::enableBatch(int64_t timeout)
 
     int res = 0;
 
-    res = write_sysfs_int(mpu.batchmode_timeout, timeout);
+    res = mSysfs.write(mpu.batchmode_timeout, timeout);
     if (timeout == 0) {
-        res = write_sysfs_int(mpu.six_axis_q_on, 0);
-        res = write_sysfs_int(mpu.ped_q_on, 0);
-        res = write_sysfs_int(mpu.step_detector_on, 0);
-        res = write_sysfs_int(mpu.step_indicator_on, 0);
+        res = mSysfs.write(mpu.six_axis_q_on, 0);
+        res = mSysfs.write(mpu.ped_q_on, 0);
+        res = mSysfs.write(mpu.step_detector_on, 0);
+        res = mSysfs.write(mpu.step_indicator_on, 0);
     }
 
     if (timeout == 0) {
@@ -2276,7 +2523,7 @@ int MPLSensor::enableSensors(unsigned long sensors, int en, uint32_t changed)
                 // disable DMP event interrupt only (w/ data interrupt)
                 LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                         0, mpu.dmp_event_int_on, getTimestamp());
-                if (write_sysfs_int(mpu.dmp_event_int_on, 0) < 0) {
+                if (mSysfs.write(mpu.dmp_event_int_on, 0) < 0) {
                     res = -1;
                     LOGE("HAL:ERR can't disable DMP event interrupt");
                     return res;
@@ -2500,7 +2747,7 @@ int MPLSensor::setBatch(int en, int toggleEnable)
         // default fifo rate to 200Hz
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 200, mpu.gyro_fifo_rate, getTimestamp());
-        if (write_sysfs_int(mpu.gyro_fifo_rate, 200) < 0) {
+        if (mSysfs.write(mpu.gyro_fifo_rate, 200) < 0) {
             res = -1;
             LOGE("HAL:ERR can't set rate to 200Hz");
             return res;
@@ -2523,7 +2770,7 @@ int MPLSensor::setBatch(int en, int toggleEnable)
     uint32_t dataInterrupt = (mEnabled || (mFeatureActiveMask & INV_DMP_BATCH_MODE));
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 !dataInterrupt, mpu.dmp_event_int_on, getTimestamp());
-    if (write_sysfs_int(mpu.dmp_event_int_on, !dataInterrupt) < 0) {
+    if (mSysfs.write(mpu.dmp_event_int_on, !dataInterrupt) < 0) {
         res = -1;
         LOGE("HAL:ERR can't enable DMP event interrupt");
     }
@@ -2573,7 +2820,7 @@ int MPLSensor::writeBatchTimeout(int en, int64_t timeoutInMs)
         /* write required timeout to sysfs */
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %lld > %s (%lld)",
                 timeoutInMs, mpu.batchmode_timeout, getTimestamp());
-        if (write_sysfs_int(mpu.batchmode_timeout, timeoutInMs) < 0) {
+        if (mSysfs.write(mpu.batchmode_timeout, timeoutInMs) < 0) {
             LOGE("HAL:ERR can't write batchmode_timeout");
         }
     }
@@ -3033,8 +3280,8 @@ int MPLSensor::metaHandler(sensors_event_t* s, int flags)
         s->type = SENSOR_TYPE_META_DATA;
         s->version = META_DATA_VERSION;
         s->meta_data.what = flags;
-        s->meta_data.sensor = mFlushSensorEnabledVector[0];
-        mFlushSensorEnabledVector.removeAt(0);
+        /* callers check an event is owed first */
+        s->meta_data.sensor = mFlushCompleteHandle;
         LOGV_IF(HANDLER_DATA,
                 "HAL:flush complete data: type=%d what=%d, "
                 "sensor=%d - %lld - %d",
@@ -3054,6 +3301,12 @@ int MPLSensor::enable(int32_t handle, int en)
 {
     VFUNC_LOG;
 
+    SysfsAttrCache::Scope sysfsScope(mSysfs);
+    ReconfigScope reconfigScope(this);
+
+    if (uint32_t(handle) < NumSensors)
+        mActivationStart[handle] = en ? getTimestamp() : 0;
+
     android::String8 sname;
     int what = -1, err = 0;
     int batchMode = 0;
@@ -3083,6 +3336,13 @@ int MPLSensor::enable(int32_t handle, int en)
             mEnabledTime[StepCounter] = android::elapsedRealtimeNano();
         else
             mEnabledTime[StepCounter] = 0;
+        if (isStepCountEventDriven()) {
+            /* report the current count right away, then on steps only */
+            if (en)
+                armStepCountTimer(0);
+            else
+                disarmStepCountTimer();
+        }
 
         if (!en)
             mBatchDelays[what] = 1000000000LL;
@@ -3416,6 +3676,9 @@ int MPLSensor::setDelay(int32_t handle, int64_t ns)
 {
     VFUNC_LOG;
 
+    SysfsAttrCache::Scope sysfsScope(mSysfs);
+    ReconfigScope reconfigScope(this);
+
     android::String8 sname;
     int what = -1;
 
@@ -3547,6 +3810,12 @@ int MPLSensor::update_delay(void)
     int res = 0;
     int64_t got;
 
+    /* computed once with the final configuration in endReconfig() */
+    if (inReconfig() && !mReconfigApplying) {
+        mReconfigDelayDirty = true;
+        return 0;
+    }
+
     if (mEnabled) {
         int64_t wanted = 1000000000LL;
         int64_t wanted_3rd_party_sensor = 1000000000LL;
@@ -3591,7 +3860,6 @@ int MPLSensor::update_delay(void)
         wanted_3rd_party_sensor = wanted;
 
         int enabled_sensors = mEnabled;
-        int tempFd = -1;
 
         if(mFeatureActiveMask & INV_DMP_BATCH_MODE) {
             // set batch rates
@@ -3607,8 +3875,7 @@ int MPLSensor::update_delay(void)
             /* driver only looks at sampling frequency if DMP is off */
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
                     1000000000.f / tempWanted, mpu.gyro_fifo_rate, getTimestamp());
-            tempFd = open(mpu.gyro_fifo_rate, O_RDWR);
-            res = write_attribute_sensor(tempFd, 1000000000.f / tempWanted);
+            res = mSysfs.write(mpu.gyro_fifo_rate, 1000000000.f / tempWanted);
             LOGE_IF(res < 0, "HAL:sampling frequency update delay error");
 
         if (LA_ENABLED || GR_ENABLED || RV_ENABLED
@@ -3672,8 +3939,7 @@ int MPLSensor::update_delay(void)
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
                     1000000000.f / gyroRate, mpu.gyro_rate,
                     getTimestamp());
-            tempFd = open(mpu.gyro_rate, O_RDWR);
-            res = write_attribute_sensor(tempFd, 1000000000.f / gyroRate);
+            res = mSysfs.write(mpu.gyro_rate, 1000000000.f / gyroRate);
             if(res < 0) {
                 LOGE("HAL:GYRO update delay error");
             }
@@ -3684,8 +3950,7 @@ int MPLSensor::update_delay(void)
                 LOGV_IF(SYSFS_VERBOSE, "echo %lld > %s (%lld)",
                         wanted_3rd_party_sensor / 1000000L, mpu.accel_rate,
                         getTimestamp());
-                tempFd = open(mpu.accel_rate, O_RDWR);
-                res = write_attribute_sensor(tempFd,
+                res = mSysfs.write(mpu.accel_rate,
                         wanted_3rd_party_sensor / 1000000L);
                 LOGE_IF(res < 0, "HAL:ACCEL update delay error");
             } else {
@@ -3693,8 +3958,7 @@ int MPLSensor::update_delay(void)
                LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
                         1000000000.f / accelRate, mpu.accel_rate,
                         getTimestamp());
-                tempFd = open(mpu.accel_rate, O_RDWR);
-                res = write_attribute_sensor(tempFd, 1000000000.f / accelRate);
+                res = mSysfs.write(mpu.accel_rate, 1000000000.f / accelRate);
                 LOGE_IF(res < 0, "HAL:ACCEL update delay error");
             }
 
@@ -3735,8 +3999,7 @@ int MPLSensor::update_delay(void)
                     "HAL:MPL gyro sample rate: (mpl)=%d us", int(wanted/1000LL));
                 LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
                         1000000000.f / wanted, mpu.gyro_rate, getTimestamp());
-                tempFd = open(mpu.gyro_rate, O_RDWR);
-                res = write_attribute_sensor(tempFd, 1000000000.f / wanted);
+                res = mSysfs.write(mpu.gyro_rate, 1000000000.f / wanted);
                 LOGE_IF(res < 0, "HAL:GYRO update delay error");
             }
 
@@ -3756,14 +4019,13 @@ int MPLSensor::update_delay(void)
                 LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
                         1000000000.f / wanted, mpu.accel_rate,
                         getTimestamp());
-                tempFd = open(mpu.accel_rate, O_RDWR);
                 if(USE_THIRD_PARTY_ACCEL == 1) {
                     //BMA250 in ms
-                    res = write_attribute_sensor(tempFd, wanted / 1000000L);
+                    res = mSysfs.write(mpu.accel_rate, wanted / 1000000L);
                 }
                 else {
                     //MPUxxxx in hz
-                    res = write_attribute_sensor(tempFd, 1000000000.f/wanted);
+                    res = mSysfs.write(mpu.accel_rate, 1000000000.f/wanted);
                 }
                 LOGE_IF(res < 0, "HAL:ACCEL update delay error");
             }
@@ -3843,8 +4105,12 @@ int MPLSensor::readEvents(sensors_event_t* data, int count)
 {
     VHANDLER_LOG;
 
-    if (!mSkipExecuteOnData)
+    if (!mSkipExecuteOnData) {
+        int64_t executeStart = LATENCY_STATS ? android::elapsedRealtimeNano() : 0;
         inv_execute_on_data();
+        if (LATENCY_STATS)
+            mLatency[LAT_EXECUTE].add(android::elapsedRealtimeNano() - executeStart);
+    }
 
     int numEventReceived = 0;
     long msg;
@@ -3922,7 +4188,10 @@ int MPLSensor::readEvents(sensors_event_t* data, int count)
 
             // load up virtual sensors
             if (mEnabledCached & (1 << i)) {
+                int64_t handlerStart = LATENCY_STATS ? android::elapsedRealtimeNano() : 0;
                 update = CALL_MEMBER_FN(this, mHandlers[i])(mPendingEvents + i);
+                if (LATENCY_STATS)
+                    mHandlerLatency[i].add(android::elapsedRealtimeNano() - handlerStart);
                 mPendingMask |= (1 << i);
 
                 if (update && (count > 0)) {
@@ -3930,6 +4199,8 @@ int MPLSensor::readEvents(sensors_event_t* data, int count)
                     if (mLastTimestamp[i] != mPendingEvents[i].timestamp) {
                         mLastTimestamp[i] = mPendingEvents[i].timestamp;
                         *data++ = mPendingEvents[i];
+                        if (mActivationStart[i])
+                            recordActivation(i);
                         count--;
                         numEventReceived++;
                     } else {
@@ -3942,9 +4213,28 @@ int MPLSensor::readEvents(sensors_event_t* data, int count)
 
             // handle partial packet read and end marker
             // skip readEvents from hal_outputs
-            if (mFlushBatchSet && count>0 && !mFlushSensorEnabledVector.isEmpty()) {
-                while (mFlushBatchSet && count>0 && !mFlushSensorEnabledVector.isEmpty()) {
+            if (count > 0 && (mFlushCompleteCount ||
+                              (mFlushBatchSet && !mFlushTracker.empty()))) {
+                while (count > 0 && (mFlushCompleteCount ||
+                                     (mFlushBatchSet && !mFlushTracker.empty()))) {
+                    if (!mFlushCompleteCount) {
+                        // next marker, one event per flush() it covers
+                        bool restart;
+                        int res;
+                        mFlushTracker.completeNext(&mFlushCompleteHandle,
+                                                   &mFlushCompleteCount,
+                                                   &restart);
+                        mFlushBatchSet--;
+                        // flushes that came in while it was outstanding
+                        if (restart && flushFifo(&res) < 0) {
+                            LOGE("HAL:ERR can't restart flush of handle %d",
+                                 mFlushCompleteHandle);
+                            mFlushTracker.cancel(mFlushCompleteHandle, 0);
+                        }
+                        continue;
+                    }
                     int sendEvent = metaHandler(&mPendingFlushEvents[0], META_DATA_FLUSH_COMPLETE);
+                    mFlushCompleteCount--;
                     if (sendEvent) {
                         LOGV_IF(ENG_VERBOSE, "Queueing flush complete for handle=%d",
                                 mPendingFlushEvents[0].meta_data.sensor);
@@ -3955,11 +4245,10 @@ int MPLSensor::readEvents(sensors_event_t* data, int count)
                         LOGV_IF(ENG_VERBOSE, "sendEvent false, NOT queueing flush complete for handle=%d",
                                 mPendingFlushEvents[0].meta_data.sensor);
                     }
-                    mFlushBatchSet--;
                 }
 
                 // Double check flush status
-                if (mFlushSensorEnabledVector.isEmpty()) {
+                if (!mFlushCompleteCount && mFlushTracker.empty()) {
                     mEmptyDataMarkerDetected = 0;
                     mDataMarkerDetected = 0;
                     mFlushBatchSet = 0;
@@ -3967,7 +4256,7 @@ int MPLSensor::readEvents(sensors_event_t* data, int count)
                 } else {
                     LOGV_IF(ENG_VERBOSE, "Flush is still active");
                 }
-            } else if (mFlushBatchSet && mFlushSensorEnabledVector.isEmpty()) {
+            } else if (mFlushBatchSet && mFlushTracker.empty()) {
                 mFlushBatchSet = 0;
             }
         }
@@ -3998,6 +4287,8 @@ void MPLSensor::buildMpuEvent(void)
     ssize_t readCounter = 0;
     char *rdataP = NULL;
     bool doneFlag = 0;
+    struct inv_fifo_packet packet;
+    ssize_t packetSize;
 
     /* flush buffer when no sensors are enabled */
     if (mEnabledCached == 0 && mBatchEnabled == 0 && mDmpPedometerEnabled == 0) {
@@ -4006,6 +4297,8 @@ void MPLSensor::buildMpuEvent(void)
             LOGV_IF(ENG_VERBOSE, "HAL:input data flush rsize=%d", (int)rsize);
         }
         mLeftOverBufferSize = 0;
+        mIIOReadOffset = 0;
+        mIIOReadSize = 0;
         mDataMarkerDetected = 0;
         mEmptyDataMarkerDetected = 0;
         return;
@@ -4016,6 +4309,46 @@ void MPLSensor::buildMpuEvent(void)
     ped_quaternion_on = checkPedQuatEnabled();
     ped_standalone_on = checkPedStandaloneEnabled();
 
+#ifdef ENABLE_BULK_FIFO_READ
+    /* only go back to the driver once the bytes left in mIIOBuffer
+       no longer hold a full packet, then drain as much as it has */
+    readCounter = mIIOReadSize - mIIOReadOffset;
+    if (readCounter < MAX_READ_SIZE) {
+        if (readCounter > 0 && mIIOReadOffset > 0) {
+            memmove(mIIOBuffer, mIIOBuffer + mIIOReadOffset, readCounter);
+        }
+        mIIOReadOffset = 0;
+        mIIOReadSize = readCounter;
+        nbyte = sizeof(mIIOBuffer) - readCounter;
+
+        int64_t readStart = LATENCY_STATS ? android::elapsedRealtimeNano() : 0;
+        rsize = read(iio_fd, mIIOBuffer + readCounter, nbyte);
+        if (LATENCY_STATS)
+            mLatency[LAT_FIFO_READ].add(android::elapsedRealtimeNano() - readStart);
+        mIIOReadCount++;
+        if(rsize < 0) {
+            LOGE("HAL:input data file descriptor not available - (%s)",
+                 strerror(errno));
+            if (sensors == 0) {
+                rsize = read(iio_fd, rdata, MAX_SUSPEND_BATCH_PACKET_SIZE);
+                if(rsize > 0) {
+                    LOGV_IF(ENG_VERBOSE, "HAL:input data flush rsize=%d", (int)rsize);
+                }
+                mIIOReadOffset = 0;
+                mIIOReadSize = 0;
+            }
+            return;
+        }
+        mIIOReadSize += rsize;
+        LOGV_IF(INPUT_DATA && ENG_VERBOSE,
+                "HAL:input bulk read rsize=%d, buffered=%d",
+                (int)rsize, mIIOReadSize);
+    } else {
+        nbyte = 0;
+    }
+    rdata = mIIOBuffer + mIIOReadOffset;
+    readCounter = mIIOReadSize - mIIOReadOffset;
+#else
     nbyte = MAX_READ_SIZE - mLeftOverBufferSize;
 
     /* check previous copied buffer */
@@ -4035,7 +4368,11 @@ void MPLSensor::buildMpuEvent(void)
     rdataP = rdata + mLeftOverBufferSize;
 
     /* read expected number of bytes */
+    int64_t readStart = LATENCY_STATS ? android::elapsedRealtimeNano() : 0;
     rsize = read(iio_fd, rdataP, nbyte);
+    if (LATENCY_STATS)
+        mLatency[LAT_FIFO_READ].add(android::elapsedRealtimeNano() - readStart);
+    mIIOReadCount++;
     if(rsize < 0) {
         /* IIO buffer might have old data.
            Need to flush it if no sensor is on, to avoid infinite
@@ -4089,16 +4426,17 @@ LOGV_IF(INPUT_DATA,
     rdataP = rdata;
     readCounter = rsize + mLeftOverBufferSize;
     LOGV_IF(0, "HAL:input readCounter set=%d", (int)readCounter);
+#endif
 
     if(readCounter < MAX_READ_SIZE) {
         // Handle standalone MARKER packet
         if (readCounter >= BYTES_PER_SENSOR) {
-            data_format = *((short *)(rdata));
+            data_format = inv_fifo_header(rdata);
             if (data_format == DATA_FORMAT_MARKER) {
                 LOGV_IF(ENG_VERBOSE && INPUT_DATA, "MARKER DETECTED:0x%x", data_format);
                 readCounter -= BYTES_PER_SENSOR;
                 rdata += BYTES_PER_SENSOR;
-                if (!mFlushSensorEnabledVector.isEmpty()) {
+                if (!mFlushTracker.empty()) {
                     mFlushBatchSet++;
                 }
                 mDataMarkerDetected = 1;
@@ -4107,7 +4445,7 @@ LOGV_IF(INPUT_DATA,
                 LOGV_IF(ENG_VERBOSE && INPUT_DATA, "EMPTY MARKER DETECTED:0x%x", data_format);
                 readCounter -= BYTES_PER_SENSOR;
                 rdata += BYTES_PER_SENSOR;
-                if (!mFlushSensorEnabledVector.isEmpty()) {
+                if (!mFlushTracker.empty()) {
                     mFlushBatchSet++;
                 }
                 mEmptyDataMarkerDetected = 1;
@@ -4116,8 +4454,12 @@ LOGV_IF(INPUT_DATA,
         }
 
         /* store packet then return */
+#ifdef ENABLE_BULK_FIFO_READ
+        mIIOReadOffset = rdata - mIIOBuffer;
+#else
         mLeftOverBufferSize = readCounter;
         memcpy(mLeftOverBuffer, rdata, mLeftOverBufferSize);
+#endif
 
 #ifdef TESTING
         LOGV_IF(1, "HAL:input data has batched partial packet");
@@ -4136,7 +4478,7 @@ LOGV_IF(INPUT_DATA,
 
     LOGV_IF(INPUT_DATA && ENG_VERBOSE,
             "HAL:input b=%d rdata= %d nbyte= %d rsize= %d readCounter= %d",
-            checkBatchEnabled(), *((short *) rdata), nbyte, (int)rsize, (int)readCounter);
+            checkBatchEnabled(), inv_fifo_header(rdata), nbyte, (int)rsize, (int)readCounter);
     LOGV_IF(INPUT_DATA && ENG_VERBOSE,
             "HAL:input sensors= %d, lp_q_on= %d, 6axis_q_on= %d, "
             "ped_q_on= %d, ped_standalone_on= %d",
@@ -4149,193 +4491,135 @@ LOGV_IF(INPUT_DATA,
         mLeftOverBufferSize = 0;
         // clear data format mask for parsing the next set of data
         mask = 0;
-        data_format = *((short *)(rdata));
+        packetSize = inv_fifo_decode(rdata, readCounter, &packet);
+        data_format = inv_fifo_header(rdata);
         LOGV_IF(INPUT_DATA && ENG_VERBOSE,
                 "HAL:input data_format=%x", data_format);
 
-        if(checkValidHeader(data_format) == 0) {
+        if (packetSize < 0) {
             LOGE("HAL:input invalid data_format 0x%02X", data_format);
+#ifdef ENABLE_BULK_FIFO_READ
+            /* drop the rest of the buffer, it cannot be realigned */
+            mIIOReadOffset = 0;
+            mIIOReadSize = 0;
+#endif
             return;
         }
 
-        if (data_format & DATA_FORMAT_STEP) {
-            if (data_format == DATA_FORMAT_STEP) {
-                rdata += BYTES_PER_SENSOR;
-                latestTimestamp = *((long long*) (rdata));
-                LOGV_IF(ENG_VERBOSE && INPUT_DATA, "STEP DETECTED:0x%x - ts: %lld", data_format, latestTimestamp);
-                // readCounter is decrement by 24 because DATA_FORMAT_STEP only applies in batch  mode
-                readCounter -= BYTES_PER_SENSOR_PACKET;
-            } else {
-                LOGV_IF(0, "STEP DETECTED:0x%x", data_format);
-            }
+        if (packetSize > 0 && (packet.flags & DATA_FORMAT_STEP)) {
+            LOGV_IF(0, "STEP DETECTED:0x%x", data_format);
             mPedUpdate |= data_format;
-            // cancels step bit
-            data_format &= (~DATA_FORMAT_STEP);
+            notifyStepCount();
         }
 
-        if (data_format == DATA_FORMAT_MARKER) {
+        switch (packetSize ? packet.desc->target : INV_FIFO_TARGET_NONE) {
+        case INV_FIFO_TARGET_STEP:
+            latestTimestamp = inv_fifo_ts(&packet)->timestamp;
+            LOGV_IF(ENG_VERBOSE && INPUT_DATA, "STEP DETECTED:0x%x - ts: %lld", data_format, latestTimestamp);
+            mPedUpdate |= data_format;
+            notifyStepCount();
+            break;
+        case INV_FIFO_TARGET_MARKER:
             LOGV_IF(ENG_VERBOSE && INPUT_DATA, "MARKER DETECTED:0x%x", data_format);
-            readCounter -= BYTES_PER_SENSOR;
-            if (!mFlushSensorEnabledVector.isEmpty()) {
+            if (!mFlushTracker.empty()) {
                 mFlushBatchSet++;
             }
             mDataMarkerDetected = 1;
-        }
-        else if (data_format == DATA_FORMAT_EMPTY_MARKER) {
+            break;
+        case INV_FIFO_TARGET_EMPTY_MARKER:
             LOGV_IF(ENG_VERBOSE && INPUT_DATA, "EMPTY MARKER DETECTED:0x%x", data_format);
-            readCounter -= BYTES_PER_SENSOR;
-            if (!mFlushSensorEnabledVector.isEmpty()) {
+            if (!mFlushTracker.empty()) {
                 mFlushBatchSet++;
             }
             mEmptyDataMarkerDetected = 1;
             mDataMarkerDetected = 1;
-        }
-        else if (data_format == DATA_FORMAT_QUAT) {
+            break;
+        case INV_FIFO_TARGET_QUAT:
             LOGV_IF(ENG_VERBOSE && INPUT_DATA, "QUAT DETECTED:0x%x", data_format);
-            if (readCounter >= BYTES_QUAT_DATA) {
-                mCachedQuaternionData[0] = *((int *) (rdata + 4));
-                mCachedQuaternionData[1] = *((int *) (rdata + 8));
-                mCachedQuaternionData[2] = *((int *) (rdata + 12));
-                rdata += QUAT_ONLY_LAST_PACKET_OFFSET;
-                mQuatSensorTimestamp = *((long long*) (rdata));
-                mask |= DATA_FORMAT_QUAT;
-                readCounter -= BYTES_QUAT_DATA;
-            }
-            else {
-                doneFlag = 1;
-            }
-        }
-        else if (data_format == DATA_FORMAT_6_AXIS) {
+            mCachedQuaternionData[0] = inv_fifo_s32(&packet)->data[0];
+            mCachedQuaternionData[1] = inv_fifo_s32(&packet)->data[1];
+            mCachedQuaternionData[2] = inv_fifo_s32(&packet)->data[2];
+            mQuatSensorTimestamp = inv_fifo_s32(&packet)->timestamp;
+            mask |= packet.desc->mask;
+            break;
+        case INV_FIFO_TARGET_6_AXIS:
             LOGV_IF(ENG_VERBOSE && INPUT_DATA, "6AXIS DETECTED:0x%x", data_format);
-            if (readCounter >= BYTES_QUAT_DATA) {
-                mCached6AxisQuaternionData[0] = *((int *) (rdata + 4));
-                mCached6AxisQuaternionData[1] = *((int *) (rdata + 8));
-                mCached6AxisQuaternionData[2] = *((int *) (rdata + 12));
-                rdata += QUAT_ONLY_LAST_PACKET_OFFSET;
-                mQuatSensorTimestamp = *((long long*) (rdata));
-                mask |= DATA_FORMAT_6_AXIS;
-                readCounter -= BYTES_QUAT_DATA;
-            }
-            else {
-                doneFlag = 1;
-            }
-        }
-        else if (data_format == DATA_FORMAT_PED_QUAT) {
+            mCached6AxisQuaternionData[0] = inv_fifo_s32(&packet)->data[0];
+            mCached6AxisQuaternionData[1] = inv_fifo_s32(&packet)->data[1];
+            mCached6AxisQuaternionData[2] = inv_fifo_s32(&packet)->data[2];
+            mQuatSensorTimestamp = inv_fifo_s32(&packet)->timestamp;
+            mask |= packet.desc->mask;
+            break;
+        case INV_FIFO_TARGET_PED_QUAT:
             LOGV_IF(ENG_VERBOSE && INPUT_DATA, "PED QUAT DETECTED:0x%x", data_format);
-            if (readCounter >= BYTES_PER_SENSOR_PACKET) {
-                mCachedPedQuaternionData[0] = *((short *) (rdata + 2));
-                mCachedPedQuaternionData[1] = *((short *) (rdata + 4));
-                mCachedPedQuaternionData[2] = *((short *) (rdata + 6));
-                rdata += BYTES_PER_SENSOR;
-                mQuatSensorTimestamp = *((long long*) (rdata));
-                mask |= DATA_FORMAT_PED_QUAT;
-                readCounter -= BYTES_PER_SENSOR_PACKET;
-            }
-            else {
-                doneFlag = 1;
-            }
-        }
-        else if (data_format == DATA_FORMAT_PED_STANDALONE) {
+            mCachedPedQuaternionData[0] = inv_fifo_s16(&packet)->data[0];
+            mCachedPedQuaternionData[1] = inv_fifo_s16(&packet)->data[1];
+            mCachedPedQuaternionData[2] = inv_fifo_s16(&packet)->data[2];
+            mQuatSensorTimestamp = inv_fifo_s16(&packet)->timestamp;
+            mask |= packet.desc->mask;
+            break;
+        case INV_FIFO_TARGET_PED_STANDALONE:
             LOGV_IF(ENG_VERBOSE && INPUT_DATA, "STANDALONE STEP DETECTED:0x%x", data_format);
-            if (readCounter >= BYTES_PER_SENSOR_PACKET) {
-                rdata += BYTES_PER_SENSOR;
-                mStepSensorTimestamp = *((long long*) (rdata));
-                mask |= DATA_FORMAT_PED_STANDALONE;
-                readCounter -= BYTES_PER_SENSOR_PACKET;
-                mPedUpdate |= data_format;
-            }
-            else {
-                doneFlag = 1;
-            }
-        }
-        else if (data_format == DATA_FORMAT_GYRO) {
+            mStepSensorTimestamp = inv_fifo_ts(&packet)->timestamp;
+            mask |= packet.desc->mask;
+            mPedUpdate |= packet.desc->header;
+            notifyStepCount();
+            break;
+        case INV_FIFO_TARGET_GYRO:
             LOGV_IF(ENG_VERBOSE && INPUT_DATA, "GYRO DETECTED:0x%x", data_format);
-            if (readCounter >= BYTES_PER_SENSOR_PACKET) {
-                mCachedGyroData[0] = *((short *) (rdata + 2));
-                mCachedGyroData[1] = *((short *) (rdata + 4));
-                mCachedGyroData[2] = *((short *) (rdata + 6));
-                rdata += BYTES_PER_SENSOR;
-                mGyroSensorTimestamp = *((long long*) (rdata));
-                mask |= DATA_FORMAT_GYRO;
-                readCounter -= BYTES_PER_SENSOR_PACKET;
-            } else {
-                doneFlag = 1;
-            }
-        }
-        else if (data_format == DATA_FORMAT_ACCEL) {
+            mCachedGyroData[0] = inv_fifo_s16(&packet)->data[0];
+            mCachedGyroData[1] = inv_fifo_s16(&packet)->data[1];
+            mCachedGyroData[2] = inv_fifo_s16(&packet)->data[2];
+            mGyroSensorTimestamp = inv_fifo_s16(&packet)->timestamp;
+            mask |= packet.desc->mask;
+            break;
+        case INV_FIFO_TARGET_ACCEL:
             LOGV_IF(ENG_VERBOSE && INPUT_DATA, "ACCEL DETECTED:0x%x", data_format);
-            if (readCounter >= BYTES_PER_SENSOR_PACKET) {
-                mCachedAccelData[0] = *((short *) (rdata + 2));
-                mCachedAccelData[1] = *((short *) (rdata + 4));
-                mCachedAccelData[2] = *((short *) (rdata + 6));
-                rdata += BYTES_PER_SENSOR;
-                mAccelSensorTimestamp = *((long long*) (rdata));
-                mask |= DATA_FORMAT_ACCEL;
-                readCounter -= BYTES_PER_SENSOR_PACKET;
-            }
-            else {
-                doneFlag = 1;
-            }
-        }
-        else if (data_format == DATA_FORMAT_COMPASS) {
+            mCachedAccelData[0] = inv_fifo_s16(&packet)->data[0];
+            mCachedAccelData[1] = inv_fifo_s16(&packet)->data[1];
+            mCachedAccelData[2] = inv_fifo_s16(&packet)->data[2];
+            mAccelSensorTimestamp = inv_fifo_s16(&packet)->timestamp;
+            mask |= packet.desc->mask;
+            break;
+        case INV_FIFO_TARGET_COMPASS:
             LOGV_IF(ENG_VERBOSE && INPUT_DATA, "COMPASS DETECTED:0x%x", data_format);
-            if (readCounter >= BYTES_PER_SENSOR_PACKET) {
-                if (mCompassSensor->isIntegrated()) {
-                    mCachedCompassData[0] = *((short *) (rdata + 2));
-                    mCachedCompassData[1] = *((short *) (rdata + 4));
-                    mCachedCompassData[2] = *((short *) (rdata + 6));
-                    rdata += BYTES_PER_SENSOR;
-                    mCompassTimestamp = *((long long*) (rdata));
-                    mask |= DATA_FORMAT_COMPASS;
-                    readCounter -= BYTES_PER_SENSOR_PACKET;
-                }
-            }
-            else {
-                doneFlag = 1;
+            if (mCompassSensor->isIntegrated()) {
+                mCachedCompassData[0] = inv_fifo_s16(&packet)->data[0];
+                mCachedCompassData[1] = inv_fifo_s16(&packet)->data[1];
+                mCachedCompassData[2] = inv_fifo_s16(&packet)->data[2];
+                mCompassTimestamp = inv_fifo_s16(&packet)->timestamp;
+                mask |= packet.desc->mask;
             }
-        }
-        else if (data_format == DATA_FORMAT_COMPASS_OF) {
+            break;
+        case INV_FIFO_TARGET_COMPASS_OF:
             LOGV_IF(ENG_VERBOSE && INPUT_DATA, "COMPASS OF DETECTED:0x%x", data_format);
-            mask |= DATA_FORMAT_COMPASS_OF;
+            mask |= packet.desc->mask;
             mCompassOverFlow = 1;
-#ifdef INV_PLAYBACK_DBG
-            if (readCounter >= BYTES_PER_SENSOR_PACKET) {
-                if (mCompassSensor->isIntegrated()) {
-                    mCachedCompassData[0] = *((short *) (rdata + 2));
-                    mCachedCompassData[1] = *((short *) (rdata + 4));
-                    mCachedCompassData[2] = *((short *) (rdata + 6));
-                    rdata += BYTES_PER_SENSOR;
-                    mCompassTimestamp = *((long long*) (rdata));
-                    readCounter -= BYTES_PER_SENSOR_PACKET;
-                }
-            }
-#else
-            readCounter -= BYTES_PER_SENSOR;
-#endif
-        }
+            break;
 #ifdef ENABLE_PRESSURE
-        else if (data_format == DATA_FORMAT_PRESSURE) {
+        case INV_FIFO_TARGET_PRESSURE:
             LOGV_IF(ENG_VERBOSE && INPUT_DATA, "PRESSURE DETECTED:0x%x", data_format);
-            if (readCounter >= BYTES_QUAT_DATA) {
-                if (mPressureSensor->isIntegrated()) {
-                    mCachedPressureData =
-                        ((*((short *)(rdata + 4))) << 16) +
-                        (*((unsigned short *) (rdata + 6)));
-                    rdata += BYTES_PER_SENSOR;
-                    mPressureTimestamp = *((long long*) (rdata));
-                    if (mCachedPressureData != 0) {
-                        mask |= DATA_FORMAT_PRESSURE;
-                    }
-                    readCounter -= BYTES_PER_SENSOR_PACKET;
+            if (mPressureSensor->isIntegrated()) {
+                mCachedPressureData = inv_fifo_pressure_value(&packet);
+                mPressureTimestamp = inv_fifo_pressure(&packet)->timestamp;
+                if (mCachedPressureData != 0) {
+                    mask |= packet.desc->mask;
                 }
-            } else{
-                doneFlag = 1;
             }
-        }
+            break;
 #endif
+        case INV_FIFO_TARGET_NONE:
+            /* partial packet, keep it for the next read */
+            doneFlag = 1;
+            break;
+        default:
+            break;
+        }
 
         if(doneFlag == 0) {
-            rdata += BYTES_PER_SENSOR;
+            rdata += packetSize;
+            readCounter -= packetSize;
+            mIIOPacketCount++;
             LOGV_IF(ENG_VERBOSE && INPUT_DATA, "HAL: input data doneFlag is zero, readCounter=%d", (int)readCounter);
         }
         else {
@@ -4346,24 +4630,39 @@ LOGV_IF(INPUT_DATA,
         if (readCounter != 0) {
             int currentBufferCounter = 0;
             LOGV_IF(0, "Not enough data readCounter=%d, expected nbyte=%d, rsize=%d", (int)readCounter, nbyte, (int)rsize);
+#ifndef ENABLE_BULK_FIFO_READ
             memset(mLeftOverBuffer, 0, sizeof(mLeftOverBuffer));
+#endif
             /* check for end markers, don't save */
-            data_format = *((short *) (rdata));
+            data_format = inv_fifo_header(rdata);
             if ((data_format == DATA_FORMAT_MARKER) || (data_format == DATA_FORMAT_EMPTY_MARKER)) {
 				LOGV_IF(ENG_VERBOSE && INPUT_DATA, "s MARKER DETECTED:0x%x", data_format);
 				rdata += BYTES_PER_SENSOR;
 				readCounter -= BYTES_PER_SENSOR;
-				if (!mFlushSensorEnabledVector.isEmpty()) {
+				if (!mFlushTracker.empty()) {
 					mFlushBatchSet++;
 				}
 				mDataMarkerDetected = 1;
 				if (readCounter == 0) {
 					mLeftOverBufferSize = 0;
+#ifdef ENABLE_BULK_FIFO_READ
+					mIIOReadOffset = rdata - mIIOBuffer;
+#endif
 					if(doneFlag != 0) {
 						return;
 					}
 				}
 			}
+#ifdef ENABLE_BULK_FIFO_READ
+			/* leave the tail in mIIOBuffer, the next call parses it */
+			mIIOReadOffset = rdata - mIIOBuffer;
+			readCounter = 0;
+		} else {
+			/* reset count since this is the last packet for the data set */
+			mIIOReadOffset = rdata - mIIOBuffer;
+			readCounter = 0;
+		}
+#else
 			memcpy(mLeftOverBuffer, rdata, readCounter);
 			LOGV_IF(0,
 					"HAL:input store rdata=:%d, %d, %d, %d,%d, %d, %d, %d,%d, "
@@ -4381,24 +4680,26 @@ LOGV_IF(INPUT_DATA,
             readCounter = 0;
             mLeftOverBufferSize = 0;
         }
+#endif
 
         /* handle data read */
+        int64_t buildStart = LATENCY_STATS ? android::elapsedRealtimeNano() : 0;
         if (mask == DATA_FORMAT_GYRO) {
             /* batch mode does not batch temperature */
             /* disable temperature read */
             if (!(mFeatureActiveMask & INV_DMP_BATCH_MODE)) {
                 // send down temperature every 0.5 seconds
-                // with timestamp measured in "driver" layer
-                if(mGyroSensorTimestamp - mTempCurrentTime >= 500000000LL) {
+                // with timestamp measured in "driver" layer,
+                // read from the poll loop when the timer is there
+                if (mTempTimerFd < 0 &&
+                    mGyroSensorTimestamp - mTempCurrentTime >= TEMP_READ_PERIOD_NS) {
                     mTempCurrentTime = mGyroSensorTimestamp;
-                    long long temperature[2];
-                    if(inv_read_temperature(temperature) == 0) {
-                        LOGV_IF(INPUT_DATA,
-                        "HAL:input inv_read_temperature = %lld, timestamp= %lld",
-                        temperature[0], temperature[1]);
-                        inv_build_temp(temperature[0], temperature[1]);
-                        mSkipExecuteOnData = 0;
-                     }
+                    updateTemperature();
+                }
+                if (mTempPending) {
+                    mTempPending = false;
+                    inv_build_temp(mCachedTemperature[0], mCachedTemperature[1]);
+                    mSkipExecuteOnData = 0;
 #ifdef TESTING
                     long bias[3], temp, temp_slope[3];
                     inv_get_mpl_gyro_bias(bias, &temp);
@@ -4407,7 +4708,7 @@ LOGV_IF(INPUT_DATA,
                      "GB: %+13f %+13f %+13f "
                      "TS: %+13f %+13f %+13f "
                      "\n",
-                     (float)temperature[0] / 65536.f,
+                     (float)mCachedTemperature[0] / 65536.f,
                      (float)bias[0] / 65536.f / 16.384f,
                      (float)bias[1] / 65536.f / 16.384f,
                      (float)bias[2] / 65536.f / 16.384f,
@@ -4560,6 +4861,21 @@ LOGV_IF(INPUT_DATA,
             mSkipExecuteOnData = 0;
         }
 #endif
+        /* the oldest compass sample read before this packet goes in the
+           same pass, readBufferedEvents() drains the rest */
+        if (latestTimestamp) {
+            mCompassMerger.advance(MergeMpu, latestTimestamp);
+            buildMergedCompass();
+        }
+        if (LATENCY_STATS) {
+            int64_t now = android::elapsedRealtimeNano();
+            mLatency[LAT_BUILD].add(now - buildStart);
+            /* age of the first sample the driver woke us up for */
+            if (mLatencyWakeup && latestTimestamp) {
+                mLatency[LAT_POLL_WAKEUP].add(mLatencyWakeup - latestTimestamp);
+                mLatencyWakeup = 0;
+            }
+        }
         /* take the latest timestamp */
         if (mPedUpdate & DATA_FORMAT_STEP) {
         /* work around driver output duplicate step detector bit */
@@ -4577,46 +4893,53 @@ LOGV_IF(INPUT_DATA,
    }    //while end
 }
 
+/* true when mIIOBuffer still holds a full packet that buildMpuEvent()
+   can parse without going back to the driver */
+bool MPLSensor::hasBufferedMpuData(void) const
+{
+#ifdef ENABLE_BULK_FIFO_READ
+    return (mIIOReadSize - mIIOReadOffset) >= MAX_READ_SIZE;
+#else
+    return false;
+#endif
+}
+
+/* true when the compass bulk read still has samples for
+   buildCompassEvent() */
+bool MPLSensor::hasBufferedCompassData(void) const
+{
+    return mCompassSensor->hasBufferedSamples();
+}
+
 int MPLSensor::checkValidHeader(unsigned short data_format)
 {
     LOGV_IF(ENG_VERBOSE && INPUT_DATA, "check data_format=%x", data_format);
 
-    if(data_format == DATA_FORMAT_STEP)
-        return 1;
-
-    if(data_format & DATA_FORMAT_STEP) {
-        data_format &= (~DATA_FORMAT_STEP);
-    }
-
-    if ((data_format == DATA_FORMAT_PED_STANDALONE) ||
-        (data_format == DATA_FORMAT_PED_QUAT) ||
-        (data_format == DATA_FORMAT_6_AXIS) ||
-        (data_format == DATA_FORMAT_QUAT) ||
-        (data_format == DATA_FORMAT_COMPASS) ||
-        (data_format == DATA_FORMAT_GYRO) ||
-        (data_format == DATA_FORMAT_ACCEL) ||
-        (data_format == DATA_FORMAT_PRESSURE) ||
-        (data_format == DATA_FORMAT_EMPTY_MARKER) ||
-        (data_format == DATA_FORMAT_MARKER) ||
-        (data_format == DATA_FORMAT_COMPASS_OF))
-            return 1;
-     else {
+    if (inv_fifo_lookup(data_format, NULL) == NULL) {
         LOGV_IF(ENG_VERBOSE, "bad data_format = %x", data_format);
         return 0;
     }
+    return 1;
 }
 
-/* use for both MPUxxxx and third party compass */
-void MPLSensor::buildCompassEvent(void)
+/* use for both MPUxxxx and third party compass,
+   returns true if a compass sample was handed to MPL */
+bool MPLSensor::buildCompassEvent(void)
 {
     VHANDLER_LOG;
 
     int done = 0;
+    bool built = false;
+    SampleMerger::Sample sample;
+
+    /* the sample may be held back by the merge, nothing new until built */
+    mSkipReadEvents = 1;
+    mSkipExecuteOnData = 1;
 
     // pthread_mutex_lock(&mMplMutex);
     // pthread_mutex_lock(&mHALMutex);
 
-    done = mCompassSensor->readSample(mCachedCompassData, &mCompassTimestamp);
+    done = mCompassSensor->readSample(sample.data, &sample.timestamp);
     if(mCompassSensor->isYasCompass()) {
         if (mCompassSensor->checkCoilsReset() == 1) {
            //Reset relevant compass settings
@@ -4624,23 +4947,51 @@ void MPLSensor::buildCompassEvent(void)
         }
     }
     if (done > 0) {
-        int status = 0;
+        sample.status = 0;
         if (mCompassSensor->providesCalibration()) {
-            status = mCompassSensor->getAccuracy();
-            status |= INV_CALIBRATED;
+            sample.status = mCompassSensor->getAccuracy();
+            sample.status |= INV_CALIBRATED;
+        }
+        mCompassMerger.setActive(MergeCompass, true);
+        /* window full, release the oldest one to make room */
+        if (!mCompassMerger.push(MergeCompass, sample)) {
+            built = buildMergedCompass();
+            mCompassMerger.push(MergeCompass, sample);
+        } else {
+            built = buildMergedCompass();
         }
-        inv_build_compass(mCachedCompassData, status,
-                          mCompassTimestamp);
-        LOGV_IF(INPUT_DATA,
-                "HAL:input inv_build_compass: %+8ld %+8ld %+8ld - %lld",
-                mCachedCompassData[0], mCachedCompassData[1],
-                mCachedCompassData[2], mCompassTimestamp);
-        mSkipReadEvents = 0;
-        mSkipExecuteOnData = 0;
     }
 
     // pthread_mutex_unlock(&mMplMutex);
     // pthread_mutex_unlock(&mHALMutex);
+    return built;
+}
+
+/* builds the oldest compass sample no pending MPU packet predates.
+   MPL keeps a single sample per type and execute, so this releases at
+   most one: callers run readEvents() after each true return and call
+   again until it returns false to drain what the merge holds */
+bool MPLSensor::buildMergedCompass(void)
+{
+    SampleMerger::Sample sample;
+    int source;
+
+    mCompassMerger.setActive(MergeMpu,
+            !!(mLocalSensorMask & (INV_THREE_AXIS_GYRO | INV_THREE_AXIS_ACCEL)));
+    if (!mCompassMerger.pop(&source, &sample))
+        return false;
+
+    memcpy(mCachedCompassData, sample.data, sizeof(sample.data));
+    mCompassTimestamp = sample.timestamp;
+    inv_build_compass(mCachedCompassData, sample.status,
+                      mCompassTimestamp);
+    LOGV_IF(INPUT_DATA,
+            "HAL:input inv_build_compass: %+8ld %+8ld %+8ld - %lld",
+            mCachedCompassData[0], mCachedCompassData[1],
+            mCachedCompassData[2], mCompassTimestamp);
+    mSkipReadEvents = 0;
+    mSkipExecuteOnData = 0;
+    return true;
 }
 
 int MPLSensor::resetCompass(void)
@@ -4692,7 +5043,7 @@ int MPLSensor::turnOffAccelFifo(void)
     int i, res = 0, tempFd;
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                         0, mpu.accel_fifo_enable, getTimestamp());
-    res += write_sysfs_int(mpu.accel_fifo_enable, 0);
+    res += mSysfs.write(mpu.accel_fifo_enable, 0);
     return res;
 }
 
@@ -4702,7 +5053,7 @@ int MPLSensor::turnOffGyroFifo(void)
     int i, res = 0, tempFd;
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                         0, mpu.gyro_fifo_enable, getTimestamp());
-    res += write_sysfs_int(mpu.gyro_fifo_enable, 0);
+    res += mSysfs.write(mpu.gyro_fifo_enable, 0);
     return res;
 }
 
@@ -4724,7 +5075,7 @@ int MPLSensor::enableDmpOrientation(int en)
         // Enable DMP orientation
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 en, mpu.display_orientation_on, getTimestamp());
-        if (write_sysfs_int(mpu.display_orientation_on, en) < 0) {
+        if (mSysfs.write(mpu.display_orientation_on, en) < 0) {
             LOGE("HAL:ERR can't enable Android orientation");
             res = -1;	// indicate an err
             return res;
@@ -4745,7 +5096,7 @@ int MPLSensor::enableDmpOrientation(int en)
         if (!mEnabled){
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                        1, mpu.dmp_event_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.dmp_event_int_on, en) < 0) {
+            if (mSysfs.write(mpu.dmp_event_int_on, en) < 0) {
                 res = -1;
                 LOGE("HAL:ERR can't enable DMP event interrupt");
             }
@@ -4769,7 +5120,7 @@ int MPLSensor::enableDmpOrientation(int en)
         if (mEnabled){
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                        en, mpu.dmp_event_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.dmp_event_int_on, en) < 0) {
+            if (mSysfs.write(mpu.dmp_event_int_on, en) < 0) {
                 res = -1;
                 LOGE("HAL:ERR can't enable DMP event interrupt");
             }
@@ -4914,6 +5265,10 @@ int MPLSensor::getPollTime(void)
 int MPLSensor::getStepCountPollTime(void)
 {
     VFUNC_LOG;
+    if (isStepCountEventDriven()) {
+        // step count timer wakes the poll, nothing to time out for
+        return -1;
+    }
     if (mDmpStepCountEnabled) {
         // convert poll time from nS to mS
         return (mStepCountPollTime / 1000000LL);
@@ -4924,6 +5279,8 @@ int MPLSensor::getStepCountPollTime(void)
 bool MPLSensor::hasStepCountPendingEvents(void)
 {
     VFUNC_LOG;
+    if (isStepCountEventDriven())
+        return false;
     if (mDmpStepCountEnabled) {
         int64_t t_now_ns;
         int64_t interval = 0;
@@ -4987,6 +5344,38 @@ int MPLSensor::inv_read_temperature(long long *data)
     return 0;
 }
 
+/* read the gyro temperature, applied with the next gyro sample */
+void MPLSensor::updateTemperature(void)
+{
+    VHANDLER_LOG;
+
+    int64_t start = LATENCY_STATS ? android::elapsedRealtimeNano() : 0;
+
+    if (inv_read_temperature(mCachedTemperature) == 0) {
+        LOGV_IF(INPUT_DATA,
+                "HAL:input inv_read_temperature = %lld, timestamp= %lld",
+                mCachedTemperature[0], mCachedTemperature[1]);
+        mTempPending = true;
+    }
+    if (LATENCY_STATS)
+        mLatency[LAT_TEMP_READ].add(android::elapsedRealtimeNano() - start);
+}
+
+/* temperature timer expired, no events are reported */
+int MPLSensor::readTemperatureEvents(void)
+{
+    VFUNC_LOG;
+
+    uint64_t expirations;
+
+    if (read(mTempTimerFd, &expirations, sizeof(expirations)) <= 0)
+        return 0;
+    /* batch mode does not batch temperature */
+    if (!(mFeatureActiveMask & INV_DMP_BATCH_MODE))
+        updateTemperature();
+    return 0;
+}
+
 int MPLSensor::inv_read_dmp_state(int fd)
 {
     VFUNC_LOG;
@@ -5871,6 +6260,9 @@ int MPLSensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
 {
     VFUNC_LOG;
 
+    SysfsAttrCache::Scope sysfsScope(mSysfs);
+    ReconfigScope reconfigScope(this);
+
     int res = 0;
 
     if (isMpuNonDmp())
@@ -6188,7 +6580,7 @@ int MPLSensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
     /*if (flags & (1 << SENSORS_BATCH_WAKE_UPON_FIFO_FULL)) {
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 0, mpu.batchmode_wake_fifo_full_on, getTimestamp());
-        if (write_sysfs_int(mpu.batchmode_wake_fifo_full_on, 0) < 0) {
+        if (mSysfs.write(mpu.batchmode_wake_fifo_full_on, 0) < 0) {
             LOGE("HAL:ERR can't write batchmode_wake_fifo_full_on");
         }
     }*/
@@ -6218,7 +6610,7 @@ int MPLSensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
     // set sensor data interrupt
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 !dataInterrupt, mpu.dmp_event_int_on, getTimestamp());
-    if (write_sysfs_int(mpu.dmp_event_int_on, !dataInterrupt) < 0) {
+    if (mSysfs.write(mpu.dmp_event_int_on, !dataInterrupt) < 0) {
         res = -1;
         LOGE("HAL:ERR can't enable DMP event interrupt");
     }
@@ -6240,6 +6632,8 @@ int MPLSensor::flush(int handle)
 {
     VFUNC_LOG;
 
+    SysfsAttrCache::Scope sysfsScope(mSysfs);
+
     int res = 0;
     int status = 0;
     android::String8 sname;
@@ -6264,27 +6658,46 @@ int MPLSensor::flush(int handle)
          LOGV_IF(PROCESS_VERBOSE, "HAL:flush - batch mode not enabled for sensor %s (handle %d)", sname.string(), handle);
     }
 
-    mFlushSensorEnabledVector.push_back(handle);
-
-    /*write sysfs */
-    LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:cat %s (%lld)",
-            mpu.flush_batch, getTimestamp());
-
-    status = read_sysfs_int(mpu.flush_batch, &res);
+    switch (mFlushTracker.add(handle)) {
+    case FlushTracker::FLUSH_INVALID:
+        LOGE("HAL:flush - can't track a flush of handle %d", handle);
+        return -EINVAL;
+    case FlushTracker::FLUSH_DEFERRED:
+        /* started again when the outstanding flush completes */
+        LOGV_IF(ENG_VERBOSE, "HAL:flush - handle %d waits for pending flush",
+                handle);
+        return 0;
+    default:
+        break;
+    }
 
-    if (status < 0)
+    status = flushFifo(&res);
+    if (status < 0) {
         LOGE("HAL: flush - error invoking flush_batch");
+        mFlushTracker.cancel(handle, 1);
+        return status;
+    }
 
     /* driver returns 0 if FIFO is empty */
     if (res == 0) {
         LOGV_IF(ENG_VERBOSE, "HAL: flush - no data in FIFO");
     }
 
-    LOGV_IF(ENG_VERBOSE, "HAl:flush - mFlushSensorEnabledVector=%d res=%d status=%d", handle, res, status);
+    LOGV_IF(ENG_VERBOSE, "HAl:flush - handle=%d res=%d status=%d", handle, res, status);
 
     return 0;
 }
 
+/* the driver pushes out the FIFO, followed by a marker */
+int MPLSensor::flushFifo(int *res)
+{
+    /*write sysfs */
+    LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:cat %s (%lld)",
+            mpu.flush_batch, getTimestamp());
+
+    return mSysfs.read(mpu.flush_batch, res);
+}
+
 int MPLSensor::selectAndSetQuaternion(int batchMode, int mEnabled, long long featureMask)
 {
     VFUNC_LOG;
@@ -6439,61 +6852,10 @@ int MPLSensor::readDmpPedometerEvents(sensors_event_t* data, int count,
         }
         break;
     case ID_SC:
-        FILE *fp;
-        uint64_t stepCount;
-        uint64_t stepCountTs;
-
         if (mDmpStepCountEnabled && count > 0) {
-            fp = fopen(mpu.pedometer_steps, "r");
-            if (fp == NULL) {
-                LOGE("HAL:cannot open pedometer_steps");
-            } else {
-                if (fscanf(fp, "%lld\n", &stepCount) < 0) {
-                    LOGV_IF(PROCESS_VERBOSE, "HAL:cannot read pedometer_steps");
-                    if (fclose(fp) < 0) {
-                       LOGW("HAL:cannot close pedometer_steps");
-                    }
-                    return 0;
-                }
-                if (fclose(fp) < 0) {
-                       LOGW("HAL:cannot close pedometer_steps");
-                }
-            }
-
-            /* return event onChange only */
-            if (stepCount == mLastStepCount) {
+            numEventReceived = readStepCount(data, count);
+            if (!numEventReceived)
                 return 0;
-            }
-
-            mLastStepCount = stepCount;
-
-            /* Read step count timestamp */
-            fp = fopen(mpu.pedometer_counter, "r");
-            if (fp == NULL) {
-                LOGE("HAL:cannot open pedometer_counter");
-            } else{
-                if (fscanf(fp, "%lld\n", &stepCountTs) < 0) {
-                    LOGE("HAL:cannot read pedometer_counter");
-                    if (fclose(fp) < 0) {
-                        LOGE("HAL:cannot close pedometer_counter");
-                    }
-                    return 0;
-                }
-                if (fclose(fp) < 0) {
-                        LOGE("HAL:cannot close pedometer_counter");
-                        return 0;
-                }
-            }
-            mScEvents.timestamp = stepCountTs;
-
-            /* Handles return event */
-            update = scHandler(&mScEvents);
-        }
-
-        if (update && count > 0) {
-            *data++ = mScEvents;
-            count--;
-            numEventReceived++;
         }
         break;
     }
@@ -6502,6 +6864,7 @@ int MPLSensor::readDmpPedometerEvents(sensors_event_t* data, int count,
         // read dummy data per driver's request
         // only required if actual irq is issued
         read(dmp_pedometer_fd, dummy, 4);
+        notifyStepCount();
     } else {
         return 1;
     }
@@ -6509,6 +6872,129 @@ int MPLSensor::readDmpPedometerEvents(sensors_event_t* data, int count,
     return numEventReceived;
 }
 
+/* read pedometer_steps, returns the step counter event if it changed */
+int MPLSensor::readStepCount(sensors_event_t* data, int count)
+{
+    VFUNC_LOG;
+
+    FILE *fp;
+    uint64_t stepCount;
+    uint64_t stepCountTs;
+    int update = 0;
+
+    fp = fopen(mpu.pedometer_steps, "r");
+    if (fp == NULL) {
+        LOGE("HAL:cannot open pedometer_steps");
+    } else {
+        if (fscanf(fp, "%lld\n", &stepCount) < 0) {
+            LOGV_IF(PROCESS_VERBOSE, "HAL:cannot read pedometer_steps");
+            if (fclose(fp) < 0) {
+               LOGW("HAL:cannot close pedometer_steps");
+            }
+            return 0;
+        }
+        if (fclose(fp) < 0) {
+               LOGW("HAL:cannot close pedometer_steps");
+        }
+    }
+
+    /* return event onChange only */
+    if (stepCount == mLastStepCount) {
+        return 0;
+    }
+
+    mLastStepCount = stepCount;
+
+    /* Read step count timestamp */
+    fp = fopen(mpu.pedometer_counter, "r");
+    if (fp == NULL) {
+        LOGE("HAL:cannot open pedometer_counter");
+    } else{
+        if (fscanf(fp, "%lld\n", &stepCountTs) < 0) {
+            LOGE("HAL:cannot read pedometer_counter");
+            if (fclose(fp) < 0) {
+                LOGE("HAL:cannot close pedometer_counter");
+            }
+            return 0;
+        }
+        if (fclose(fp) < 0) {
+                LOGE("HAL:cannot close pedometer_counter");
+                return 0;
+        }
+    }
+    mScEvents.timestamp = stepCountTs;
+
+    /* Handles return event */
+    update = scHandler(&mScEvents);
+
+    if (update && count > 0) {
+        *data = mScEvents;
+        return 1;
+    }
+    return 0;
+}
+
+bool MPLSensor::isStepCountEventDriven(void)
+{
+    return (mStepCountTimerFd >= 0 && dmp_pedometer_fd >= 0);
+}
+
+/* The step count only changes on a step, which comes in as a pedometer
+   interrupt or a step packet in the FIFO. A step arms the timer for when
+   the count is next due, further steps until then are folded into that
+   read. */
+void MPLSensor::notifyStepCount(void)
+{
+    VFUNC_LOG;
+
+    if (!mDmpStepCountEnabled || mStepCountTimerArmed ||
+            !isStepCountEventDriven())
+        return;
+
+    int64_t period = mStepCountPollTime > 0 ? mStepCountPollTime : 0;
+    armStepCountTimer(mt_pre_ns + period - android::elapsedRealtimeNano());
+}
+
+void MPLSensor::armStepCountTimer(int64_t delay)
+{
+    VFUNC_LOG;
+
+    /* a zero delay would disarm the timer */
+    if (delay < 1)
+        delay = 1;
+    if (armTimerFd(mStepCountTimerFd, delay) < 0) {
+        LOGE("HAL:ERR can't arm step count timer (%s)", strerror(errno));
+        return;
+    }
+    mStepCountTimerArmed = true;
+    LOGV_IF(PROCESS_VERBOSE, "HAL:step count due in %lld ns", delay);
+}
+
+void MPLSensor::disarmStepCountTimer(void)
+{
+    VFUNC_LOG;
+
+    armTimerFd(mStepCountTimerFd, 0);
+    mStepCountTimerArmed = false;
+}
+
+/* step count timer expired, report the count if it changed */
+int MPLSensor::readStepCountEvents(sensors_event_t* data, int count)
+{
+    VFUNC_LOG;
+
+    uint64_t expirations;
+
+    if (read(mStepCountTimerFd, &expirations, sizeof(expirations)) < 0)
+        return 0;
+    mStepCountTimerArmed = false;
+    mt_pre_ns = android::elapsedRealtimeNano();
+
+    if (!mDmpStepCountEnabled || count <= 0)
+        return 0;
+    return readStepCount(data, count);
+}
+
 int MPLSensor::getDmpSignificantMotionFd()
 {
     VFUNC_LOG;
@@ -6609,7 +7095,7 @@ int MPLSensor::enableDmpSignificantMotion(int en)
         LOGV_IF(ENG_VERBOSE, "HAL:Enabling Significant Motion");
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 1, mpu.smd_enable, getTimestamp());
-        if (write_sysfs_int(mpu.smd_enable, 1) < 0) {
+        if (mSysfs.write(mpu.smd_enable, 1) < 0) {
             LOGE("HAL:ERR can't write DMP smd_enable");
             res = -1;   //Indicate an err
         }
@@ -6619,7 +7105,7 @@ int MPLSensor::enableDmpSignificantMotion(int en)
         LOGV_IF(ENG_VERBOSE, "HAL:Disabling Significant Motion");
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 0, mpu.smd_enable, getTimestamp());
-        if (write_sysfs_int(mpu.smd_enable, 0) < 0) {
+        if (mSysfs.write(mpu.smd_enable, 0) < 0) {
             LOGE("HAL:ERR write DMP smd_enable");
         }
         mFeatureActiveMask &= ~INV_DMP_SIGNIFICANT_MOTION;
@@ -6691,16 +7177,16 @@ int MPLSensor::writeSignificantMotionParams(bool toggleEnable,
     // Write supplied values
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             delayThreshold1, mpu.smd_delay_threshold, getTimestamp());
-    res = write_sysfs_int(mpu.smd_delay_threshold, delayThreshold1);
+    res = mSysfs.write(mpu.smd_delay_threshold, delayThreshold1);
     if (res == 0) {
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 delayThreshold2, mpu.smd_delay_threshold2, getTimestamp());
-        res = write_sysfs_int(mpu.smd_delay_threshold2, delayThreshold2);
+        res = mSysfs.write(mpu.smd_delay_threshold2, delayThreshold2);
     }
     if (res == 0) {
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 motionThreshold, mpu.smd_threshold, getTimestamp());
-        res = write_sysfs_int(mpu.smd_threshold, motionThreshold);
+        res = mSysfs.write(mpu.smd_threshold, motionThreshold);
     }
 
     // Turn on enable
@@ -6715,7 +7201,6 @@ int MPLSensor::calcBatchDataRates(int64_t *gyro_rate, int64_t *accel_rate, int64
     VFUNC_LOG;
 
     int res = 0;
-    int tempFd = -1;
 
     int64_t gyroRate;
     int64_t accelRate;
@@ -6817,7 +7302,6 @@ int MPLSensor::MPLSensor::setBatchDataRates(int64_t gyroRate, int64_t accelRate,
     VFUNC_LOG;
 
     int res = 0;
-    int tempFd = -1;
 
     if ((mFeatureActiveMask & INV_DMP_PED_QUATERNION) ||
             (mFeatureActiveMask & INV_DMP_6AXIS_QUATERNION)) {
@@ -6828,8 +7312,7 @@ int MPLSensor::MPLSensor::setBatchDataRates(int64_t gyroRate, int64_t accelRate,
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
             1000000000.f / gyroRate, mpu.gyro_rate,
             getTimestamp());
-    tempFd = open(mpu.gyro_rate, O_RDWR);
-    res = write_attribute_sensor(tempFd, 1000000000.f / gyroRate);
+    res = mSysfs.write(mpu.gyro_rate, 1000000000.f / gyroRate);
     if(res < 0) {
         LOGE("HAL:GYRO update delay error");
     }
@@ -6838,8 +7321,7 @@ int MPLSensor::MPLSensor::setBatchDataRates(int64_t gyroRate, int64_t accelRate,
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
             1000000000.f / accelRate, mpu.accel_rate,
             getTimestamp());
-    tempFd = open(mpu.accel_rate, O_RDWR);
-    res = write_attribute_sensor(tempFd, 1000000000.f / accelRate);
+    res = mSysfs.write(mpu.accel_rate, 1000000000.f / accelRate);
     LOGE_IF(res < 0, "HAL:ACCEL update delay error");
 
     /* takes care of compass rate */
@@ -6887,7 +7369,6 @@ int MPLSensor::calctDataRates(int64_t *resetRate, int64_t *gyroRate, int64_t *ac
     VFUNC_LOG;
 
     int res = 0;
-    int tempFd = -1;
     int64_t wanted = 1000000000LL;
 
     if (!mEnabled) {
@@ -6924,7 +7405,6 @@ int MPLSensor::resetDataRates(int64_t resetRate, int64_t gyroRate, int64_t accel
     VFUNC_LOG;
 
     int res = 0;
-    int tempFd = -1;
     int64_t wanted;
 
     wanted = resetRate;
@@ -6957,16 +7437,14 @@ int MPLSensor::resetDataRates(int64_t resetRate, int64_t gyroRate, int64_t accel
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
             1000000000.f / wanted, mpu.gyro_fifo_rate,
             getTimestamp());
-    tempFd = open(mpu.gyro_fifo_rate, O_RDWR);
-    res = write_attribute_sensor(tempFd, 1000000000.f / wanted);
+    res = mSysfs.write(mpu.gyro_fifo_rate, 1000000000.f / wanted);
     LOGE_IF(res < 0, "HAL:sampling frequency update delay error");
 
     /* takes care of gyro rate */
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
             1000000000.f / gyroRate, mpu.gyro_rate,
             getTimestamp());
-    tempFd = open(mpu.gyro_rate, O_RDWR);
-    res = write_attribute_sensor(tempFd, 1000000000.f / gyroRate);
+    res = mSysfs.write(mpu.gyro_rate, 1000000000.f / gyroRate);
     if(res < 0) {
         LOGE("HAL:GYRO update delay error");
     }
@@ -6975,8 +7453,7 @@ int MPLSensor::resetDataRates(int64_t resetRate, int64_t gyroRate, int64_t accel
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
             1000000000.f / accelRate, mpu.accel_rate,
             getTimestamp());
-    tempFd = open(mpu.accel_rate, O_RDWR);
-    res = write_attribute_sensor(tempFd, 1000000000.f / accelRate);
+    res = mSysfs.write(mpu.accel_rate, 1000000000.f / accelRate);
     LOGE_IF(res < 0, "HAL:ACCEL update delay error");
 
     /* takes care of compass rate */
@@ -7106,6 +7583,64 @@ void MPLSensor::sys_dump(bool fileMode)
     read_sysfs_dir(fileMode, sysfs_path);
     read_sysfs_dir(fileMode, scan_element_path);
 
+    LOGI("HAL DEBUG:iio reads=%llu polls=%llu packets=%llu "
+         "(%.3f syscalls/packet)",
+         (unsigned long long)mIIOReadCount,
+         (unsigned long long)mPollCount,
+         (unsigned long long)mIIOPacketCount,
+         mIIOPacketCount ?
+             (double)(mIIOReadCount + mPollCount) / mIIOPacketCount : 0.0);
+
+    SysfsAttrCache::Stats stats;
+    mSysfs.getStats(&stats);
+    LOGI("HAL DEBUG:sysfs writes=%lu suppressed=%lu coalesced=%lu "
+         "reads=%lu opens=%lu",
+         stats.writes, stats.suppressed, stats.coalesced,
+         stats.reads, stats.opens);
+
+    LOGI("HAL DEBUG:reconfig windows=%lu max=%lld ns master_enable "
+         "calls=%lu writes=%lu",
+         mReconfigCount, mReconfigMaxTime,
+         mMasterEnableCalls, mMasterEnableWrites);
+    for (int i = 0; i < NumSensors; i++) {
+        if (!mActivationMaxLatency[i])
+            continue;
+        LOGI("HAL DEBUG:sensor %d activation last=%lld max=%lld ns",
+             i, mActivationLatency[i], mActivationMaxLatency[i]);
+    }
+
+    static const char *stages[LAT_NUM_STAGES] = {
+        "poll", "read", "build", "execute", "copy_out", "sample_out",
+        "temp_read"
+    };
+    for (int i = 0; i < LAT_NUM_STAGES; i++)
+        mLatency[i].dump(stages[i]);
+    for (int i = 0; i < NumSensors; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "handler%d", i);
+        mHandlerLatency[i].dump(name);
+    }
+
     dump_dmp_img("/data/local/read_img.h");
     return;
 }
+
+/* "setprop invn.hal.debug.dump <new value>" runs sys_dump(), checked at
+   most once a second while LATENCY_STATS is set */
+void MPLSensor::checkDumpRequest(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+    int64_t now = android::elapsedRealtimeNano();
+    int request;
+
+    if (now - mDumpCheckTime < 1000000000LL)
+        return;
+    mDumpCheckTime = now;
+
+    property_get("invn.hal.debug.dump", value, "0");
+    request = atoi(value);
+    if (request != mDumpRequest) {
+        mDumpRequest = request;
+        sys_dump(false);
+    }
+}
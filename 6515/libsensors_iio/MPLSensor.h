@@ -29,6 +29,11 @@
 #include "sensors.h"
 #include "SensorBase.h"
 #include "InputEventReader.h"
+#include "FifoPacketDecoder.h"
+#include "SysfsAttrCache.h"
+#include "FlushTracker.h"
+#include "SampleMerger.h"
+#include "LatencyHistogram.h"
 
 #ifndef INVENSENSE_COMPASS_CAL
 #pragma message("unified HAL for AKM")
@@ -125,25 +130,6 @@ class PressureSensor;
         | (INV_DMP_6AXIS_QUATERNION)                 \
 )
 
-// data header format used by kernel driver.
-#define DATA_FORMAT_STEP           0x0001
-#define DATA_FORMAT_MARKER         0x0010
-#define DATA_FORMAT_EMPTY_MARKER   0x0020
-#define DATA_FORMAT_PED_STANDALONE 0x0100
-#define DATA_FORMAT_PED_QUAT       0x0200
-#define DATA_FORMAT_6_AXIS         0x0400
-#define DATA_FORMAT_QUAT           0x0800
-#define DATA_FORMAT_COMPASS        0x1000
-#define DATA_FORMAT_COMPASS_OF     0x1800
-#define DATA_FORMAT_GYRO           0x2000
-#define DATA_FORMAT_ACCEL          0x4000
-#define DATA_FORMAT_PRESSURE       0x8000
-#define DATA_FORMAT_MASK           0xffff
-
-#define BYTES_PER_SENSOR                8
-#define BYTES_PER_SENSOR_PACKET         16
-#define QUAT_ONLY_LAST_PACKET_OFFSET    16
-#define BYTES_QUAT_DATA                 24
 #define MAX_READ_SIZE                   BYTES_QUAT_DATA
 #define MAX_SUSPEND_BATCH_PACKET_SIZE   1024
 #define MAX_PACKET_SIZE                 80 //8 * 4 + (2 * 24)
@@ -151,6 +137,9 @@ class PressureSensor;
 /* Uncomment to enable Low Power Quaternion */
 #define ENABLE_LP_QUAT_FEAT
 
+/* Drain the iio FIFO in bulk into mIIOBuffer instead of MAX_READ_SIZE reads */
+#define ENABLE_BULK_FIFO_READ
+
 /* Enable Pressure sensor support */
 #undef ENABLE_PRESSURE
 
@@ -184,6 +173,7 @@ public:
     virtual int enable(int32_t handle, int enabled);
     virtual int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
     virtual int flush(int handle);
+    int flushFifo(int *res);
     int selectAndSetQuaternion(int batchMode, int mEnabled, long long featureMask);
     int checkBatchEnabled();
     int setBatch(int en, int toggleEnable);
@@ -202,8 +192,27 @@ public:
     virtual bool hasStepCountPendingEvents();
     int populateSensorList(struct sensor_t *list, int len);
 
-    void buildCompassEvent();
+    bool buildCompassEvent();
+    bool buildMergedCompass();
     void buildMpuEvent();
+    bool hasBufferedMpuData() const;
+    bool hasBufferedCompassData() const;
+
+    /* hot path latency histograms, collected when LATENCY_STATS is set */
+    enum {
+        LAT_POLL_WAKEUP = 0,    // first sample timestamp to poll() return
+        LAT_FIFO_READ,          // read() of the iio buffer
+        LAT_BUILD,              // inv_build_*() for one packet
+        LAT_EXECUTE,            // inv_execute_on_data()
+        LAT_COPY_OUT,           // event ring to the framework buffer
+        LAT_SAMPLE_TO_OUT,      // sample timestamp to pollEvents() return
+        LAT_TEMP_READ,          // gyro temperature sysfs read
+        LAT_NUM_STAGES
+    };
+    void markPollWakeup(int64_t now) { mLatencyWakeup = now; }
+    void countPoll() { mPollCount++; }
+    void recordLatency(int stage, int64_t ns) { mLatency[stage].add(ns); }
+    void checkDumpRequest();
     int checkValidHeader(unsigned short data_format);
 
     int turnOffAccelFifo();
@@ -227,6 +236,10 @@ public:
     int enableDmpPedometer(int, int);
     int readDmpPedometerEvents(sensors_event_t* data, int count, int32_t id, int outputType);
     int getDmpPedometerFd();
+    int getStepCountTimerFd() { return mStepCountTimerFd; };
+    int getTempTimerFd() { return mTempTimerFd; };
+    int readTemperatureEvents(void);
+    int readStepCountEvents(sensors_event_t* data, int count);
     bool checkPedometerSupport() {return (mDmpPedometerEnabled || mDmpStepCountEnabled);};
     bool checkOrientationSupport() {return ((isDmpDisplayOrientationOn()
                                        && (mDmpOrientationEnabled
@@ -261,6 +274,11 @@ protected:
     int inv_constructor_default_enable();
     int setAccelInitialState();
     int masterEnable(int en);
+    int writeMasterEnable(int en);
+    bool inReconfig() const;
+    void beginReconfig();
+    int endReconfig();
+    void recordActivation(int what);
     int enablePedStandalone(int en);
     int enablePedStandaloneData(int en);
     int enablePedQuaternion(int);
@@ -286,6 +304,7 @@ protected:
     int computeBatchDataOutput();
     int enableSensors(unsigned long sensors, int en, uint32_t changed);
     int inv_read_temperature(long long *data);
+    void updateTemperature(void);
     int inv_read_dmp_state(int fd);
     int inv_read_sensor_bias(int fd, long *data);
     void inv_get_sensors_orientation(void);
@@ -306,6 +325,11 @@ protected:
     int checkLPQRateSupported();
     int checkLPQuaternion();
     int checkAccelPed();
+    bool isStepCountEventDriven();
+    void notifyStepCount(void);
+    void armStepCountTimer(int64_t delay);
+    void disarmStepCountTimer(void);
+    int readStepCount(sensors_event_t* data, int count);
     void setInitial6QuatValue();
     int writeSignificantMotionParams(bool toggleEnable,
                                      uint32_t delayThreshold1, uint32_t delayThreshold2,
@@ -321,6 +345,33 @@ protected:
     struct pollfd mPollFds[5];
     pthread_mutex_t mMplMutex;
     pthread_mutex_t mHALMutex;
+    SysfsAttrCache mSysfs;
+
+    /* enable(), setDelay() and batch() reprogram the chip in a single
+       master disable window, see beginReconfig() */
+    class ReconfigScope {
+    public:
+        ReconfigScope(MPLSensor *sensor) : mSensor(sensor) { mSensor->beginReconfig(); }
+        ~ReconfigScope() { mSensor->endReconfig(); }
+    private:
+        MPLSensor *mSensor;
+    };
+    int mReconfigDepth;
+    pthread_t mReconfigThread;
+    bool mReconfigMasterTouched;
+    bool mReconfigMasterOff;
+    bool mReconfigMasterOn;
+    bool mReconfigDelayDirty;
+    bool mReconfigApplying;
+    int64_t mReconfigStart;
+    unsigned long mReconfigCount;
+    unsigned long mMasterEnableCalls;
+    unsigned long mMasterEnableWrites;
+    /* chip left off or system suspended since the last master enable,
+       see writeMasterEnable() */
+    bool mChipIdle;
+    int64_t mSuspendTime;
+    int64_t mReconfigMaxTime;
 
     char mIIOBuffer[(16 + 8 * 3 + 8) * IIO_BUFFER_LENGTH];
 
@@ -353,11 +404,17 @@ protected:
     int dmp_pedometer_fd;
     int mDmpPedometerEnabled;
     int mDmpStepCountEnabled;
+    int mStepCountTimerFd;      // fires when the step count is due
+    bool mStepCountTimerArmed;
 
     uint32_t mEnabled;
     uint32_t mEnabledCached;
     uint32_t mBatchEnabled;
-    android::Vector<int> mFlushSensorEnabledVector;
+    FlushTracker mFlushTracker;     // flushes waiting for the FIFO marker
+    SampleMerger mCompassMerger;    // compass fd samples in MPU FIFO time order
+    enum { MergeMpu, MergeCompass };
+    int mFlushCompleteHandle;       // marker being reported
+    int mFlushCompleteCount;        // events still owed for it
     uint32_t mOldBatchEnabledMask;
     int64_t mBatchTimeoutInMs;
     sensors_event_t mPendingEvents[NumSensors];
@@ -369,6 +426,15 @@ protected:
     int64_t mBatchDelays[NumSensors];
     int64_t mBatchTimeouts[NumSensors];
     hfunc_t mHandlers[NumSensors];
+    /* enable() call to first event delivered */
+    int64_t mActivationStart[NumSensors];
+    int64_t mActivationLatency[NumSensors];
+    int64_t mActivationMaxLatency[NumSensors];
+    LatencyHistogram mLatency[LAT_NUM_STAGES];
+    LatencyHistogram mHandlerLatency[NumSensors];
+    int64_t mLatencyWakeup;
+    int64_t mDumpCheckTime;
+    int mDumpRequest;
     int64_t mEnabledTime[NumSensors];
     int64_t mLastTimestamp[NumSensors];
     short mCachedGyroData[3];
@@ -388,6 +454,9 @@ protected:
     short mTempScale;
     short mTempOffset;
     int64_t mTempCurrentTime;
+    int mTempTimerFd;                   // fires when a temperature read is due
+    long long mCachedTemperature[2];    // value, driver timestamp
+    bool mTempPending;                  // not passed to inv_build_temp() yet
     int mAccelScale;
     long mAccelSelfTestScale;
     long mGyroScale;
@@ -536,6 +605,11 @@ protected:
     uint64_t mLastStepCount;
     int mLeftOverBufferSize;
     char mLeftOverBuffer[1024];
+    int mIIOReadOffset;         // parse position in mIIOBuffer
+    int mIIOReadSize;           // valid bytes in mIIOBuffer
+    uint64_t mIIOReadCount;     // read() calls issued on iio_fd
+    uint64_t mIIOPacketCount;   // packets parsed from iio_fd
+    uint64_t mPollCount;        // poll() calls waiting for sensor data
     bool mInitial6QuatValueAvailable;
     long mInitial6QuatValue[4];
     int mFlushBatchSet;
@@ -0,0 +1,96 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <string.h>
+
+#include "SampleMerger.h"
+
+SampleMerger::SampleMerger()
+{
+    memset(mSources, 0, sizeof(mSources));
+}
+
+void SampleMerger::setActive(int source, bool active)
+{
+    mSources[source].active = active;
+}
+
+void SampleMerger::advance(int source, int64_t timestamp)
+{
+    if (timestamp > mSources[source].watermark)
+        mSources[source].watermark = timestamp;
+}
+
+void SampleMerger::reset(int source)
+{
+    mSources[source].head = mSources[source].tail = 0;
+    mSources[source].watermark = 0;
+}
+
+bool SampleMerger::push(int source, const Sample &sample)
+{
+    Source *src = &mSources[source];
+
+    if (src->tail - src->head == WINDOW)
+        return false;
+    src->ring[src->tail++ & (WINDOW - 1)] = sample;
+    advance(source, sample.timestamp);
+    return true;
+}
+
+bool SampleMerger::pop(int *source, Sample *sample)
+{
+    const Sample *oldest = NULL;
+    bool full = false;
+    int best = -1;
+
+    /* k-way merge: the smallest head over every source */
+    for (int i = 0; i < MAX_SOURCES; i++) {
+        const Source *src = &mSources[i];
+        if (src->head == src->tail)
+            continue;
+        if (src->tail - src->head == WINDOW)
+            full = true;
+        const Sample *head = &src->ring[src->head & (WINDOW - 1)];
+        if (!oldest || head->timestamp < oldest->timestamp) {
+            oldest = head;
+            best = i;
+        }
+    }
+    if (!oldest)
+        return false;
+
+    /* an active source behind it may still produce an older sample */
+    for (int i = 0; !full && i < MAX_SOURCES; i++) {
+        if (i != best && mSources[i].active &&
+            mSources[i].watermark < oldest->timestamp)
+            return false;
+    }
+
+    *source = best;
+    *sample = *oldest;
+    mSources[best].head++;
+    return true;
+}
+
+bool SampleMerger::empty() const
+{
+    for (int i = 0; i < MAX_SOURCES; i++) {
+        if (mSources[i].head != mSources[i].tail)
+            return false;
+    }
+    return true;
+}
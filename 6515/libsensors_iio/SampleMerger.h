@@ -0,0 +1,75 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef ANDROID_SAMPLE_MERGER_H
+#define ANDROID_SAMPLE_MERGER_H
+
+#include <stdint.h>
+
+/*
+ * Timestamp ordered merge of sample streams that are each in time order,
+ * such as the MPU FIFO and a compass on its own fd.
+ *
+ * A buffered sample is released once every other active source has
+ * reached its timestamp, so nothing older can still come from them. A
+ * source that fills its WINDOW forces its oldest sample out, which
+ * bounds the latency a stalled source adds. Sources consumed elsewhere
+ * only report their progress with advance().
+ *
+ * Not thread safe, everything runs from the poll loop.
+ */
+class SampleMerger {
+public:
+    enum {
+        MAX_SOURCES = 4,
+        /* power of 2, samples buffered per source */
+        WINDOW = 8,
+    };
+
+    struct Sample {
+        int64_t timestamp;
+        long data[3];
+        int status;
+    };
+
+    SampleMerger();
+
+    /* inactive sources hold nothing back */
+    void setActive(int source, bool active);
+    /* source has produced everything up to timestamp */
+    void advance(int source, int64_t timestamp);
+    /* drops what source still buffers */
+    void reset(int source);
+
+    /* false if the source window is full, pop() first */
+    bool push(int source, const Sample &sample);
+    /* oldest sample that can be released in time order */
+    bool pop(int *source, Sample *sample);
+    bool empty() const;
+
+private:
+    struct Source {
+        Sample ring[WINDOW];
+        uint32_t head;
+        uint32_t tail;
+        int64_t watermark;      // latest timestamp seen
+        bool active;
+    };
+
+    Source mSources[MAX_SOURCES];
+};
+
+#endif  // ANDROID_SAMPLE_MERGER_H
@@ -44,6 +44,7 @@ bool SensorBase::ENG_VERBOSE = false;
 bool SensorBase::INPUT_DATA = false;
 bool SensorBase::HANDLER_DATA = false;
 bool SensorBase::DEBUG_BATCHING = false;
+bool SensorBase::LATENCY_STATS = false;
 
 SensorBase::SensorBase(const char* dev_name,
                        const char* data_name) 
@@ -93,6 +94,10 @@ SensorBase::SensorBase(const char* dev_name,
     if (atoi(value)) {
         DEBUG_BATCHING = true;
     }
+    property_get("invn.hal.debug.latency", value, "0");
+    if (atoi(value)) {
+        LATENCY_STATS = true;
+    }
 }
 
 SensorBase::~SensorBase()
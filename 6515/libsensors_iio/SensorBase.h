@@ -66,6 +66,7 @@ public:
     static bool INPUT_DATA;        /* log the data input from the events */
     static bool HANDLER_DATA;      /* log the data fetched from the handlers */
     static bool DEBUG_BATCHING;    /* log the data for debugging batching */
+    static bool LATENCY_STATS;     /* collect hot path latency histograms */
 
 protected:
     const char *dev_name;
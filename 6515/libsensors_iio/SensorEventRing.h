@@ -0,0 +1,60 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef ANDROID_SENSOR_EVENT_RING_H
+#define ANDROID_SENSOR_EVENT_RING_H
+
+#include <stdint.h>
+#include <hardware/sensors.h>
+
+/*
+ * Single producer, single consumer ring of sensor events.
+ *
+ * The reader thread fills it in place: beginWrite() hands out the free
+ * slots up to the end of the buffer and endWrite() publishes the ones
+ * that were filled. pollEvents() copies events out with read(). Neither
+ * side takes a lock, the indices only ever grow and wrap at 2^32.
+ */
+class SensorEventRing {
+public:
+    enum {
+        CAPACITY = 1024,    /* power of 2 */
+    };
+
+    SensorEventRing();
+
+    /* producer */
+    int beginWrite(sensors_event_t **events);
+    void endWrite(int count);
+    uint32_t writeCount() const { return mTail; }
+
+    /* consumer */
+    int read(sensors_event_t *events, int count);
+    uint32_t readCount() const { return mHead; }
+
+    bool empty() const;
+    bool full() const;
+
+private:
+    /* each index is written by one side only, keep them on separate
+       cache lines */
+    uint32_t mHead;
+    char mPad[64 - sizeof(uint32_t)];
+    uint32_t mTail;
+    sensors_event_t mEvents[CAPACITY];
+};
+
+#endif  // ANDROID_SENSOR_EVENT_RING_H
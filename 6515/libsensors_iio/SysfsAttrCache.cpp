@@ -0,0 +1,290 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "SensorBase.h"
+#include "MPLSupport.h"
+#include "SysfsAttrCache.h"
+
+SysfsAttrCache::SysfsAttrCache()
+    : mNumAttrs(0),
+      mNumPending(0),
+      mInTransaction(false)
+{
+    pthread_mutex_init(&mLock, NULL);
+    memset(mAttrs, 0, sizeof(mAttrs));
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+SysfsAttrCache::~SysfsAttrCache()
+{
+    pthread_mutex_lock(&mLock);
+    flushPending();
+    for (int i = 0; i < mNumAttrs; i++) {
+        if (mAttrs[i].fd >= 0)
+            close(mAttrs[i].fd);
+    }
+    pthread_mutex_unlock(&mLock);
+    pthread_mutex_destroy(&mLock);
+}
+
+SysfsAttrCache::Attr *SysfsAttrCache::lookup(const char *path)
+{
+    int i;
+
+    /* callers pass the same sysfs_attrbs strings every time */
+    for (i = 0; i < mNumAttrs; i++) {
+        if (mAttrs[i].path == path)
+            return &mAttrs[i];
+    }
+    for (i = 0; i < mNumAttrs; i++) {
+        if (!strcmp(mAttrs[i].path, path))
+            return &mAttrs[i];
+    }
+    if (mNumAttrs == MAX_ATTRS)
+        return NULL;
+
+    Attr *attr = &mAttrs[mNumAttrs++];
+    attr->path = path;
+    attr->fd = -1;
+    attr->flags = 0;
+    attr->valid = false;
+    attr->value = 0;
+    return attr;
+}
+
+int SysfsAttrCache::openAttr(Attr *attr)
+{
+    if (attr->fd >= 0)
+        return attr->fd;
+
+    attr->fd = open(attr->path, O_RDWR);
+    if (attr->fd < 0)
+        attr->fd = open(attr->path, O_WRONLY);
+    if (attr->fd >= 0)
+        mStats.opens++;
+    return attr->fd;
+}
+
+int SysfsAttrCache::issue(Attr *attr, long long value)
+{
+    char buf[32];
+    int len, fd, err;
+
+    if (attr->valid && attr->value == value &&
+            !(attr->flags & FLAG_VOLATILE)) {
+        mStats.suppressed++;
+        LOGV_IF(SensorBase::SYSFS_VERBOSE, "HAL:sysfs:%s already %lld", attr->path, value);
+        return 0;
+    }
+
+    /* a missing attribute is not an error, same as write_sysfs_int() */
+    fd = openAttr(attr);
+    if (fd < 0)
+        return 0;
+
+    len = snprintf(buf, sizeof(buf), "%lld\n", value);
+    mStats.writes++;
+    if (pwrite(fd, buf, len, 0) < 0) {
+        err = errno;
+        attr->valid = false;
+        LOGE("HAL:ERR open file %s to write with error %d", attr->path, err);
+        return -err;
+    }
+    attr->valid = true;
+    attr->value = value;
+    return 0;
+}
+
+int SysfsAttrCache::flushPending(Failure *failed, int *numFailed)
+{
+    int res = 0, err;
+
+    if (numFailed)
+        *numFailed = 0;
+    for (int i = 0; i < mNumPending; i++) {
+        err = issue(mPending[i].attr, mPending[i].value);
+        if (err < 0 && res == 0)
+            res = err;
+        if (err < 0 && failed && numFailed) {
+            failed[*numFailed].path = mPending[i].attr->path;
+            failed[*numFailed].value = mPending[i].value;
+            failed[*numFailed].err = err;
+            (*numFailed)++;
+        }
+    }
+    mNumPending = 0;
+    return res;
+}
+
+int SysfsAttrCache::write(const char *path, long long value)
+{
+    int res = 0;
+
+    pthread_mutex_lock(&mLock);
+    Attr *attr = lookup(path);
+    if (attr == NULL) {
+        pthread_mutex_unlock(&mLock);
+        return write_sysfs_longlong((char *)path, value);
+    }
+
+    if (!mInTransaction || (attr->flags & FLAG_VOLATILE)) {
+        res = flushPending();
+        int err = issue(attr, value);
+        if (err < 0)
+            res = err;
+        pthread_mutex_unlock(&mLock);
+        return res;
+    }
+
+    /* a later write replaces the queued one and moves to the end */
+    for (int i = 0; i < mNumPending; i++) {
+        if (mPending[i].attr == attr) {
+            memmove(&mPending[i], &mPending[i + 1],
+                    (mNumPending - i - 1) * sizeof(mPending[0]));
+            mNumPending--;
+            mStats.coalesced++;
+            break;
+        }
+    }
+    if (mNumPending == MAX_PENDING)
+        res = flushPending();
+    mPending[mNumPending].attr = attr;
+    mPending[mNumPending].value = value;
+    mNumPending++;
+
+    pthread_mutex_unlock(&mLock);
+    return res;
+}
+
+int SysfsAttrCache::readAttr(const char *path, long long *value)
+{
+    char buf[32];
+    int fd, count, err;
+    bool cached = false;
+
+    Attr *attr = lookup(path);
+    flushPending();
+    mStats.reads++;
+
+    if (attr != NULL && openAttr(attr) >= 0) {
+        fd = attr->fd;
+        cached = true;
+    } else {
+        fd = open(path, O_RDONLY);
+    }
+    /* missing attribute, value left untouched as read_sysfs_int() does */
+    if (fd < 0)
+        return 0;
+
+    count = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (count < 0 && cached && errno == EBADF) {
+        /* attribute only opened for writing */
+        fd = open(path, O_RDONLY);
+        cached = false;
+        count = fd < 0 ? -1 : pread(fd, buf, sizeof(buf) - 1, 0);
+    }
+    err = errno;
+    if (!cached && fd >= 0)
+        close(fd);
+    if (count < 0) {
+        LOGE("HAL:ERR open file %s to read with error %d", path, err);
+        return -err;
+    }
+    buf[count] = '\0';
+    *value = strtoll(buf, NULL, 10);
+
+    if (attr != NULL && !(attr->flags & FLAG_VOLATILE)) {
+        attr->valid = true;
+        attr->value = *value;
+    }
+    return 0;
+}
+
+int SysfsAttrCache::read(const char *path, int *value)
+{
+    long long v;
+    int res;
+
+    pthread_mutex_lock(&mLock);
+    res = readAttr(path, &v);
+    pthread_mutex_unlock(&mLock);
+    if (res == 0)
+        *value = (int)v;
+    return res;
+}
+
+int SysfsAttrCache::read(const char *path, int64_t *value)
+{
+    long long v;
+    int res;
+
+    pthread_mutex_lock(&mLock);
+    res = readAttr(path, &v);
+    pthread_mutex_unlock(&mLock);
+    if (res == 0)
+        *value = v;
+    return res;
+}
+
+void SysfsAttrCache::setFlags(const char *path, int flags)
+{
+    pthread_mutex_lock(&mLock);
+    Attr *attr = lookup(path);
+    if (attr != NULL)
+        attr->flags = flags;
+    pthread_mutex_unlock(&mLock);
+}
+
+void SysfsAttrCache::begin()
+{
+    pthread_mutex_lock(&mLock);
+    mInTransaction = true;
+    pthread_mutex_unlock(&mLock);
+}
+
+int SysfsAttrCache::commit(Failure *failed, int *numFailed)
+{
+    int res;
+
+    pthread_mutex_lock(&mLock);
+    mInTransaction = false;
+    res = flushPending(failed, numFailed);
+    pthread_mutex_unlock(&mLock);
+    return res;
+}
+
+void SysfsAttrCache::invalidate()
+{
+    pthread_mutex_lock(&mLock);
+    for (int i = 0; i < mNumAttrs; i++)
+        mAttrs[i].valid = false;
+    pthread_mutex_unlock(&mLock);
+}
+
+void SysfsAttrCache::getStats(Stats *stats)
+{
+    pthread_mutex_lock(&mLock);
+    *stats = mStats;
+    pthread_mutex_unlock(&mLock);
+}
@@ -0,0 +1,122 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef ANDROID_SYSFS_ATTR_CACHE_H
+#define ANDROID_SYSFS_ATTR_CACHE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * Integer sysfs attributes of the iio device, kept open.
+ *
+ * The last value written to each attribute is remembered and writing the
+ * same value again is skipped. Between begin() and commit() writes are
+ * queued instead: a later write to the same attribute replaces the queued
+ * one and commit() issues what is left in the order it was last written.
+ * A read, or a write to a volatile attribute, issues the queue first.
+ *
+ * A queued write can't fail when it is made, its error comes back from
+ * commit(), which lists each write that failed. Writes issued early
+ * because of a read or a full queue report to the call that issued them.
+ */
+class SysfsAttrCache {
+public:
+    /* the driver acts on every write, never skip or queue them */
+    enum {
+        FLAG_VOLATILE = 1,
+    };
+
+    enum {
+        MAX_PENDING = 32,
+    };
+
+    /* a queued write the driver refused */
+    struct Failure {
+        const char *path;
+        long long value;
+        int err;
+    };
+
+    struct Stats {
+        unsigned long writes;       /* writes issued to the driver */
+        unsigned long suppressed;   /* same value as last written */
+        unsigned long coalesced;    /* replaced by a later queued write */
+        unsigned long reads;
+        unsigned long opens;
+    };
+
+    SysfsAttrCache();
+    ~SysfsAttrCache();
+
+    int write(const char *path, long long value);
+    int read(const char *path, int *value);
+    int read(const char *path, int64_t *value);
+    void setFlags(const char *path, int flags);
+
+    void begin();
+    /* failed, if given, holds MAX_PENDING entries and *numFailed how many
+       are set. Returns the first error */
+    int commit(Failure *failed = NULL, int *numFailed = NULL);
+    /* forget the remembered values, e.g. after the driver was reset.
+       Queued writes stay queued and are all issued */
+    void invalidate();
+
+    void getStats(Stats *stats);
+
+    /* commits the transaction on scope exit */
+    class Scope {
+    public:
+        Scope(SysfsAttrCache &cache) : mCache(cache) {}
+        ~Scope() { mCache.commit(); }
+    private:
+        SysfsAttrCache &mCache;
+    };
+
+private:
+    enum {
+        MAX_ATTRS = 128,
+    };
+
+    struct Attr {
+        const char *path;
+        int fd;
+        int flags;
+        bool valid;
+        long long value;
+    };
+
+    struct Pending {
+        Attr *attr;
+        long long value;
+    };
+
+    Attr *lookup(const char *path);
+    int openAttr(Attr *attr);
+    int issue(Attr *attr, long long value);
+    int flushPending(Failure *failed = NULL, int *numFailed = NULL);
+    int readAttr(const char *path, long long *value);
+
+    pthread_mutex_t mLock;
+    Attr mAttrs[MAX_ATTRS];
+    int mNumAttrs;
+    Pending mPending[MAX_PENDING];
+    int mNumPending;
+    bool mInTransaction;
+    Stats mStats;
+};
+
+#endif  // ANDROID_SYSFS_ATTR_CACHE_H
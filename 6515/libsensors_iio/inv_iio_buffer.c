@@ -0,0 +1,814 @@
+/*
+ * Copyright (C) 2017-2019 InvenSense, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+
+#include "inv_iio_buffer.h"
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define INV_IIO_BUFFER_SIMD
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define INV_IIO_BUFFER_SIMD
+#endif
+#endif
+
+#ifndef __ANDROID__
+static inline uint16_t betoh16(uint16_t val)
+{
+    return be16toh(val);
+}
+
+static inline uint16_t letoh16(uint16_t val)
+{
+    return le16toh(val);
+}
+
+static inline uint32_t betoh32(uint32_t val)
+{
+    return be32toh(val);
+}
+
+static inline uint32_t letoh32(uint32_t val)
+{
+    return le32toh(val);
+}
+
+static inline uint64_t betoh64(uint64_t val)
+{
+    return be64toh(val);
+}
+
+static inline uint64_t letoh64(uint64_t val)
+{
+    return le64toh(val);
+}
+#endif
+
+int inv_iio_buffer_scan_channel(const char *sysfs_enable, const char *sysfs_index, const char *sysfs_type,
+                                const char *sysfs_offset, const char *sysfs_scale,
+                                struct inv_iio_buffer_channel *channel)
+{
+    FILE *file;
+    int val;
+    double valf;
+    char endian, sign;
+    unsigned realbits, storagebits, shift;
+    int ret;
+
+    /* parse channel enable state */
+    file = fopen(sysfs_enable, "r");
+    if (file == NULL) {
+        goto error;
+    }
+    ret = fscanf(file, "%d", &val);
+    fclose(file);
+    if (ret != 1 || val < 0) {
+        goto error;
+    }
+    channel->is_enabled = val ? true : false;
+
+    /* parse channel index */
+    file = fopen(sysfs_index, "r");
+    if (file == NULL) {
+        goto error;
+    }
+    ret = fscanf(file, "%d", &val);
+    fclose(file);
+    if (ret != 1 || val < 0) {
+        goto error;
+    }
+    channel->index = val;
+
+    /* parse channel type, ex: le:s16/32>>8 */
+    file = fopen(sysfs_type, "r");
+    if (file == NULL) {
+        goto error;
+    }
+    ret = fscanf(file, "%ce:%c%u/%u>>%u", &endian, &sign, &realbits, &storagebits, &shift);
+    fclose(file);
+    if (ret != 5) {
+        goto error;
+    }
+    if (endian == 'b') {
+        channel->is_be = true;
+    } else if (endian == 'l') {
+        channel->is_be = false;
+    } else {
+        goto error;
+    }
+    if (sign == 's') {
+        channel->is_signed = true;
+    } else if (sign == 'u') {
+        channel->is_signed = false;
+    } else {
+        goto error;
+    }
+    if (realbits <= storagebits) {
+        channel->bits = realbits;
+    } else {
+        goto error;
+    }
+    switch (storagebits) {
+    case 8:
+    case 16:
+    case 24:
+    case 32:
+    case 64:
+        channel->size = storagebits / 8;
+        break;
+    default:
+        goto error;
+    }
+    if (shift < storagebits) {
+        channel->shift = shift;
+    } else {
+        goto error;
+    }
+
+    /* parse channel offset (optional) */
+    channel->offset = 0;
+    file = sysfs_offset ? fopen(sysfs_offset, "r") : NULL;
+    if (file != NULL) {
+        ret = fscanf(file, "%lf", &valf);
+        fclose(file);
+        if (ret == 1) {
+            channel->offset = valf;
+        }
+    }
+
+    /* parse channel scale (optional) */
+    channel->scale = 1.0;
+    file = sysfs_scale ? fopen(sysfs_scale, "r") : NULL;
+    if (file != NULL) {
+        ret = fscanf(file, "%lf", &valf);
+        fclose(file);
+        if (ret == 1) {
+            channel->scale = valf;
+        }
+    }
+
+    return 0;
+
+error:
+    // disable channel
+    channel->is_enabled = false;
+    return -1;
+}
+
+static inline uint8_t sample_get_u8(const struct inv_iio_buffer_channel *channel,
+                                    const void *addr)
+{
+    const uint8_t *d = addr;
+    uint8_t value;
+
+    value = *d;
+    value <<= sizeof(value) * 8 - channel->bits - channel->shift;
+    value >>= sizeof(value) * 8 - channel->bits;
+
+    return value;
+}
+
+static inline int8_t sample_get_s8(const struct inv_iio_buffer_channel *channel,
+                                   const void *addr)
+{
+    const int8_t *d = addr;
+    int8_t value;
+
+    value = *d;
+    value <<= sizeof(value) * 8 - channel->bits - channel->shift;
+    value >>= sizeof(value) * 8 - channel->bits;
+
+    return value;
+}
+
+static inline uint16_t sample_get_u16(const struct inv_iio_buffer_channel *channel,
+                                      const void *addr)
+{
+    uint16_t value;
+
+    memcpy(&value, addr, sizeof(value));
+    if (channel->is_be) {
+        value = betoh16(value);
+    } else {
+        value = letoh16(value);
+    }
+    value <<= sizeof(value) * 8 - channel->bits - channel->shift;
+    value >>= sizeof(value) * 8 - channel->bits;
+
+    return value;
+}
+
+static inline int16_t sample_get_s16(const struct inv_iio_buffer_channel *channel,
+                                     const void *addr)
+{
+    int16_t value;
+
+    memcpy(&value, addr, sizeof(value));
+    if (channel->is_be) {
+        value = betoh16(value);
+    } else {
+        value = letoh16(value);
+    }
+    value <<= sizeof(value) * 8 - channel->bits - channel->shift;
+    value >>= sizeof(value) * 8 - channel->bits;
+
+    return value;
+}
+
+
+static inline uint32_t sample_get_u24(const struct inv_iio_buffer_channel *channel,
+                                      const void *addr)
+{
+    uint32_t value = 0;
+    uint8_t *d;
+
+    if (channel->is_be) {
+        d = (uint8_t *)&value + 1;
+        memcpy(d, addr, 3);
+        value = betoh32(value);
+    } else {
+        d = (uint8_t *)&value;
+        memcpy(d, addr, 3);
+        value = letoh32(value);
+    }
+    value <<= sizeof(value) * 8 - channel->bits - channel->shift;
+    value >>= sizeof(value) * 8 - channel->bits;
+
+    return value;
+}
+
+static inline int32_t sample_get_s24(const struct inv_iio_buffer_channel *channel,
+                                     const void *addr)
+{
+    int32_t value = 0;
+    uint8_t *d;
+
+    if (channel->is_be) {
+        d = (uint8_t *)&value + 1;
+        memcpy(d, addr, 3);
+        value = betoh32(value);
+    } else {
+        d = (uint8_t *)&value;
+        memcpy(d, addr, 3);
+        value = letoh32(value);
+    }
+    value <<= sizeof(value) * 8 - channel->bits - channel->shift;
+    value >>= sizeof(value) * 8 - channel->bits;
+
+    return value;
+}
+
+static inline uint32_t sample_get_u32(const struct inv_iio_buffer_channel *channel,
+                                      const void *addr)
+{
+    uint32_t value;
+
+    memcpy(&value, addr, sizeof(value));
+    if (channel->is_be) {
+        value = betoh32(value);
+    } else {
+        value = letoh32(value);
+    }
+    value <<= sizeof(value) * 8 - channel->bits - channel->shift;
+    value >>= sizeof(value) * 8 - channel->bits;
+
+    return value;
+}
+
+static inline int32_t sample_get_s32(const struct inv_iio_buffer_channel *channel,
+                                     const void *addr)
+{
+    int32_t value;
+
+    memcpy(&value, addr, sizeof(value));
+    if (channel->is_be) {
+        value = betoh32(value);
+    } else {
+        value = letoh32(value);
+    }
+    value <<= sizeof(value) * 8 - channel->bits - channel->shift;
+    value >>= sizeof(value) * 8 - channel->bits;
+
+    return value;
+}
+
+static inline uint64_t sample_get_u64(const struct inv_iio_buffer_channel *channel,
+                                      const void *addr)
+{
+    uint64_t value;
+
+    memcpy(&value, addr, sizeof(value));
+    if (channel->is_be) {
+        value = betoh64(value);
+    } else {
+        value = letoh64(value);
+    }
+    value <<= sizeof(value) * 8 - channel->bits - channel->shift;
+    value >>= sizeof(value) * 8 - channel->bits;
+
+    return value;
+}
+
+static inline int64_t sample_get_s64(const struct inv_iio_buffer_channel *channel,
+                                     const void *addr)
+{
+    int64_t value;
+
+    memcpy(&value, addr, sizeof(value));
+    if (channel->is_be) {
+        value = betoh64(value);
+    } else {
+        value = letoh64(value);
+    }
+    value <<= sizeof(value) * 8 - channel->bits - channel->shift;
+    value >>= sizeof(value) * 8 - channel->bits;
+
+    return value;
+}
+
+int64_t inv_iio_buffer_channel_get_data(const struct inv_iio_buffer_channel *channel,
+                                        const void *addr)
+{
+    int64_t val;
+
+    switch (channel->size) {
+    case 1:
+        if (channel->is_signed) {
+            val = sample_get_s8(channel, addr);
+        } else {
+            val = sample_get_u8(channel, addr);
+        }
+        break;
+    case 2:
+        if (channel->is_signed) {
+            val = sample_get_s16(channel, addr);
+        } else {
+            val = sample_get_u16(channel, addr);
+        }
+        break;
+    case 3:
+        if (channel->is_signed) {
+            val = sample_get_s24(channel, addr);
+        } else {
+            val = sample_get_u24(channel, addr);
+        }
+        break;
+    case 4:
+        if (channel->is_signed) {
+            val = sample_get_s32(channel, addr);
+        } else {
+            val = sample_get_u32(channel, addr);
+        }
+        break;
+    case 8:
+        if (channel->is_signed) {
+            val = sample_get_s64(channel, addr);
+        } else {
+            val = sample_get_u64(channel, addr);
+        }
+        break;
+    default:
+        val = 0;
+        break;
+    }
+
+    return val;
+}
+
+/* true if the channel is a full width, unshifted little endian signed int */
+static bool channel_is_le_signed(const struct inv_iio_buffer_channel *channel,
+                                 size_t size)
+{
+    return channel->is_enabled && channel->is_signed && !channel->is_be &&
+           channel->size == size && channel->bits == size * 8 &&
+           channel->shift == 0;
+}
+
+static enum inv_iio_buffer_format layout_get_format(const struct inv_iio_buffer_layout *layout)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    const size_t last = layout->nb - 1;
+    size_t width, i;
+
+    if (layout->nb < 2 || !channel_is_le_signed(&layout->channels[last], 8)) {
+        return INV_IIO_BUFFER_FORMAT_GENERIC;
+    }
+    width = layout->channels[0].size;
+    if (width != 2 && width != 4) {
+        return INV_IIO_BUFFER_FORMAT_GENERIC;
+    }
+    for (i = 0; i < last; ++i) {
+        if (!channel_is_le_signed(&layout->channels[i], width) ||
+            layout->addresses[i] != (ssize_t)(i * width)) {
+            return INV_IIO_BUFFER_FORMAT_GENERIC;
+        }
+    }
+    /* timestamp right after the channels, aligned on 8 bytes */
+    if (layout->addresses[last] != (ssize_t)((last * width + 7) & ~(size_t)7)) {
+        return INV_IIO_BUFFER_FORMAT_GENERIC;
+    }
+
+    return width == 2 ? INV_IIO_BUFFER_FORMAT_S16_TS : INV_IIO_BUFFER_FORMAT_S32_TS;
+#else
+    (void)layout;
+    return INV_IIO_BUFFER_FORMAT_GENERIC;
+#endif
+}
+
+static void extract_generic(const struct inv_iio_buffer_channel *channel,
+                            const uint8_t *addr, size_t stride, size_t count,
+                            float scale, float offset, float *out)
+{
+    size_t n;
+
+    for (n = 0; n < count; ++n) {
+        out[n] = (float)inv_iio_buffer_channel_get_data(channel, addr) * scale + offset;
+        addr += stride;
+    }
+}
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+static void extract_le_s16(const struct inv_iio_buffer_channel *channel,
+                           const uint8_t *addr, size_t stride, size_t count,
+                           float scale, float offset, float *out)
+{
+    int16_t value;
+    size_t n;
+
+    (void)channel;
+    for (n = 0; n < count; ++n) {
+        memcpy(&value, addr, sizeof(value));
+        out[n] = (float)value * scale + offset;
+        addr += stride;
+    }
+}
+
+static void extract_le_s32(const struct inv_iio_buffer_channel *channel,
+                           const uint8_t *addr, size_t stride, size_t count,
+                           float scale, float offset, float *out)
+{
+    int32_t value;
+    size_t n;
+
+    (void)channel;
+    for (n = 0; n < count; ++n) {
+        memcpy(&value, addr, sizeof(value));
+        out[n] = (float)value * scale + offset;
+        addr += stride;
+    }
+}
+#endif
+
+static inv_iio_buffer_extract_t layout_get_extract(const struct inv_iio_buffer_channel *channel)
+{
+    if (!channel->is_enabled) {
+        return NULL;
+    }
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    if (channel_is_le_signed(channel, 2)) {
+        return extract_le_s16;
+    }
+    if (channel_is_le_signed(channel, 4)) {
+        return extract_le_s32;
+    }
+#endif
+    return extract_generic;
+}
+
+int inv_iio_buffer_layout_init(struct inv_iio_buffer_layout *layout, size_t nb)
+{
+    size_t size, align, addr;
+    size_t i, idx, max_index;
+
+    if (nb == 0 || nb > INV_IIO_BUFFER_MAX_CHANNELS) {
+        return -1;
+    }
+    layout->nb = nb;
+
+    /* compute scan size and alignment */
+    size = 0;
+    align = 0;
+    max_index = 0;
+    for (i = 0; i < nb; ++i) {
+        layout->addresses[i] = -1;
+        if (layout->channels[i].is_enabled) {
+            size += layout->channels[i].size;
+            if (layout->channels[i].size > align) {
+                align = layout->channels[i].size;
+            }
+            if (layout->channels[i].index > max_index) {
+                max_index = layout->channels[i].index;
+            }
+        }
+    }
+    if (align == 0) {
+        layout->size = 0;
+        layout->format = INV_IIO_BUFFER_FORMAT_GENERIC;
+        return -1;
+    }
+
+    /* channels are laid out by index, each aligned on its own size */
+    addr = 0;
+    for (idx = 0; idx <= max_index; ++idx) {
+        for (i = 0; i < nb; ++i) {
+            if (layout->channels[i].is_enabled &&
+                layout->channels[i].index == idx) {
+                size = layout->channels[i].size;
+                if (addr % size != 0) {
+                    addr += size - (addr % size);
+                }
+                layout->addresses[i] = addr;
+                addr += size;
+            }
+        }
+    }
+    /* scan must be a multiple of the alignment */
+    if (addr % align != 0) {
+        addr += align - (addr % align);
+    }
+    layout->size = addr;
+
+    layout->format = layout_get_format(layout);
+
+    for (i = 0; i < nb; ++i) {
+        layout->scales[i] = layout->channels[i].scale;
+        layout->offsets[i] = layout->channels[i].offset * layout->channels[i].scale;
+        layout->extract[i] = layout_get_extract(&layout->channels[i]);
+    }
+
+    return 0;
+}
+
+static size_t layout_decode_generic(const struct inv_iio_buffer_layout *layout,
+                                    const uint8_t *buf, size_t scans,
+                                    int64_t *data)
+{
+    size_t n, i;
+
+    for (n = 0; n < scans; ++n) {
+        for (i = 0; i < layout->nb; ++i) {
+            if (layout->addresses[i] < 0) {
+                data[i] = 0;
+            } else {
+                data[i] = inv_iio_buffer_channel_get_data(&layout->channels[i],
+                                                          &buf[layout->addresses[i]]);
+            }
+        }
+        buf += layout->size;
+        data += layout->nb;
+    }
+
+    return scans;
+}
+
+static size_t layout_decode_s16_ts(const struct inv_iio_buffer_layout *layout,
+                                   const uint8_t *buf, size_t scans,
+                                   int64_t *data)
+{
+    const size_t last = layout->nb - 1;
+    const size_t ts = layout->addresses[last];
+    int16_t values[INV_IIO_BUFFER_MAX_CHANNELS];
+    size_t n, i;
+
+    for (n = 0; n < scans; ++n) {
+        memcpy(values, buf, last * sizeof(values[0]));
+        for (i = 0; i < last; ++i) {
+            data[i] = values[i];
+        }
+        memcpy(&data[last], &buf[ts], sizeof(data[last]));
+        buf += layout->size;
+        data += layout->nb;
+    }
+
+    return scans;
+}
+
+static size_t layout_decode_s32_ts(const struct inv_iio_buffer_layout *layout,
+                                   const uint8_t *buf, size_t scans,
+                                   int64_t *data)
+{
+    const size_t last = layout->nb - 1;
+    const size_t ts = layout->addresses[last];
+    int32_t values[INV_IIO_BUFFER_MAX_CHANNELS];
+    size_t n, i;
+
+    for (n = 0; n < scans; ++n) {
+        memcpy(values, buf, last * sizeof(values[0]));
+        for (i = 0; i < last; ++i) {
+            data[i] = values[i];
+        }
+        memcpy(&data[last], &buf[ts], sizeof(data[last]));
+        buf += layout->size;
+        data += layout->nb;
+    }
+
+    return scans;
+}
+
+/* whole scans in size bytes, at most count */
+static inline size_t layout_get_scans(const struct inv_iio_buffer_layout *layout,
+                                      size_t size, size_t count)
+{
+    if (layout->size == 0) {
+        return 0;
+    }
+    /* skip the division when the buffer holds enough scans */
+    if (count <= size && count * layout->size <= size) {
+        return count;
+    }
+    return size / layout->size;
+}
+
+size_t inv_iio_buffer_layout_decode(const struct inv_iio_buffer_layout *layout,
+                                    const void *buf, size_t size,
+                                    int64_t *data, size_t count)
+{
+    size_t scans = layout_get_scans(layout, size, count);
+
+    switch (layout->format) {
+    case INV_IIO_BUFFER_FORMAT_S16_TS:
+        return layout_decode_s16_ts(layout, buf, scans, data);
+    case INV_IIO_BUFFER_FORMAT_S32_TS:
+        return layout_decode_s32_ts(layout, buf, scans, data);
+    default:
+        return layout_decode_generic(layout, buf, scans, data);
+    }
+}
+
+#ifdef INV_IIO_BUFFER_SIMD
+#if defined(__SSE2__)
+typedef __m128 vfloat;
+
+/* 4 le:s16 widened to float */
+static inline vfloat vload_s16(const uint8_t *addr)
+{
+    __m128i v = _mm_loadl_epi64((const __m128i *)addr);
+
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+}
+
+/* 4 le:s32 converted to float */
+static inline vfloat vload_s32(const uint8_t *addr)
+{
+    return _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)addr));
+}
+
+static inline vfloat vload(const float *p)
+{
+    return _mm_loadu_ps(p);
+}
+
+static inline vfloat vmuladd(vfloat v, vfloat scale, vfloat offset)
+{
+    return _mm_add_ps(_mm_mul_ps(v, scale), offset);
+}
+
+static inline void vstore(float *p, vfloat v)
+{
+    _mm_storeu_ps(p, v);
+}
+
+static inline void vtranspose(vfloat *r)
+{
+    _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+}
+#else
+typedef float32x4_t vfloat;
+
+static inline vfloat vload_s16(const uint8_t *addr)
+{
+    int16x4_t v = vreinterpret_s16_u8(vld1_u8(addr));
+
+    return vcvtq_f32_s32(vmovl_s16(v));
+}
+
+static inline vfloat vload_s32(const uint8_t *addr)
+{
+    return vcvtq_f32_s32(vreinterpretq_s32_u8(vld1q_u8(addr)));
+}
+
+static inline vfloat vload(const float *p)
+{
+    return vld1q_f32(p);
+}
+
+static inline vfloat vmuladd(vfloat v, vfloat scale, vfloat offset)
+{
+    return vmlaq_f32(offset, v, scale);
+}
+
+static inline void vstore(float *p, vfloat v)
+{
+    vst1q_f32(p, v);
+}
+
+static inline void vtranspose(vfloat *r)
+{
+    float32x4x2_t t01 = vtrnq_f32(r[0], r[1]);
+    float32x4x2_t t23 = vtrnq_f32(r[2], r[3]);
+
+    r[0] = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+    r[1] = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+    r[2] = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+    r[3] = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+}
+#endif
+
+/*
+ * Packed layouts with up to 4 data channels: every scan starts with one
+ * vector of channels, widened in one go. 4 scans are converted then
+ * transposed, each row being 4 values of one channel.
+ */
+static void layout_decode_float_packed(const struct inv_iio_buffer_layout *layout,
+                                       const uint8_t *buf, size_t scans,
+                                       float *const *data)
+{
+    const size_t last = layout->nb - 1;
+    const size_t stride = layout->size;
+    const bool s16 = layout->format == INV_IIO_BUFFER_FORMAT_S16_TS;
+    /* lanes past the data channels are computed but never stored */
+    const vfloat scale = vload(layout->scales);
+    const vfloat offset = vload(layout->offsets);
+    vfloat r[4];
+    size_t n, i, k;
+
+    for (n = 0; n + 4 <= scans; n += 4) {
+        for (k = 0; k < 4; ++k) {
+            const uint8_t *addr = &buf[(n + k) * stride];
+            r[k] = vmuladd(s16 ? vload_s16(addr) : vload_s32(addr), scale, offset);
+        }
+        vtranspose(r);
+        for (i = 0; i < last; ++i) {
+            if (data[i] != NULL) {
+                vstore(&data[i][n], r[i]);
+            }
+        }
+    }
+
+    /* leftover scans, one vector each */
+    for (; n < scans; ++n) {
+        const uint8_t *addr = &buf[n * stride];
+        float values[4];
+
+        vstore(values, vmuladd(s16 ? vload_s16(addr) : vload_s32(addr), scale, offset));
+        for (i = 0; i < last; ++i) {
+            if (data[i] != NULL) {
+                data[i][n] = values[i];
+            }
+        }
+    }
+}
+#endif
+
+size_t inv_iio_buffer_layout_decode_float(const struct inv_iio_buffer_layout *layout,
+                                          const void *buf, size_t size,
+                                          float *const *data, size_t count)
+{
+    const uint8_t *scan = buf;
+    size_t scans = layout_get_scans(layout, size, count);
+    size_t i, first = 0;
+
+#ifdef INV_IIO_BUFFER_SIMD
+    if (layout->format != INV_IIO_BUFFER_FORMAT_GENERIC && layout->nb <= 5) {
+        layout_decode_float_packed(layout, scan, scans, data);
+        /* only the timestamp remains */
+        first = layout->nb - 1;
+    }
+#endif
+
+    for (i = first; i < layout->nb; ++i) {
+        if (data[i] == NULL) {
+            continue;
+        }
+        if (layout->extract[i] == NULL) {
+            memset(data[i], 0, scans * sizeof(data[i][0]));
+            continue;
+        }
+        layout->extract[i](&layout->channels[i], &scan[layout->addresses[i]],
+                           layout->size, scans, layout->scales[i], layout->offsets[i],
+                           data[i]);
+    }
+
+    return scans;
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2017-2019 InvenSense, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INV_IIO_BUFFER_H_
+#define _INV_IIO_BUFFER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ *  struct inv_iio_buffer_channel - iio buffer channel data information
+ *  @is_enabled:	Is the channel enabled or not
+ *  @index:		Index ordering of the channel inside the buffer
+ *  @size:		Data size in bytes
+ *  @bits:		Number of used bits in the data
+ *  @shift:		Data number of bits to shift right
+ *  @is_signed:		Is data a signed number
+ *  @is_be:		Is data big endian or little endian
+ *  @offset:		Offset to apply to data
+ *  @scale:		Scale to apply to data after appyling offset
+ */
+struct inv_iio_buffer_channel {
+    bool is_enabled;
+    unsigned index;
+    size_t size;
+    size_t bits;
+    size_t shift;
+    bool is_signed;
+    bool is_be;
+    double offset;
+    double scale;
+};
+
+/**
+ * inv_iio_buffer_scan_channel - scan a channel information
+ * @sysfs_enable:	Path to sysfs scan_elements enable file
+ * @sysfs_index:	Path to sysfs scan_elements index file
+ * @sysfs_type:		Path to sysfs scan_elements type file
+ * @sysfs_offset:	Path to sysfs offset file, NULL for none
+ * @sysfs_scale:	Path to sysfs scale file, NULL for none
+ * @channel:		Channel data information structure to fill
+ */
+int inv_iio_buffer_scan_channel(const char *sysfs_enable, const char *sysfs_index, const char *sysfs_type,
+                                const char *sysfs_offset, const char *sysfs_scale,
+                                struct inv_iio_buffer_channel *channel);
+
+/**
+ * inv_iio_buffer_channel_get_data - extract data from a channel
+ * @channel:		Channel data information
+ * @addr:		Data address in the sample corresponding to this channel
+ * @return:		Data extracted from the sample
+ */
+int64_t inv_iio_buffer_channel_get_data(const struct inv_iio_buffer_channel *channel,
+                                        const void *addr);
+
+static inline double inv_iio_buffer_convert_data(const struct inv_iio_buffer_channel *channel,
+                                                 int64_t data)
+{
+    return ((double)data + channel->offset) * channel->scale;
+}
+
+#define INV_IIO_BUFFER_MAX_CHANNELS	8
+
+/**
+ *  enum inv_iio_buffer_format - decoding path selected for a scan layout
+ *  @INV_IIO_BUFFER_FORMAT_GENERIC:	any layout, per channel extraction
+ *  @INV_IIO_BUFFER_FORMAT_S16_TS:	le:s16/16>>0 channels packed from
+ *					offset 0, then a le:s64/64>>0 timestamp
+ *  @INV_IIO_BUFFER_FORMAT_S32_TS:	same with le:s32/32>>0 channels
+ */
+enum inv_iio_buffer_format {
+    INV_IIO_BUFFER_FORMAT_GENERIC,
+    INV_IIO_BUFFER_FORMAT_S16_TS,
+    INV_IIO_BUFFER_FORMAT_S32_TS,
+};
+
+/**
+ * inv_iio_buffer_extract_t - convert one channel of several scans to float
+ * @channel:		Channel data information
+ * @addr:		Channel data in the first scan
+ * @stride:		Scan size in bytes
+ * @count:		Number of scans
+ * @scale:		Channel scale
+ * @offset:		Channel offset times scale
+ * @out:		count converted values
+ */
+typedef void (*inv_iio_buffer_extract_t)(const struct inv_iio_buffer_channel *channel,
+                                         const uint8_t *addr, size_t stride, size_t count,
+                                         float scale, float offset, float *out);
+
+/**
+ *  struct inv_iio_buffer_layout - precompiled layout of an iio buffer scan
+ *  @channels:		Channels in the order decoded values are returned
+ *  @addresses:		Byte offset of each channel in a scan, -1 if disabled
+ *  @nb:		Number of channels
+ *  @size:		Scan size in bytes, padded to the largest channel
+ *  @format:		Decoding path, see enum inv_iio_buffer_format
+ *  @scales:		Channel scales as float
+ *  @offsets:		Channel offsets times scales as float
+ *  @extract:		Float extractor bound to each channel type
+ */
+struct inv_iio_buffer_layout {
+    struct inv_iio_buffer_channel channels[INV_IIO_BUFFER_MAX_CHANNELS];
+    ssize_t addresses[INV_IIO_BUFFER_MAX_CHANNELS];
+    size_t nb;
+    size_t size;
+    enum inv_iio_buffer_format format;
+    float scales[INV_IIO_BUFFER_MAX_CHANNELS];
+    float offsets[INV_IIO_BUFFER_MAX_CHANNELS];
+    inv_iio_buffer_extract_t extract[INV_IIO_BUFFER_MAX_CHANNELS];
+};
+
+/**
+ * inv_iio_buffer_layout_init - compute scan addresses, size and format
+ * @layout:		Layout whose channels[0..nb-1] were filled by
+ *			inv_iio_buffer_scan_channel()
+ * @nb:			Number of channels
+ * @return:		0 on success, -1 if no channel is enabled
+ *
+ * Call once each time the set of enabled channels changes.
+ */
+int inv_iio_buffer_layout_init(struct inv_iio_buffer_layout *layout, size_t nb);
+
+/**
+ * inv_iio_buffer_layout_decode - extract the channels of whole scans
+ * @layout:		Layout built by inv_iio_buffer_layout_init()
+ * @buf:		Scans as read from the iio device node
+ * @size:		Number of bytes in buf
+ * @data:		nb raw values per scan, 0 for disabled channels
+ * @count:		Maximum number of scans to decode
+ * @return:		Number of scans decoded, a partial scan is left alone
+ */
+size_t inv_iio_buffer_layout_decode(const struct inv_iio_buffer_layout *layout,
+                                    const void *buf, size_t size,
+                                    int64_t *data, size_t count);
+
+/**
+ * inv_iio_buffer_layout_decode_float - convert whole scans to float arrays
+ * @layout:		Layout built by inv_iio_buffer_layout_init()
+ * @buf:		Scans as read from the iio device node
+ * @size:		Number of bytes in buf
+ * @data:		One array of count floats per channel, offset and scale
+ *			applied. NULL entries are skipped, as should be 64 bits
+ *			timestamps which do not fit a float.
+ * @count:		Maximum number of scans to decode
+ * @return:		Number of scans decoded, a partial scan is left alone
+ */
+size_t inv_iio_buffer_layout_decode_float(const struct inv_iio_buffer_layout *layout,
+                                          const void *buf, size_t size,
+                                          float *const *data, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _INV_IIO_BUFFER_H_ */
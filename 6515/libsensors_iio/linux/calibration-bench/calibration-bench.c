@@ -0,0 +1,195 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "data_builder.h"
+#include "ml_math_func.h"
+
+/* the MPL logs through this outside of Android */
+int _MLPrintLog(int priority, const char *tag, const char *fmt, ...)
+{
+    va_list args;
+    int ret;
+
+    (void)priority;
+    fprintf(stderr, "%s: ", tag);
+    va_start(args, fmt);
+    ret = vfprintf(stderr, fmt, args);
+    va_end(args);
+    return ret;
+}
+
+/* inv_apply_calibration() as it was before the transform was precomputed:
+   the orientation is decoded twice per sample */
+static void apply_calibration_orig(struct inv_single_sensor_t *sensor,
+                                   const long *bias)
+{
+    long raw32[3];
+
+    raw32[0] = (long)sensor->raw[0] << 15;
+    raw32[1] = (long)sensor->raw[1] << 15;
+    raw32[2] = (long)sensor->raw[2] << 15;
+
+    inv_convert_to_body_with_scale(sensor->orientation,
+                                   sensor->sensitivity << 1, raw32,
+                                   sensor->raw_scaled);
+
+    raw32[0] -= bias[0] >> 1;
+    raw32[1] -= bias[1] >> 1;
+    raw32[2] -= bias[2] >> 1;
+
+    inv_convert_to_body_with_scale(sensor->orientation,
+                                   sensor->sensitivity << 1, raw32,
+                                   sensor->calibrated);
+
+    sensor->status |= INV_CALIBRATED;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static short samples[4096][3];
+static long bias[3];
+
+static void load_sample(struct inv_single_sensor_t *sensor, int i)
+{
+    memcpy(sensor->raw, samples[i & 4095], sizeof(sensor->raw));
+}
+
+/* 48 valid orientations: each row picks a distinct column and a sign */
+static int orientations(int *list)
+{
+    static const int perm[6][3] = {
+        {0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}
+    };
+    int p, s, k, count = 0;
+
+    for (p = 0; p < 6; p++) {
+        for (s = 0; s < 8; s++) {
+            int orientation = 0;
+
+            for (k = 0; k < 3; k++) {
+                orientation |= perm[p][k] << (3 * k);
+                if (s & (1 << k))
+                    orientation |= 0x004 << (3 * k);
+            }
+            list[count++] = orientation;
+        }
+    }
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    /* an MPU6515 gyro at 2000 dps */
+    const long sensitivity = 2000L << 15;
+    struct inv_single_sensor_t ref, out;
+    struct inv_sensor_transform_t transform;
+    int list[48], count;
+    long samples_count = 10000000;
+    int i, k, opt, failed = 0;
+    volatile long sink = 0;
+    int64_t start;
+    double orig_ns, fused_ns;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            samples_count = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n samples]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (samples_count < 1) {
+        fprintf(stderr, "bad sample count\n");
+        return 1;
+    }
+
+    srand(1);
+    for (i = 0; i < 4096; i++)
+        for (k = 0; k < 3; k++)
+            samples[i][k] = (short)(rand() & 0xffff);
+    for (k = 0; k < 3; k++)
+        bias[k] = (long)(rand() % (1 << 24)) - (1 << 23);
+
+    /* every orientation, every sample, against the original */
+    count = orientations(list);
+    for (i = 0; i < count; i++) {
+        memset(&ref, 0, sizeof(ref));
+        ref.orientation = list[i];
+        ref.sensitivity = sensitivity;
+        out = ref;
+        inv_init_sensor_transform(&transform, list[i], sensitivity);
+        for (k = 0; k < 4096; k++) {
+            load_sample(&ref, k);
+            load_sample(&out, k);
+            apply_calibration_orig(&ref, bias);
+            inv_apply_calibration(&out, &transform, bias);
+            if (memcmp(ref.raw_scaled, out.raw_scaled,
+                       sizeof(ref.raw_scaled)) ||
+                memcmp(ref.calibrated, out.calibrated,
+                       sizeof(ref.calibrated))) {
+                printf("orientation 0x%03x sample %d: MISMATCH\n",
+                       list[i], k);
+                failed = 1;
+                break;
+            }
+        }
+    }
+    printf("%d orientations x 4096 samples: %s\n", count,
+           failed ? "MISMATCH" : "exact");
+
+    /* YZX with the second row negated */
+    memset(&out, 0, sizeof(out));
+    out.orientation = 0x0a1;
+    out.sensitivity = sensitivity;
+    inv_init_sensor_transform(&transform, out.orientation, sensitivity);
+
+    start = now_ns();
+    for (i = 0; i < samples_count; i++) {
+        load_sample(&out, i);
+        apply_calibration_orig(&out, bias);
+        sink += out.calibrated[0];
+    }
+    orig_ns = (double)(now_ns() - start) / samples_count;
+
+    start = now_ns();
+    for (i = 0; i < samples_count; i++) {
+        load_sample(&out, i);
+        inv_apply_calibration(&out, &transform, bias);
+        sink += out.calibrated[0];
+    }
+    fused_ns = (double)(now_ns() - start) / samples_count;
+
+    printf("%-8s %7.2f ns/sample %12.0f samples/s\n", "before",
+           orig_ns, 1e9 / orig_ns);
+    printf("%-8s %7.2f ns/sample %12.0f samples/s %5.2fx\n", "after",
+           fused_ns, 1e9 / fused_ns, orig_ns / fused_ns);
+    return failed;
+}
@@ -0,0 +1,323 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <float.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "data_builder.h"
+#include "hal_outputs.h"
+#include "ml_math_batch.h"
+#include "ml_math_func.h"
+#include "results_holder.h"
+
+/* documented bound of inv_atan2f_fast() and inv_asinf_fast() */
+#define MAX_ERROR_RAD 3e-6
+/* the same in degrees, plus float rounding of angles up to 360 */
+#define MAX_ERROR_DEG (MAX_ERROR_RAD * 180.0 / M_PI + 360.0 * FLT_EPSILON)
+
+/* the MPL logs through this outside of Android */
+int _MLPrintLog(int priority, const char *tag, const char *fmt, ...)
+{
+    va_list args;
+    int ret;
+
+    (void)priority;
+    fprintf(stderr, "%s: ", tag);
+    va_start(args, fmt);
+    ret = vfprintf(stderr, fmt, args);
+    va_end(args);
+    return ret;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* difference of two angles in degrees, across the 0/360 and -180/180
+   wrap */
+static double angle_diff(double a, double b)
+{
+    double d = fmod(fabs(a - b), 360.0);
+
+    return d > 180.0 ? 360.0 - d : d;
+}
+
+/* the functions on their own, against double precision libm */
+static int check_functions(void)
+{
+    double err, atan2_max = 0, asin_max = 0;
+    int i, j;
+
+    for (i = 0; i < 100000; i++) {
+        double angle = -M_PI + 2 * M_PI * i / 100000;
+
+        for (j = -6; j <= 6; j += 3) {
+            float r = powf(10.f, (float)j);
+            float y = (float)(sin(angle) * r), x = (float)(cos(angle) * r);
+
+            err = fabs(inv_atan2f_fast(y, x) - atan2((double)y, (double)x));
+            if (err > M_PI)
+                err = 2 * M_PI - err;
+            if (err > atan2_max)
+                atan2_max = err;
+        }
+    }
+    for (i = -1000000; i <= 1000000; i++) {
+        float x = (float)i / 1000000;
+
+        err = fabs(inv_asinf_fast(x) - asin((double)x));
+        if (err > asin_max)
+            asin_max = err;
+    }
+    printf("atan2 max error %.3g rad, asin max error %.3g rad\n",
+           atan2_max, asin_max);
+    return atan2_max > MAX_ERROR_RAD || asin_max > MAX_ERROR_RAD;
+}
+
+/* the data callback that copies the 9-axis quaternion into hal_outputs,
+   not exported through hal_outputs.h */
+inv_error_t inv_generate_hal_outputs(struct inv_sensor_cal_t *sensor_cal);
+
+/* orientation of n quaternions, one sample at a time through the same
+   calls an MPL pass makes */
+static void orientation(const long *quat, int n, float *out)
+{
+    static struct inv_sensor_cal_t cal;
+    float quat_float[4];
+    int8_t accuracy;
+    inv_time_t timestamp;
+    int i, k;
+
+    for (i = 0; i < n; i++) {
+        for (k = 0; k < 4; k++)
+            quat_float[k] = quat[i * 4 + k] * (1.f / (1L << 30));
+        inv_store_nav_quaternion(quat_float, 0);
+        inv_generate_hal_outputs(&cal);
+        inv_get_sensor_type_orientation(out + i * 3, &accuracy, &timestamp);
+    }
+}
+
+/* compares inv_get_hal_outputs_batch() with the single sample getters
+   for every quaternion, bit for bit, on every batch instruction set the
+   CPU has */
+static int check_batch(const long *quat, int n)
+{
+    static struct inv_sensor_cal_t cal;
+    struct inv_hal_batch_out_t *batch, ref;
+    float quat_float[4], heading;
+    long *accel;
+    int8_t accuracy;
+    inv_time_t timestamp;
+    int isa, trig, i, k, mismatch = 0;
+
+    batch = calloc(n, sizeof(*batch));
+    accel = calloc(n * 3, sizeof(*accel));
+    if (!batch || !accel) {
+        free(batch);
+        free(accel);
+        return 1;
+    }
+    /* +-4g, 1g = 2^16 */
+    for (i = 0; i < n * 3; i++)
+        accel[i] = (long)((i * 2654435761u) >> 8) % (8L << 16) - (4L << 16);
+    heading = inv_get_heading_confidence_interval();
+
+    for (isa = 0; isa < INV_MATH_BATCH_NUM_ISA; isa++) {
+        if (!inv_math_batch_isa_supported(isa))
+            continue;
+        inv_set_math_batch_isa(isa);
+        for (trig = 0; trig <= 1; trig++) {
+            inv_set_fast_trig(trig);
+            inv_get_hal_outputs_batch(quat, accel, n,
+                                      INV_HAL_OUT_ROTATION_VECTOR |
+                                      INV_HAL_OUT_GRAVITY |
+                                      INV_HAL_OUT_LINEAR_ACCELERATION |
+                                      INV_HAL_OUT_ORIENTATION,
+                                      heading, batch);
+            for (i = 0; i < n; i++) {
+                for (k = 0; k < 4; k++)
+                    quat_float[k] = quat[i * 4 + k] * (1.f / (1L << 30));
+                inv_store_nav_quaternion(quat_float, 0);
+                inv_build_accel(accel + i * 3, INV_CALIBRATED, i);
+                inv_generate_hal_outputs(&cal);
+                inv_get_sensor_type_rotation_vector(ref.rotation_vector,
+                                                    &accuracy, &timestamp);
+                inv_get_sensor_type_gravity(ref.gravity, &accuracy,
+                                            &timestamp);
+                inv_get_sensor_type_linear_acceleration(
+                    ref.linear_acceleration, &accuracy, &timestamp);
+                inv_get_sensor_type_orientation(ref.orientation, &accuracy,
+                                                &timestamp);
+                if (memcmp(&ref, batch + i, sizeof(ref)))
+                    mismatch++;
+            }
+            printf("batch outputs, %-6s %s trig: %d of %d samples differ\n",
+                   inv_math_batch_isa_name(isa), trig ? "fast" : "libm",
+                   mismatch, n);
+            if (mismatch)
+                break;
+        }
+        if (mismatch)
+            break;
+    }
+    inv_set_math_batch_isa(INV_MATH_BATCH_SCALAR);
+    inv_set_fast_trig(0);
+    free(batch);
+    free(accel);
+    return mismatch != 0;
+}
+
+/* quaternions on a grid over the whole unit sphere, Hopf coordinates.
+   The components are rounded to float precision, so that the float
+   quaternion the MPL stores holds them exactly. */
+static long *sphere(int steps, int *count)
+{
+    long *quat;
+    int a, b, c, n = 0;
+
+    quat = malloc(sizeof(long) * 4 * steps * steps * (steps / 2 + 1));
+    if (!quat)
+        return NULL;
+    for (c = 0; c <= steps / 2; c++) {
+        double chi = M_PI / 2 * c / (steps / 2);
+
+        for (a = 0; a < steps; a++) {
+            double psi1 = 2 * M_PI * a / steps;
+
+            for (b = 0; b < steps; b++) {
+                double psi2 = 2 * M_PI * b / steps;
+
+                quat[n * 4 + 0] =
+                    (long)(float)(cos(chi) * cos(psi1) * 1073741823.);
+                quat[n * 4 + 1] =
+                    (long)(float)(cos(chi) * sin(psi1) * 1073741823.);
+                quat[n * 4 + 2] =
+                    (long)(float)(sin(chi) * cos(psi2) * 1073741823.);
+                quat[n * 4 + 3] =
+                    (long)(float)(sin(chi) * sin(psi2) * 1073741823.);
+                n++;
+            }
+        }
+    }
+    *count = n;
+    return quat;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *names[3] = { "azimuth", "pitch", "roll" };
+    float *ref, *out;
+    struct inv_hal_batch_out_t *batch;
+    double err, max[3] = { 0, 0, 0 }, libm_ns, fast_ns, batch_ns;
+    int steps = 128, loops = 10;
+    int n, i, k, opt, failed;
+    long *quat;
+    int64_t start;
+
+    while ((opt = getopt(argc, argv, "s:l:")) != -1) {
+        switch (opt) {
+        case 's':
+            steps = atoi(optarg);
+            break;
+        case 'l':
+            loops = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s grid steps] [-l loops]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (steps < 2 || loops < 1) {
+        fprintf(stderr, "bad grid step or loop count\n");
+        return 1;
+    }
+
+    failed = check_functions();
+
+    quat = sphere(steps, &n);
+    ref = calloc(n * 3, sizeof(*ref));
+    out = calloc(n * 3, sizeof(*out));
+    batch = calloc(n, sizeof(*batch));
+    if (!quat || !ref || !out || !batch) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    if (check_batch(quat, n))
+        failed = 1;
+
+    inv_set_fast_trig(0);
+    orientation(quat, n, ref);
+    inv_set_fast_trig(1);
+    orientation(quat, n, out);
+    for (i = 0; i < n; i++) {
+        for (k = 0; k < 3; k++) {
+            err = angle_diff(ref[i * 3 + k], out[i * 3 + k]);
+            if (err > max[k])
+                max[k] = err;
+        }
+    }
+    for (k = 0; k < 3; k++) {
+        printf("%d quaternions: %-7s max error %.3g degree\n", n, names[k],
+               max[k]);
+        if (max[k] > MAX_ERROR_DEG)
+            failed = 1;
+    }
+
+    inv_set_fast_trig(0);
+    start = now_ns();
+    for (i = 0; i < loops; i++)
+        orientation(quat, n, out);
+    libm_ns = (double)(now_ns() - start) / ((double)loops * n);
+
+    inv_set_fast_trig(1);
+    start = now_ns();
+    for (i = 0; i < loops; i++)
+        orientation(quat, n, out);
+    fast_ns = (double)(now_ns() - start) / ((double)loops * n);
+
+    start = now_ns();
+    for (i = 0; i < loops; i++)
+        inv_get_hal_outputs_batch(quat, NULL, n, INV_HAL_OUT_ORIENTATION, 0,
+                                  batch);
+    batch_ns = (double)(now_ns() - start) / ((double)loops * n);
+    inv_set_fast_trig(0);
+
+    printf("%-8s %7.2f ns/sample %12.0f samples/s\n", "libm",
+           libm_ns, 1e9 / libm_ns);
+    printf("%-8s %7.2f ns/sample %12.0f samples/s %5.2fx\n", "fast",
+           fast_ns, 1e9 / fast_ns, libm_ns / fast_ns);
+    printf("%-8s %7.2f ns/sample %12.0f samples/s %5.2fx\n", "batch",
+           batch_ns, 1e9 / batch_ns, libm_ns / batch_ns);
+    printf("%s\n", failed ? "ERROR BOUND EXCEEDED" : "within error bound");
+
+    free(quat);
+    free(ref);
+    free(out);
+    free(batch);
+    return failed;
+}
@@ -0,0 +1,224 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "FifoPacketDecoder.h"
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void put_packet(std::vector<char> &buf, unsigned short header,
+                       size_t size, int64_t ts)
+{
+    size_t off = buf.size();
+
+    buf.resize(off + size);
+    memset(&buf[off], 0, size);
+    memcpy(&buf[off], &header, sizeof(header));
+    if (size > 8)
+        memcpy(&buf[off + size - sizeof(ts)], &ts, sizeof(ts));
+}
+
+/* 200Hz gyro + accel + 6 axis quaternion, compass at 50Hz.
+   With batching enabled the driver interleaves sensors running at
+   different rates, shuffle mimics that ordering. */
+static void synthesize(std::vector<char> &buf, unsigned int samples,
+                       bool shuffle)
+{
+    static const struct {
+        unsigned short header;
+        size_t size;
+    } packets[] = {
+        { DATA_FORMAT_GYRO,      BYTES_PER_SENSOR_PACKET },
+        { DATA_FORMAT_ACCEL,     BYTES_PER_SENSOR_PACKET },
+        { DATA_FORMAT_6_AXIS,    BYTES_QUAT_DATA },
+        { DATA_FORMAT_COMPASS,   BYTES_PER_SENSOR_PACKET },
+        { DATA_FORMAT_PED_QUAT,  BYTES_PER_SENSOR_PACKET },
+        { DATA_FORMAT_PRESSURE,  BYTES_PER_SENSOR_PACKET },
+    };
+    int64_t ts = 0;
+
+    srand(1);
+    for (unsigned int i = 0; i < samples; i++) {
+        ts += 5000000LL;
+        if (shuffle) {
+            for (unsigned int j = 0; j < 4; j++) {
+                unsigned int k = rand() % (sizeof(packets) / sizeof(packets[0]));
+                put_packet(buf, packets[k].header, packets[k].size, ts);
+            }
+            continue;
+        }
+        put_packet(buf, DATA_FORMAT_GYRO, BYTES_PER_SENSOR_PACKET, ts);
+        put_packet(buf, DATA_FORMAT_ACCEL, BYTES_PER_SENSOR_PACKET, ts);
+        put_packet(buf, DATA_FORMAT_6_AXIS, BYTES_QUAT_DATA, ts);
+        if ((i % 4) == 0)
+            put_packet(buf, DATA_FORMAT_COMPASS, BYTES_PER_SENSOR_PACKET, ts);
+    }
+    put_packet(buf, DATA_FORMAT_MARKER, BYTES_PER_SENSOR, 0);
+}
+
+static int load(std::vector<char> &buf, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    char chunk[4096];
+    size_t n;
+
+    if (fp == NULL) {
+        perror(path);
+        return -1;
+    }
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        buf.insert(buf.end(), chunk, chunk + n);
+    fclose(fp);
+    return 0;
+}
+
+/* header chain the HAL used before the descriptor table */
+static ssize_t legacy_decode(const char *buf, size_t len, unsigned int *sum)
+{
+    unsigned short header = inv_fifo_header(buf);
+    unsigned short data_format = header;
+    size_t size;
+
+    if (len < sizeof(header))
+        return 0;
+    if (header != DATA_FORMAT_STEP)
+        data_format = header & (~DATA_FORMAT_STEP);
+
+    if (data_format == DATA_FORMAT_STEP) {
+        size = BYTES_PER_SENSOR_PACKET;
+    } else if (data_format == DATA_FORMAT_MARKER) {
+        size = BYTES_PER_SENSOR;
+    } else if (data_format == DATA_FORMAT_EMPTY_MARKER) {
+        size = BYTES_PER_SENSOR;
+    } else if (data_format == DATA_FORMAT_PED_STANDALONE) {
+        size = BYTES_PER_SENSOR_PACKET;
+    } else if (data_format == DATA_FORMAT_PED_QUAT) {
+        size = BYTES_PER_SENSOR_PACKET;
+    } else if (data_format == DATA_FORMAT_6_AXIS) {
+        size = BYTES_QUAT_DATA;
+    } else if (data_format == DATA_FORMAT_QUAT) {
+        size = BYTES_QUAT_DATA;
+    } else if (data_format == DATA_FORMAT_COMPASS) {
+        size = BYTES_PER_SENSOR_PACKET;
+    } else if (data_format == DATA_FORMAT_COMPASS_OF) {
+        size = BYTES_PER_SENSOR;
+    } else if (data_format == DATA_FORMAT_GYRO) {
+        size = BYTES_PER_SENSOR_PACKET;
+    } else if (data_format == DATA_FORMAT_ACCEL) {
+        size = BYTES_PER_SENSOR_PACKET;
+    } else if (data_format == DATA_FORMAT_PRESSURE) {
+        size = BYTES_PER_SENSOR_PACKET;
+    } else {
+        return -1;
+    }
+    if (len < size)
+        return 0;
+    *sum += data_format;
+    return size;
+}
+
+static ssize_t table_decode(const char *buf, size_t len, unsigned int *sum)
+{
+    struct inv_fifo_packet packet;
+    ssize_t size = inv_fifo_decode(buf, len, &packet);
+
+    if (size > 0)
+        *sum += packet.desc->header;
+    return size;
+}
+
+static double run(const char *name, const std::vector<char> &buf,
+                  unsigned int loops,
+                  ssize_t (*decode)(const char *, size_t, unsigned int *))
+{
+    unsigned long long packets = 0;
+    unsigned int sum = 0;
+    int64_t start, elapsed;
+    double rate;
+
+    start = now_ns();
+    for (unsigned int i = 0; i < loops; i++) {
+        size_t off = 0;
+        while (off < buf.size()) {
+            ssize_t size = decode(&buf[off], buf.size() - off, &sum);
+            if (size <= 0)
+                break;
+            off += size;
+            packets++;
+        }
+    }
+    elapsed = now_ns() - start;
+
+    rate = elapsed ? (double)packets * 1e9 / elapsed : 0.0;
+    printf("%-8s %llu packets in %.3f ms, %.1f Mpackets/s (checksum %08x)\n",
+           name, packets, elapsed / 1e6, rate / 1e6, sum);
+    return rate;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<char> buf;
+    const char *path = NULL;
+    unsigned int loops = 1000;
+    bool shuffle = false;
+    double legacy, table;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:n:r")) != -1) {
+        switch (opt) {
+        case 'f':
+            path = optarg;
+            break;
+        case 'n':
+            loops = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            shuffle = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-f capture.bin] [-n loops] [-r]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (path) {
+        if (load(buf, path))
+            return EXIT_FAILURE;
+    } else {
+        synthesize(buf, 1000, shuffle);
+    }
+    printf("%zu bytes, %u loops\n", buf.size(), loops);
+
+    legacy = run("legacy", buf, loops, legacy_decode);
+    table = run("table", buf, loops, table_decode);
+    if (legacy > 0.0)
+        printf("speedup  %.2fx\n", table / legacy);
+
+    return EXIT_SUCCESS;
+}
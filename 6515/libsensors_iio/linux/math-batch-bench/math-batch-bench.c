@@ -0,0 +1,213 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ml_math_batch.h"
+
+enum {
+    K_Q30_MULT = 0,
+    K_Q29_MULT,
+    K_Q_MULT,
+    K_Q_ROTATE,
+    K_QUAT_TO_ROT,
+    K_TO_BODY,
+    K_MATRIX_VECTOR,
+    NUM_KERNELS
+};
+
+static const char *kernel_names[NUM_KERNELS] = {
+    "q30_mult", "q29_mult", "q_mult", "q_rotate", "quat_to_rot",
+    "to_body", "matrix_vector"
+};
+
+static long *in_a, *in_b, *out, *ref[NUM_KERNELS];
+static long quat[4] = { 759250125L, 379625062L, -536870912L, 268435456L };
+static long matrix[9];
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* values with a magnitude below 2^bits */
+static void fill(long *buf, int n, int bits)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        buf[i] = ((((long)rand() << 16) ^ rand()) % (1L << bits)) *
+                 ((rand() & 1) ? -1 : 1);
+}
+
+static void run(int kernel, int n, long *dst)
+{
+    switch (kernel) {
+    case K_Q30_MULT:
+        inv_q30_mult_batch(in_a, in_b, dst, n);
+        break;
+    case K_Q29_MULT:
+        inv_q29_mult_batch(in_a, in_b, dst, n);
+        break;
+    case K_Q_MULT:
+        inv_q_mult_batch(in_a, in_b, dst, n);
+        break;
+    case K_Q_ROTATE:
+        inv_q_rotate_batch(quat, in_a, dst, n);
+        break;
+    case K_QUAT_TO_ROT:
+        inv_quaternion_to_rotation_batch(in_a, dst, n);
+        break;
+    case K_TO_BODY:
+        /* YZX with the second row negated */
+        inv_convert_to_body_with_scale_batch(0x0a1, 1234567890L,
+                                             in_a, dst, n);
+        break;
+    case K_MATRIX_VECTOR:
+        inv_matrix_vector_mult_batch(matrix, in_a, dst, n);
+        break;
+    }
+}
+
+/* longs written for n elements */
+static int out_size(int kernel, int n)
+{
+    switch (kernel) {
+    case K_Q_MULT:
+        return n * 4;
+    case K_QUAT_TO_ROT:
+        return n * 9;
+    case K_Q_ROTATE:
+    case K_TO_BODY:
+    case K_MATRIX_VECTOR:
+        return n * 3;
+    default:
+        return n;
+    }
+}
+
+/* checks and times every kernel on inputs with a magnitude below
+   2^bits, returns non-zero if any result differs from the scalar one */
+static int bench(int n, int loops, int bits)
+{
+    int isa, kernel, i, failed = 0;
+    double scalar_ns[NUM_KERNELS];
+
+    srand(1);
+    fill(in_a, n * 4, bits);
+    fill(in_b, n * 4, bits);
+    fill(matrix, 9, bits);
+
+    printf("inputs below 2^%d\n", bits);
+
+    /* scalar results everything else has to match */
+    inv_set_math_batch_isa(INV_MATH_BATCH_SCALAR);
+    for (kernel = 0; kernel < NUM_KERNELS; kernel++)
+        run(kernel, n, ref[kernel]);
+
+    for (isa = 0; isa < INV_MATH_BATCH_NUM_ISA; isa++) {
+        if (!inv_math_batch_isa_supported(isa))
+            continue;
+        inv_set_math_batch_isa(isa);
+
+        for (kernel = 0; kernel < NUM_KERNELS; kernel++) {
+            size_t size = out_size(kernel, n) * sizeof(long);
+            const char *check = "exact";
+            int64_t start;
+            double ns;
+
+            memset(out, 0, size);
+            run(kernel, n, out);
+            if (memcmp(out, ref[kernel], size)) {
+                check = "MISMATCH";
+                failed = 1;
+            }
+
+            start = now_ns();
+            for (i = 0; i < loops; i++)
+                run(kernel, n, out);
+            ns = (double)(now_ns() - start) / ((double)loops * n);
+            if (isa == INV_MATH_BATCH_SCALAR)
+                scalar_ns[kernel] = ns;
+
+            printf("%-7s %-14s %7.2f ns/element %5.2fx %s\n",
+                   inv_math_batch_isa_name(isa), kernel_names[kernel], ns,
+                   scalar_ns[kernel] / ns, check);
+        }
+    }
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = 1021, loops = 2000;
+    int kernel, opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "n:l:")) != -1) {
+        switch (opt) {
+        case 'n':
+            n = atoi(optarg);
+            break;
+        case 'l':
+            loops = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n elements] [-l loops]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (n < 1 || loops < 1) {
+        fprintf(stderr, "bad element or loop count\n");
+        return 1;
+    }
+
+    in_a = calloc(n * 4, sizeof(long));
+    in_b = calloc(n * 4, sizeof(long));
+    out = calloc(n * 9, sizeof(long));
+    if (!in_a || !in_b || !out) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (kernel = 0; kernel < NUM_KERNELS; kernel++) {
+        ref[kernel] = calloc(out_size(kernel, n), sizeof(long));
+        if (!ref[kernel]) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+    }
+
+    printf("%d elements, %d loops, default %s\n", n, loops,
+           inv_math_batch_isa_name(inv_get_math_batch_isa()));
+
+    /* sensor sized values run on the 32 bit multiply, the whole range of
+       a 32 bit long takes q_rotate and some products past 32 bits */
+    failed |= bench(n, loops, 24);
+    failed |= bench(n, loops, 31);
+
+    for (kernel = 0; kernel < NUM_KERNELS; kernel++)
+        free(ref[kernel]);
+    free(in_a);
+    free(in_b);
+    free(out);
+    return failed;
+}
@@ -24,18 +24,22 @@
 #include <math.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 
-#include <sys/queue.h>
+#include <sys/eventfd.h>
 
 #include <linux/input.h>
 
 #include <cutils/atomic.h>
+#include <cutils/properties.h>
 #include <utils/Log.h>
 #include <utils/SystemClock.h>
 
 #include "sensors.h"
 #include "MPLSensor.h"
+#include "SensorEventRing.h"
+#include "FlushQueue.h"
 
 /*
  * Vendor-defined Accel Load Calibration File Method
@@ -54,14 +58,8 @@
 #define LOCAL_SENSORS (NumSensors)
 #endif
 
-struct handle_entry {
-    SIMPLEQ_ENTRY(handle_entry) entries;
-    int handle;
-};
-
-static SIMPLEQ_HEAD(simplehead, handle_entry) pending_flush_items_head;
-struct simplehead *headp;
-static pthread_mutex_t flush_handles_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* flushes completed without going through the FIFO */
+static FlushQueue pending_flush_items;
 
 static const char *smdWakelockStr = "significant motion";
 
@@ -118,26 +116,57 @@ struct sensors_poll_context_t {
     int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
 #if defined ANDROID_KITKAT || defined ANDROID_LOLLIPOP
     int flush(int handle);
+    void pendingFlush(int handle);
 #endif
     int64_t getTimestamp();
 
 private:
+    int checkBufferedData(int nb);
+    int pollSensors(int timeout);
+    int readSensorEvents(sensors_event_t *data, int count);
+    int readBufferedEvents(int fd, sensors_event_t *data, int count);
+    int readPendingFlush(sensors_event_t *data, int count);
+
+    int startReaderThread(int cpu);
+    static void *readerThread(void *arg);
+    void readerLoop();
+    int readEventRing(sensors_event_t *data, int count);
+    void recordEventLatency(sensors_event_t *data, int nb);
+
     enum {
         mpl = 0,
         compass,
         dmpOrient,
         dmpSign,
         dmpPed,
+        stepTimer,
+        tempTimer,
         numSensorDrivers,
+        readerWake = numSensorDrivers,  // reader thread mode only
         numFds,
     };
 
     struct pollfd mPollFds[numFds];
+    int mNumPollFds;
     SensorBase *mSensor;
     CompassSensor *mCompassSensor;
 
     /* Significant Motion wakelock support */
     bool mSMDWakelockHeld;
+
+    /* Reader thread mode: the FIFO is drained and fused on a dedicated
+       thread into mEventRing, pollEvents() only copies events out */
+    bool mReaderThreadEnabled;
+    pthread_t mReaderThread;
+    int mReaderCpu;
+    bool mReaderExit;
+    SensorEventRing *mEventRing;
+    int mEventRingFd;       // eventfd, ring no longer empty
+    int mPollWaiting;       // pollEvents() waits on mEventRingFd
+    int mReaderBlocked;     // reader waits on readerWake for room
+    bool mSMDEventRead;
+    uint32_t mSMDWakelockSeq;
+    pthread_mutex_t mSMDWakelockMutex;
 };
 
 /******************************************************************************/
@@ -151,6 +180,16 @@ sensors_poll_context_t::sensors_poll_context_t() {
 
     /* No significant motion events pending yet */
     mSMDWakelockHeld = false;
+    mSMDEventRead = false;
+    mSMDWakelockSeq = 0;
+    pthread_mutex_init(&mSMDWakelockMutex, NULL);
+
+    mReaderThreadEnabled = false;
+    mReaderExit = false;
+    mEventRing = NULL;
+    mEventRingFd = -1;
+    mPollWaiting = 0;
+    mReaderBlocked = 0;
 
    /* For Vendor-defined Accel Calibration File Load
     * Use the Following Constructor and Pass Your Load Cal File Function
@@ -158,9 +197,6 @@ sensors_poll_context_t::sensors_poll_context_t() {
     * MPLSensor *mplSensor = new MPLSensor(mCompassSensor, AccelLoadConfig);
     */
 
-    // Initialize pending flush queue
-    SIMPLEQ_INIT(&pending_flush_items_head);
-
     // populate the sensor list
     sensors =
             mplSensor->populateSensorList(sSensorList, sizeof(sSensorList));
@@ -185,10 +221,39 @@ sensors_poll_context_t::sensors_poll_context_t() {
     mPollFds[dmpPed].fd = ((MPLSensor*) mSensor)->getDmpPedometerFd();
     mPollFds[dmpPed].events = POLLPRI;
     mPollFds[dmpPed].revents = 0;
+
+    mPollFds[stepTimer].fd = ((MPLSensor*) mSensor)->getStepCountTimerFd();
+    mPollFds[stepTimer].events = POLLIN;
+    mPollFds[stepTimer].revents = 0;
+
+    mPollFds[tempTimer].fd = ((MPLSensor*) mSensor)->getTempTimerFd();
+    mPollFds[tempTimer].events = POLLIN;
+    mPollFds[tempTimer].revents = 0;
+
+    mPollFds[readerWake].fd = -1;
+    mPollFds[readerWake].events = POLLIN;
+    mPollFds[readerWake].revents = 0;
+    mNumPollFds = numSensorDrivers;
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("invn.hal.reader.thread", value, "0");
+    if (atoi(value)) {
+        property_get("invn.hal.reader.cpu", value, "-1");
+        startReaderThread(atoi(value));
+    }
 }
 
 sensors_poll_context_t::~sensors_poll_context_t() {
     FUNC_LOG;
+    if (mReaderThreadEnabled) {
+        __atomic_store_n(&mReaderExit, true, __ATOMIC_RELEASE);
+        eventfd_write(mPollFds[readerWake].fd, 1);
+        pthread_join(mReaderThread, NULL);
+        close(mPollFds[readerWake].fd);
+        close(mEventRingFd);
+        delete mEventRing;
+    }
+    pthread_mutex_destroy(&mSMDWakelockMutex);
     delete mSensor;
     delete mCompassSensor;
     for (int i = 0; i < numSensorDrivers; i++) {
@@ -215,40 +280,245 @@ int64_t sensors_poll_context_t::getTimestamp()
     return android::elapsedRealtimeNano();
 }
 
+/* flag the mpl and compass fds as readable while a bulk read still has
+   packets queued */
+int sensors_poll_context_t::checkBufferedData(int nb)
+{
+    if (nb >= 0 && ((MPLSensor*) mSensor)->hasBufferedMpuData()) {
+        if (!(mPollFds[mpl].revents & POLLIN)) {
+            mPollFds[mpl].revents |= POLLIN;
+            nb++;
+        }
+    }
+    if (nb >= 0 && ((MPLSensor*) mSensor)->hasBufferedCompassData()) {
+        if (!(mPollFds[compass].revents & POLLIN)) {
+            mPollFds[compass].revents |= POLLIN;
+            nb++;
+        }
+    }
+    return nb;
+}
+
+int sensors_poll_context_t::pollSensors(int timeout)
+{
+    int nb = poll(mPollFds, mNumPollFds, timeout);
+
+    ((MPLSensor*) mSensor)->countPoll();
+
+    if (SensorBase::LATENCY_STATS && nb > 0 && (mPollFds[mpl].revents & POLLIN))
+        ((MPLSensor*) mSensor)->markPollWakeup(getTimestamp());
+    if (nb > 0 && mNumPollFds > readerWake &&
+            (mPollFds[readerWake].revents & POLLIN)) {
+        eventfd_t value;
+        eventfd_read(mPollFds[readerWake].fd, &value);
+        mPollFds[readerWake].revents = 0;
+        nb--;
+    }
+    return checkBufferedData(nb);
+}
+
+int sensors_poll_context_t::startReaderThread(int cpu)
+{
+    int fd;
+
+    mEventRing = new SensorEventRing();
+    mEventRingFd = eventfd(0, 0);
+    fd = eventfd(0, EFD_NONBLOCK);
+    if (mEventRingFd < 0 || fd < 0) {
+        LOGE("HAL:ERR can't create reader thread eventfd (%s)",
+             strerror(errno));
+        goto err;
+    }
+    mPollFds[readerWake].fd = fd;
+    mNumPollFds = numFds;
+    mReaderCpu = cpu;
+
+    mReaderThreadEnabled = true;
+    if (pthread_create(&mReaderThread, NULL, readerThread, this)) {
+        LOGE("HAL:ERR can't start reader thread, reading from pollEvents()");
+        mReaderThreadEnabled = false;
+        goto err;
+    }
+    LOGI("HAL:reader thread started, cpu %d", cpu);
+    return 0;
+
+err:
+    if (fd >= 0)
+        close(fd);
+    if (mEventRingFd >= 0)
+        close(mEventRingFd);
+    mEventRingFd = -1;
+    mPollFds[readerWake].fd = -1;
+    mNumPollFds = numSensorDrivers;
+    delete mEventRing;
+    mEventRing = NULL;
+    return -1;
+}
+
+void *sensors_poll_context_t::readerThread(void *arg)
+{
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)arg;
+
+    pthread_setname_np(pthread_self(), "invn_reader");
+    if (ctx->mReaderCpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(ctx->mReaderCpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0)
+            LOGE("HAL:ERR can't pin reader thread to cpu %d (%s)",
+                 ctx->mReaderCpu, strerror(errno));
+    }
+    ctx->readerLoop();
+    return NULL;
+}
+
+void sensors_poll_context_t::readerLoop()
+{
+    sensors_event_t *events;
+    int count, nb;
+
+    while (!__atomic_load_n(&mReaderExit, __ATOMIC_ACQUIRE)) {
+        count = mEventRing->beginWrite(&events);
+        if (count == 0) {
+            /* pollEvents() is behind, leave the data in the kernel FIFO
+               until it makes room */
+            LOGI_IF(SensorBase::ENG_VERBOSE, "HAL:event ring full");
+            __atomic_store_n(&mReaderBlocked, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (mEventRing->full()) {
+                struct pollfd pfd;
+                eventfd_t value;
+                pfd.fd = mPollFds[readerWake].fd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                poll(&pfd, 1, -1);
+                eventfd_read(pfd.fd, &value);
+            }
+            __atomic_store_n(&mReaderBlocked, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        nb = readSensorEvents(events, count);
+        if (nb < 0)
+            nb = 0;
+        /* after the events read so far, which were queued before them */
+        nb += readPendingFlush(events + nb, count - nb);
+        if (nb == 0)
+            continue;
+
+        if (mSMDEventRead) {
+            /* held until pollEvents() has handed the event out */
+            mSMDEventRead = false;
+            pthread_mutex_lock(&mSMDWakelockMutex);
+            mSMDWakelockSeq = mEventRing->writeCount() + nb;
+            if (!mSMDWakelockHeld) {
+                acquire_wake_lock(PARTIAL_WAKE_LOCK, smdWakelockStr);
+                LOGI_IF(1, "HAL: grabbed %s wakelock", smdWakelockStr);
+                __atomic_store_n(&mSMDWakelockHeld, true, __ATOMIC_RELEASE);
+            }
+            pthread_mutex_unlock(&mSMDWakelockMutex);
+        }
+
+        mEventRing->endWrite(nb);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&mPollWaiting, __ATOMIC_RELAXED))
+            eventfd_write(mEventRingFd, 1);
+    }
+}
+
+int sensors_poll_context_t::readEventRing(sensors_event_t *data, int count)
+{
+    eventfd_t value;
+    int64_t copyStart = 0;
+    int nb;
+
+    for (;;) {
+        if (SensorBase::LATENCY_STATS)
+            copyStart = getTimestamp();
+        nb = mEventRing->read(data, count);
+        if (nb)
+            break;
+        __atomic_store_n(&mPollWaiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (mEventRing->empty())
+            eventfd_read(mEventRingFd, &value);
+        __atomic_store_n(&mPollWaiting, 0, __ATOMIC_RELAXED);
+    }
+
+    if (SensorBase::LATENCY_STATS)
+        ((MPLSensor*) mSensor)->recordLatency(MPLSensor::LAT_COPY_OUT,
+                                              getTimestamp() - copyStart);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&mReaderBlocked, __ATOMIC_RELAXED))
+        eventfd_write(mPollFds[readerWake].fd, 1);
+    return nb;
+}
+
+void sensors_poll_context_t::recordEventLatency(sensors_event_t *data, int nb)
+{
+    MPLSensor *mplSensor = (MPLSensor*) mSensor;
+    int64_t now = getTimestamp();
+
+    for (int i = 0; i < nb; i++) {
+        if (data[i].type == SENSOR_TYPE_META_DATA)
+            continue;
+        mplSensor->recordLatency(MPLSensor::LAT_SAMPLE_TO_OUT,
+                                 now - data[i].timestamp);
+    }
+    mplSensor->checkDumpRequest();
+}
+
 int sensors_poll_context_t::pollEvents(sensors_event_t *data, int count)
 {
     VHANDLER_LOG;
 
-    int nbEvents = 0;
-    int nb, polltime = -1;
-
-    if (mSMDWakelockHeld) {
+    if (mReaderThreadEnabled) {
+        if (__atomic_load_n(&mSMDWakelockHeld, __ATOMIC_ACQUIRE)) {
+            pthread_mutex_lock(&mSMDWakelockMutex);
+            if (mSMDWakelockHeld && (int32_t)(mEventRing->readCount() -
+                                              mSMDWakelockSeq) >= 0) {
+                mSMDWakelockHeld = false;
+                release_wake_lock(smdWakelockStr);
+            }
+            pthread_mutex_unlock(&mSMDWakelockMutex);
+        }
+    } else if (mSMDWakelockHeld) {
         mSMDWakelockHeld = false;
         release_wake_lock(smdWakelockStr);
     }
 
-    struct handle_entry *handle_element;
-    pthread_mutex_lock(&flush_handles_mutex);
-    if (!SIMPLEQ_EMPTY(&pending_flush_items_head)) {
-        sensors_event_t flushCompleteEvent;
-        flushCompleteEvent.type = SENSOR_TYPE_META_DATA;
-        flushCompleteEvent.sensor = 0;
-        handle_element = SIMPLEQ_FIRST(&pending_flush_items_head);
-        flushCompleteEvent.meta_data.sensor = handle_element->handle;
-        SIMPLEQ_REMOVE_HEAD(&pending_flush_items_head, entries);
-        free(handle_element);
-        memcpy(data, (void *) &flushCompleteEvent, sizeof(flushCompleteEvent));
-        LOGI_IF(1, "pollEvents() Returning fake flush event completion for handle %d",
-                flushCompleteEvent.meta_data.sensor);
-        pthread_mutex_unlock(&flush_handles_mutex);
-        return 1;
+    int nb;
+    if (mReaderThreadEnabled) {
+        /* the reader thread puts fake flush completions in the ring */
+        nb = readEventRing(data, count);
+    } else {
+        nb = readPendingFlush(data, count);
+        if (nb)
+            return nb;
+        nb = readSensorEvents(data, count);
     }
-    pthread_mutex_unlock(&flush_handles_mutex);
+    if (SensorBase::LATENCY_STATS)
+        recordEventLatency(data, nb);
+    return nb;
+}
+
+/* drain the FIFO and the DMP event fds into data */
+int sensors_poll_context_t::readSensorEvents(sensors_event_t *data, int count)
+{
+    int nbEvents = 0;
+    int nb, polltime = -1;
 
     polltime = ((MPLSensor*) mSensor)->getStepCountPollTime();
 
     // look for new events
-    nb = poll(mPollFds, numSensorDrivers, polltime);
+    if (((MPLSensor*) mSensor)->hasBufferedMpuData() ||
+        ((MPLSensor*) mSensor)->hasBufferedCompassData()) {
+        // packets left over from a bulk read, no need to ask the driver
+        nb = checkBufferedData(0);
+    } else {
+        nb = pollSensors(polltime);
+    }
     LOGI_IF(0, "poll nb=%d, count=%d, pt=%d ts=%lld", nb, count, polltime, getTimestamp());
     if (nb == 0 && count > 0) {
         /* to see if any step counter events */
@@ -268,12 +538,13 @@ int sensors_poll_context_t::pollEvents(sensors_event_t *data, int count)
         for (int i = 0; count && i < numSensorDrivers; i++) {
             if (mPollFds[i].revents & (POLLIN | POLLPRI)) {
                 nb = 0;
-                if (i == mpl) {
-                    ((MPLSensor*) mSensor)->buildMpuEvent();
-                    mPollFds[i].revents = 0;
-                } else if (i == compass) {
-                    ((MPLSensor*) mSensor)->buildCompassEvent();
+                if (i == mpl || i == compass) {
+                    nb = readBufferedEvents(i, data, count);
                     mPollFds[i].revents = 0;
+                    count -= nb;
+                    nbEvents += nb;
+                    data += nb;
+                    continue;
                 } else if (i == dmpOrient) {
                     nb = ((MPLSensor*)mSensor)->
                                         readDmpOrientEvents(data, count);
@@ -288,7 +559,9 @@ int sensors_poll_context_t::pollEvents(sensors_event_t *data, int count)
                                     readDmpSignificantMotionEvents(data, count);
                     mPollFds[i].revents = 0;
                     if (nb) {
-                        if (!mSMDWakelockHeld) {
+                        if (mReaderThreadEnabled) {
+                            mSMDEventRead = true;
+                        } else if (!mSMDWakelockHeld) {
                             /* Hold wakelock until Sensor Services reads event */
                             acquire_wake_lock(PARTIAL_WAKE_LOCK, smdWakelockStr);
                             LOGI_IF(1, "HAL: grabbed %s wakelock", smdWakelockStr);
@@ -306,6 +579,16 @@ int sensors_poll_context_t::pollEvents(sensors_event_t *data, int count)
                     count -= nb;
                     nbEvents += nb;
                     data += nb;
+                } else if (i == stepTimer) {
+                    nb = ((MPLSensor*) mSensor)->readStepCountEvents(
+                            data, count);
+                    mPollFds[i].revents = 0;
+                    count -= nb;
+                    nbEvents += nb;
+                    data += nb;
+                } else if (i == tempTimer) {
+                    ((MPLSensor*) mSensor)->readTemperatureEvents();
+                    mPollFds[i].revents = 0;
                 }
 
                 if(nb == 0) {
@@ -340,7 +623,7 @@ int sensors_poll_context_t::pollEvents(sensors_event_t *data, int count)
         }
         if (count > 0) {
             // We still have room for more events, try an immediate poll for more data
-            nb = poll(mPollFds, numSensorDrivers, 0);
+            nb = pollSensors(0);
         } else {
             nb = 0;
         }
@@ -348,6 +631,59 @@ int sensors_poll_context_t::pollEvents(sensors_event_t *data, int count)
     return nbEvents;
 }
 
+/* build and report every complete packet a bulk read left in memory for
+   the mpl or compass fd, without going back to poll() between them */
+int sensors_poll_context_t::readBufferedEvents(int fd, sensors_event_t *data,
+                                               int count)
+{
+    MPLSensor *mplSensor = (MPLSensor*) mSensor;
+    int nbEvents = 0;
+    int nb;
+    bool built;
+
+    do {
+        if (fd == mpl) {
+            mplSensor->buildMpuEvent();
+            built = true;
+        } else {
+            built = mplSensor->buildCompassEvent();
+        }
+        /* compass samples the merge released past the one already built
+           each need their own execute, MPL holds one per type */
+        while (built) {
+            nb = mplSensor->readEvents(data, count);
+            if (nb > 0) {
+                count -= nb;
+                nbEvents += nb;
+                data += nb;
+            }
+            built = count > 0 && mplSensor->buildMergedCompass();
+        }
+    } while (count > 0 && (fd == mpl ? mplSensor->hasBufferedMpuData() :
+                                       mplSensor->hasBufferedCompassData()));
+    return nbEvents;
+}
+
+/* flush complete events for the sensors flushed without going through the
+   FIFO, read by the reader thread when there is one */
+int sensors_poll_context_t::readPendingFlush(sensors_event_t *data, int count)
+{
+    int nb = 0;
+    int handle;
+
+    while (nb < count && pending_flush_items.pop(&handle)) {
+        sensors_event_t flushCompleteEvent;
+        flushCompleteEvent.type = SENSOR_TYPE_META_DATA;
+        flushCompleteEvent.sensor = 0;
+        flushCompleteEvent.meta_data.sensor = handle;
+        memcpy(&data[nb], (void *) &flushCompleteEvent, sizeof(flushCompleteEvent));
+        LOGI_IF(1, "pollEvents() Returning fake flush event completion for handle %d",
+                flushCompleteEvent.meta_data.sensor);
+        nb++;
+    }
+    return nb;
+}
+
 int sensors_poll_context_t::query(int what, int* value)
 {
     FUNC_LOG;
@@ -363,18 +699,15 @@ int sensors_poll_context_t::batch(int handle, int flags, int64_t period_ns,
 
 #if defined ANDROID_KITKAT || defined ANDROID_LOLLIPOP
 
-void inv_pending_flush(int handle) {
-    struct handle_entry *the_entry;
-    pthread_mutex_lock(&flush_handles_mutex);
-    the_entry = (struct handle_entry*) malloc(sizeof(struct handle_entry));
-    if (the_entry != NULL) {
-        LOGI_IF(0, "Inserting %d into pending list", handle);
-        the_entry->handle = handle;
-        SIMPLEQ_INSERT_TAIL(&pending_flush_items_head, the_entry, entries);
-    } else {
-        LOGE("ERROR malloc'ing space for pending handler flush entry");
+void sensors_poll_context_t::pendingFlush(int handle) {
+    LOGI_IF(0, "Inserting %d into pending list", handle);
+    if (!pending_flush_items.push(handle)) {
+        LOGE("ERROR no room for pending flush of handle %d", handle);
+        return;
     }
-    pthread_mutex_unlock(&flush_handles_mutex);
+    /* the reader thread may be waiting for sensor data */
+    if (mReaderThreadEnabled)
+        eventfd_write(mPollFds[readerWake].fd, 1);
 }
 
 int sensors_poll_context_t::flush(int handle)
@@ -440,7 +773,7 @@ static int poll__flush(struct sensors_poll_device_1 *dev,
     int status = ctx->flush(handle);
     if (handle == SENSORS_STEP_COUNTER_HANDLE) {
         LOGI_IF(0, "creating flush completion event for handle %d", handle);
-        inv_pending_flush(handle);
+        ctx->pendingFlush(handle);
         return 0;
     }
     return status;
@@ -8,6 +8,9 @@ HEADERS += $(MLLITE_DIR)/data_builder.h
 HEADERS += $(MLLITE_DIR)/hal_outputs.h
 HEADERS += $(MLLITE_DIR)/message_layer.h
 HEADERS += $(MLLITE_DIR)/ml_math_func.h
+HEADERS += $(MLLITE_DIR)/ml_math_batch.h
+HEADERS += $(MLLITE_DIR)/ml_math_batch_simd.h
+HEADERS += $(MLLITE_DIR)/ml_math_batch_kernels.h
 HEADERS += $(MLLITE_DIR)/mpl.h
 HEADERS += $(MLLITE_DIR)/results_holder.h
 HEADERS += $(MLLITE_DIR)/start_manager.h
@@ -18,12 +21,17 @@ HEADERS += $(MLLITE_DIR)/linux/mlos.h
 HEADERS += $(MLLITE_DIR)/linux/ml_stored_data.h
 HEADERS += $(MLLITE_DIR)/linux/ml_load_dmp.h
 HEADERS += $(MLLITE_DIR)/linux/ml_sysfs_helper.h
+HEADERS += $(MLLITE_DIR)/linux/ml_data_recorder.h
 
 # sources
 SOURCES := $(MLLITE_DIR)/data_builder.c
 SOURCES += $(MLLITE_DIR)/hal_outputs.c
 SOURCES += $(MLLITE_DIR)/message_layer.c
 SOURCES += $(MLLITE_DIR)/ml_math_func.c
+SOURCES += $(MLLITE_DIR)/ml_math_batch.c
+SOURCES += $(MLLITE_DIR)/ml_math_batch_sse41.c
+SOURCES += $(MLLITE_DIR)/ml_math_batch_avx2.c
+SOURCES += $(MLLITE_DIR)/ml_math_batch_neon.c
 SOURCES += $(MLLITE_DIR)/mpl.c
 SOURCES += $(MLLITE_DIR)/results_holder.c
 SOURCES += $(MLLITE_DIR)/start_manager.c
@@ -34,6 +42,7 @@ SOURCES += $(MLLITE_DIR)/linux/mlos_linux.c
 SOURCES += $(MLLITE_DIR)/linux/ml_stored_data.c
 SOURCES += $(MLLITE_DIR)/linux/ml_load_dmp.c
 SOURCES += $(MLLITE_DIR)/linux/ml_sysfs_helper.c
+SOURCES += $(MLLITE_DIR)/linux/ml_data_recorder.c
 
 
 INV_SOURCES += $(SOURCES)
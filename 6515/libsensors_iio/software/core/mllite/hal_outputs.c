@@ -26,6 +26,7 @@
 #include "hal_outputs.h"
 #include "log.h"
 #include "ml_math_func.h"
+#include "ml_math_batch.h"
 #include "mlmath.h"
 #include "start_manager.h"
 #include "data_builder.h"
@@ -69,6 +70,10 @@ struct hal_output_t {
     long geomagnetic_rotation_vector_sample_rate_us;
 };
 
+/* quaternions inv_get_hal_outputs_batch() turns into rotation matrices
+   at a time */
+#define HAL_OUT_BATCH_CHUNK 32
+
 static struct hal_output_t hal_out;
 
 void inv_set_linear_acceleration_sample_rate(long sample_rate_us)
@@ -241,6 +246,22 @@ int inv_get_sensor_type_gyroscope_raw(float *values, int8_t *accuracy,
     return status;
 }
 
+/* Android rotation vector from a quaternion, w kept positive */
+static void rotation_vector_from_quat(const float *quat, float *values)
+{
+    if (quat[0] >= .0) {
+        values[0] = quat[1];
+        values[1] = quat[2];
+        values[2] = quat[3];
+        values[3] = quat[0];
+    } else {
+        values[0] = -quat[1];
+        values[1] = -quat[2];
+        values[2] = -quat[3];
+        values[3] = -quat[0];
+    }
+}
+
 /**
 * This corresponds to Sensor.TYPE_ROTATION_VECTOR.
 * The rotation vector represents the orientation of the device as a combination
@@ -275,17 +296,7 @@ int inv_get_sensor_type_rotation_vector(float *values, int8_t *accuracy,
     *accuracy = (int8_t) hal_out.accuracy_quat;
     inv_get_quaternion_float(quat_float);
 
-    if (quat_float[0] >= .0) {
-        values[0] = quat_float[1];
-        values[1] = quat_float[2];
-        values[2] = quat_float[3];
-        values[3] = quat_float[0];
-    } else {
-        values[0] = -quat_float[1];
-        values[1] = -quat_float[2];
-        values[2] = -quat_float[3];
-        values[3] = -quat_float[0];
-    }
+    rotation_vector_from_quat(quat_float, values);
     values[4] = inv_get_heading_confidence_interval();
     return inv_get_9_axis_timestamp(hal_out.rotation_vector_sample_rate_us, timestamp);
 }
@@ -300,17 +311,7 @@ int inv_get_sensor_type_rotation_vector_6_axis(float *values, int8_t *accuracy,
     inv_get_accel_set(accel, accuracy, &timestamp1);
     inv_get_6axis_quaternion_float(quat_6_axis, &timestamp1);
 
-    if (quat_6_axis[0] >= .0) {
-        values[0] = quat_6_axis[1];
-        values[1] = quat_6_axis[2];
-        values[2] = quat_6_axis[3];
-        values[3] = quat_6_axis[0];
-    } else {
-        values[0] = -quat_6_axis[1];
-        values[1] = -quat_6_axis[2];
-        values[2] = -quat_6_axis[3];
-        values[3] = -quat_6_axis[0];
-    }
+    rotation_vector_from_quat(quat_6_axis, values);
     //This sensor does not report an estimated heading accuracy
     values[4] = 0;
     if (hal_out.quat_status & INV_QUAT_3AXIS)
@@ -345,17 +346,7 @@ int inv_get_sensor_type_geomagnetic_rotation_vector(float *values, int8_t *accur
     inv_get_compass_set(compass, accuracy, &timestamp1);
     inv_get_geomagnetic_quaternion_float(quat_geomagnetic, &timestamp1);
 
-    if (quat_geomagnetic[0] >= .0) {
-        values[0] = quat_geomagnetic[1];
-        values[1] = quat_geomagnetic[2];
-        values[2] = quat_geomagnetic[3];
-        values[3] = quat_geomagnetic[0];
-    } else {
-        values[0] = -quat_geomagnetic[1];
-        values[1] = -quat_geomagnetic[2];
-        values[2] = -quat_geomagnetic[3];
-        values[3] = -quat_geomagnetic[0];
-    }
+    rotation_vector_from_quat(quat_geomagnetic, values);
     values[4] = inv_get_accel_compass_confidence_interval();
     status = hal_out.accel_status & INV_NEW_DATA? 1 : 0;
     MPL_LOGV("values:%f %f %f %f %f -%d", values[0], values[1],
@@ -421,97 +412,53 @@ int inv_get_sensor_type_magnetic_field_raw(float *values, int8_t *accuracy,
         status = 0;
     return status;
 }
-static void inv_get_rotation_geomagnetic(float r[3][3])
-{
-    long rot[9], quat_geo[4];
-    float conv = 1.f / (1L<<30);
-    inv_time_t timestamp;
-    inv_get_geomagnetic_quaternion(quat_geo, &timestamp);
-    inv_quaternion_to_rotation(quat_geo, rot);
-    r[0][0] = rot[0]*conv;
-    r[0][1] = rot[1]*conv;
-    r[0][2] = rot[2]*conv;
-    r[1][0] = rot[3]*conv;
-    r[1][1] = rot[4]*conv;
-    r[1][2] = rot[5]*conv;
-    r[2][0] = rot[6]*conv;
-    r[2][1] = rot[7]*conv;
-    r[2][2] = rot[8]*conv;
-}
-static void google_orientation_geomagnetic(float *g)
+/* Android orientation angles in degrees from a rotation matrix scaled
+   such that 1.0 = 2^30, as inv_quaternion_to_rotation() returns it */
+static void google_orientation_from_rotation(const long *rot, float *g)
 {
     float rad2deg = (float)(180.0 / M_PI);
+    float conv = 1.f / (1L<<30);
     float R[3][3];
-    inv_get_rotation_geomagnetic(R);
-    g[0] = atan2f(-R[1][0], R[0][0]) * rad2deg;
-    g[1] = atan2f(-R[2][1], R[2][2]) * rad2deg;
-    g[2] = asinf ( R[2][0])          * rad2deg;
+
+    R[0][0] = rot[0]*conv;
+    R[1][0] = rot[3]*conv;
+    R[2][0] = rot[6]*conv;
+    R[2][1] = rot[7]*conv;
+    R[2][2] = rot[8]*conv;
+
+    g[0] = inv_atan2f(-R[1][0], R[0][0]) * rad2deg;
+    g[1] = inv_atan2f(-R[2][1], R[2][2]) * rad2deg;
+    g[2] = inv_asinf ( R[2][0])          * rad2deg;
     if (g[0] < 0)
         g[0] += 360;
 }
 
-static void inv_get_rotation_6_axis(float r[3][3])
+static void google_orientation_geomagnetic(float *g)
 {
-    long rot[9], quat_6_axis[4];
-    float conv = 1.f / (1L<<30);
+    long rot[9], quat_geo[4];
     inv_time_t timestamp;
 
-    inv_get_6axis_quaternion(quat_6_axis, &timestamp);
-    inv_quaternion_to_rotation(quat_6_axis, rot);
-    r[0][0] = rot[0]*conv;
-    r[0][1] = rot[1]*conv;
-    r[0][2] = rot[2]*conv;
-    r[1][0] = rot[3]*conv;
-    r[1][1] = rot[4]*conv;
-    r[1][2] = rot[5]*conv;
-    r[2][0] = rot[6]*conv;
-    r[2][1] = rot[7]*conv;
-    r[2][2] = rot[8]*conv;
+    inv_get_geomagnetic_quaternion(quat_geo, &timestamp);
+    inv_quaternion_to_rotation(quat_geo, rot);
+    google_orientation_from_rotation(rot, g);
 }
 
 static void google_orientation_6_axis(float *g)
 {
-    float rad2deg = (float)(180.0 / M_PI);
-    float R[3][3];
-
-    inv_get_rotation_6_axis(R);
+    long rot[9], quat_6_axis[4];
+    inv_time_t timestamp;
 
-    g[0] = atan2f(-R[1][0], R[0][0]) * rad2deg;
-    g[1] = atan2f(-R[2][1], R[2][2]) * rad2deg;
-    g[2] = asinf ( R[2][0])          * rad2deg;
-    if (g[0] < 0)
-        g[0] += 360;
+    inv_get_6axis_quaternion(quat_6_axis, &timestamp);
+    inv_quaternion_to_rotation(quat_6_axis, rot);
+    google_orientation_from_rotation(rot, g);
 }
 
-static void inv_get_rotation(float r[3][3])
+static void google_orientation(float *g)
 {
     long rot[9];
-    float conv = 1.f / (1L<<30);
 
     inv_quaternion_to_rotation(hal_out.nav_quat, rot);
-    r[0][0] = rot[0]*conv;
-    r[0][1] = rot[1]*conv;
-    r[0][2] = rot[2]*conv;
-    r[1][0] = rot[3]*conv;
-    r[1][1] = rot[4]*conv;
-    r[1][2] = rot[5]*conv;
-    r[2][0] = rot[6]*conv;
-    r[2][1] = rot[7]*conv;
-    r[2][2] = rot[8]*conv;
-}
-
-static void google_orientation(float *g)
-{
-    float rad2deg = (float)(180.0 / M_PI);
-    float R[3][3];
-
-    inv_get_rotation(R);
-
-    g[0] = atan2f(-R[1][0], R[0][0]) * rad2deg;
-    g[1] = atan2f(-R[2][1], R[2][2]) * rad2deg;
-    g[2] = asinf ( R[2][0])          * rad2deg;
-    if (g[0] < 0)
-        g[0] += 360;
+    google_orientation_from_rotation(rot, g);
 }
 
 /** This corresponds to Sensor.TYPE_ORIENTATION. All values are angles in degrees.
@@ -694,6 +641,75 @@ inv_error_t inv_generate_hal_outputs(struct inv_sensor_cal_t *sensor_cal)
     return INV_SUCCESS;
 }
 
+/** Computes virtual sensor outputs for a batch of quaternions in one pass,
+* e.g. for every sample of a FIFO flush instead of only the latest one.
+* The rotation matrix of each quaternion is computed once, with the batch
+* math functions, and shared by gravity, linear acceleration and
+* orientation. The values are the same the inv_get_sensor_type_*()
+* functions return for a single quaternion.
+* @param[in] quat n quaternions scaled such that 1.0 = 2^30, length 4 each.
+* @param[in] accel n accel samples in body frame, 1g = 2^16, length 3 each,
+*            as inv_get_accel_set() returns them. Only read for linear
+*            acceleration, may be NULL otherwise.
+* @param[in] n Number of samples.
+* @param[in] outputs Outputs to compute, a combination of INV_HAL_OUT_*.
+* @param[in] heading_accuracy 5th element of the rotation vectors, the
+*            heading accuracy in radians, 0 if not estimated.
+* @param[out] out n samples, only the requested outputs are written.
+* @return Returns INV_SUCCESS if successful or an error code if not.
+*/
+inv_error_t inv_get_hal_outputs_batch(const long *quat, const long *accel,
+                                      int n, int outputs,
+                                      float heading_accuracy,
+                                      struct inv_hal_batch_out_t *out)
+{
+    long rot[HAL_OUT_BATCH_CHUNK * 9];
+    float conv = 1.f / (1L<<30);
+    float quat_float[4];
+    int i, k, m, chunk;
+
+    if (!quat || !out || n < 0)
+        return INV_ERROR_INVALID_PARAMETER;
+    if ((outputs & INV_HAL_OUT_LINEAR_ACCELERATION) && !accel)
+        return INV_ERROR_INVALID_PARAMETER;
+
+    for (i = 0; i < n; i += chunk) {
+        chunk = MIN(n - i, HAL_OUT_BATCH_CHUNK);
+        if (outputs & (INV_HAL_OUT_GRAVITY | INV_HAL_OUT_LINEAR_ACCELERATION |
+                       INV_HAL_OUT_ORIENTATION))
+            inv_quaternion_to_rotation_batch(quat + i * 4, rot, chunk);
+
+        for (k = 0; k < chunk; k++) {
+            const long *q = quat + (i + k) * 4;
+            const long *r = rot + k * 9;
+            struct inv_hal_batch_out_t *o = out + i + k;
+
+            if (outputs & INV_HAL_OUT_ROTATION_VECTOR) {
+                for (m = 0; m < 4; m++)
+                    quat_float[m] = q[m] * conv;
+                rotation_vector_from_quat(quat_float, o->rotation_vector);
+                o->rotation_vector[4] = heading_accuracy;
+            }
+            /* the last row of the rotation matrix is gravity, see
+               inv_get_gravity() */
+            if (outputs & INV_HAL_OUT_GRAVITY) {
+                for (m = 0; m < 3; m++)
+                    o->gravity[m] = (r[6 + m] >> 14) * ACCEL_CONVERSION;
+            }
+            if (outputs & INV_HAL_OUT_LINEAR_ACCELERATION) {
+                const long *a = accel + (i + k) * 3;
+
+                for (m = 0; m < 3; m++)
+                    o->linear_acceleration[m] =
+                        (a[m] - (r[6 + m] >> 14)) * ACCEL_CONVERSION;
+            }
+            if (outputs & INV_HAL_OUT_ORIENTATION)
+                google_orientation_from_rotation(r, o->orientation);
+        }
+    }
+    return INV_SUCCESS;
+}
+
 /** Turns off generation of HAL outputs.
 * @return Returns INV_SUCCESS if successful or an error code if not.
  */
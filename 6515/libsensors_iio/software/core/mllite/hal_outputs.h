@@ -43,6 +43,26 @@ extern "C" {
     int inv_get_sensor_type_geomagnetic_rotation_vector(float *values, int8_t *accuracy,
                                          inv_time_t * timestamp);
 
+    /* outputs of inv_get_hal_outputs_batch() */
+#define INV_HAL_OUT_ROTATION_VECTOR     0x01
+#define INV_HAL_OUT_GRAVITY             0x02
+#define INV_HAL_OUT_LINEAR_ACCELERATION 0x04
+#define INV_HAL_OUT_ORIENTATION         0x08
+
+    /* one sample of inv_get_hal_outputs_batch(), same units and layout
+       as the matching inv_get_sensor_type_*() values */
+    struct inv_hal_batch_out_t {
+        float rotation_vector[5];
+        float gravity[3];
+        float linear_acceleration[3];
+        float orientation[3];
+    };
+
+    inv_error_t inv_get_hal_outputs_batch(const long *quat, const long *accel,
+                                          int n, int outputs,
+                                          float heading_accuracy,
+                                          struct inv_hal_batch_out_t *out);
+
     inv_error_t inv_enable_hal_outputs(void);
     inv_error_t inv_disable_hal_outputs(void);
     inv_error_t inv_init_hal_outputs(void);
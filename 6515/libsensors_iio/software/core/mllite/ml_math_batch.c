@@ -0,0 +1,233 @@
+/*
+ $License:
+    Copyright (C) 2014 InvenSense Corporation, All Rights Reserved.
+    See included License.txt for License information.
+ $
+ */
+
+/**
+ *   @defgroup  ML_MATH_BATCH ml_math_batch
+ *   @brief     Motion Library - Batch Math Functions
+ *              ml_math_func functions applied to arrays, on the best
+ *              instruction set the CPU has.
+ *
+ *   @{
+ *       @file ml_math_batch.c
+ *       @brief Batch Math Functions.
+ */
+
+#include "ml_math_batch.h"
+#include "ml_math_batch_simd.h"
+#include "ml_math_func.h"
+
+static void scalar_q30_mult(const long *a, const long *b, long *out, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        out[i] = inv_q30_mult(a[i], b[i]);
+}
+
+static void scalar_q29_mult(const long *a, const long *b, long *out, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        out[i] = inv_q29_mult(a[i], b[i]);
+}
+
+static void scalar_q_mult(const long *q1, const long *q2, long *qProd, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        inv_q_mult(q1 + i * 4, q2 + i * 4, qProd + i * 4);
+}
+
+static void scalar_q_rotate(const long *q, const long *in, long *out, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        inv_q_rotate(q, in + i * 3, out + i * 3);
+}
+
+static void scalar_quaternion_to_rotation(const long *quat, long *rot, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        inv_quaternion_to_rotation(quat + i * 4, rot + i * 9);
+}
+
+static void scalar_convert_to_body_with_scale(unsigned short orientation,
+                                              long sensitivity,
+                                              const long *input, long *output,
+                                              int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        inv_convert_to_body_with_scale(orientation, sensitivity,
+                                       input + i * 3, output + i * 3);
+}
+
+static void scalar_matrix_vector_mult(const long *matrix, const long *vecIn,
+                                      long *vecOut, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        inv_batch_matrix_vector_mult(matrix, vecIn + i * 3, vecOut + i * 3);
+}
+
+static const struct inv_math_batch_ops scalar_ops = {
+    scalar_q30_mult,
+    scalar_q29_mult,
+    scalar_q_mult,
+    scalar_q_rotate,
+    scalar_quaternion_to_rotation,
+    scalar_convert_to_body_with_scale,
+    scalar_matrix_vector_mult,
+};
+
+static const char *isa_names[INV_MATH_BATCH_NUM_ISA] = {
+    "scalar", "sse4.1", "avx2", "neon"
+};
+
+static const struct inv_math_batch_ops *batch_ops;
+static int batch_isa = -1;
+
+static const struct inv_math_batch_ops *isa_ops(int isa)
+{
+    switch (isa) {
+    case INV_MATH_BATCH_SCALAR:
+        return &scalar_ops;
+#ifdef INV_MATH_BATCH_HAVE_X86
+    case INV_MATH_BATCH_SSE41:
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.1"))
+            return &inv_math_batch_sse41_ops;
+        break;
+    case INV_MATH_BATCH_AVX2:
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return &inv_math_batch_avx2_ops;
+        break;
+#endif
+#ifdef INV_MATH_BATCH_HAVE_NEON
+    case INV_MATH_BATCH_NEON:
+        return &inv_math_batch_neon_ops;
+#endif
+    default:
+        break;
+    }
+    return NULL;
+}
+
+static const struct inv_math_batch_ops *get_ops(void)
+{
+    int isa;
+
+    if (batch_ops)
+        return batch_ops;
+    /* the best one the CPU runs, later entries are preferred */
+    for (isa = INV_MATH_BATCH_NUM_ISA - 1; isa >= 0; isa--) {
+        if (isa_ops(isa)) {
+            batch_isa = isa;
+            batch_ops = isa_ops(isa);
+            break;
+        }
+    }
+    return batch_ops;
+}
+
+/** Returns the instruction set the batch functions run on.
+* @return One of enum inv_math_batch_isa.
+*/
+int inv_get_math_batch_isa(void)
+{
+    get_ops();
+    return batch_isa;
+}
+
+/** Selects the instruction set of the batch functions, e.g. to compare
+* them with the scalar ones. The default is the best one available.
+* @param[in] isa One of enum inv_math_batch_isa.
+* @return INV_SUCCESS or INV_ERROR_INVALID_PARAMETER if it is not
+*         supported by this build or CPU.
+*/
+inv_error_t inv_set_math_batch_isa(int isa)
+{
+    const struct inv_math_batch_ops *ops = isa_ops(isa);
+
+    if (!ops)
+        return INV_ERROR_INVALID_PARAMETER;
+    batch_isa = isa;
+    batch_ops = ops;
+    return INV_SUCCESS;
+}
+
+int inv_math_batch_isa_supported(int isa)
+{
+    return isa_ops(isa) != NULL;
+}
+
+const char *inv_math_batch_isa_name(int isa)
+{
+    if (isa < 0 || isa >= INV_MATH_BATCH_NUM_ISA)
+        return "unknown";
+    return isa_names[isa];
+}
+
+/** out[i] = inv_q30_mult(a[i], b[i]) for n elements */
+void inv_q30_mult_batch(const long *a, const long *b, long *out, int n)
+{
+    get_ops()->q30_mult(a, b, out, n);
+}
+
+/** out[i] = inv_q29_mult(a[i], b[i]) for n elements */
+void inv_q29_mult_batch(const long *a, const long *b, long *out, int n)
+{
+    get_ops()->q29_mult(a, b, out, n);
+}
+
+/** inv_q_mult() on n pairs of quaternions, 4 longs each */
+void inv_q_mult_batch(const long *q1, const long *q2, long *qProd, int n)
+{
+    get_ops()->q_mult(q1, q2, qProd, n);
+}
+
+/** inv_q_rotate() of n 3-element vectors by the same quaternion */
+void inv_q_rotate_batch(const long *q, const long *in, long *out, int n)
+{
+    get_ops()->q_rotate(q, in, out, n);
+}
+
+/** inv_quaternion_to_rotation() on n quaternions, 9 longs out each */
+void inv_quaternion_to_rotation_batch(const long *quat, long *rot, int n)
+{
+    get_ops()->quaternion_to_rotation(quat, rot, n);
+}
+
+/** inv_convert_to_body_with_scale() on n 3-element vectors */
+void inv_convert_to_body_with_scale_batch(unsigned short orientation,
+                                          long sensitivity,
+                                          const long *input, long *output,
+                                          int n)
+{
+    get_ops()->convert_to_body_with_scale(orientation, sensitivity,
+                                          input, output, n);
+}
+
+/** inv_matrix_vector_mult() of n 3-element vectors by the same row
+* major matrix */
+void inv_matrix_vector_mult_batch(const long *matrix, const long *vecIn,
+                                  long *vecOut, int n)
+{
+    get_ops()->matrix_vector_mult(matrix, vecIn, vecOut, n);
+}
+
+/**
+ * @}
+ */
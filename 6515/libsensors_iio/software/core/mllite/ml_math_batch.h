@@ -0,0 +1,51 @@
+/*
+ $License:
+    Copyright (C) 2014 InvenSense Corporation, All Rights Reserved.
+    See included License.txt for License information.
+ $
+ */
+#ifndef INVENSENSE_INV_MATH_BATCH_H__
+#define INVENSENSE_INV_MATH_BATCH_H__
+
+#include "mltypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /* instruction sets the batch functions can run on */
+    enum inv_math_batch_isa {
+        INV_MATH_BATCH_SCALAR = 0,
+        INV_MATH_BATCH_SSE41,
+        INV_MATH_BATCH_AVX2,
+        INV_MATH_BATCH_NEON,
+        INV_MATH_BATCH_NUM_ISA
+    };
+
+    int inv_get_math_batch_isa(void);
+    inv_error_t inv_set_math_batch_isa(int isa);
+    int inv_math_batch_isa_supported(int isa);
+    const char *inv_math_batch_isa_name(int isa);
+
+    /* Array versions of the ml_math_func functions, n is the number of
+     * scalars, quaternions or vectors. Results are bit exact with the
+     * scalar functions for any input, products keep the same low 64 bits
+     * (low 32 where long is 32 bits) as the scalar long long multiply.
+     */
+    void inv_q30_mult_batch(const long *a, const long *b, long *out, int n);
+    void inv_q29_mult_batch(const long *a, const long *b, long *out, int n);
+    void inv_q_mult_batch(const long *q1, const long *q2, long *qProd, int n);
+    void inv_q_rotate_batch(const long *q, const long *in, long *out, int n);
+    void inv_quaternion_to_rotation_batch(const long *quat, long *rot, int n);
+    void inv_convert_to_body_with_scale_batch(unsigned short orientation,
+                                              long sensitivity,
+                                              const long *input, long *output,
+                                              int n);
+    void inv_matrix_vector_mult_batch(const long *matrix, const long *vecIn,
+                                      long *vecOut, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INVENSENSE_INV_MATH_BATCH_H__
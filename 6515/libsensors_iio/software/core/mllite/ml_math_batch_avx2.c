@@ -0,0 +1,166 @@
+/*
+ $License:
+    Copyright (C) 2014 InvenSense Corporation, All Rights Reserved.
+    See included License.txt for License information.
+ $
+ */
+
+/**
+ *   @defgroup  ML_MATH_BATCH ml_math_batch
+ *   @brief     Motion Library - Batch Math Functions, AVX2
+ *
+ *   @{
+ *       @file ml_math_batch_avx2.c
+ *       @brief AVX2 kernels for the x86-64 host builds.
+ */
+
+#include "ml_math_batch_simd.h"
+
+#ifdef INV_MATH_BATCH_HAVE_X86
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+#include <immintrin.h>
+
+/* long is 64 bits here, four per register */
+typedef __m256i vec_t;
+#define VEC_LANES 4
+#define BATCH_OPS inv_math_batch_avx2_ops
+
+static inline vec_t vld(const long *p)
+{
+    return _mm256_loadu_si256((const __m256i *)p);
+}
+
+static inline void vst(long *p, vec_t v)
+{
+    _mm256_storeu_si256((__m256i *)p, v);
+}
+
+/* vectors 0-1 in the low halves and 2-3 in the high ones, each pair
+   split as in the SSE4.1 version */
+static inline void vld3(const long *p, vec_t *v)
+{
+    vec_t r0 = _mm256_loadu2_m128i((const __m128i *)(p + 6),
+                                   (const __m128i *)p);
+    vec_t r1 = _mm256_loadu2_m128i((const __m128i *)(p + 8),
+                                   (const __m128i *)(p + 2));
+    vec_t r2 = _mm256_loadu2_m128i((const __m128i *)(p + 10),
+                                   (const __m128i *)(p + 4));
+
+    v[0] = _mm256_blend_epi32(r0, r1, 0xcc);
+    v[1] = _mm256_alignr_epi8(r2, r0, 8);
+    v[2] = _mm256_blend_epi32(r1, r2, 0xcc);
+}
+
+static inline void vst3(long *p, const vec_t *v)
+{
+    vec_t r0 = _mm256_unpacklo_epi64(v[0], v[1]);
+    vec_t r1 = _mm256_blend_epi32(v[2], v[0], 0xcc);
+    vec_t r2 = _mm256_unpackhi_epi64(v[1], v[2]);
+
+    _mm256_storeu2_m128i((__m128i *)(p + 6), (__m128i *)p, r0);
+    _mm256_storeu2_m128i((__m128i *)(p + 8), (__m128i *)(p + 2), r1);
+    _mm256_storeu2_m128i((__m128i *)(p + 10), (__m128i *)(p + 4), r2);
+}
+
+static inline void transpose4(vec_t r0, vec_t r1, vec_t r2, vec_t r3,
+                              vec_t *v)
+{
+    vec_t t0 = _mm256_unpacklo_epi64(r0, r1);
+    vec_t t1 = _mm256_unpackhi_epi64(r0, r1);
+    vec_t t2 = _mm256_unpacklo_epi64(r2, r3);
+    vec_t t3 = _mm256_unpackhi_epi64(r2, r3);
+
+    v[0] = _mm256_permute2x128_si256(t0, t2, 0x20);
+    v[1] = _mm256_permute2x128_si256(t1, t3, 0x20);
+    v[2] = _mm256_permute2x128_si256(t0, t2, 0x31);
+    v[3] = _mm256_permute2x128_si256(t1, t3, 0x31);
+}
+
+static inline void vld4(const long *p, vec_t *v)
+{
+    transpose4(vld(p), vld(p + 4), vld(p + 8), vld(p + 12), v);
+}
+
+static inline void vst4(long *p, const vec_t *v)
+{
+    vec_t t[4];
+
+    transpose4(v[0], v[1], v[2], v[3], t);
+    vst(p, t[0]);
+    vst(p + 4, t[1]);
+    vst(p + 8, t[2]);
+    vst(p + 12, t[3]);
+}
+
+static inline void vscatter(long *p, int stride, vec_t v)
+{
+    __m128i lo = _mm256_castsi256_si128(v);
+    __m128i hi = _mm256_extracti128_si256(v, 1);
+
+    p[0] = _mm_cvtsi128_si64(lo);
+    p[stride] = _mm_extract_epi64(lo, 1);
+    p[2 * stride] = _mm_cvtsi128_si64(hi);
+    p[3 * stride] = _mm_extract_epi64(hi, 1);
+}
+
+static inline vec_t vdup(long x)
+{
+    return _mm256_set1_epi64x(x);
+}
+
+static inline vec_t vadd(vec_t a, vec_t b)
+{
+    return _mm256_add_epi64(a, b);
+}
+
+static inline vec_t vsub(vec_t a, vec_t b)
+{
+    return _mm256_sub_epi64(a, b);
+}
+
+static inline vec_t vor(vec_t a, vec_t b)
+{
+    return _mm256_or_si256(a, b);
+}
+
+/* multiplied and sign extended by hand as in the SSE4.1 version */
+static inline vec_t vmul(vec_t a, vec_t b, int wide)
+{
+    vec_t cross;
+
+    if (!wide)
+        return _mm256_mul_epi32(a, b);
+    cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                             _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(_mm256_mul_epu32(a, b),
+                            _mm256_slli_epi64(cross, 32));
+}
+
+static inline vec_t vq30(vec_t a, vec_t b, int wide)
+{
+    const vec_t sign = _mm256_set1_epi64x(1LL << 33);
+    vec_t p = _mm256_srli_epi64(vmul(a, b, wide), 30);
+
+    return _mm256_sub_epi64(_mm256_xor_si256(p, sign), sign);
+}
+
+static inline vec_t vq29(vec_t a, vec_t b, int wide)
+{
+    const vec_t sign = _mm256_set1_epi64x(1LL << 34);
+    vec_t p = _mm256_srli_epi64(vmul(a, b, wide), 29);
+
+    return _mm256_sub_epi64(_mm256_xor_si256(p, sign), sign);
+}
+
+#include "ml_math_batch_kernels.h"
+
+#pragma GCC pop_options
+
+#endif
+
+/**
+ * @}
+ */
@@ -0,0 +1,296 @@
+/*
+ $License:
+    Copyright (C) 2014 InvenSense Corporation, All Rights Reserved.
+    See included License.txt for License information.
+ $
+ */
+
+/*
+ * Batch kernels shared by the instruction set specific files. Before
+ * including this, the file defines vec_t holding VEC_LANES longs, the
+ * primitives below and BATCH_OPS, the name of the table to define:
+ *
+ *   vld(p), vst(p, v)   load/store VEC_LANES consecutive longs
+ *   vld3(p, v), vst3(p, v), vld4(p, v), vst4(p, v)
+ *                       VEC_LANES 3 or 4 element vectors to or from one
+ *                       vec_t per component
+ *   vscatter(p, stride, v)  store lanes to every stride-th long
+ *   vdup(x)             all lanes set to x
+ *   vadd(a, b), vsub(a, b), vor(a, b)
+ *   vq30(a, b, wide), vq29(a, b, wide)
+ *                       same as inv_q30_mult(), inv_q29_mult(), wide
+ *                       for lanes that do not fit in 32 bits
+ *
+ * A file defines BATCH_SCALAR_Q_MULT if its q_mult kernel is no faster
+ * than the scalar loop, which is then used instead.
+ *
+ * Each kernel checks its inputs once and runs on the cheaper 32 x 32 bit
+ * multiply when every operand fits in 32 bits, which is the usual case.
+ * Leftover elements go through the scalar functions.
+ */
+
+#include "ml_math_func.h"
+
+#define BATCH_INLINE static inline __attribute__((always_inline))
+
+/* nonzero if -2^bits <= p[i] < 2^bits for all n, the sign bit of a long
+   is out of reach */
+static inline int fits(const long *p, int n, int bits)
+{
+    vec_t bias, acc;
+    long lanes[VEC_LANES];
+    unsigned long all = 0;
+    int i;
+
+    if (bits >= (int)sizeof(long) * 8 - 1)
+        return 1;
+    bias = vdup(1L << bits);
+    acc = vdup(0);
+    for (i = 0; i + VEC_LANES <= n; i += VEC_LANES)
+        acc = vor(acc, vadd(vld(p + i), bias));
+    vst(lanes, acc);
+    for (; i < n; i++)
+        all |= (unsigned long)p[i] + (1UL << bits);
+    for (i = 0; i < VEC_LANES; i++)
+        all |= (unsigned long)lanes[i];
+    return !(all >> (bits + 1));
+}
+
+/* inv_q_mult() on VEC_LANES quaternions */
+BATCH_INLINE void vqmult(const vec_t *q1, const vec_t *q2, vec_t *qProd,
+                         int w)
+{
+    qProd[0] = vsub(vsub(vsub(vq30(q1[0], q2[0], w), vq30(q1[1], q2[1], w)),
+                         vq30(q1[2], q2[2], w)), vq30(q1[3], q2[3], w));
+    qProd[1] = vsub(vadd(vadd(vq30(q1[0], q2[1], w), vq30(q1[1], q2[0], w)),
+                         vq30(q1[2], q2[3], w)), vq30(q1[3], q2[2], w));
+    qProd[2] = vadd(vadd(vsub(vq30(q1[0], q2[2], w), vq30(q1[1], q2[3], w)),
+                         vq30(q1[2], q2[0], w)), vq30(q1[3], q2[1], w));
+    qProd[3] = vadd(vsub(vadd(vq30(q1[0], q2[3], w), vq30(q1[1], q2[2], w)),
+                         vq30(q1[2], q2[1], w)), vq30(q1[3], q2[0], w));
+}
+
+BATCH_INLINE void q30_mult_run(const long *a, const long *b, long *out,
+                               int n, int w)
+{
+    int i;
+
+    for (i = 0; i + VEC_LANES <= n; i += VEC_LANES)
+        vst(out + i, vq30(vld(a + i), vld(b + i), w));
+    for (; i < n; i++)
+        out[i] = inv_q30_mult(a[i], b[i]);
+}
+
+static void q30_mult_batch(const long *a, const long *b, long *out, int n)
+{
+    if (fits(a, n, 31) && fits(b, n, 31))
+        q30_mult_run(a, b, out, n, 0);
+    else
+        q30_mult_run(a, b, out, n, 1);
+}
+
+BATCH_INLINE void q29_mult_run(const long *a, const long *b, long *out,
+                               int n, int w)
+{
+    int i;
+
+    for (i = 0; i + VEC_LANES <= n; i += VEC_LANES)
+        vst(out + i, vq29(vld(a + i), vld(b + i), w));
+    for (; i < n; i++)
+        out[i] = inv_q29_mult(a[i], b[i]);
+}
+
+static void q29_mult_batch(const long *a, const long *b, long *out, int n)
+{
+    if (fits(a, n, 31) && fits(b, n, 31))
+        q29_mult_run(a, b, out, n, 0);
+    else
+        q29_mult_run(a, b, out, n, 1);
+}
+
+BATCH_INLINE void q_mult_run(const long *q1, const long *q2, long *qProd,
+                             int n, int w)
+{
+    vec_t a[4], b[4], p[4];
+    int i;
+
+    for (i = 0; i + VEC_LANES <= n; i += VEC_LANES) {
+        vld4(q1 + i * 4, a);
+        vld4(q2 + i * 4, b);
+        vqmult(a, b, p, w);
+        vst4(qProd + i * 4, p);
+    }
+    for (; i < n; i++)
+        inv_q_mult(q1 + i * 4, q2 + i * 4, qProd + i * 4);
+}
+
+static void q_mult_batch(const long *q1, const long *q2, long *qProd, int n)
+{
+#ifdef BATCH_SCALAR_Q_MULT
+    int i;
+
+    for (i = 0; i < n; i++)
+        inv_q_mult(q1 + i * 4, q2 + i * 4, qProd + i * 4);
+    return;
+#endif
+    if (fits(q1, n * 4, 31) && fits(q2, n * 4, 31))
+        q_mult_run(q1, q2, qProd, n, 0);
+    else
+        q_mult_run(q1, q2, qProd, n, 1);
+}
+
+BATCH_INLINE void q_rotate_run(const long *q, const long *in, long *out,
+                               int n, int w)
+{
+    vec_t qv[4], qinv[4], in4[4], t[4], out4[4];
+    int i, k;
+
+    qv[0] = qinv[0] = vdup(q[0]);
+    for (k = 1; k < 4; k++) {
+        qv[k] = vdup(q[k]);
+        qinv[k] = vdup(-q[k]);
+    }
+    in4[0] = vdup(0);
+
+    for (i = 0; i + VEC_LANES <= n; i += VEC_LANES) {
+        vld3(in + i * 3, in4 + 1);
+        vqmult(qv, in4, t, w);
+        vqmult(t, qinv, out4, w);
+        vst3(out + i * 3, out4 + 1);
+    }
+    for (; i < n; i++)
+        inv_q_rotate(q, in + i * 3, out + i * 3);
+}
+
+/* all vectors rotated by the same quaternion */
+static void q_rotate_batch(const long *q, const long *in, long *out, int n)
+{
+    /* keeps the q * in products below 2^31 for the second multiply */
+    if (fits(q, 4, 30) && fits(in, n * 3, 28))
+        q_rotate_run(q, in, out, n, 0);
+    else
+        q_rotate_run(q, in, out, n, 1);
+}
+
+BATCH_INLINE void quaternion_to_rotation_run(const long *quat, long *rot,
+                                             int n, int w)
+{
+    vec_t q[4], one = vdup(1073741824L);
+    int i;
+
+    for (i = 0; i + VEC_LANES <= n; i += VEC_LANES) {
+        long *r = rot + i * 9;
+
+        vld4(quat + i * 4, q);
+        vscatter(r + 0, 9, vsub(vadd(vq29(q[1], q[1], w),
+                                     vq29(q[0], q[0], w)), one));
+        vscatter(r + 1, 9, vsub(vq29(q[1], q[2], w), vq29(q[3], q[0], w)));
+        vscatter(r + 2, 9, vadd(vq29(q[1], q[3], w), vq29(q[2], q[0], w)));
+        vscatter(r + 3, 9, vadd(vq29(q[1], q[2], w), vq29(q[3], q[0], w)));
+        vscatter(r + 4, 9, vsub(vadd(vq29(q[2], q[2], w),
+                                     vq29(q[0], q[0], w)), one));
+        vscatter(r + 5, 9, vsub(vq29(q[2], q[3], w), vq29(q[1], q[0], w)));
+        vscatter(r + 6, 9, vsub(vq29(q[1], q[3], w), vq29(q[2], q[0], w)));
+        vscatter(r + 7, 9, vadd(vq29(q[2], q[3], w), vq29(q[1], q[0], w)));
+        vscatter(r + 8, 9, vsub(vadd(vq29(q[3], q[3], w),
+                                     vq29(q[0], q[0], w)), one));
+    }
+    for (; i < n; i++)
+        inv_quaternion_to_rotation(quat + i * 4, rot + i * 9);
+}
+
+static void quaternion_to_rotation_batch(const long *quat, long *rot, int n)
+{
+    if (fits(quat, n * 4, 31))
+        quaternion_to_rotation_run(quat, rot, n, 0);
+    else
+        quaternion_to_rotation_run(quat, rot, n, 1);
+}
+
+BATCH_INLINE void convert_to_body_with_scale_run(unsigned short orientation,
+                                                 long sensitivity,
+                                                 const long *input,
+                                                 long *output, int n, int w)
+{
+    vec_t scale = vdup(sensitivity), zero = vdup(0), in[3], out[3];
+    int idx[3], neg[3];
+    int i, k, vn = n;
+
+    for (k = 0; k < 3; k++) {
+        idx[k] = (orientation >> (3 * k)) & 0x03;
+        neg[k] = orientation & (0x004 << (3 * k));
+        /* bad orientation, keep whatever the scalar version does */
+        if (idx[k] > 2)
+            vn = 0;
+    }
+
+    for (i = 0; i + VEC_LANES <= vn; i += VEC_LANES) {
+        vld3(input + i * 3, in);
+        for (k = 0; k < 3; k++) {
+            out[k] = in[idx[k]];
+            if (neg[k])
+                out[k] = vsub(zero, out[k]);
+            out[k] = vq30(out[k], scale, w);
+        }
+        vst3(output + i * 3, out);
+    }
+    for (; i < n; i++)
+        inv_convert_to_body_with_scale(orientation, sensitivity,
+                                       input + i * 3, output + i * 3);
+}
+
+static void convert_to_body_with_scale_batch(unsigned short orientation,
+                                             long sensitivity,
+                                             const long *input, long *output,
+                                             int n)
+{
+    /* -2^31 would not fit once negated */
+    if (fits(&sensitivity, 1, 31) && fits(input, n * 3, 30))
+        convert_to_body_with_scale_run(orientation, sensitivity,
+                                       input, output, n, 0);
+    else
+        convert_to_body_with_scale_run(orientation, sensitivity,
+                                       input, output, n, 1);
+}
+
+BATCH_INLINE void matrix_vector_mult_run(const long *matrix,
+                                         const long *vecIn, long *vecOut,
+                                         int n, int w)
+{
+    vec_t m[9], v[3], out[3];
+    int i, k;
+
+    for (k = 0; k < 9; k++)
+        m[k] = vdup(matrix[k]);
+
+    for (i = 0; i + VEC_LANES <= n; i += VEC_LANES) {
+        vld3(vecIn + i * 3, v);
+        for (k = 0; k < 3; k++)
+            out[k] = vadd(vadd(vq30(m[k * 3], v[0], w),
+                               vq30(m[k * 3 + 1], v[1], w)),
+                          vq30(m[k * 3 + 2], v[2], w));
+        vst3(vecOut + i * 3, out);
+    }
+    for (; i < n; i++)
+        inv_batch_matrix_vector_mult(matrix, vecIn + i * 3, vecOut + i * 3);
+}
+
+/* same row major matrix for all vectors */
+static void matrix_vector_mult_batch(const long *matrix, const long *vecIn,
+                                     long *vecOut, int n)
+{
+    if (fits(matrix, 9, 31) && fits(vecIn, n * 3, 31))
+        matrix_vector_mult_run(matrix, vecIn, vecOut, n, 0);
+    else
+        matrix_vector_mult_run(matrix, vecIn, vecOut, n, 1);
+}
+
+const struct inv_math_batch_ops BATCH_OPS = {
+    q30_mult_batch,
+    q29_mult_batch,
+    q_mult_batch,
+    q_rotate_batch,
+    quaternion_to_rotation_batch,
+    convert_to_body_with_scale_batch,
+    matrix_vector_mult_batch,
+};
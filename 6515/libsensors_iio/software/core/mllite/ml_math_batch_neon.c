@@ -0,0 +1,244 @@
+/*
+ $License:
+    Copyright (C) 2014 InvenSense Corporation, All Rights Reserved.
+    See included License.txt for License information.
+ $
+ */
+
+/**
+ *   @defgroup  ML_MATH_BATCH ml_math_batch
+ *   @brief     Motion Library - Batch Math Functions, NEON
+ *
+ *   @{
+ *       @file ml_math_batch_neon.c
+ *       @brief NEON kernels, long is 32 bits on ARMv7 and 64 on ARMv8.
+ */
+
+#include "ml_math_batch_simd.h"
+
+#ifdef INV_MATH_BATCH_HAVE_NEON
+
+#include <arm_neon.h>
+
+#define BATCH_OPS inv_math_batch_neon_ops
+
+#ifdef __aarch64__
+
+typedef int64x2_t vec_t;
+#define VEC_LANES 2
+
+static inline vec_t vld(const long *p)
+{
+    return vld1q_s64((const int64_t *)p);
+}
+
+static inline void vst(long *p, vec_t v)
+{
+    vst1q_s64((int64_t *)p, v);
+}
+
+static inline void vld3(const long *p, vec_t *v)
+{
+    int64x2x3_t t = vld3q_s64((const int64_t *)p);
+
+    v[0] = t.val[0];
+    v[1] = t.val[1];
+    v[2] = t.val[2];
+}
+
+static inline void vst3(long *p, const vec_t *v)
+{
+    int64x2x3_t t;
+
+    t.val[0] = v[0];
+    t.val[1] = v[1];
+    t.val[2] = v[2];
+    vst3q_s64((int64_t *)p, t);
+}
+
+static inline void vld4(const long *p, vec_t *v)
+{
+    int64x2x4_t t = vld4q_s64((const int64_t *)p);
+
+    v[0] = t.val[0];
+    v[1] = t.val[1];
+    v[2] = t.val[2];
+    v[3] = t.val[3];
+}
+
+static inline void vst4(long *p, const vec_t *v)
+{
+    int64x2x4_t t;
+
+    t.val[0] = v[0];
+    t.val[1] = v[1];
+    t.val[2] = v[2];
+    t.val[3] = v[3];
+    vst4q_s64((int64_t *)p, t);
+}
+
+static inline void vscatter(long *p, int stride, vec_t v)
+{
+    p[0] = vgetq_lane_s64(v, 0);
+    p[stride] = vgetq_lane_s64(v, 1);
+}
+
+static inline vec_t vdup(long x)
+{
+    return vdupq_n_s64(x);
+}
+
+static inline vec_t vadd(vec_t a, vec_t b)
+{
+    return vaddq_s64(a, b);
+}
+
+static inline vec_t vsub(vec_t a, vec_t b)
+{
+    return vsubq_s64(a, b);
+}
+
+static inline vec_t vor(vec_t a, vec_t b)
+{
+    return vorrq_s64(a, b);
+}
+
+/* Low 64 bits of a * b, as the scalar (long long) multiply. NEON has no
+   64 bit multiply, wide builds it from the 32 bit halves, the high half
+   products only matter in the upper word. */
+static inline vec_t vmul(vec_t a, vec_t b, int wide)
+{
+    uint64x2_t ua, ub, cross;
+    uint32x2_t alo, blo;
+
+    if (!wide)
+        return vmull_s32(vmovn_s64(a), vmovn_s64(b));
+    ua = vreinterpretq_u64_s64(a);
+    ub = vreinterpretq_u64_s64(b);
+    alo = vmovn_u64(ua);
+    blo = vmovn_u64(ub);
+    cross = vmull_u32(vshrn_n_u64(ua, 32), blo);
+    cross = vmlal_u32(cross, alo, vshrn_n_u64(ub, 32));
+    return vreinterpretq_s64_u64(vmlal_u32(vshlq_n_u64(cross, 32), alo, blo));
+}
+
+static inline vec_t vq30(vec_t a, vec_t b, int wide)
+{
+    return vshrq_n_s64(vmul(a, b, wide), 30);
+}
+
+static inline vec_t vq29(vec_t a, vec_t b, int wide)
+{
+    return vshrq_n_s64(vmul(a, b, wide), 29);
+}
+
+#else
+
+typedef int32x4_t vec_t;
+#define VEC_LANES 4
+
+static inline vec_t vld(const long *p)
+{
+    return vld1q_s32((const int32_t *)p);
+}
+
+static inline void vst(long *p, vec_t v)
+{
+    vst1q_s32((int32_t *)p, v);
+}
+
+static inline void vld3(const long *p, vec_t *v)
+{
+    int32x4x3_t t = vld3q_s32((const int32_t *)p);
+
+    v[0] = t.val[0];
+    v[1] = t.val[1];
+    v[2] = t.val[2];
+}
+
+static inline void vst3(long *p, const vec_t *v)
+{
+    int32x4x3_t t;
+
+    t.val[0] = v[0];
+    t.val[1] = v[1];
+    t.val[2] = v[2];
+    vst3q_s32((int32_t *)p, t);
+}
+
+static inline void vld4(const long *p, vec_t *v)
+{
+    int32x4x4_t t = vld4q_s32((const int32_t *)p);
+
+    v[0] = t.val[0];
+    v[1] = t.val[1];
+    v[2] = t.val[2];
+    v[3] = t.val[3];
+}
+
+static inline void vst4(long *p, const vec_t *v)
+{
+    int32x4x4_t t;
+
+    t.val[0] = v[0];
+    t.val[1] = v[1];
+    t.val[2] = v[2];
+    t.val[3] = v[3];
+    vst4q_s32((int32_t *)p, t);
+}
+
+static inline void vscatter(long *p, int stride, vec_t v)
+{
+    p[0] = vgetq_lane_s32(v, 0);
+    p[stride] = vgetq_lane_s32(v, 1);
+    p[2 * stride] = vgetq_lane_s32(v, 2);
+    p[3 * stride] = vgetq_lane_s32(v, 3);
+}
+
+static inline vec_t vdup(long x)
+{
+    return vdupq_n_s32(x);
+}
+
+static inline vec_t vadd(vec_t a, vec_t b)
+{
+    return vaddq_s32(a, b);
+}
+
+static inline vec_t vsub(vec_t a, vec_t b)
+{
+    return vsubq_s32(a, b);
+}
+
+static inline vec_t vor(vec_t a, vec_t b)
+{
+    return vorrq_s32(a, b);
+}
+
+/* 64 bit products, narrowed back keeping the low 32 bits of the shift.
+   long is 32 bits, every lane fits the multiply, wide is ignored. */
+static inline vec_t vq30(vec_t a, vec_t b, int wide)
+{
+    int64x2_t lo = vmull_s32(vget_low_s32(a), vget_low_s32(b));
+    int64x2_t hi = vmull_s32(vget_high_s32(a), vget_high_s32(b));
+
+    return vcombine_s32(vshrn_n_s64(lo, 30), vshrn_n_s64(hi, 30));
+}
+
+static inline vec_t vq29(vec_t a, vec_t b, int wide)
+{
+    int64x2_t lo = vmull_s32(vget_low_s32(a), vget_low_s32(b));
+    int64x2_t hi = vmull_s32(vget_high_s32(a), vget_high_s32(b));
+
+    return vcombine_s32(vshrn_n_s64(lo, 29), vshrn_n_s64(hi, 29));
+}
+
+#endif
+
+#include "ml_math_batch_kernels.h"
+
+#endif
+
+/**
+ * @}
+ */
@@ -0,0 +1,66 @@
+/*
+ $License:
+    Copyright (C) 2014 InvenSense Corporation, All Rights Reserved.
+    See included License.txt for License information.
+ $
+ */
+#ifndef INVENSENSE_INV_MATH_BATCH_SIMD_H__
+#define INVENSENSE_INV_MATH_BATCH_SIMD_H__
+
+/* Internal to ml_math_batch*.c, one table of kernels per instruction set */
+
+#include "ml_math_func.h"
+
+#ifndef UMPL_ELIMINATE_64BIT
+#if defined(__x86_64__)
+#define INV_MATH_BATCH_HAVE_X86
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define INV_MATH_BATCH_HAVE_NEON
+#endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    struct inv_math_batch_ops {
+        void (*q30_mult)(const long *a, const long *b, long *out, int n);
+        void (*q29_mult)(const long *a, const long *b, long *out, int n);
+        void (*q_mult)(const long *q1, const long *q2, long *qProd, int n);
+        void (*q_rotate)(const long *q, const long *in, long *out, int n);
+        void (*quaternion_to_rotation)(const long *quat, long *rot, int n);
+        void (*convert_to_body_with_scale)(unsigned short orientation,
+                                           long sensitivity,
+                                           const long *input, long *output,
+                                           int n);
+        void (*matrix_vector_mult)(const long *matrix, const long *vecIn,
+                                   long *vecOut, int n);
+    };
+
+    /* y = A x, A row major as for inv_matrix_vector_mult() in
+       data_builder.c */
+    static inline void inv_batch_matrix_vector_mult(const long *A,
+                                                    const long *x, long *y)
+    {
+        y[0] = inv_q30_mult(A[0], x[0]) + inv_q30_mult(A[1], x[1]) +
+               inv_q30_mult(A[2], x[2]);
+        y[1] = inv_q30_mult(A[3], x[0]) + inv_q30_mult(A[4], x[1]) +
+               inv_q30_mult(A[5], x[2]);
+        y[2] = inv_q30_mult(A[6], x[0]) + inv_q30_mult(A[7], x[1]) +
+               inv_q30_mult(A[8], x[2]);
+    }
+
+#ifdef INV_MATH_BATCH_HAVE_X86
+    extern const struct inv_math_batch_ops inv_math_batch_sse41_ops;
+    extern const struct inv_math_batch_ops inv_math_batch_avx2_ops;
+#endif
+#ifdef INV_MATH_BATCH_HAVE_NEON
+    extern const struct inv_math_batch_ops inv_math_batch_neon_ops;
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INVENSENSE_INV_MATH_BATCH_SIMD_H__
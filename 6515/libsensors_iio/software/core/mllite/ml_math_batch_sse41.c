@@ -0,0 +1,146 @@
+/*
+ $License:
+    Copyright (C) 2014 InvenSense Corporation, All Rights Reserved.
+    See included License.txt for License information.
+ $
+ */
+
+/**
+ *   @defgroup  ML_MATH_BATCH ml_math_batch
+ *   @brief     Motion Library - Batch Math Functions, SSE4.1
+ *
+ *   @{
+ *       @file ml_math_batch_sse41.c
+ *       @brief SSE4.1 kernels for the x86-64 host builds.
+ */
+
+#include "ml_math_batch_simd.h"
+
+#ifdef INV_MATH_BATCH_HAVE_X86
+
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+
+#include <smmintrin.h>
+
+/* long is 64 bits here, two per register */
+typedef __m128i vec_t;
+#define VEC_LANES 2
+#define BATCH_OPS inv_math_batch_sse41_ops
+/* the shuffles of two quaternions per register cost what the multiplies
+   save */
+#define BATCH_SCALAR_Q_MULT
+
+static inline vec_t vld(const long *p)
+{
+    return _mm_loadu_si128((const __m128i *)p);
+}
+
+static inline void vst(long *p, vec_t v)
+{
+    _mm_storeu_si128((__m128i *)p, v);
+}
+
+/* two vectors a, b: (a0 a1) (a2 b0) (b1 b2) */
+static inline void vld3(const long *p, vec_t *v)
+{
+    vec_t r0 = vld(p), r1 = vld(p + 2), r2 = vld(p + 4);
+
+    v[0] = _mm_blend_epi16(r0, r1, 0xf0);
+    v[1] = _mm_alignr_epi8(r2, r0, 8);
+    v[2] = _mm_blend_epi16(r1, r2, 0xf0);
+}
+
+static inline void vst3(long *p, const vec_t *v)
+{
+    vst(p, _mm_unpacklo_epi64(v[0], v[1]));
+    vst(p + 2, _mm_blend_epi16(v[2], v[0], 0xf0));
+    vst(p + 4, _mm_unpackhi_epi64(v[1], v[2]));
+}
+
+/* two quaternions a, b: (a0 a1) (a2 a3) (b0 b1) (b2 b3) */
+static inline void vld4(const long *p, vec_t *v)
+{
+    vec_t r0 = vld(p), r1 = vld(p + 2), r2 = vld(p + 4), r3 = vld(p + 6);
+
+    v[0] = _mm_unpacklo_epi64(r0, r2);
+    v[1] = _mm_unpackhi_epi64(r0, r2);
+    v[2] = _mm_unpacklo_epi64(r1, r3);
+    v[3] = _mm_unpackhi_epi64(r1, r3);
+}
+
+static inline void vst4(long *p, const vec_t *v)
+{
+    vst(p, _mm_unpacklo_epi64(v[0], v[1]));
+    vst(p + 2, _mm_unpacklo_epi64(v[2], v[3]));
+    vst(p + 4, _mm_unpackhi_epi64(v[0], v[1]));
+    vst(p + 6, _mm_unpackhi_epi64(v[2], v[3]));
+}
+
+static inline void vscatter(long *p, int stride, vec_t v)
+{
+    p[0] = _mm_cvtsi128_si64(v);
+    p[stride] = _mm_extract_epi64(v, 1);
+}
+
+static inline vec_t vdup(long x)
+{
+    return _mm_set1_epi64x(x);
+}
+
+static inline vec_t vadd(vec_t a, vec_t b)
+{
+    return _mm_add_epi64(a, b);
+}
+
+static inline vec_t vsub(vec_t a, vec_t b)
+{
+    return _mm_sub_epi64(a, b);
+}
+
+static inline vec_t vor(vec_t a, vec_t b)
+{
+    return _mm_or_si128(a, b);
+}
+
+/* Low 64 bits of a * b, as the scalar (long long) multiply. There is no
+   64 bit multiply before AVX-512, wide builds it from the 32 bit halves,
+   the high half products only matter in the upper word. */
+static inline vec_t vmul(vec_t a, vec_t b, int wide)
+{
+    vec_t cross;
+
+    if (!wide)
+        return _mm_mul_epi32(a, b);
+    cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b),
+                          _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+    return _mm_add_epi64(_mm_mul_epu32(a, b), _mm_slli_epi64(cross, 32));
+}
+
+/* There is no 64 bit arithmetic shift before AVX-512 either, shift
+   logically and sign extend from the bit the sign landed on. */
+static inline vec_t vq30(vec_t a, vec_t b, int wide)
+{
+    const vec_t sign = _mm_set1_epi64x(1LL << 33);
+    vec_t p = _mm_srli_epi64(vmul(a, b, wide), 30);
+
+    return _mm_sub_epi64(_mm_xor_si128(p, sign), sign);
+}
+
+static inline vec_t vq29(vec_t a, vec_t b, int wide)
+{
+    const vec_t sign = _mm_set1_epi64x(1LL << 34);
+    vec_t p = _mm_srli_epi64(vmul(a, b, wide), 29);
+
+    return _mm_sub_epi64(_mm_xor_si128(p, sign), sign);
+}
+
+#include "ml_math_batch_kernels.h"
+
+#pragma GCC pop_options
+
+#endif
+
+/**
+ * @}
+ */
@@ -26,6 +26,88 @@
 #include "mlinclude.h"
 #include <string.h>
 
+/* 0 for the libm trig functions, 1 for the approximations */
+static int fast_trig;
+
+/** Selects the trig functions used for orientation outputs and the
+* compass angle: the libm ones by default, or the faster approximations
+* inv_atan2f_fast() and inv_asinf_fast().
+* @param[in] enable 1 to use the approximations, 0 for libm.
+*/
+void inv_set_fast_trig(int enable)
+{
+    fast_trig = enable ? 1 : 0;
+}
+
+int inv_get_fast_trig(void)
+{
+    return fast_trig;
+}
+
+/* atan(z) for 0 <= z <= 1, minimax polynomial */
+static float atan_unit(float z)
+{
+    float s = z * z;
+
+    return z * (0.99997726f + s * (-0.33262347f + s * (0.19354346f +
+                s * (-0.11643287f + s * (0.05265332f + s * -0.01172120f)))));
+}
+
+/** Polynomial approximation of atan2f(). Within 3e-6 rad (0.0002 degree)
+* of the exact value for any input, atan2(0, 0) gives 0.
+* @param[in] y
+* @param[in] x
+* @return Angle in radians, -pi to pi.
+*/
+float inv_atan2f_fast(float y, float x)
+{
+    float ax = fabsf(x), ay = fabsf(y);
+    float angle;
+
+    if (ax >= ay) {
+        if (ax == 0.f)
+            return 0.f;
+        angle = atan_unit(ay / ax);
+    } else {
+        angle = (float)(M_PI / 2) - atan_unit(ax / ay);
+    }
+    if (x < 0.f)
+        angle = (float)M_PI - angle;
+    return (y < 0.f) ? -angle : angle;
+}
+
+/** Approximation of asinf() through inv_atan2f_fast(), same error bound.
+* Inputs outside -1 to 1, e.g. from rounding in a rotation matrix, are
+* clamped instead of giving NaN.
+* @param[in] x
+* @return Angle in radians, -pi/2 to pi/2.
+*/
+float inv_asinf_fast(float x)
+{
+    if (x >= 1.f)
+        return (float)(M_PI / 2);
+    if (x <= -1.f)
+        return (float)(-M_PI / 2);
+    /* (1 - x)(1 + x) keeps the precision near +-1 that 1 - x * x loses */
+    return inv_atan2f_fast(x, sqrtf((1.f - x) * (1.f + x)));
+}
+
+/** atan2f() or inv_atan2f_fast(), see inv_set_fast_trig() */
+float inv_atan2f(float y, float x)
+{
+    if (fast_trig)
+        return inv_atan2f_fast(y, x);
+    return atan2f(y, x);
+}
+
+/** asinf() or inv_asinf_fast(), see inv_set_fast_trig() */
+float inv_asinf(float x)
+{
+    if (fast_trig)
+        return inv_asinf_fast(x);
+    return asinf(x);
+}
+
 /** @internal
  * Does the cross product of compass by gravity, then converts that
  * to the world frame using the quaternion, then computes the angle that
@@ -57,7 +139,7 @@ float inv_compass_angle(const long *compass, const long *grav, const float *quat
         return 0.f;
 
     // This is the unfiltered heading correction
-    angW = -atan2f(q2[2], q2[1]);
+    angW = -inv_atan2f(q2[2], q2[1]);
     return angW;
 }
 
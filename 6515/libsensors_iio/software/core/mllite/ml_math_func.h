@@ -99,6 +99,12 @@ extern "C" {
     uint32_t inv_checksum(const unsigned char *str, int len);
     float inv_compass_angle(const long *compass, const long *grav,
                             const float *quat);
+    void inv_set_fast_trig(int enable);
+    int inv_get_fast_trig(void);
+    float inv_atan2f_fast(float y, float x);
+    float inv_asinf_fast(float x);
+    float inv_atan2f(float y, float x);
+    float inv_asinf(float x);
     unsigned long inv_get_gyro_sum_of_sqr(const long *gyro);
 
     static inline long inv_delta_time_ms(inv_time_t t1, inv_time_t t2)
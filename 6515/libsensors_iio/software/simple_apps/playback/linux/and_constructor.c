@@ -17,6 +17,12 @@
 #undef MPL_LOG_NDEBUG
 #define MPL_LOG_NDEBUG 0 /* turn to 0 to enable verbose logging */
 
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "log.h"
 #undef MPL_LOG_TAG
 #define MPL_LOG_TAG "MPL-playback"
@@ -25,6 +31,7 @@
 #include "mlos.h"
 #include "invensense.h"
 #include "invensense_adv.h"
+#include "ml_data_recorder.h"
 
 /*
     Typedef
@@ -106,56 +113,188 @@ void int32_to_long(int32_t in[], long out[], int length)
         out[ii] = (long)in[ii];
 }
 
-inv_error_t inv_playback(void)
+/* read position in a mapped playback file */
+struct inv_playback_cursor {
+    const unsigned char *pos;
+    const unsigned char *end;
+};
+
+static int playback_read(struct inv_playback_cursor *cur, void *dst,
+                         size_t size, size_t count)
 {
+    size_t len = size * count;
+
+    if ((size_t)(cur->end - cur->pos) < len)
+        return 0;
+    memcpy(dst, cur->pos, len);
+    cur->pos += len;
+    return 1;
+}
+
+/* applies one record of the indexed recording format */
+static int playback_apply(const struct inv_rec_sample_t *s,
+                          void (*execute_cb)(void *arg), void *arg,
+                          struct inv_playback_stats *count)
+{
+    long data[4];
+    short gyro[3];
+    int ii;
+
+    for (ii = 0; ii < 4; ii++)
+        data[ii] = (long)s->data[ii];
+
+    switch (s->type) {
+    case PLAYBACK_DBG_TYPE_GYRO:
+        for (ii = 0; ii < 3; ii++)
+            gyro[ii] = (short)data[ii];
+        inv_build_gyro(gyro, s->timestamp);
+        count->samples++;
+        break;
+    case PLAYBACK_DBG_TYPE_ACCEL:
+        inv_build_accel(data, 0, s->timestamp);
+        count->samples++;
+        break;
+    case PLAYBACK_DBG_TYPE_COMPASS:
+        inv_build_compass(data, 0, s->timestamp);
+        count->samples++;
+        break;
+    case PLAYBACK_DBG_TYPE_TEMPERATURE:
+        inv_build_temp(data[0], s->timestamp);
+        count->samples++;
+        break;
+    case PLAYBACK_DBG_TYPE_QUAT:
+        inv_build_quat(data, INV_BIAS_APPLIED, s->timestamp);
+        count->samples++;
+        break;
+    case PLAYBACK_DBG_TYPE_EXECUTE:
+        inv_execute_on_data();
+        count->executes++;
+        if (execute_cb)
+            execute_cb(arg);
+        break;
+    case PLAYBACK_DBG_TYPE_G_ORIENT:
+        inv_set_gyro_orientation_and_scale((int)data[0], data[1]);
+        break;
+    case PLAYBACK_DBG_TYPE_A_ORIENT:
+        inv_set_accel_orientation_and_scale((int)data[0], data[1]);
+        break;
+    case PLAYBACK_DBG_TYPE_C_ORIENT:
+        inv_set_compass_orientation_and_scale((int)data[0], data[1]);
+        break;
+    case PLAYBACK_DBG_TYPE_G_SAMPLE_RATE:
+        inv_set_gyro_sample_rate(data[0]);
+        break;
+    case PLAYBACK_DBG_TYPE_A_SAMPLE_RATE:
+        inv_set_accel_sample_rate(data[0]);
+        break;
+    case PLAYBACK_DBG_TYPE_C_SAMPLE_RATE:
+        inv_set_compass_sample_rate(data[0]);
+        break;
+    case PLAYBACK_DBG_TYPE_Q_SAMPLE_RATE:
+        inv_set_quat_sample_rate(data[0]);
+        break;
+    case PLAYBACK_DBG_TYPE_GYRO_OFF:
+        inv_gyro_was_turned_off();
+        break;
+    case PLAYBACK_DBG_TYPE_ACCEL_OFF:
+        inv_accel_was_turned_off();
+        break;
+    case PLAYBACK_DBG_TYPE_COMPASS_OFF:
+        inv_compass_was_turned_off();
+        break;
+    case PLAYBACK_DBG_TYPE_QUAT_OFF:
+        inv_quaternion_sensor_was_turned_off();
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+/* recordings made with inv_rec_start(), see ml_data_recorder.h */
+static inv_error_t playback_recording(const unsigned char *data, size_t size,
+                                      void (*execute_cb)(void *arg),
+                                      void *arg,
+                                      struct inv_playback_stats *stats)
+{
+    struct inv_rec_reader_t reader;
+    struct inv_rec_sample_t sample;
+    struct inv_playback_stats count = { 0, 0 };
+    inv_error_t result;
+    int rc;
+
+    result = inv_rec_reader_open(&reader, data, size);
+    if (result)
+        return result;
+
+    while ((rc = inv_rec_reader_next(&reader, &sample)) > 0) {
+        if (playback_apply(&sample, execute_cb, arg, &count)) {
+            rc = -1;
+            break;
+        }
+    }
+    if (rc < 0) {
+        MPL_LOGE("%s|%s|%d error: corrupted recording, PLAYBACK stopped\n",
+                 __FILE__, __func__, __LINE__);
+        result = INV_ERROR;
+    }
+    MPL_LOGV("end of PLAYBACK data\n");
+
+    inv_rec_reader_close(&reader);
+    if (stats)
+        *stats = count;
+    return result;
+}
+
+/** Plays back a recording held in memory.
+* Both the indexed format of ml_data_recorder.h and the older raw
+* record stream are accepted.
+* @param[in] data Content of a playback file recorded with RD_RECORD.
+* @param[in] size Size of data in bytes.
+* @param[in] execute_cb Called after each inv_execute_on_data(), may be NULL.
+* @param[in] arg Passed to execute_cb.
+* @param[out] stats Number of samples and processing passes played back,
+*                   may be NULL.
+* @return Returns INV_SUCCESS if successful or an error code if not.
+*/
+inv_error_t inv_playback_buffer(const unsigned char *data, size_t size,
+                                void (*execute_cb)(void *arg), void *arg,
+                                struct inv_playback_stats *stats)
+{
+    struct inv_playback_cursor cur = { data, data + size };
+    struct inv_playback_stats count = { 0, 0 };
     inv_rd_dbg_states type;
     inv_time_t ts;
     int32_t buffer[4];
     short gyro[3];
-    size_t r = 1;
     int32_t orientation;
     int32_t sensitivity, sample_rate_us = 0;
+    inv_error_t result = INV_SUCCESS;
 
-    // Check to make sure we were request to playback
-    if (inv_construct.debug_mode != RD_PLAYBACK) {
-        MPL_LOGE("%s|%s|%d error: debug_mode != RD_PLAYBACK\n",
-                 __FILE__, __func__, __LINE__);
-        return INV_ERROR;
-    }
-
-    if (inv_construct.file == NULL) {
-        inv_construct.file = fopen(playback_filename, "rb");
-        if (!inv_construct.file) {
-            MPL_LOGE("Error : cannot find or open playback file '%s'\n",
-                     playback_filename);
-            return INV_ERROR_FILE_OPEN;
-        }
-    }
+    if (inv_rec_is_recording(data, size))
+        return playback_recording(data, size, execute_cb, arg, stats);
 
-    while (1) {
-        r = fread(&type, sizeof(type), 1, inv_construct.file);
-        if (r == 0) {
-            MPL_LOGV("read 0 bytes, PLAYBACK file closed\n");
-            inv_construct.debug_mode = RD_NO_DEBUG;
-            fclose(inv_construct.file);
-            break;
-        }
+    while (playback_read(&cur, &type, sizeof(type), 1)) {
         //MPL_LOGV("TYPE : %d, %d\n", type);
         switch (type) {
         case PLAYBACK_DBG_TYPE_GYRO:
-            r = fread(gyro, sizeof(gyro[0]), 3, inv_construct.file);
-            r = fread(&ts, sizeof(ts), 1, inv_construct.file);
+            if (!playback_read(&cur, gyro, sizeof(gyro[0]), 3) ||
+                    !playback_read(&cur, &ts, sizeof(ts), 1))
+                goto truncated;
             inv_build_gyro(gyro, ts);
+            count.samples++;
             MPL_LOGV("PLAYBACK_DBG_TYPE_GYRO, %+d, %+d, %+d, %+lld\n",
                      gyro[0], gyro[1], gyro[2], ts);
             break;
         case PLAYBACK_DBG_TYPE_ACCEL:
         {
             long accel[3];
-            r = fread(buffer, sizeof(buffer[0]), 3, inv_construct.file);
-            r = fread(&ts, sizeof(ts), 1, inv_construct.file);
+            if (!playback_read(&cur, buffer, sizeof(buffer[0]), 3) ||
+                    !playback_read(&cur, &ts, sizeof(ts), 1))
+                goto truncated;
             int32_to_long(buffer, accel, 3);
             inv_build_accel(accel, 0, ts);
+            count.samples++;
             MPL_LOGV("PLAYBACK_DBG_TYPE_ACCEL, %+d, %+d, %+d, %lld\n",
                      buffer[0], buffer[1], buffer[2], ts);
             break;
@@ -163,28 +302,34 @@ inv_error_t inv_playback(void)
         case PLAYBACK_DBG_TYPE_COMPASS:
         {
             long compass[3];
-            r = fread(buffer, sizeof(buffer[0]), 3, inv_construct.file);
-            r = fread(&ts, sizeof(ts), 1, inv_construct.file);
+            if (!playback_read(&cur, buffer, sizeof(buffer[0]), 3) ||
+                    !playback_read(&cur, &ts, sizeof(ts), 1))
+                goto truncated;
             int32_to_long(buffer, compass, 3);
             inv_build_compass(compass, 0, ts);
+            count.samples++;
             MPL_LOGV("PLAYBACK_DBG_TYPE_COMPASS, %+d, %+d, %+d, %lld\n",
                      buffer[0], buffer[1], buffer[2], ts);
             break;
         }
         case PLAYBACK_DBG_TYPE_TEMPERATURE:
-            r = fread(buffer, sizeof(buffer[0]), 1, inv_construct.file);
-            r = fread(&ts, sizeof(ts), 1, inv_construct.file);
+            if (!playback_read(&cur, buffer, sizeof(buffer[0]), 1) ||
+                    !playback_read(&cur, &ts, sizeof(ts), 1))
+                goto truncated;
             inv_build_temp(buffer[0], ts);
+            count.samples++;
             MPL_LOGV("PLAYBACK_DBG_TYPE_TEMPERATURE, %+d, %lld\n",
                      buffer[0], ts);
             break;
         case PLAYBACK_DBG_TYPE_QUAT:
         {
             long quat[4];
-            r = fread(buffer, sizeof(buffer[0]), 4, inv_construct.file);
-            r = fread(&ts, sizeof(ts), 1, inv_construct.file);
+            if (!playback_read(&cur, buffer, sizeof(buffer[0]), 4) ||
+                    !playback_read(&cur, &ts, sizeof(ts), 1))
+                goto truncated;
             int32_to_long(buffer, quat, 4);
             inv_build_quat(quat, INV_BIAS_APPLIED, ts);
+            count.samples++;
             MPL_LOGV("PLAYBACK_DBG_TYPE_QUAT, %+d, %+d, %+d, %+d, %lld\n",
                      buffer[0], buffer[1], buffer[2], buffer[3], ts);
             break;
@@ -192,47 +337,53 @@ inv_error_t inv_playback(void)
         case PLAYBACK_DBG_TYPE_EXECUTE:
             MPL_LOGV("PLAYBACK_DBG_TYPE_EXECUTE\n");
             inv_execute_on_data();
-            if (s_func_cb)
-                s_func_cb();
-            //done = 1;
+            count.executes++;
+            if (execute_cb)
+                execute_cb(arg);
             break;
 
         case PLAYBACK_DBG_TYPE_G_ORIENT:
             MPL_LOGV("PLAYBACK_DBG_TYPE_G_ORIENT\n");
-            r = fread(&orientation, sizeof(orientation), 1, inv_construct.file);
-            r = fread(&sensitivity, sizeof(sensitivity), 1, inv_construct.file);
+            if (!playback_read(&cur, &orientation, sizeof(orientation), 1) ||
+                    !playback_read(&cur, &sensitivity, sizeof(sensitivity), 1))
+                goto truncated;
             inv_set_gyro_orientation_and_scale(orientation, sensitivity);
             break;
         case PLAYBACK_DBG_TYPE_A_ORIENT:
             MPL_LOGV("PLAYBACK_DBG_TYPE_A_ORIENT\n");
-            r = fread(&orientation, sizeof(orientation), 1, inv_construct.file);
-            r = fread(&sensitivity, sizeof(sensitivity), 1, inv_construct.file);
+            if (!playback_read(&cur, &orientation, sizeof(orientation), 1) ||
+                    !playback_read(&cur, &sensitivity, sizeof(sensitivity), 1))
+                goto truncated;
             inv_set_accel_orientation_and_scale(orientation, sensitivity);
             break;
         case PLAYBACK_DBG_TYPE_C_ORIENT:
             MPL_LOGV("PLAYBACK_DBG_TYPE_C_ORIENT\n");
-            r = fread(&orientation, sizeof(orientation), 1, inv_construct.file);
-            r = fread(&sensitivity, sizeof(sensitivity), 1, inv_construct.file);
+            if (!playback_read(&cur, &orientation, sizeof(orientation), 1) ||
+                    !playback_read(&cur, &sensitivity, sizeof(sensitivity), 1))
+                goto truncated;
             inv_set_compass_orientation_and_scale(orientation, sensitivity);
             break;
 
         case PLAYBACK_DBG_TYPE_G_SAMPLE_RATE:
-            r = fread(&sample_rate_us, sizeof(sample_rate_us), 
-                      1, inv_construct.file);
+            if (!playback_read(&cur, &sample_rate_us,
+                               sizeof(sample_rate_us), 1))
+                goto truncated;
             inv_set_gyro_sample_rate(sample_rate_us);
             MPL_LOGV("PLAYBACK_DBG_TYPE_G_SAMPLE_RATE => %d\n",
                      sample_rate_us);
             break;
         case PLAYBACK_DBG_TYPE_A_SAMPLE_RATE:
-            r = fread(&sample_rate_us, sizeof(sample_rate_us), 
-                      1, inv_construct.file);
+            if (!playback_read(&cur, &sample_rate_us,
+                               sizeof(sample_rate_us), 1))
+                goto truncated;
             inv_set_accel_sample_rate(sample_rate_us);
             MPL_LOGV("PLAYBACK_DBG_TYPE_A_SAMPLE_RATE => %d\n",
                      sample_rate_us);
             break;
         case PLAYBACK_DBG_TYPE_C_SAMPLE_RATE:
-            r = fread(&sample_rate_us, sizeof(sample_rate_us), 
-                      1, inv_construct.file);
+            if (!playback_read(&cur, &sample_rate_us,
+                               sizeof(sample_rate_us), 1))
+                goto truncated;
             inv_set_compass_sample_rate(sample_rate_us);
             MPL_LOGV("PLAYBACK_DBG_TYPE_C_SAMPLE_RATE => %d\n",
                      sample_rate_us);
@@ -257,25 +408,84 @@ inv_error_t inv_playback(void)
 
         case PLAYBACK_DBG_TYPE_Q_SAMPLE_RATE:
             MPL_LOGV("PLAYBACK_DBG_TYPE_Q_SAMPLE_RATE\n");
-            r = fread(&sample_rate_us, sizeof(sample_rate_us), 
-                      1, inv_construct.file);
+            if (!playback_read(&cur, &sample_rate_us,
+                               sizeof(sample_rate_us), 1))
+                goto truncated;
             inv_set_quat_sample_rate(sample_rate_us);
             break;
         default:
-            //MPL_LOGV("PLAYBACK file closed\n");
-            fclose(inv_construct.file);
             MPL_LOGE("%s|%s|%d error: unrecognized log type '%d', "
-                     "PLAYBACK file closed\n",
+                     "PLAYBACK stopped\n",
                      __FILE__, __func__, __LINE__, type);
-            return INV_ERROR;
+            result = INV_ERROR;
+            goto done;
         }
     }
+    MPL_LOGV("end of PLAYBACK data\n");
+    goto done;
+
+truncated:
+    MPL_LOGV("PLAYBACK data truncated in record type '%d'\n", type);
+done:
+    if (stats)
+        *stats = count;
+    return result;
+}
+
+static void playback_execute_cb(void *arg)
+{
+    (void)arg;
+    if (s_func_cb)
+        s_func_cb();
+}
+
+inv_error_t inv_playback(void)
+{
+    struct stat st;
+    void *data;
+    int fd;
+    inv_error_t result;
+
+    // Check to make sure we were request to playback
+    if (inv_construct.debug_mode != RD_PLAYBACK) {
+        MPL_LOGE("%s|%s|%d error: debug_mode != RD_PLAYBACK\n",
+                 __FILE__, __func__, __LINE__);
+        return INV_ERROR;
+    }
+
+    fd = open(playback_filename, O_RDONLY);
+    if (fd < 0) {
+        MPL_LOGE("Error : cannot find or open playback file '%s'\n",
+                 playback_filename);
+        return INV_ERROR_FILE_OPEN;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return INV_ERROR_FILE_READ;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        inv_construct.debug_mode = RD_NO_DEBUG;
+        return INV_SUCCESS;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        MPL_LOGE("Error : cannot map playback file '%s'\n",
+                 playback_filename);
+        return INV_ERROR_FILE_READ;
+    }
+    /* records are read once, in order */
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    result = inv_playback_buffer((const unsigned char *)data, st.st_size,
+                                 playback_execute_cb, NULL, NULL);
     msleep(1);
 
+    munmap(data, st.st_size);
     inv_construct.debug_mode = RD_NO_DEBUG;
-    fclose(inv_construct.file);
 
-    return INV_SUCCESS;
+    return result;
 }
 
 /** Turns on/off playback and record modes
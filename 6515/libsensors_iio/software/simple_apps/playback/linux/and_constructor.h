@@ -30,6 +30,12 @@ extern "C" {
     x += ((float)range.fraction/PRECISION);     \
 }
 
+/** Counts of what inv_playback_buffer() played back. */
+struct inv_playback_stats {
+    unsigned long samples;      /**< sensor samples built */
+    unsigned long executes;     /**< inv_execute_on_data() calls */
+};
+
 struct fifo_dmp_config {
     unsigned char sample_divider;
     unsigned char fifo_divider;
@@ -44,6 +50,9 @@ inv_error_t inv_constructor_init();
 inv_error_t inv_constructor_default_enable();
 void inv_set_debug_mode(rd_dbg_mode mode);
 inv_error_t inv_playback();
+inv_error_t inv_playback_buffer(const unsigned char *data, size_t size,
+                                void (*execute_cb)(void *arg), void *arg,
+                                struct inv_playback_stats *stats);
 void inv_set_playback_filename(char *filename, int length);
 inv_error_t wait_for_and_process_interrupt();
 
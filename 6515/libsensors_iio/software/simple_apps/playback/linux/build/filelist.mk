@@ -4,6 +4,7 @@
 HEADERS += $(APP_DIR)/iio_utils.h
 HEADERS += $(APP_DIR)/and_constructor.h
 HEADERS += $(APP_DIR)/datalogger_outputs.h
+HEADERS += $(APP_DIR)/playback_engine.h
 HEADERS += $(COMMON_DIR)/console_helper.h
 HEADERS += $(COMMON_DIR)/mlerrorcode.h
 HEADERS += $(COMMON_DIR)/testsupport.h
@@ -12,6 +13,7 @@ HEADERS += $(COMMON_DIR)/testsupport.h
 SOURCES := $(APP_DIR)/main.c
 SOURCES += $(APP_DIR)/and_constructor.c
 SOURCES += $(APP_DIR)/datalogger_outputs.c
+SOURCES += $(APP_DIR)/playback_engine.c
 SOURCES += $(COMMON_DIR)/console_helper.c
 SOURCES += $(COMMON_DIR)/mlerrorcode.c
 
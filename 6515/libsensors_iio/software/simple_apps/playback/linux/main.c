@@ -17,6 +17,7 @@
 #include "and_constructor.h"
 #include "ml_math_func.h"
 #include "datalogger_outputs.h"
+#include "playback_engine.h"
 
 #include "console_helper.h"
 
@@ -166,6 +167,7 @@ static int one_time_print = true;
 static FILE *stream_file = NULL;
 static unsigned long sample_count = 0;
 static int enabled_9x = true;
+static int use_nm_detection = true;
 
 signed char g_gyro_orientation[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
 signed char g_accel_orientation[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
@@ -595,7 +597,12 @@ void print_help(char *exename)
         "        [-o|--output PREFIX] = to dump data on csv file whose file\n"
         "                               prefix is specified by the parameter,\n"
         "                               e.g. '<PREFIX>-<timestamp>.csv'\n"
-        "        [-i|--input NAME]    = to read the provided playback.bin file\n"
+        "        [-i|--input NAME]    = to read the provided playback.bin file,\n"
+        "                               may be repeated to replay several\n"
+        "                               files, each one from a fresh MPL\n"
+        "        [-j|--jobs N]        = replay up to N files in parallel and\n"
+        "                               print a digest of the outputs of each\n"
+        "                               file instead of the components\n"
         "        [-c|--comp C]        = enable the following components in the\n"
         "                               given order:\n"
         "                                 t = TIME\n"
@@ -722,6 +729,81 @@ int components_parser(char pname[], char requested[], int length)
     return 0;
 }
 
+/* enables the algorithms and starts the MPL */
+static inv_error_t playback_setup(void)
+{
+    /* algorithm init */
+    CALL_N_CHECK(inv_enable_quaternion());
+    if (use_nm_detection == 1) {
+        CALL_N_CHECK(inv_enable_motion_no_motion());
+    } else if (use_nm_detection == 2) {
+        CALL_N_CHECK(inv_enable_fast_nomot());
+    }
+    CALL_N_CHECK(inv_enable_gyro_tc());
+    CALL_N_CHECK(inv_enable_in_use_auto_calibration());
+    CALL_N_CHECK(inv_enable_no_gyro_fusion());
+    CALL_N_CHECK(inv_enable_results_holder());
+    if (enabled_9x) {
+        CALL_N_CHECK(inv_enable_heading_from_gyro());
+        CALL_N_CHECK(inv_enable_compass_bias_w_gyro());
+        CALL_N_CHECK(inv_enable_vector_compass_cal());
+        CALL_N_CHECK(inv_enable_9x_sensor_fusion());
+    }
+
+    CALL_CHECK_N_RETURN_ERROR(inv_enable_datalogger_outputs());
+    CALL_CHECK_N_RETURN_ERROR(inv_constructor_start());
+
+    return INV_SUCCESS;
+}
+
+/* replays every input file on a pool of workers and prints the results */
+static inv_error_t playback_parallel(char *inputs[], int num_inputs, int jobs)
+{
+    struct inv_playback_job *list;
+    unsigned long long total_samples = 0;
+    double total_seconds = 0, wall_time;
+    inv_time_t start_time;
+    inv_error_t result;
+    int i, failed = 0;
+
+    list = (struct inv_playback_job *)calloc(num_inputs, sizeof(*list));
+    if (list == NULL)
+        return INV_ERROR_MEMORY_EXAUSTED;
+    for (i = 0; i < num_inputs; i++)
+        list[i].filename = inputs[i];
+
+    MPL_LOGI("-- Playing back %d files with %d workers\n", num_inputs, jobs);
+    start_time = inv_get_tick_count();
+    result = inv_playback_files(list, num_inputs, jobs, playback_setup);
+    wall_time = (1.0 * inv_get_tick_count() - start_time) / 1000;
+
+    for (i = 0; i < num_inputs; i++) {
+        if (list[i].result) {
+            MPL_LOGI("%s : error %s (#%d)\n", list[i].filename,
+                     MLErrorCode(list[i].result), list[i].result);
+            failed++;
+            continue;
+        }
+        MPL_LOGI("%s : %lu samples, %lu passes, digest %016llx, %.2f s\n",
+                 list[i].filename, list[i].samples, list[i].executes,
+                 (unsigned long long)list[i].digest, list[i].seconds);
+        total_samples += list[i].samples;
+        total_seconds += list[i].seconds;
+    }
+
+    MPL_LOGI("\nPlayed back %d files, %d failed, %llu samples in %.2f s\n",
+             num_inputs, failed, total_samples, wall_time);
+    if (wall_time > 0 && total_seconds > 0) {
+        MPL_LOGI("%.1f samples/s, %.1f samples/s per core\n",
+                 total_samples / wall_time, total_samples / total_seconds);
+    }
+
+    free(list);
+    if (result)
+        return result;
+    return failed ? INV_ERROR : INV_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
 #ifndef INV_PLAYBACK_DBG
@@ -737,10 +819,11 @@ int main(int argc, char *argv[])
     double total_time;
     char req_component_list[50] = "tQGACH";
     char input_filename[101] = "/data/playback.bin";
+    char **inputs;
+    int num_inputs = 0;
+    int jobs = 0;
     int i = 0;
     char *ver_str;
-    /* flags */
-    int use_nm_detection = true;
 
     /* make sure there is no buffering of the print messages */
     setvbuf(stdout, NULL, _IONBF, 0);
@@ -757,6 +840,10 @@ int main(int argc, char *argv[])
     MPL_LOGI("%s\n", ver_str);
     MPL_LOGI("\n");
 
+    inputs = (char **)calloc(argc, sizeof(*inputs));
+    if (inputs == NULL)
+        return INV_ERROR_MEMORY_EXAUSTED;
+
     for (i = 1; i < argc; i++) {
         if(strcmp(argv[i], "-h") == 0
             || strcmp(argv[i], "--help") == 0) {
@@ -782,8 +869,18 @@ int main(int argc, char *argv[])
             || strcmp(argv[i], "--input") == 0) {
             i++;
             strncpy(input_filename, argv[i], sizeof(input_filename));
+            inputs[num_inputs++] = argv[i];
             MPL_LOGI("-- Playing back file '%s'\n", input_filename);
 
+        } else if(strcmp(argv[i], "-j") == 0
+            || strcmp(argv[i], "--jobs") == 0) {
+            i++;
+            jobs = atoi(argv[i]);
+            if (jobs <= 0) {
+                MPL_LOGI("Error : invalid number of jobs '%s'\n", argv[i]);
+                return INV_ERROR_INVALID_PARAMETER;
+            }
+
         } else if(strcmp(argv[i], "-n") == 0
             || strcmp(argv[i], "--nm") == 0) {
             i++;
@@ -822,29 +919,20 @@ int main(int argc, char *argv[])
             argv[0],
             req_component_list, strlen(req_component_list)));
 
+    if (num_inputs > 1 || jobs > 0) {
+        inv_error_t result;
+        if (num_inputs == 0)
+            inputs[num_inputs++] = input_filename;
+        result = playback_parallel(inputs, num_inputs, jobs ? jobs : 1);
+        free(inputs);
+        return result;
+    }
+    free(inputs);
+
     /* set up callbacks */
     CALL_N_CHECK(inv_set_fifo_processed_callback(fifo_callback));
 
-    /* algorithm init */
-    CALL_N_CHECK(inv_enable_quaternion());
-    if (use_nm_detection == 1) {
-        CALL_N_CHECK(inv_enable_motion_no_motion());
-    } else if (use_nm_detection == 2) {
-        CALL_N_CHECK(inv_enable_fast_nomot());
-    }
-    CALL_N_CHECK(inv_enable_gyro_tc());
-    CALL_N_CHECK(inv_enable_in_use_auto_calibration());
-    CALL_N_CHECK(inv_enable_no_gyro_fusion());
-    CALL_N_CHECK(inv_enable_results_holder());
-    if (enabled_9x) {
-        CALL_N_CHECK(inv_enable_heading_from_gyro());
-        CALL_N_CHECK(inv_enable_compass_bias_w_gyro());
-        CALL_N_CHECK(inv_enable_vector_compass_cal());
-        CALL_N_CHECK(inv_enable_9x_sensor_fusion());
-    }
-
-    CALL_CHECK_N_RETURN_ERROR(inv_enable_datalogger_outputs());
-    CALL_CHECK_N_RETURN_ERROR(inv_constructor_start());
+    CALL_CHECK_N_RETURN_ERROR(playback_setup());
 
     /* load persistent data */
     {
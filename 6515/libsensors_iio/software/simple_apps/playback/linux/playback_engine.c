@@ -0,0 +1,274 @@
+/*
+ $License:
+    Copyright (C) 2012 InvenSense Corporation, All Rights Reserved.
+ $
+ */
+
+/*******************************************************************************
+ *
+ * $Id:$
+ *
+ ******************************************************************************/
+
+/*
+    Replays many playback files at once.
+
+    Each file is replayed by its own worker process, with at most
+    num_workers of them running. A process per file gives every replay a
+    fresh MPL, algorithms included, so results do not depend on which other
+    files were replayed or in which order. The recording is mapped, not
+    read, and the outputs of every processing pass are folded into a digest
+    that can be compared between runs.
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "log.h"
+#undef MPL_LOG_TAG
+#define MPL_LOG_TAG "MPL-playback"
+
+#include "playback_engine.h"
+#include "and_constructor.h"
+#include "invensense.h"
+
+/*
+    Defines & Macros
+*/
+#define FNV_OFFSET_BASIS    (14695981039346656037ULL)
+#define FNV_PRIME           (1099511628211ULL)
+
+/*
+    Functions
+*/
+static double playback_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t playback_hash(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+
+    while (len--) {
+        hash ^= *p++;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/* folds the outputs of a processing pass into the job digest */
+static void playback_digest_cb(void *arg)
+{
+    struct inv_playback_job *job = (struct inv_playback_job *)arg;
+    long data[4];
+    int accuracy;
+    int8_t accuracy8;
+    inv_time_t ts;
+
+    memset(data, 0, sizeof(data));
+    inv_get_quaternion_set(data, &accuracy, &ts);
+    job->digest = playback_hash(job->digest, data, sizeof(data));
+    job->digest = playback_hash(job->digest, &accuracy, sizeof(accuracy));
+
+    memset(data, 0, sizeof(data));
+    inv_get_6axis_quaternion(data, &ts);
+    job->digest = playback_hash(job->digest, data, sizeof(data));
+
+    inv_get_gyro_set(data, &accuracy8, &ts);
+    job->digest = playback_hash(job->digest, data, 3 * sizeof(data[0]));
+    job->digest = playback_hash(job->digest, &accuracy8, sizeof(accuracy8));
+
+    inv_get_accel_set(data, &accuracy8, &ts);
+    job->digest = playback_hash(job->digest, data, 3 * sizeof(data[0]));
+    job->digest = playback_hash(job->digest, &accuracy8, sizeof(accuracy8));
+
+    inv_get_compass_set(data, &accuracy8, &ts);
+    job->digest = playback_hash(job->digest, data, 3 * sizeof(data[0]));
+    job->digest = playback_hash(job->digest, &accuracy8, sizeof(accuracy8));
+}
+
+/* runs in the worker process */
+static inv_error_t playback_run_job(struct inv_playback_job *job,
+                                    inv_error_t (*setup)(void))
+{
+    struct inv_playback_stats stats;
+    struct stat st;
+    void *data;
+    double start;
+    int fd;
+    inv_error_t result;
+
+    job->digest = FNV_OFFSET_BASIS;
+
+    fd = open(job->filename, O_RDONLY);
+    if (fd < 0) {
+        MPL_LOGE("Error : cannot find or open playback file '%s'\n",
+                 job->filename);
+        return INV_ERROR_FILE_OPEN;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return INV_ERROR_FILE_READ;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        MPL_LOGE("Error : cannot map playback file '%s'\n", job->filename);
+        return INV_ERROR_FILE_READ;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    if (setup) {
+        result = setup();
+        if (result) {
+            munmap(data, st.st_size);
+            return result;
+        }
+    }
+
+    start = playback_now();
+    result = inv_playback_buffer((const unsigned char *)data, st.st_size,
+                                 playback_digest_cb, job, &stats);
+    job->seconds = playback_now() - start;
+    job->samples = stats.samples;
+    job->executes = stats.executes;
+
+    munmap(data, st.st_size);
+    return result;
+}
+
+/** Replays playback files in parallel.
+* @param[in,out] jobs Files to replay, results are filled in.
+* @param[in] num_jobs Number of files.
+* @param[in] num_workers Maximum number of files replayed at once.
+* @param[in] setup Enables the MPL algorithms and starts the MPL,
+*                  called in each worker before replaying, may be NULL.
+* @return Returns INV_SUCCESS if every worker could be started.
+*         The result of each replay is in its job.
+*/
+inv_error_t inv_playback_files(struct inv_playback_job *jobs, int num_jobs,
+                               int num_workers, inv_error_t (*setup)(void))
+{
+    struct inv_playback_job *shared;
+    struct pollfd *pfds;
+    pid_t *pids;
+    int *pipes;
+    int next = 0, running = 0;
+    int status, ii, nn;
+    int fds[2];
+    pid_t pid;
+    inv_error_t result = INV_SUCCESS;
+
+    if (num_jobs <= 0)
+        return INV_SUCCESS;
+    if (num_workers <= 0)
+        num_workers = 1;
+
+    /* workers write their results straight into shared memory */
+    shared = (struct inv_playback_job *)mmap(NULL, num_jobs * sizeof(*jobs),
+                                             PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+        return INV_ERROR_MEMORY_EXAUSTED;
+    pids = (pid_t *)calloc(num_jobs, sizeof(*pids));
+    pipes = (int *)calloc(num_jobs, sizeof(*pipes));
+    pfds = (struct pollfd *)calloc(num_workers, sizeof(*pfds));
+    if (pids == NULL || pipes == NULL || pfds == NULL) {
+        free(pids);
+        free(pipes);
+        free(pfds);
+        munmap(shared, num_jobs * sizeof(*jobs));
+        return INV_ERROR_MEMORY_EXAUSTED;
+    }
+    for (ii = 0; ii < num_jobs; ii++) {
+        shared[ii] = jobs[ii];
+        /* stays set if the worker dies before reporting */
+        shared[ii].result = INV_ERROR;
+        pipes[ii] = -1;
+    }
+
+    while (next < num_jobs || running > 0) {
+        if (next < num_jobs && running < num_workers) {
+            /* the write end closes when the worker exits, however it
+               exits, which tells its workers apart from other children
+               of the caller */
+            if (pipe(fds) < 0) {
+                pid = -1;
+            } else {
+                pid = fork();
+                if (pid < 0) {
+                    close(fds[0]);
+                    close(fds[1]);
+                }
+            }
+            if (pid == 0) {
+                close(fds[0]);
+                shared[next].result = playback_run_job(&shared[next], setup);
+                _exit(0);
+            } else if (pid < 0) {
+                MPL_LOGE("Error : cannot start playback worker\n");
+                result = INV_ERROR;
+                /* replay nothing more, wait for the running workers */
+                next = num_jobs;
+                continue;
+            }
+            close(fds[1]);
+            pipes[next] = fds[0];
+            pids[next++] = pid;
+            running++;
+            continue;
+        }
+
+        for (ii = 0, nn = 0; ii < next; ii++) {
+            if (pipes[ii] < 0)
+                continue;
+            pfds[nn].fd = pipes[ii];
+            pfds[nn].events = POLLIN;
+            pfds[nn].revents = 0;
+            nn++;
+        }
+        if (poll(pfds, nn, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            /* can't tell which worker is done, take them in turn */
+            for (ii = 0; ii < nn; ii++)
+                pfds[ii].revents = POLLIN;
+        }
+        for (ii = 0, nn = 0; ii < next; ii++) {
+            if (pipes[ii] < 0)
+                continue;
+            if (!pfds[nn++].revents)
+                continue;
+            close(pipes[ii]);
+            pipes[ii] = -1;
+            running--;
+            if (waitpid(pids[ii], &status, 0) < 0 || !WIFEXITED(status))
+                MPL_LOGE("Error : playback worker for '%s' died\n",
+                         jobs[ii].filename);
+        }
+    }
+
+    for (ii = 0; ii < num_jobs; ii++) {
+        const char *filename = jobs[ii].filename;
+        jobs[ii] = shared[ii];
+        jobs[ii].filename = filename;
+    }
+
+    free(pfds);
+    free(pipes);
+    free(pids);
+    munmap(shared, num_jobs * sizeof(*jobs));
+    return result;
+}
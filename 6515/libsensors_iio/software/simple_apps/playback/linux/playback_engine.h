@@ -0,0 +1,41 @@
+/*
+ $License:
+    Copyright (C) 2012 InvenSense Corporation, All Rights Reserved.
+ $
+ */
+
+/*******************************************************************************
+ *
+ * $Id:$
+ *
+ ******************************************************************************/
+
+#ifndef INV_PLAYBACK_ENGINE_H__
+#define INV_PLAYBACK_ENGINE_H__
+
+#include <stdint.h>
+
+#include "mltypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** One recording replayed by inv_playback_files(). */
+struct inv_playback_job {
+    const char *filename;       /**< playback file recorded with RD_RECORD */
+    unsigned long samples;      /**< sensor samples played back */
+    unsigned long executes;     /**< processing passes */
+    uint64_t digest;            /**< hash of the MPL outputs of every pass */
+    double seconds;             /**< time spent replaying the file */
+    inv_error_t result;
+};
+
+inv_error_t inv_playback_files(struct inv_playback_job *jobs, int num_jobs,
+                               int num_workers, inv_error_t (*setup)(void));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INV_PLAYBACK_ENGINE_H__
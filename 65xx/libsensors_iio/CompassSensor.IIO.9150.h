@@ -54,6 +54,7 @@ public:
     int turnOffCompassFifo(void);
     int turnOnCompassFifo(void);
     int readSample(long *data, int64_t *timestamp);
+    int readSamples(long *data, int64_t *timestamps, int count);
     int providesCalibration() { return 0; }
     void getOrientationMatrix(signed char *orient);
     long getSensitivity();
@@ -93,6 +93,7 @@ CompassSensor::CompassSensor()
     }
 
     memset(mCachedCompassData, 0, sizeof(mCachedCompassData));
+    memset(&mBufferScan, 0, sizeof(mBufferScan));
 
     if (!isIntegrated()) {
         enable(ID_M, 0);
@@ -264,6 +265,8 @@ int CompassSensor::enable(int32_t handle, int en)
                 en, compassSysFs.compass_z_fifo_enable, getTimestamp());
         res += write_sysfs_int(compassSysFs.compass_z_fifo_enable, en);
 
+        scan_iio_buffer();
+
         res = masterEnable(en);
         if (res < en) {
             return res;
@@ -273,6 +276,43 @@ int CompassSensor::enable(int32_t handle, int en)
     return res;
 }
 
+/* parse the scan layout once, readSample() only decodes with it */
+void CompassSensor::scan_iio_buffer(void)
+{
+    VFUNC_LOG;
+
+    inv_iio_buffer_scan_channel(compassSysFs.compass_x_fifo_enable,
+                                compassSysFs.compass_x_fifo_index,
+                                compassSysFs.compass_x_fifo_type,
+                                NULL, NULL,
+                                &mBufferScan.channels[MAG_X_CHANNEL]);
+    inv_iio_buffer_scan_channel(compassSysFs.compass_y_fifo_enable,
+                                compassSysFs.compass_y_fifo_index,
+                                compassSysFs.compass_y_fifo_type,
+                                NULL, NULL,
+                                &mBufferScan.channels[MAG_Y_CHANNEL]);
+    inv_iio_buffer_scan_channel(compassSysFs.compass_z_fifo_enable,
+                                compassSysFs.compass_z_fifo_index,
+                                compassSysFs.compass_z_fifo_type,
+                                NULL, NULL,
+                                &mBufferScan.channels[MAG_Z_CHANNEL]);
+    inv_iio_buffer_scan_channel(compassSysFs.in_timestamp_en,
+                                compassSysFs.in_timestamp_index,
+                                compassSysFs.in_timestamp_type,
+                                NULL, NULL,
+                                &mBufferScan.channels[TIMESTAMP_CHANNEL]);
+    if (inv_iio_buffer_layout_init(&mBufferScan, CHANNELS_NB) < 0) {
+        LOGE("HAL:compass buffer has no enabled channel");
+        return;
+    }
+    LOGV_IF(PROCESS_VERBOSE, "HAL:compass scan size=%zu format=%d "
+            "x@%zd y@%zd z@%zd ts@%zd", mBufferScan.size, mBufferScan.format,
+            mBufferScan.addresses[MAG_X_CHANNEL],
+            mBufferScan.addresses[MAG_Y_CHANNEL],
+            mBufferScan.addresses[MAG_Z_CHANNEL],
+            mBufferScan.addresses[TIMESTAMP_CHANNEL]);
+}
+
 int CompassSensor::masterEnable(int en)
 {
     VFUNC_LOG;
@@ -363,26 +403,31 @@ long CompassSensor::getSensitivity()
 int CompassSensor::readSample(long *data, int64_t *timestamp) {
     VFUNC_LOG;
 
-    int i;
     char *rdata = mIIOBuffer;
+    int64_t raw[CHANNELS_NB];
 
-    size_t rsize = read(compass_fd, rdata, (8 * mEnable + 8) * 1);
+    ssize_t rsize;
 
-    if (!mEnable) {
-        rsize = read(compass_fd, rdata, (8 + 8) * IIO_BUFFER_LENGTH);
+    if (!mEnable || mBufferScan.size == 0) {
+        rsize = read(compass_fd, rdata, sizeof(mIIOBuffer));
         // LOGI("clear buffer with size: %d", rsize);
+        return 0;
     }
+
+    rsize = read(compass_fd, rdata, mBufferScan.size);
 /*
     LOGI("get one sample of AMI IIO data with size: %d", rsize);
     LOGI_IF(mEnable, "compass x/y/z: %d/%d/%d", *((short *) (rdata + 0)),
         *((short *) (rdata + 2)), *((short *) (rdata + 4)));
 */
-    if (mEnable) {
-        for (i = 0; i < 3; i++) {
-            data[i] = *((short *) (rdata + i * 2));
-        }
-        *timestamp = *((long long *) (rdata + 8 * mEnable));
+    if (rsize <= 0 ||
+        inv_iio_buffer_layout_decode(&mBufferScan, rdata, rsize, raw, 1) != 1) {
+        return 0;
     }
+    data[0] = raw[MAG_X_CHANNEL];
+    data[1] = raw[MAG_Y_CHANNEL];
+    data[2] = raw[MAG_Z_CHANNEL];
+    *timestamp = raw[TIMESTAMP_CHANNEL];
 
     return mEnable;
 }
@@ -525,6 +570,14 @@ int CompassSensor::inv_init_sysfs_attributes(void)
     sprintf(compassSysFs.compass_x_fifo_enable, "%s%s", sysfs_path, "/scan_elements/in_magn_x_en");
     sprintf(compassSysFs.compass_y_fifo_enable, "%s%s", sysfs_path, "/scan_elements/in_magn_y_en");
     sprintf(compassSysFs.compass_z_fifo_enable, "%s%s", sysfs_path, "/scan_elements/in_magn_z_en");
+    sprintf(compassSysFs.compass_x_fifo_index, "%s%s", sysfs_path, "/scan_elements/in_magn_x_index");
+    sprintf(compassSysFs.compass_y_fifo_index, "%s%s", sysfs_path, "/scan_elements/in_magn_y_index");
+    sprintf(compassSysFs.compass_z_fifo_index, "%s%s", sysfs_path, "/scan_elements/in_magn_z_index");
+    sprintf(compassSysFs.in_timestamp_index, "%s%s", sysfs_path, "/scan_elements/in_timestamp_index");
+    sprintf(compassSysFs.compass_x_fifo_type, "%s%s", sysfs_path, "/scan_elements/in_magn_x_type");
+    sprintf(compassSysFs.compass_y_fifo_type, "%s%s", sysfs_path, "/scan_elements/in_magn_y_type");
+    sprintf(compassSysFs.compass_z_fifo_type, "%s%s", sysfs_path, "/scan_elements/in_magn_z_type");
+    sprintf(compassSysFs.in_timestamp_type, "%s%s", sysfs_path, "/scan_elements/in_timestamp_type");
     sprintf(compassSysFs.compass_rate, "%s%s", sysfs_path, "/sampling_frequency");
     sprintf(compassSysFs.compass_scale, "%s%s", sysfs_path, "/in_magn_scale");
     sprintf(compassSysFs.compass_orient, "%s%s", sysfs_path, "/compass_matrix");
@@ -34,6 +34,7 @@
 #include "sensors.h"
 #include "SensorBase.h"
 #include "InputEventReader.h"
+#include "inv_iio_buffer.h"
 
 #define MAX_CHIP_ID_LEN (20)
 #define COMPASS_ON_PRIMARY "in_magn_x_raw"
@@ -80,6 +81,14 @@ private:
        char *compass_x_fifo_enable;
        char *compass_y_fifo_enable;
        char *compass_z_fifo_enable;
+       char *compass_x_fifo_index;
+       char *compass_y_fifo_index;
+       char *compass_z_fifo_index;
+       char *in_timestamp_index;
+       char *compass_x_fifo_type;
+       char *compass_y_fifo_type;
+       char *compass_z_fifo_type;
+       char *in_timestamp_type;
        char *compass_rate;
        char *compass_scale;
        char *compass_orient;
@@ -99,10 +108,19 @@ private:
     int mEnable;
     char *pathP;
 
-    char mIIOBuffer[(8 + 8) * IIO_BUFFER_LENGTH];
+    enum scan_elements {
+        MAG_X_CHANNEL,
+        MAG_Y_CHANNEL,
+        MAG_Z_CHANNEL,
+        TIMESTAMP_CHANNEL,
+        CHANNELS_NB,
+    };
+    struct inv_iio_buffer_layout mBufferScan;
+    char mIIOBuffer[CHANNELS_NB * 8 * IIO_BUFFER_LENGTH];
 
     int masterEnable(int en);
     void enable_iio_sysfs(void);
+    void scan_iio_buffer(void);
     void processCompassEvent(const input_event *event);
     int inv_init_sysfs_attributes(void);
     FILE *mCoilsResetFd;
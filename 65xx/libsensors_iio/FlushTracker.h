@@ -0,0 +1,84 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef ANDROID_FLUSH_TRACKER_H
+#define ANDROID_FLUSH_TRACKER_H
+
+#include <stdint.h>
+
+#include "FlushQueue.h"
+
+/*
+ * Flushes waiting for their flush complete events.
+ *
+ * A flush() completes at the FIFO marker of a hardware flush started
+ * after it, so every sample produced before the call is reported first.
+ * A flush of a handle whose hardware flush is still outstanding therefore
+ * can't complete with that one, the samples that came in since sit behind
+ * its marker. It is deferred instead: when the outstanding marker arrives,
+ * completeNext() asks for one follow-up hardware flush that covers every
+ * flush deferred meanwhile.
+ *
+ * The state of a handle is one word: whether a hardware flush is
+ * outstanding, how many flush() calls it covers, how many are deferred and
+ * a generation that tells queue entries of cancelled flushes apart.
+ *
+ * Nothing allocates. Any thread may add() and cancel(), a single thread
+ * completes.
+ */
+class FlushTracker {
+public:
+    enum {
+        MAX_HANDLES = 64,
+    };
+
+    enum {
+        FLUSH_INVALID = -1,     /* handle out of range */
+        FLUSH_DEFERRED = 0,     /* covered by a follow-up flush */
+        FLUSH_START = 1,        /* caller starts a hardware flush */
+    };
+
+    FlushTracker();
+
+    int add(int handle);
+
+    /*
+     * The hardware flush of handle could not be started. 'failed' of the
+     * flushes it covers are dropped, 1 for the flush() that got
+     * FLUSH_START, 0 for a follow-up. The others are carried to the next
+     * flush started for handle.
+     */
+    void cancel(int handle, int failed);
+
+    /* consumer only, once per FIFO marker. *restart is set when flushes
+       were deferred behind this one: the caller starts their hardware
+       flush, or cancel()s it */
+    bool completeNext(int *handle, int *count, bool *restart);
+
+    /* consumer only, instead of completeNext() when the marker carries
+       the handle it was flushed for. Returns false if no flush of handle
+       is outstanding, the marker is not one of ours */
+    bool complete(int handle, int *count, bool *restart);
+    bool empty() const { return mOrder.empty(); }
+
+private:
+    void prune();
+
+    FlushQueue mOrder;      /* handle and generation of each outstanding flush */
+    uint64_t mState[MAX_HANDLES];
+};
+
+#endif  // ANDROID_FLUSH_TRACKER_H
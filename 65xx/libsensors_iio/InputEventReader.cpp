@@ -35,12 +35,17 @@
 
 struct input_event;
 
+/*
+ * The second half of mBuffer mirrors the first one for the events that
+ * wrapped around, so the events from mCurr are always contiguous.
+ */
 InputEventCircularReader::InputEventCircularReader(size_t numEvents)
     : mBuffer(new input_event[numEvents * 2]),
       mBufferEnd(mBuffer + numEvents),
       mHead(mBuffer),
       mCurr(mBuffer),
-      mFreeSpace(numEvents)
+      mFreeSpace(numEvents),
+      mFrames(0)
 {
     mLastFd = -1;
 }
@@ -77,6 +82,17 @@ ssize_t InputEventCircularReader::fill(int fd)
 
         numEventsRead = nread / sizeof(input_event);
         if (numEventsRead) {
+            input_event *start = mHead;
+            for (size_t i = 0; i < numEventsRead; i++) {
+                if (start[i].type == EV_SYN)
+                    mFrames++;
+            }
+            /* events behind the read position, mirror them after
+               mBufferEnd so they follow the ones before it */
+            if (start < mCurr) {
+                memcpy(start + (mBufferEnd - mBuffer), start,
+                       numEventsRead * sizeof(input_event));
+            }
             mHead += numEventsRead;
             mFreeSpace -= numEventsRead;
             if (mHead > mBufferEnd) {
@@ -103,6 +119,8 @@ ssize_t InputEventCircularReader::readEvent(input_event const** events)
 
 void InputEventCircularReader::next()
 {
+    if (mCurr->type == EV_SYN)
+        mFrames--;
     mCurr++;
     mFreeSpace++;
     if (mCurr >= mBufferEnd) {
@@ -113,3 +131,37 @@ void InputEventCircularReader::next()
             __PRETTY_FUNCTION__, mLastFd, (int)available);
 }
 
+/*
+ * Returns the number of events up to and including the last EV_SYN in
+ * the ring, starting at *events. A full ring without any EV_SYN is
+ * returned whole, no frame could ever complete in it.
+ */
+ssize_t InputEventCircularReader::readFrames(input_event const** events)
+{
+    ssize_t available = (mBufferEnd - mBuffer) - mFreeSpace;
+    ssize_t count = available;
+
+    *events = mCurr;
+    if (!mFrames) {
+        return mFreeSpace ? 0 : available;
+    }
+    while (count && mCurr[count - 1].type != EV_SYN) {
+        count--;
+    }
+    LOGV_IF(INPUT_EVENT_DEBUG, "DEBUG:%s fd:%d, frames:%d events:%d\n",
+            __PRETTY_FUNCTION__, mLastFd, (int)mFrames, (int)count);
+    return count;
+}
+
+void InputEventCircularReader::next(size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (mCurr[i].type == EV_SYN)
+            mFrames--;
+    }
+    mCurr += count;
+    mFreeSpace += count;
+    if (mCurr >= mBufferEnd) {
+        mCurr -= mBufferEnd - mBuffer;
+    }
+}
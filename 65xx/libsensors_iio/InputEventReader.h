@@ -35,6 +35,7 @@ class InputEventCircularReader
     struct input_event* mHead;
     struct input_event* mCurr;
     ssize_t mFreeSpace;
+    ssize_t mFrames;            // EV_SYN events in the ring
     int mLastFd;
 
 public:
@@ -43,6 +44,13 @@ public:
     ssize_t fill(int fd);
     ssize_t readEvent(input_event const** events);
     void next();
+
+    // batch API: every complete EV_SYN terminated frame at the read
+    // position, as one contiguous span of the ring. Consume it with
+    // next(count).
+    ssize_t readFrames(input_event const** events);
+    void next(size_t count);
+    bool hasFrame() const { return mFrames > 0; }
 };
 
 /*****************************************************************************/
@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <sys/select.h>
 #include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <dlfcn.h>
 #include <pthread.h>
 #include <cutils/atomic.h>
@@ -87,6 +88,9 @@ static int hertz_request = 200;
 #define HW_COMPASS_RATE_HZ              (1000000000LL / hertz_request)
 
 #define RATE_200HZ                      5000000LL
+
+/* gyro temperature is sent to MPL every 0.5 seconds */
+#define TEMP_READ_PERIOD_NS             500000000LL
 #define RATE_15HZ                       66667000LL
 #define RATE_5HZ                        200000000LL
 
@@ -199,6 +203,35 @@ static FILE *logfile = NULL;
  * MPLSensor class implementation
  ******************************************************************************/
 
+/* fires delay ns from now then every interval ns if not 0,
+   a delay of 0 disarms it */
+static int armTimerFd(int fd, int64_t delay, int64_t interval = 0)
+{
+    struct itimerspec spec;
+
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = delay / 1000000000LL;
+    spec.it_value.tv_nsec = delay % 1000000000LL;
+    spec.it_interval.tv_sec = interval / 1000000000LL;
+    spec.it_interval.tv_nsec = interval % 1000000000LL;
+    return timerfd_settime(fd, 0, &spec, NULL);
+}
+
+/* a longer suspend than this is taken as a possible chip reset */
+#define SUSPEND_RESET_MIN_NS 10000000LL
+
+/* time spent suspended since boot: CLOCK_BOOTTIME keeps counting while
+   the system sleeps, CLOCK_MONOTONIC does not */
+static int64_t getSuspendTime(void)
+{
+    struct timespec mono, boot;
+
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_BOOTTIME, &boot);
+    return (int64_t)(boot.tv_sec - mono.tv_sec) * 1000000000LL +
+           (boot.tv_nsec - mono.tv_nsec);
+}
+
 // following extended initializer list would only be available with -std=c++11
 //  or -std=gnu+11
 MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *))
@@ -220,15 +253,20 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
                          dmp_pedometer_fd(-1),
                          mDmpPedometerEnabled(0),
                          mDmpStepCountEnabled(0),
+                         mStepCountTimerFd(-1),
+                         mStepCountTimerArmed(false),
                          mEnabled(0),
                          mBatchEnabled(0),
-                         mFlushEnabled(-1),
+                         mFlushCompleteHandle(-1),
+                         mFlushCompleteCount(0),
                          mOldBatchEnabledMask(0),
                          mAccelInputReader(4),
                          mGyroInputReader(32),
                          mTempScale(0),
                          mTempOffset(0),
                          mTempCurrentTime(0),
+                         mTempTimerFd(-1),
+                         mTempPending(false),
                          mAccelScale(2),
                          mAccelSelfTestScale(2),
                          mGyroScale(2000),
@@ -267,12 +305,34 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
 
     pthread_mutex_init(&mMplMutex, NULL);
     pthread_mutex_init(&mHALMutex, NULL);
+    mReconfigDepth = 0;
+    mReconfigApplying = false;
+    mChipIdle = true;
+    mSuspendTime = getSuspendTime();
+    mReconfigCount = 0;
+    mMasterEnableCalls = 0;
+    mMasterEnableWrites = 0;
+    mReconfigMaxTime = 0;
+    mTempReadCount = 0;
+    mTempReadMaxTime = 0;
+    memset(mActivationStart, 0, sizeof(mActivationStart));
+    memset(mActivationLatency, 0, sizeof(mActivationLatency));
+    memset(mActivationMaxLatency, 0, sizeof(mActivationMaxLatency));
     memset(mGyroOrientation, 0, sizeof(mGyroOrientation));
     memset(mAccelOrientation, 0, sizeof(mAccelOrientation));
 
     /* setup sysfs paths */
     inv_init_sysfs_attributes();
 
+    /* attributes the driver acts on every time they are written */
+    mSysfs.setFlags(mpu.master_enable, SysfsAttrCache::FLAG_VOLATILE);
+    mSysfs.setFlags(mpu.firmware_loaded, SysfsAttrCache::FLAG_VOLATILE);
+    mSysfs.setFlags(mpu.dmp_on, SysfsAttrCache::FLAG_VOLATILE);
+    /* one shot, cleared by the driver when it fires */
+    mSysfs.setFlags(mpu.smd_enable, SysfsAttrCache::FLAG_VOLATILE);
+    mSysfs.setFlags(mpu.flush_batch, SysfsAttrCache::FLAG_VOLATILE);
+    mSysfs.setFlags(mpu.chip_enable, SysfsAttrCache::FLAG_VOLATILE);
+
     /* get chip name */
     if (inv_get_chip_name(chip_ID) != INV_SUCCESS) {
         LOGE("HAL:ERR- Failed to get chip ID\n");
@@ -304,6 +364,10 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
     } else {
         LOGV_IF(EXTRA_VERBOSE,
                 "HAL:temperature_fd opened: %s", mpu.temperature);
+        mTempTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (mTempTimerFd < 0) {
+            LOGE("HAL:ERR couldn't create temperature timer");
+        }
     }
 
     /* read gyro FSR to calculate accel scale later */
@@ -478,6 +542,11 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
                 "HAL:dmp_pedometer_fd opened : %d", dmp_pedometer_fd);
     }
 
+    mStepCountTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (mStepCountTimerFd < 0) {
+        LOGE("HAL:ERR couldn't create step count timer, polling instead");
+    }
+
     initBias();
 
     (void)inv_get_version(&ver_str);
@@ -675,6 +744,9 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
         openDmpOrientFd();
         enableDmpOrientation(!isDmpScreenAutoRotationEnabled());
     }
+
+    /* chip may stay off, write out what was queued */
+    mSysfs.commit();
 }
 
 void MPLSensor::enable_iio_sysfs(void)
@@ -711,14 +783,11 @@ void MPLSensor::enable_iio_sysfs(void)
 
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             1, mpu.chip_enable, getTimestamp());
-    tempFp = fopen(mpu.chip_enable, "w");
-    if (tempFp == NULL) {
-        LOGE("HAL:could not open chip enable");
-    } else {
-        if (fprintf(tempFp, "%d", 1) < 0 || fclose(tempFp) < 0) {
-            LOGE("HAL:could not write chip enable");
-        }
+    if (mSysfs.write(mpu.chip_enable, 1) < 0) {
+        LOGE("HAL:could not write chip enable");
     }
+    /* the chip comes up with the driver defaults */
+    mSysfs.invalidate();
     
     inv_get_iio_device_node(iio_device_node);
     iio_fd = open(iio_device_node, O_RDONLY);
@@ -919,6 +988,8 @@ void MPLSensor::loadDMP(void)
                 } else {
                     LOGV_IF(PROCESS_VERBOSE, "HAL:DMP loaded");
                 }
+                /* the driver resets its DMP state behind the cache */
+                mSysfs.invalidate();
             }
         } else {
             LOGV_IF(ENG_VERBOSE, "HAL:DMP is already loaded");
@@ -1037,12 +1108,19 @@ MPLSensor::~MPLSensor()
         close(accel_z_offset_fd);
     }
 
+    if (mStepCountTimerFd >= 0) {
+        close(mStepCountTimerFd);
+    }
+    if (mTempTimerFd >= 0) {
+        close(mTempTimerFd);
+    }
+
     /* Turn off Gyro master enable          */
     /* A workaround until driver handles it */
     /* TODO: Turn off and close all sensors */
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             0, mpu.master_enable, getTimestamp());
-    write_sysfs_int(mpu.master_enable, 0);
+    mSysfs.write(mpu.master_enable, 0);
 
 #ifdef INV_PLAYBACK_DBG
     inv_turn_off_data_logging();
@@ -1131,18 +1209,18 @@ int MPLSensor::onDmp(int en)
 
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:cat %s (%lld)",
             mpu.firmware_loaded, getTimestamp());
-    if(read_sysfs_int(mpu.firmware_loaded, &status) < 0){
+    if(mSysfs.read(mpu.firmware_loaded, &status) < 0){
         LOGE("HAL:ERR can't get firmware_loaded status");
     } else if (status == 1) {
         //Write only if curr DMP state <> request
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:cat %s (%lld)",
                 mpu.dmp_on, getTimestamp());
-        if (read_sysfs_int(mpu.dmp_on, &status) < 0) {
+        if (mSysfs.read(mpu.dmp_on, &status) < 0) {
             LOGE("HAL:ERR can't read DMP state");
         } else if (status != en) {
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     en, mpu.dmp_on, getTimestamp());
-            if (write_sysfs_int(mpu.dmp_on, en) < 0) {
+            if (mSysfs.write(mpu.dmp_on, en) < 0) {
                 LOGE("HAL:ERR can't write dmp_on");
             } else {
                 mDmpOn = en;
@@ -1154,7 +1232,7 @@ int MPLSensor::onDmp(int en)
             //Enable DMP interrupt
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     en, mpu.dmp_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.dmp_int_on, en) < 0) {
+            if (mSysfs.write(mpu.dmp_int_on, en) < 0) {
                 LOGE("HAL:ERR can't en/dis DMP interrupt");
             }
 
@@ -1162,7 +1240,7 @@ int MPLSensor::onDmp(int en)
             if (!en) {
                 LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                         en, mpu.dmp_event_int_on, getTimestamp());
-                if (write_sysfs_int(mpu.dmp_event_int_on, en) < 0) {
+                if (mSysfs.write(mpu.dmp_event_int_on, en) < 0) {
                     res = -1;
                     LOGE("HAL:ERR can't enable DMP event interrupt");
                 }
@@ -1191,7 +1269,7 @@ int MPLSensor::enablePedIndicator(int en)
             //Disable DMP Pedometer Interrupt
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                         0, mpu.pedometer_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.pedometer_int_on, 0) < 0) {
+            if (mSysfs.write(mpu.pedometer_int_on, 0) < 0) {
                LOGE("HAL:ERR can't enable Android Pedometer Interrupt");
                res = -1;   // indicate an err
                return res;
@@ -1202,7 +1280,7 @@ int MPLSensor::enablePedIndicator(int en)
     LOGV_IF(ENG_VERBOSE, "HAL:Toggling step indicator to %d", en);
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 en, mpu.step_indicator_on, getTimestamp());
-    if (write_sysfs_int(mpu.step_indicator_on, en) < 0) {
+    if (mSysfs.write(mpu.step_indicator_on, en) < 0) {
         res = -1;
         LOGE("HAL:ERR can't write to DMP step_indicator_on");
     }
@@ -1230,7 +1308,7 @@ int MPLSensor::enablePedStandalone(int en)
              //Re-enable DMP Pedometer Interrupt
              LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                      1, mpu.pedometer_int_on, getTimestamp());
-             if (write_sysfs_int(mpu.pedometer_int_on, 1) < 0) {
+             if (mSysfs.write(mpu.pedometer_int_on, 1) < 0) {
                  LOGE("HAL:ERR can't enable Android Pedometer Interrupt");
                  return (-1);
              }
@@ -1238,7 +1316,7 @@ int MPLSensor::enablePedStandalone(int en)
             if (mEnabled == 0) {
                 LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                        1, mpu.dmp_event_int_on, getTimestamp());
-                if (write_sysfs_int(mpu.dmp_event_int_on, 1) < 0) {
+                if (mSysfs.write(mpu.dmp_event_int_on, 1) < 0) {
                     LOGE("HAL:ERR can't enable DMP event interrupt");
                     return (-1);
                 }
@@ -1253,14 +1331,14 @@ int MPLSensor::enablePedStandalone(int en)
             //Disable DMP Pedometer Interrupt
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     0, mpu.pedometer_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.pedometer_int_on, 0) < 0) {
+            if (mSysfs.write(mpu.pedometer_int_on, 0) < 0) {
                 LOGE("HAL:ERR can't disable Android Pedometer Interrupt");
                 return (-1);
             }
             //Enable Data Interrupt
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                        0, mpu.dmp_event_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.dmp_event_int_on, 0) < 0) {
+            if (mSysfs.write(mpu.dmp_event_int_on, 0) < 0) {
                 LOGE("HAL:ERR can't enable DMP event interrupt");
                 return (-1);
             }
@@ -1279,7 +1357,7 @@ int MPLSensor:: enablePedStandaloneData(int en)
     // Enable DMP Ped standalone
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.step_detector_on, getTimestamp());
-    if (write_sysfs_int(mpu.step_detector_on, en) < 0) {
+    if (mSysfs.write(mpu.step_detector_on, en) < 0) {
         LOGE("HAL:ERR can't write DMP step_detector_on");
         res = -1;   //Indicate an err
     }
@@ -1287,7 +1365,7 @@ int MPLSensor:: enablePedStandaloneData(int en)
     // Disable DMP Step indicator
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.step_indicator_on, getTimestamp());
-    if (write_sysfs_int(mpu.step_indicator_on, en) < 0) {
+    if (mSysfs.write(mpu.step_indicator_on, en) < 0) {
         LOGE("HAL:ERR can't write DMP step_indicator_on");
         res = -1;   //Indicate an err
     }
@@ -1348,7 +1426,7 @@ int MPLSensor::enablePedQuaternion(int en)
              //Re-enable DMP Pedometer Interrupt
              LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                      1, mpu.pedometer_int_on, getTimestamp());
-             if (write_sysfs_int(mpu.pedometer_int_on, 1) < 0) {
+             if (mSysfs.write(mpu.pedometer_int_on, 1) < 0) {
                  LOGE("HAL:ERR can't enable Android Pedometer Interrupt");
                  return (-1);
              }
@@ -1356,7 +1434,7 @@ int MPLSensor::enablePedQuaternion(int en)
             if (mEnabled == 0) {
                 LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                        1, mpu.dmp_event_int_on, getTimestamp());
-                if (write_sysfs_int(mpu.dmp_event_int_on, en) < 0) {
+                if (mSysfs.write(mpu.dmp_event_int_on, en) < 0) {
                     LOGE("HAL:ERR can't enable DMP event interrupt");
                     return (-1);
                 }
@@ -1371,14 +1449,14 @@ int MPLSensor::enablePedQuaternion(int en)
             //Disable DMP Pedometer Interrupt
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     0, mpu.pedometer_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.pedometer_int_on, 0) < 0) {
+            if (mSysfs.write(mpu.pedometer_int_on, 0) < 0) {
                 LOGE("HAL:ERR can't disable Android Pedometer Interrupt");
                 return (-1);
             }
             //Enable Data Interrupt
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                        0, mpu.dmp_event_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.dmp_event_int_on, 0) < 0) {
+            if (mSysfs.write(mpu.dmp_event_int_on, 0) < 0) {
                 LOGE("HAL:ERR can't enable DMP event interrupt");
                 return (-1);
             }
@@ -1397,7 +1475,7 @@ int MPLSensor::enablePedQuaternionData(int en)
     // Enable DMP quaternion
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.ped_q_on, getTimestamp());
-    if (write_sysfs_int(mpu.ped_q_on, en) < 0) {
+    if (mSysfs.write(mpu.ped_q_on, en) < 0) {
         LOGE("HAL:ERR can't write DMP ped_q_on");
         res = -1;   //Indicate an err
     }
@@ -1405,7 +1483,7 @@ int MPLSensor::enablePedQuaternionData(int en)
     // toggle DMP step indicator
     /*LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.step_indicator_on, getTimestamp());
-    if (write_sysfs_int(mpu.step_indicator_on, en) < 0) {
+    if (mSysfs.write(mpu.step_indicator_on, en) < 0) {
         LOGE("HAL:ERR can't write DMP step_indicator_on");
         res = -1;   //Indicate an err
     }*/
@@ -1428,8 +1506,8 @@ int MPLSensor::enablePedQuaternionData(int en)
                 return res;
         }
         if (mFeatureActiveMask & INV_DMP_QUATERNION) {
-            res = write_sysfs_int(mpu.gyro_fifo_enable, 1);
-            res += write_sysfs_int(mpu.accel_fifo_enable, 1);
+            res = mSysfs.write(mpu.gyro_fifo_enable, 1);
+            res += mSysfs.write(mpu.accel_fifo_enable, 1);
             if (res < 0)
                 return res;
         }
@@ -1518,7 +1596,7 @@ int MPLSensor::enable6AxisQuaternionData(int en)
     // Enable DMP quaternion
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.six_axis_q_on, getTimestamp());
-    if (write_sysfs_int(mpu.six_axis_q_on, en) < 0) {
+    if (mSysfs.write(mpu.six_axis_q_on, en) < 0) {
         LOGE("HAL:ERR can't write DMP six_axis_q_on");
         res = -1;   //Indicate an err
     }
@@ -1543,10 +1621,10 @@ int MPLSensor::enable6AxisQuaternionData(int en)
         if (mFeatureActiveMask & INV_DMP_QUATERNION) {
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     1, mpu.gyro_fifo_enable, getTimestamp());
-            res = write_sysfs_int(mpu.gyro_fifo_enable, 1);
+            res = mSysfs.write(mpu.gyro_fifo_enable, 1);
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     1, mpu.accel_fifo_enable, getTimestamp());
-            res += write_sysfs_int(mpu.accel_fifo_enable, 1);
+            res += mSysfs.write(mpu.accel_fifo_enable, 1);
             if (res < 0)
                 return res;
         }
@@ -1556,8 +1634,8 @@ int MPLSensor::enable6AxisQuaternionData(int en)
             if (!(mFeatureActiveMask & INV_DMP_PED_QUATERNION)) {
                 mLocalSensorMask |= INV_THREE_AXIS_GYRO;        
                 mLocalSensorMask |= INV_THREE_AXIS_ACCEL;
-                res = write_sysfs_int(mpu.gyro_fifo_enable, 1);
-                res += write_sysfs_int(mpu.accel_fifo_enable, 1);
+                res = mSysfs.write(mpu.gyro_fifo_enable, 1);
+                res += mSysfs.write(mpu.accel_fifo_enable, 1);
                 if (res < 0)
                     return res;
             }
@@ -1652,7 +1730,7 @@ int MPLSensor::enableQuaternionData(int en)
     // Enable DMP quaternion
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.three_axis_q_on, getTimestamp());
-    if (write_sysfs_int(mpu.three_axis_q_on, en) < 0) {
+    if (mSysfs.write(mpu.three_axis_q_on, en) < 0) {
         LOGE("HAL:ERR can't write DMP three_axis_q__on");
         res = -1;   //Indicates an err
     }
@@ -1686,17 +1764,19 @@ int MPLSensor::enableDmpPedometer(int en, int interruptMode)
         //Enable DMP Pedometer Function
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 en, mpu.pedometer_on, getTimestamp());
-        if (write_sysfs_int(mpu.pedometer_on, en) < 0) {
+        if (mSysfs.write(mpu.pedometer_on, en) < 0) {
             LOGE("HAL:ERR can't enable Android Pedometer");
             res = -1;   // indicate an err
             return res;
         }
 
-        if (interruptMode || (mFeatureActiveMask & INV_DMP_PEDOMETER)) {
+        /* step counter reads the count when a step interrupt comes in */
+        if (interruptMode || (mFeatureActiveMask & INV_DMP_PEDOMETER) ||
+                isStepCountEventDriven()) {
             //Enable DMP Pedometer Interrupt
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     en, mpu.pedometer_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.pedometer_int_on, en) < 0) {
+            if (mSysfs.write(mpu.pedometer_int_on, en) < 0) {
                 LOGE("HAL:ERR can't enable Android Pedometer Interrupt");
                 res = -1;   // indicate an err
                 return res;
@@ -1711,7 +1791,7 @@ int MPLSensor::enableDmpPedometer(int en, int interruptMode)
         // set DMP rate to 200Hz
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 200, mpu.accel_fifo_rate, getTimestamp());
-        if (write_sysfs_int(mpu.accel_fifo_rate, 200) < 0) {
+        if (mSysfs.write(mpu.accel_fifo_rate, 200) < 0) {
             res = -1;
             LOGE("HAL:ERR can't set rate to 200Hz");
             return res;
@@ -1735,7 +1815,7 @@ int MPLSensor::enableDmpPedometer(int en, int interruptMode)
         if (enabled_sensors == 0) {
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                         en, mpu.dmp_event_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.dmp_event_int_on, en) < 0) {
+            if (mSysfs.write(mpu.dmp_event_int_on, en) < 0) {
                 res = -1;
                 LOGE("HAL:ERR can't enable DMP event interrupt");
             }
@@ -1763,7 +1843,7 @@ int MPLSensor::enableDmpPedometer(int en, int interruptMode)
             //Disable DMP Pedometer Function
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     en, mpu.pedometer_on, getTimestamp());
-            if (write_sysfs_int(mpu.pedometer_on, en) < 0) {
+            if (mSysfs.write(mpu.pedometer_on, en) < 0) {
                 LOGE("HAL:ERR can't enable Android Pedometer");
                 res = -1;   // indicate an err
                 return res;
@@ -1787,12 +1867,14 @@ int MPLSensor::enableDmpPedometer(int en, int interruptMode)
             }
         }
 
-        /* if feature is not step detector */
-        if (!(mFeatureActiveMask & INV_DMP_PEDOMETER)) { 
+        /* if feature is not step detector nor event driven step counter */
+        if (!(mFeatureActiveMask & INV_DMP_PEDOMETER) &&
+                !((mFeatureActiveMask & INV_DMP_PEDOMETER_STEP) &&
+                  isStepCountEventDriven())) {
             //Disable DMP Pedometer Interrupt
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     en, mpu.pedometer_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.pedometer_int_on, en) < 0) {
+            if (mSysfs.write(mpu.pedometer_int_on, en) < 0) {
                 LOGE("HAL:ERR can't enable Android Pedometer Interrupt");
                 res = -1;   // indicate an err
                 return res;
@@ -1803,7 +1885,7 @@ int MPLSensor::enableDmpPedometer(int en, int interruptMode)
         if (enabled_sensors) {
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                         en, mpu.dmp_event_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.dmp_event_int_on, en) < 0) {
+            if (mSysfs.write(mpu.dmp_event_int_on, en) < 0) {
                 res = -1;
                 LOGE("HAL:ERR can't enable DMP event interrupt");
             }
@@ -1820,10 +1902,145 @@ int MPLSensor::masterEnable(int en)
 {
     VFUNC_LOG;
 
+    mMasterEnableCalls++;
+    if (inReconfig()) {
+        /* the chip goes off once for the whole reconfiguration and
+           endReconfig() turns it back on if it was asked to */
+        mReconfigMasterTouched = true;
+        mReconfigMasterOn = !!en;
+        if (en || mReconfigMasterOff)
+            return 0;
+        mReconfigMasterOff = true;
+    }
+    return writeMasterEnable(en);
+}
+
+/*
+ * enable(), setDelay() and batch() each turn the chip off and on several
+ * times, once per helper they call (enableSensors(), setBatch(),
+ * update_delay(), enableDmpPedometer() ...). Between beginReconfig() and
+ * endReconfig() only the first masterEnable(0) reaches the driver, the
+ * FIFO rates are computed once at the end and the chip is turned back on
+ * once with the final configuration.
+ *
+ * Deferring masterEnable(1) is safe for every helper called inside the
+ * window: enableDmpPedometer(), enableSensors(), setBatch(),
+ * update_delay(), enableDmpOrientation(), enableDmpSignificantMotion()
+ * and writeSignificantMotionParams() all turn the chip back on as their
+ * last step, only to hand it back running, and nothing they do in between
+ * reads the FIFO or waits for the chip. batch() turns it back on right
+ * before its own endReconfig().
+ *
+ * enable(), setDelay() and batch() are serialized by the framework, so
+ * one thread owns the window. Only that thread is coalesced; the poll thread
+ * (e.g. readDmpSignificantMotionEvents() disarming the one-shot SMD)
+ * still talks to the driver directly.
+ */
+bool MPLSensor::inReconfig() const
+{
+    return mReconfigDepth && pthread_equal(mReconfigThread, pthread_self());
+}
+
+void MPLSensor::beginReconfig()
+{
+    if (mReconfigDepth++)
+        return;
+    mReconfigThread = pthread_self();
+    mReconfigMasterTouched = false;
+    mReconfigMasterOff = false;
+    mReconfigMasterOn = false;
+    mReconfigDelayDirty = false;
+    mReconfigStart = getTimestamp();
+}
+
+int MPLSensor::endReconfig()
+{
+    int res = 0, err;
+    int64_t elapsed;
+
+    if (--mReconfigDepth)
+        return 0;
+
+    if (mReconfigDelayDirty) {
+        /* still inside the window, update_delay() leaves the chip off */
+        mReconfigDepth = 1;
+        mReconfigApplying = true;
+        res = update_delay();
+        mReconfigApplying = false;
+        mReconfigDelayDirty = false;
+        mReconfigDepth = 0;
+    }
+    if (mReconfigMasterTouched && mReconfigMasterOn) {
+        err = writeMasterEnable(1);
+        if (err < 0)
+            res = err;
+    } else if (mReconfigMasterTouched) {
+        /* nothing left enabled, the driver powers the chip down */
+        mChipIdle = true;
+    }
+
+    if (mReconfigMasterOff) {
+        elapsed = getTimestamp() - mReconfigStart;
+        mReconfigCount++;
+        if (elapsed > mReconfigMaxTime)
+            mReconfigMaxTime = elapsed;
+        LOGV_IF(ENG_VERBOSE, "HAL:reconfig chip off for %lld ns", elapsed);
+    }
+    if (res < 0)
+        LOGE("HAL:ERR reconfiguration failed (%d)", res);
+    return res;
+}
+
+/* first event delivered since the sensor was enabled */
+void MPLSensor::recordActivation(int what)
+{
+    int64_t latency = getTimestamp() - mActivationStart[what];
+
+    mActivationStart[what] = 0;
+    mActivationLatency[what] = latency;
+    if (latency > mActivationMaxLatency[what])
+        mActivationMaxLatency[what] = latency;
+    LOGV_IF(PROCESS_VERBOSE, "HAL:sensor %d first event %lld ns after enable",
+            what, latency);
+}
+
+int MPLSensor::writeMasterEnable(int en)
+{
     int res = 0;
+    mMasterEnableWrites++;
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.master_enable, getTimestamp());
-    res = write_sysfs_int(mpu.master_enable, en);
+    /* the driver only latches the configuration while the chip is off,
+       queue it and write it out right before turning the chip back on */
+    if (en) {
+        SysfsAttrCache::Failure failed[SysfsAttrCache::MAX_PENDING];
+        int numFailed;
+        int64_t suspendTime = getSuspendTime();
+
+        /* the driver may have reset the chip while it was left off or
+           the system was suspended, don't skip writes that match what
+           was written before */
+        if (mChipIdle || suspendTime - mSuspendTime > SUSPEND_RESET_MIN_NS) {
+            LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:chip may have been reset");
+            mSysfs.invalidate();
+            mSuspendTime = suspendTime;
+        }
+        mChipIdle = false;
+
+        res = mSysfs.commit(failed, &numFailed);
+        for (int i = 0; i < numFailed; i++) {
+            LOGE("HAL:ERR can't write %lld to %s (%d)",
+                 failed[i].value, failed[i].path, failed[i].err);
+        }
+        /* same as the helper that queued it failing: the chip stays off */
+        if (res < 0) {
+            mSysfs.begin();
+            return res;
+        }
+    }
+    res = mSysfs.write(mpu.master_enable, en);
+    if (!en)
+        mSysfs.begin();
     return res;
 }
 
@@ -1836,16 +2053,24 @@ int MPLSensor::enableGyro(int en)
     /* need to also turn on/off the master enable */
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.gyro_enable, getTimestamp());
-    res = write_sysfs_int(mpu.gyro_enable, en);
+    res = mSysfs.write(mpu.gyro_enable, en);
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.gyro_fifo_enable, getTimestamp());
-    res += write_sysfs_int(mpu.gyro_fifo_enable, en);
+    res += mSysfs.write(mpu.gyro_fifo_enable, en);
 
     if (!en) {
         LOGV_IF(EXTRA_VERBOSE, "HAL:MPL:inv_gyro_was_turned_off");
         inv_gyro_was_turned_off();
     }
 
+    /* the poll loop reads the temperature while the gyro runs */
+    if (mTempTimerFd >= 0) {
+        int64_t period = en ? TEMP_READ_PERIOD_NS : 0;
+        if (armTimerFd(mTempTimerFd, period, period) < 0) {
+            LOGE("HAL:ERR couldn't arm temperature timer");
+        }
+    }
+
     return res;
 }
 
@@ -1856,7 +2081,7 @@ int MPLSensor::enableLowPowerAccel(int en)
     int res;
     
     /* need to also turn on/off the master enable */
-    res = write_sysfs_int(mpu.motion_lpa_on, en);
+    res = mSysfs.write(mpu.motion_lpa_on, en);
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                         en, mpu.motion_lpa_on, getTimestamp());  
     return res;  
@@ -1871,10 +2096,10 @@ int MPLSensor::enableAccel(int en)
     /* need to also turn on/off the master enable */
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.accel_enable, getTimestamp());
-    res = write_sysfs_int(mpu.accel_enable, en);
+    res = mSysfs.write(mpu.accel_enable, en);
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             en, mpu.accel_fifo_enable, getTimestamp());
-    res += write_sysfs_int(mpu.accel_fifo_enable, en);
+    res += mSysfs.write(mpu.accel_fifo_enable, en);
 
     if (!en) {
         LOGV_IF(EXTRA_VERBOSE, "HAL:MPL:inv_accel_was_turned_off");
@@ -1922,12 +2147,12 @@ int MPLSensor::enableBatch(int64_t timeout)
 
     int res = 0;
 
-    res = write_sysfs_int(mpu.batchmode_timeout, timeout);
+    res = mSysfs.write(mpu.batchmode_timeout, timeout);
     if (timeout == 0) {
-        res = write_sysfs_int(mpu.six_axis_q_on, 0);
-        res = write_sysfs_int(mpu.ped_q_on, 0);
-        res = write_sysfs_int(mpu.step_detector_on, 0);
-        res = write_sysfs_int(mpu.step_indicator_on, 0);
+        res = mSysfs.write(mpu.six_axis_q_on, 0);
+        res = mSysfs.write(mpu.ped_q_on, 0);
+        res = mSysfs.write(mpu.step_detector_on, 0);
+        res = mSysfs.write(mpu.step_indicator_on, 0);
     }
 
     if (timeout == 0) {
@@ -2186,7 +2411,7 @@ int MPLSensor::enableSensors(unsigned long sensors, int en, uint32_t changed)
                 // disable DMP event interrupt only (w/ data interrupt)
                 LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                         0, mpu.dmp_event_int_on, getTimestamp());
-                if (write_sysfs_int(mpu.dmp_event_int_on, 0) < 0) {
+                if (mSysfs.write(mpu.dmp_event_int_on, 0) < 0) {
                     res = -1;
                     LOGE("HAL:ERR can't disable DMP event interrupt");
                     return res;
@@ -2406,7 +2631,7 @@ int MPLSensor::setBatch(int en, int toggleEnable)
     /* write required timeout to sysfs */
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             timeoutInMs, mpu.batchmode_timeout, getTimestamp());
-    if (write_sysfs_int(mpu.batchmode_timeout, timeoutInMs) < 0) {
+    if (mSysfs.write(mpu.batchmode_timeout, timeoutInMs) < 0) {
         LOGE("HAL:ERR can't write batchmode_timeout");
     }
 
@@ -2425,7 +2650,7 @@ int MPLSensor::setBatch(int en, int toggleEnable)
         // default fifo rate to 200Hz
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 200, mpu.gyro_fifo_rate, getTimestamp());
-        if (write_sysfs_int(mpu.gyro_fifo_rate, 200) < 0) {
+        if (mSysfs.write(mpu.gyro_fifo_rate, 200) < 0) {
             res = -1;
             LOGE("HAL:ERR can't set rate to 200Hz");
             return res;
@@ -2726,12 +2951,10 @@ int MPLSensor::metaHandler(sensors_event_t* s, int flags)
     
     switch(flags) {
     case META_DATA_FLUSH_COMPLETE:
-        update = mFlushBatchSet;
+        update = 1;
         s->type = SENSOR_TYPE_META_DATA;
         s->meta_data.what = flags;
-        s->meta_data.sensor = mFlushEnabled;
-        mFlushBatchSet = 0;
-        mFlushEnabled = -1;
+        s->meta_data.sensor = mFlushCompleteHandle;
         LOGV_IF(HANDLER_DATA,
                 "HAL:flush complete data: type=%d what=%d, "
                 "sensor=%d - %lld - %d",
@@ -2751,6 +2974,12 @@ int MPLSensor::enable(int32_t handle, int en)
 {
     VFUNC_LOG;
 
+    SysfsAttrCache::Scope sysfsScope(mSysfs);
+    ReconfigScope reconfigScope(this);
+
+    if (uint32_t(handle) < NumSensors)
+        mActivationStart[handle] = en ? getTimestamp() : 0;
+
     android::String8 sname;
     int what = -1, err = 0;
     int batchMode = 0;
@@ -2765,6 +2994,13 @@ int MPLSensor::enable(int32_t handle, int en)
                 (en? "en" : "dis"));
         enableDmpPedometer(en, 0);
         mDmpStepCountEnabled = !!en;
+        if (isStepCountEventDriven()) {
+            /* report the current count right away, then on steps only */
+            if (en)
+                armStepCountTimer(0);
+            else
+                disarmStepCountTimer();
+        }
         return 0;
     case ID_P:
         sname = "StepDetector";
@@ -3064,6 +3300,9 @@ int MPLSensor::setDelay(int32_t handle, int64_t ns)
 {
     VFUNC_LOG;
 
+    SysfsAttrCache::Scope sysfsScope(mSysfs);
+    ReconfigScope reconfigScope(this);
+
     android::String8 sname;
     int what = -1;
 
@@ -3193,6 +3432,12 @@ int MPLSensor::update_delay(void)
     int res = 0;
     int64_t got;
 
+    /* computed once with the final configuration in endReconfig() */
+    if (inReconfig() && !mReconfigApplying) {
+        mReconfigDelayDirty = true;
+        return 0;
+    }
+
     if (mEnabled) {
         int64_t wanted = 1000000000LL;
         int64_t wanted_3rd_party_sensor = 1000000000LL;
@@ -3242,7 +3487,6 @@ int MPLSensor::update_delay(void)
         }        
 
         int enabled_sensors = mEnabled;
-        int tempFd = -1;
 
         if(mFeatureActiveMask & INV_DMP_BATCH_MODE) {
             // set batch rates
@@ -3258,8 +3502,7 @@ int MPLSensor::update_delay(void)
         /* driver only looks at sampling frequency if DMP is off */
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
                 1000000000.f / tempWanted, mpu.gyro_fifo_rate, getTimestamp());
-        tempFd = open(mpu.gyro_fifo_rate, O_RDWR);
-        res = write_attribute_sensor(tempFd, 1000000000.f / tempWanted);
+        res = mSysfs.write(mpu.gyro_fifo_rate, 1000000000.f / tempWanted);
         LOGE_IF(res < 0, "HAL:sampling frequency update delay error");
 
         if (LA_ENABLED || GR_ENABLED || RV_ENABLED
@@ -3326,8 +3569,7 @@ int MPLSensor::update_delay(void)
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
                     1000000000.f / gyroRate, mpu.gyro_rate,
                     getTimestamp());
-            tempFd = open(mpu.gyro_rate, O_RDWR);
-            res = write_attribute_sensor(tempFd, 1000000000.f / gyroRate);
+            res = mSysfs.write(mpu.gyro_rate, 1000000000.f / gyroRate);
             if(res < 0) {
                 LOGE("HAL:GYRO update delay error");
             }
@@ -3338,8 +3580,7 @@ int MPLSensor::update_delay(void)
                 LOGV_IF(SYSFS_VERBOSE, "echo %lld > %s (%lld)",
                         wanted_3rd_party_sensor / 1000000L, mpu.accel_rate,
                         getTimestamp());
-                tempFd = open(mpu.accel_rate, O_RDWR);
-                res = write_attribute_sensor(tempFd,
+                res = mSysfs.write(mpu.accel_rate,
                         wanted_3rd_party_sensor / 1000000L);
                 LOGE_IF(res < 0, "HAL:ACCEL update delay error");
             } else {
@@ -3347,8 +3588,7 @@ int MPLSensor::update_delay(void)
                LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
                         1000000000.f / accelRate, mpu.accel_rate,
                         getTimestamp());
-                tempFd = open(mpu.accel_rate, O_RDWR);
-                res = write_attribute_sensor(tempFd, 1000000000.f / accelRate);
+                res = mSysfs.write(mpu.accel_rate, 1000000000.f / accelRate);
                 LOGE_IF(res < 0, "HAL:ACCEL update delay error");
             }
 
@@ -3409,8 +3649,7 @@ int MPLSensor::update_delay(void)
                     "HAL:MPL gyro sample rate: (mpl)=%d us", int(wanted/1000LL));
                 LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
                         1000000000.f / wanted, mpu.gyro_rate, getTimestamp());
-                tempFd = open(mpu.gyro_rate, O_RDWR);
-                res = write_attribute_sensor(tempFd, 1000000000.f / wanted);
+                res = mSysfs.write(mpu.gyro_rate, 1000000000.f / wanted);
                 LOGE_IF(res < 0, "HAL:GYRO update delay error");
             }
 
@@ -3441,14 +3680,13 @@ int MPLSensor::update_delay(void)
                 LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
                         1000000000.f / wanted, mpu.accel_rate,
                         getTimestamp());
-                tempFd = open(mpu.accel_rate, O_RDWR);
                 if(USE_THIRD_PARTY_ACCEL == 1) {
                     //BMA250 in ms
-                    res = write_attribute_sensor(tempFd, wanted / 1000000L);
+                    res = mSysfs.write(mpu.accel_rate, wanted / 1000000L);
                 }
                 else {
                     //MPUxxxx in hz
-                    res = write_attribute_sensor(tempFd, 1000000000.f/wanted);
+                    res = mSysfs.write(mpu.accel_rate, 1000000000.f/wanted);
                 }
                 LOGE_IF(res < 0, "HAL:ACCEL update delay error");
             }
@@ -3628,16 +3866,34 @@ int MPLSensor::readEvents(sensors_event_t* data, int count)
         }
     }
 
-    // handle flush complete event
-    if(mFlushBatchSet && mFlushEnabled != -1) {
+    // handle flush complete events, one per flush() a marker covers
+    while (count > 0 && (mFlushCompleteCount ||
+                         (mFlushBatchSet && !mFlushTracker.empty()))) {
+        if (!mFlushCompleteCount) {
+            bool restart;
+            int res;
+            mFlushTracker.completeNext(&mFlushCompleteHandle,
+                                       &mFlushCompleteCount, &restart);
+            mFlushBatchSet--;
+            // flushes that came in while it was outstanding
+            if (restart && flushFifo(&res) < 0) {
+                LOGE("HAL:ERR can't restart flush of handle %d",
+                     mFlushCompleteHandle);
+                mFlushTracker.cancel(mFlushCompleteHandle, 0);
+            }
+            continue;
+        }
         sensors_event_t temp;
         int sendEvent = metaHandler(&temp, META_DATA_FLUSH_COMPLETE);
-        if(sendEvent == 1 && count > 0) {
+        mFlushCompleteCount--;
+        if(sendEvent == 1) {
             *data++ = temp;
             count--;
             numEventReceived++;
         }
     }
+    if (mFlushTracker.empty())
+        mFlushBatchSet = 0;
 
     // handle partial packet read
     if (mSkipReadEvents)
@@ -3672,6 +3928,8 @@ int MPLSensor::readEvents(sensors_event_t* data, int count)
 
             if (update && (count > 0)) {
                 *data++ = mPendingEvents[i];
+                if (mActivationStart[i])
+                    recordActivation(i);
                 count--;
                 numEventReceived++;
             }
@@ -3703,6 +3961,8 @@ void MPLSensor::buildMpuEvent(void)
     ssize_t rsize = 0;
     size_t readCounter = 0;
     char *rdataP = NULL;
+    struct inv_fifo_packet packet;
+    ssize_t packetSize;
 
     /* 2 Bytes header + 6 Bytes x,y,z data | 8 bytes timestamp */
     nbyte= (BYTES_PER_SENSOR + 8) * sensors * 1;
@@ -3803,7 +4063,7 @@ void MPLSensor::buildMpuEvent(void)
 
     LOGV_IF(INPUT_DATA && ENG_VERBOSE, 
             "HAL:input b=%d rdata= %d nbyte= %d rsize= %d readCounter= %d",
-            checkBatchEnabled(), *((short *) rdata), nbyte, (int)rsize, readCounter);
+            checkBatchEnabled(), inv_fifo_header(rdata), nbyte, (int)rsize, readCounter);
     LOGV_IF(INPUT_DATA && ENG_VERBOSE, 
             "HAL:input sensors= %d, lp_q_on= %d, 6axis_q_on= %d, "
             "ped_q_on= %d, ped_standalone_on= %d",
@@ -3815,116 +4075,122 @@ void MPLSensor::buildMpuEvent(void)
         mLeftOverBufferSize = 0;        
         // clear data format mask for parsing the next set of data
         mask = 0;
-        data_format = *((short *)(rdata));
+        packetSize = inv_fifo_decode(rdata, readCounter, &packet);
+        data_format = inv_fifo_header(rdata);
         LOGV_IF(INPUT_DATA && ENG_VERBOSE, 
                 "HAL:input data_format=%x", data_format);
 
-        if ((data_format & ~DATA_FORMAT_MASK) || (data_format == 0)) {
+        if (packetSize < 0) {
             LOGE("HAL:input invalid data_format 0x%02X", data_format);
-            return;
+            if (data_format == 0)
+                return;
+            /* skip the 8 bytes of an unknown header, as the if/else
+               chain before the descriptor table did */
+            if (readCounter < BYTES_PER_SENSOR)
+                return;
+            rdata += BYTES_PER_SENSOR;
+            readCounter -= BYTES_PER_SENSOR;
+            continue;
         }
 
-        if (data_format & DATA_FORMAT_STEP) {
-            if (data_format == DATA_FORMAT_STEP) {
-                rdata += BYTES_PER_SENSOR;
-                latestTimestamp = *((long long*) (rdata));
-                LOGV_IF(ENG_VERBOSE, "STEP DETECTED:0x%x - ts: %lld", data_format, latestTimestamp);
-                // readCounter is decrement by 24 because DATA_FORMAT_STEP only applies in batch  mode
-                readCounter -= BYTES_PER_SENSOR_PACKET;
-            } else {
-                LOGV_IF(0, "STEP DETECTED:0x%x", data_format);
+        if (packetSize == 0) {
+            /* partial packet, keep it for the next read */
+            if (readCounter <= sizeof(mLeftOverBuffer)) {
+                memcpy(mLeftOverBuffer, rdata, readCounter);
+                mLeftOverBufferSize = readCounter;
             }
+            LOGV_IF(ENG_VERBOSE, "HAL:input partial packet, stored %d bytes",
+                    mLeftOverBufferSize);
+            return;
+        }
+
+        if (packet.flags & DATA_FORMAT_STEP) {
+            LOGV_IF(0, "STEP DETECTED:0x%x", data_format);
             mPedUpdate |= data_format;
             mask |= DATA_FORMAT_STEP;
-            // cancels step bit
-            data_format &= (~DATA_FORMAT_STEP);
+            notifyStepCount();
         }
 
-        if (data_format & DATA_FORMAT_MARKER) {
+        switch (packet.desc->target) {
+        case INV_FIFO_TARGET_STEP:
+            latestTimestamp = inv_fifo_ts(&packet)->timestamp;
+            LOGV_IF(ENG_VERBOSE, "STEP DETECTED:0x%x - ts: %lld", data_format, latestTimestamp);
+            mPedUpdate |= data_format;
+            mask |= DATA_FORMAT_STEP;
+            notifyStepCount();
+            break;
+        case INV_FIFO_TARGET_MARKER:
+        case INV_FIFO_TARGET_EMPTY_MARKER:
+            /* one per flush_batch read, counted once per packet */
             LOGV_IF(ENG_VERBOSE, "MARKER DETECTED:0x%x", data_format);
-            // cancels marker bit
-            data_format &= (~DATA_FORMAT_MARKER);
-            mFlushBatchSet = 1; 
-        }
-        
-        if (data_format == DATA_FORMAT_QUAT) {
-            mCachedQuaternionData[0] = *((int *) (rdata + 4));
-            mCachedQuaternionData[1] = *((int *) (rdata + 8));
-            mCachedQuaternionData[2] = *((int *) (rdata + 12));
-            rdata += QUAT_ONLY_LAST_PACKET_OFFSET;
-            mQuatSensorTimestamp = *((long long*) (rdata));
-            mask |= DATA_FORMAT_QUAT;
-            readCounter -= BYTES_QUAT_DATA;
-        }
-        else if (data_format == DATA_FORMAT_6_AXIS) {
-            mCached6AxisQuaternionData[0] = *((int *) (rdata + 4));
-            mCached6AxisQuaternionData[1] = *((int *) (rdata + 8));
-            mCached6AxisQuaternionData[2] = *((int *) (rdata + 12));
-            rdata += QUAT_ONLY_LAST_PACKET_OFFSET;
-            mQuatSensorTimestamp = *((long long*) (rdata));
-            mask |= DATA_FORMAT_6_AXIS;
-            readCounter -= BYTES_QUAT_DATA;
-        }
-        else if (data_format == DATA_FORMAT_PED_QUAT) {
-            mCachedPedQuaternionData[0] = *((short *) (rdata + 2));
-            mCachedPedQuaternionData[1] = *((short *) (rdata + 4));
-            mCachedPedQuaternionData[2] = *((short *) (rdata + 6));
-            rdata += BYTES_PER_SENSOR;
-            mQuatSensorTimestamp = *((long long*) (rdata));
-            mask |= DATA_FORMAT_PED_QUAT;
-            readCounter -= BYTES_PER_SENSOR_PACKET;
-        }
-        else if (data_format == DATA_FORMAT_PED_STANDALONE) {
+            if (!mFlushTracker.empty())
+                mFlushBatchSet++;
+            break;
+        case INV_FIFO_TARGET_QUAT:
+            mCachedQuaternionData[0] = inv_fifo_s32(&packet)->data[0];
+            mCachedQuaternionData[1] = inv_fifo_s32(&packet)->data[1];
+            mCachedQuaternionData[2] = inv_fifo_s32(&packet)->data[2];
+            mQuatSensorTimestamp = inv_fifo_s32(&packet)->timestamp;
+            mask |= packet.desc->mask;
+            break;
+        case INV_FIFO_TARGET_6_AXIS:
+            mCached6AxisQuaternionData[0] = inv_fifo_s32(&packet)->data[0];
+            mCached6AxisQuaternionData[1] = inv_fifo_s32(&packet)->data[1];
+            mCached6AxisQuaternionData[2] = inv_fifo_s32(&packet)->data[2];
+            mQuatSensorTimestamp = inv_fifo_s32(&packet)->timestamp;
+            mask |= packet.desc->mask;
+            break;
+        case INV_FIFO_TARGET_PED_QUAT:
+            mCachedPedQuaternionData[0] = inv_fifo_s16(&packet)->data[0];
+            mCachedPedQuaternionData[1] = inv_fifo_s16(&packet)->data[1];
+            mCachedPedQuaternionData[2] = inv_fifo_s16(&packet)->data[2];
+            mQuatSensorTimestamp = inv_fifo_s16(&packet)->timestamp;
+            mask |= packet.desc->mask;
+            break;
+        case INV_FIFO_TARGET_PED_STANDALONE:
             LOGV_IF(ENG_VERBOSE, "STEP DETECTED:0x%x", data_format);
-            rdata += BYTES_PER_SENSOR;
-            mStepSensorTimestamp = *((long long*) (rdata));
-            mask |= DATA_FORMAT_PED_STANDALONE;
-            readCounter -= BYTES_PER_SENSOR_PACKET;
-            mPedUpdate |= data_format;
-        }
-        else if (data_format == DATA_FORMAT_GYRO) {
-            mCachedGyroData[0] = *((short *) (rdata + 2));
-            mCachedGyroData[1] = *((short *) (rdata + 4));
-            mCachedGyroData[2] = *((short *) (rdata + 6));
-            rdata += BYTES_PER_SENSOR;
-            mGyroSensorTimestamp = *((long long*) (rdata));
-            mask |= DATA_FORMAT_GYRO;
-            readCounter -= BYTES_PER_SENSOR_PACKET;
-        }
-        else if (data_format == DATA_FORMAT_ACCEL) {
-            mCachedAccelData[0] = *((short *) (rdata + 2));
-            mCachedAccelData[1] = *((short *) (rdata + 4));
-            mCachedAccelData[2] = *((short *) (rdata + 6));
-            rdata += BYTES_PER_SENSOR;
-            mAccelSensorTimestamp = *((long long*) (rdata));
-            mask |= DATA_FORMAT_ACCEL;
-            readCounter -= BYTES_PER_SENSOR_PACKET;
-        }
-        else  if (data_format == DATA_FORMAT_COMPASS) {
+            mStepSensorTimestamp = inv_fifo_ts(&packet)->timestamp;
+            mask |= packet.desc->mask;
+            mPedUpdate |= packet.desc->header;
+            notifyStepCount();
+            break;
+        case INV_FIFO_TARGET_GYRO:
+            mCachedGyroData[0] = inv_fifo_s16(&packet)->data[0];
+            mCachedGyroData[1] = inv_fifo_s16(&packet)->data[1];
+            mCachedGyroData[2] = inv_fifo_s16(&packet)->data[2];
+            mGyroSensorTimestamp = inv_fifo_s16(&packet)->timestamp;
+            mask |= packet.desc->mask;
+            break;
+        case INV_FIFO_TARGET_ACCEL:
+            mCachedAccelData[0] = inv_fifo_s16(&packet)->data[0];
+            mCachedAccelData[1] = inv_fifo_s16(&packet)->data[1];
+            mCachedAccelData[2] = inv_fifo_s16(&packet)->data[2];
+            mAccelSensorTimestamp = inv_fifo_s16(&packet)->timestamp;
+            mask |= packet.desc->mask;
+            break;
+        case INV_FIFO_TARGET_COMPASS:
             if (mCompassSensor->isIntegrated()) {
-                mCachedCompassData[0] = *((short *) (rdata + 2));
-                mCachedCompassData[1] = *((short *) (rdata + 4));
-                mCachedCompassData[2] = *((short *) (rdata + 6));
-                rdata += BYTES_PER_SENSOR;
-                mCompassTimestamp = *((long long*) (rdata));
-                mask |= DATA_FORMAT_COMPASS;
-                readCounter -= BYTES_PER_SENSOR_PACKET;
+                mCachedCompassData[0] = inv_fifo_s16(&packet)->data[0];
+                mCachedCompassData[1] = inv_fifo_s16(&packet)->data[1];
+                mCachedCompassData[2] = inv_fifo_s16(&packet)->data[2];
+                mCompassTimestamp = inv_fifo_s16(&packet)->timestamp;
+                mask |= packet.desc->mask;
             }
-        }
-        else if (data_format == DATA_FORMAT_PRESSURE) {
+            break;
+        case INV_FIFO_TARGET_PRESSURE:
             if (mPressureSensor->isIntegrated()) {
-                mCachedPressureData = 
-                    ((*((short *)(rdata + 4))) << 16) + 
-                    (*((unsigned short *) (rdata + 6)));
-                rdata += BYTES_PER_SENSOR;
-                mPressureTimestamp = *((long long*) (rdata));
+                mCachedPressureData = inv_fifo_pressure_value(&packet);
+                mPressureTimestamp = inv_fifo_pressure(&packet)->timestamp;
                 if (mCachedPressureData != 0) {
-                    mask |= DATA_FORMAT_PRESSURE;
+                    mask |= packet.desc->mask;
                 }
-                readCounter -= BYTES_PER_SENSOR_PACKET;
             }
+            break;
+        default:
+            break;
         }
-        rdata += BYTES_PER_SENSOR;
+        rdata += packetSize;
+        readCounter -= packetSize;
 
         size_t storeBufferSize = 0;
         if (checkBatchEnabled()) {
@@ -3961,16 +4227,16 @@ void MPLSensor::buildMpuEvent(void)
             /* disable temperature read */
             if (!(mFeatureActiveMask & INV_DMP_BATCH_MODE)) {
                 // send down temperature every 0.5 seconds
-                // with timestamp measured in "driver" layer
-                if(mGyroSensorTimestamp - mTempCurrentTime >= 500000000LL) {
+                // with timestamp measured in "driver" layer,
+                // read from the poll loop when the timer is there
+                if (mTempTimerFd < 0 &&
+                    mGyroSensorTimestamp - mTempCurrentTime >= TEMP_READ_PERIOD_NS) {
                     mTempCurrentTime = mGyroSensorTimestamp;
-                    long long temperature[2];
-                    if(inv_read_temperature(temperature) == 0) {
-                        LOGV_IF(INPUT_DATA,
-                        "HAL:input inv_read_temperature = %lld, timestamp= %lld",
-                        temperature[0], temperature[1]);
-                        inv_build_temp(temperature[0], temperature[1]);
-                     }
+                    updateTemperature();
+                }
+                if (mTempPending) {
+                    mTempPending = false;
+                    inv_build_temp(mCachedTemperature[0], mCachedTemperature[1]);
 #ifdef TESTING
                     long bias[3], temp, temp_slope[3];
                     inv_get_mpl_gyro_bias(bias, &temp);
@@ -3979,7 +4245,7 @@ void MPLSensor::buildMpuEvent(void)
                      "GB: %+13f %+13f %+13f "
                      "TS: %+13f %+13f %+13f "
                      "\n",
-                     (float)temperature[0] / 65536.f,
+                     (float)mCachedTemperature[0] / 65536.f,
                      (float)bias[0] / 65536.f / 16.384f,
                      (float)bias[1] / 65536.f / 16.384f,
                      (float)bias[2] / 65536.f / 16.384f,
@@ -4221,7 +4487,7 @@ int MPLSensor::turnOffAccelFifo(void)
     int res = 0;
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                         0, mpu.accel_fifo_enable, getTimestamp());
-    res += write_sysfs_int(mpu.accel_fifo_enable, 0);
+    res += mSysfs.write(mpu.accel_fifo_enable, 0);
     return res;
 }
 
@@ -4231,7 +4497,7 @@ int MPLSensor::turnOffGyroFifo(void)
     int res = 0;
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                         0, mpu.gyro_fifo_enable, getTimestamp());
-    res += write_sysfs_int(mpu.gyro_fifo_enable, 0);
+    res += mSysfs.write(mpu.gyro_fifo_enable, 0);
     return res;
 }
 
@@ -4252,7 +4518,7 @@ int MPLSensor::enableDmpOrientation(int en)
         //Enable DMP orientation
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 en, mpu.display_orientation_on, getTimestamp());
-        if (write_sysfs_int(mpu.display_orientation_on, en) < 0) {
+        if (mSysfs.write(mpu.display_orientation_on, en) < 0) {
             LOGE("HAL:ERR can't enable Android orientation");
             res = -1;	// indicate an err
             return res;
@@ -4266,7 +4532,7 @@ int MPLSensor::enableDmpOrientation(int en)
         // set rate to 200Hz
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 200, mpu.accel_fifo_rate, getTimestamp());
-        if (write_sysfs_int(mpu.accel_fifo_rate, 200) < 0) {
+        if (mSysfs.write(mpu.accel_fifo_rate, 200) < 0) {
             res = -1;
             LOGE("HAL:ERR can't set rate to 200Hz");
             return res;
@@ -4287,7 +4553,7 @@ int MPLSensor::enableDmpOrientation(int en)
         if (!mEnabled){
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                        1, mpu.dmp_event_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.dmp_event_int_on, en) < 0) {
+            if (mSysfs.write(mpu.dmp_event_int_on, en) < 0) {
                 res = -1;
                 LOGE("HAL:ERR can't enable DMP event interrupt");
             }
@@ -4315,7 +4581,7 @@ int MPLSensor::enableDmpOrientation(int en)
         if (mEnabled){
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                        en, mpu.dmp_event_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.dmp_event_int_on, en) < 0) {
+            if (mSysfs.write(mpu.dmp_event_int_on, en) < 0) {
                 res = -1;
                 LOGE("HAL:ERR can't enable DMP event interrupt");
             }
@@ -4440,21 +4706,21 @@ int MPLSensor::getDmpRate(int64_t *wanted)
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 int(1000000000.f / *wanted), mpu.three_axis_q_rate,
                 getTimestamp());
-        write_sysfs_int(mpu.three_axis_q_rate, 1000000000.f / *wanted);
+        mSysfs.write(mpu.three_axis_q_rate, 1000000000.f / *wanted);
         LOGV_IF(PROCESS_VERBOSE,
                     "HAL:DMP three axis rate %.2f Hz", 1000000000.f / *wanted);
         if (mFeatureActiveMask & INV_DMP_BATCH_MODE) {
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     int(1000000000.f / *wanted), mpu.six_axis_q_rate,
                     getTimestamp());
-            write_sysfs_int(mpu.six_axis_q_rate, 1000000000.f / *wanted);
+            mSysfs.write(mpu.six_axis_q_rate, 1000000000.f / *wanted);
             LOGV_IF(PROCESS_VERBOSE,
                     "HAL:DMP six axis rate %.2f Hz", 1000000000.f / *wanted);
                     
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                     int(1000000000.f / *wanted), mpu.ped_q_rate,
                     getTimestamp());
-            write_sysfs_int(mpu.ped_q_rate, 1000000000.f / *wanted);
+            mSysfs.write(mpu.ped_q_rate, 1000000000.f / *wanted);
             LOGV_IF(PROCESS_VERBOSE,
                     "HAL:DMP ped quaternion rate %.2f Hz", 1000000000.f / *wanted);
         }
@@ -4475,6 +4741,10 @@ int MPLSensor::getPollTime(void)
 int MPLSensor::getStepCountPollTime(void)
 {
     VFUNC_LOG;
+    if (isStepCountEventDriven()) {
+        // step count timer wakes the poll, nothing to time out for
+        return -1;
+    }
     if (mDmpStepCountEnabled) {
         /* clamped to 1ms?, still rather large */
         LOGV_IF(0/*EXTRA_VERBOSE*/, "Step Count poll time = %lld ms",
@@ -4487,6 +4757,8 @@ int MPLSensor::getStepCountPollTime(void)
 bool MPLSensor::hasStepCountPendingEvents(void)
 {
     VFUNC_LOG;
+    if (isStepCountEventDriven())
+        return false;
     if (mDmpStepCountEnabled) {
         struct timespec t_now;
         int64_t interval = 0;
@@ -4622,6 +4894,41 @@ int MPLSensor::inv_read_temperature(long long *data)
     return 0;
 }
 
+/* read the gyro temperature, applied with the next gyro sample */
+void MPLSensor::updateTemperature(void)
+{
+    VHANDLER_LOG;
+
+    int64_t start = getTimestamp();
+    int64_t elapsed;
+
+    if (inv_read_temperature(mCachedTemperature) == 0) {
+        LOGV_IF(INPUT_DATA,
+                "HAL:input inv_read_temperature = %lld, timestamp= %lld",
+                mCachedTemperature[0], mCachedTemperature[1]);
+        mTempPending = true;
+    }
+    elapsed = getTimestamp() - start;
+    mTempReadCount++;
+    if (elapsed > mTempReadMaxTime)
+        mTempReadMaxTime = elapsed;
+}
+
+/* temperature timer expired, no events are reported */
+int MPLSensor::readTemperatureEvents(void)
+{
+    VFUNC_LOG;
+
+    uint64_t expirations;
+
+    if (read(mTempTimerFd, &expirations, sizeof(expirations)) <= 0)
+        return 0;
+    /* batch mode does not batch temperature */
+    if (!(mFeatureActiveMask & INV_DMP_BATCH_MODE))
+        updateTemperature();
+    return 0;
+}
+
 int MPLSensor::inv_read_dmp_state(int fd)
 {
     VFUNC_LOG;
@@ -5486,6 +5793,9 @@ int MPLSensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
 {
     VFUNC_LOG;
 
+    SysfsAttrCache::Scope sysfsScope(mSysfs);
+    ReconfigScope reconfigScope(this);
+
     int res = 0;
 
     if (isMpuNonDmp())
@@ -5681,7 +5991,7 @@ int MPLSensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 int(1000000000.f / wanted), mpu.ped_q_rate,
                 getTimestamp());
-        write_sysfs_int(mpu.ped_q_rate, 1000000000.f / wanted);
+        mSysfs.write(mpu.ped_q_rate, 1000000000.f / wanted);
         LOGV_IF(PROCESS_VERBOSE,
                 "HAL:DMP ped quaternion rate %.2f Hz", 1000000000.f / wanted);
     } else if (!(featureMask & INV_DMP_PED_STANDALONE)){
@@ -5714,7 +6024,7 @@ int MPLSensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 int(1000000000.f / wanted), mpu.six_axis_q_rate,
                 getTimestamp());
-        write_sysfs_int(mpu.six_axis_q_rate, 1000000000.f / wanted);
+        mSysfs.write(mpu.six_axis_q_rate, 1000000000.f / wanted);
         LOGV_IF(PROCESS_VERBOSE,
                 "HAL:DMP six axis rate %.2f Hz", 1000000000.f / wanted);        
     } else if (!(featureMask & INV_DMP_PED_QUATERNION)){
@@ -5732,7 +6042,7 @@ int MPLSensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
     /*if (flags & (1 << SENSORS_BATCH_WAKE_UPON_FIFO_FULL)) {
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 0, mpu.batchmode_wake_fifo_full_on, getTimestamp());
-        if (write_sysfs_int(mpu.batchmode_wake_fifo_full_on, 0) < 0) {
+        if (mSysfs.write(mpu.batchmode_wake_fifo_full_on, 0) < 0) {
             LOGE("HAL:ERR can't write batchmode_wake_fifo_full_on");
         }
     }*/
@@ -5740,7 +6050,7 @@ int MPLSensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
     /* write required timeout to sysfs */
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %lld > %s (%lld)",
             timeoutInMs, mpu.batchmode_timeout, getTimestamp());
-    if (write_sysfs_int(mpu.batchmode_timeout, timeoutInMs) < 0) {
+    if (mSysfs.write(mpu.batchmode_timeout, timeoutInMs) < 0) {
         LOGE("HAL:ERR can't write batchmode_timeout");
     }
 
@@ -5757,7 +6067,7 @@ int MPLSensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
         // default fifo rate to 200Hz
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 200, mpu.gyro_fifo_rate, getTimestamp());
-        if (write_sysfs_int(mpu.gyro_fifo_rate, 200) < 0) {
+        if (mSysfs.write(mpu.gyro_fifo_rate, 200) < 0) {
             res = -1;
             LOGE("HAL:ERR can't set DMP rate to 200Hz");
             return res;
@@ -5787,6 +6097,8 @@ int MPLSensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
 int MPLSensor::flush(int handle)
 {
     VFUNC_LOG;
+
+    SysfsAttrCache::Scope sysfsScope(mSysfs);
     
     int res = 0;
     android::String8 sname;
@@ -5810,13 +6122,22 @@ int MPLSensor::flush(int handle)
     }
     LOGV_IF(PROCESS_VERBOSE, "HAL:flush - sensor %s (handle %d)", sname.string(), handle);
 
-    /*write sysfs */
-    LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:cat %s (%lld)",
-            mpu.flush_batch, getTimestamp());
+    switch (mFlushTracker.add(handle)) {
+    case FlushTracker::FLUSH_INVALID:
+        LOGE("HAL:flush - can't track a flush of handle %d", handle);
+        return -EINVAL;
+    case FlushTracker::FLUSH_DEFERRED:
+        /* started again when the outstanding flush completes */
+        LOGV_IF(ENG_VERBOSE, "HAL:flush - handle %d waits for pending flush",
+                handle);
+        return 0;
+    default:
+        break;
+    }
 
-    read_sysfs_int(mpu.flush_batch, &res);
-    if (res < 0) {
+    if (flushFifo(&res) < 0) {
         LOGE("HAL:ERR can't read flush_batch");
+        mFlushTracker.cancel(handle, 1);
         return -1;
     } 
     
@@ -5824,13 +6145,22 @@ int MPLSensor::flush(int handle)
         LOGI("HAL: flush - no data in FIFO");
     }
 
-    mFlushEnabled = handle;
-    LOGV_IF(ENG_VERBOSE, "HAl:flush - mFlushEnabled=%d", mFlushEnabled);
-
-    mFlushBatchSet = 0;
+    LOGV_IF(ENG_VERBOSE, "HAl:flush - handle=%d res=%d", handle, res);
     return res;
 }
 
+/* the driver pushes out the FIFO, followed by a marker */
+int MPLSensor::flushFifo(int *res)
+{
+    /*write sysfs */
+    LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:cat %s (%lld)",
+            mpu.flush_batch, getTimestamp());
+
+    if (mSysfs.read(mpu.flush_batch, res) < 0 || *res < 0)
+        return -1;
+    return 0;
+}
+
 int MPLSensor::computeBatchDataOutput()
 {
     VFUNC_LOG;
@@ -5893,11 +6223,11 @@ int MPLSensor::readDmpPedometerEvents(sensors_event_t* data, int count,
     VFUNC_LOG;
 
     char dummy[4];
-    FILE *fp;
-    uint64_t stepCount = 0;
     int numEventReceived = 0;
 
-    if((mDmpStepCountEnabled || mDmpPedometerEnabled) && count > 0) {
+    /* the interrupt may be on for the step counter alone */
+    if ((id == ID_P ? mDmpPedometerEnabled : mDmpStepCountEnabled) &&
+            count > 0) {
         /* handles return event */
         sensors_event_t temp;
 
@@ -5912,27 +6242,8 @@ int MPLSensor::readDmpPedometerEvents(sensors_event_t* data, int count,
              temp.data[0] = 1;
              temp.data[1] = 0.f;
              temp.data[2] = 0.f;
-        } else {
-            fp = fopen(mpu.pedometer_steps, "r");
-            if (fp == NULL) {
-                LOGE("HAL:cannot open pedometer_steps");
-            } else{
-                if (fscanf(fp, "%lld\n", &stepCount) < 0 || fclose(fp) < 0) {
-                    LOGE("HAL:cannot read pedometer_steps");
-                    return 0;
-                }
-            }
-            /* return onChange only*/
-            if (stepCount == mLastStepCount) {
-                return 0;
-            }
-            /* TODO: framework needs to support 64-bit */
-#ifdef TESTING
-            temp.data[0] = (float)stepCount;
-#else
-            temp.u64.step_counter = stepCount;
-#endif
-            mLastStepCount = stepCount;
+        } else if (!readStepCount(&temp)) {
+            return 0;
         }
 
         if (!outputType) {
@@ -5950,6 +6261,7 @@ int MPLSensor::readDmpPedometerEvents(sensors_event_t* data, int count,
         // read dummy data per driver's request
         // only required if actual irq is issued
         read(dmp_pedometer_fd, dummy, 4);
+        notifyStepCount();
     } else {
         return 1;
     } 
@@ -5957,6 +6269,116 @@ int MPLSensor::readDmpPedometerEvents(sensors_event_t* data, int count,
     return numEventReceived;
 }
 
+/* read pedometer_steps into event, returns 0 if the count did not change */
+int MPLSensor::readStepCount(sensors_event_t *event)
+{
+    VFUNC_LOG;
+
+    FILE *fp;
+    uint64_t stepCount = 0;
+
+    fp = fopen(mpu.pedometer_steps, "r");
+    if (fp == NULL) {
+        LOGE("HAL:cannot open pedometer_steps");
+    } else{
+        if (fscanf(fp, "%lld\n", &stepCount) < 0 || fclose(fp) < 0) {
+            LOGE("HAL:cannot read pedometer_steps");
+            return 0;
+        }
+    }
+    /* return onChange only*/
+    if (stepCount == mLastStepCount) {
+        return 0;
+    }
+    /* TODO: framework needs to support 64-bit */
+#ifdef TESTING
+    event->data[0] = (float)stepCount;
+#else
+    event->u64.step_counter = stepCount;
+#endif
+    mLastStepCount = stepCount;
+    return 1;
+}
+
+bool MPLSensor::isStepCountEventDriven(void)
+{
+    return (mStepCountTimerFd >= 0 && dmp_pedometer_fd >= 0);
+}
+
+/* The step count only changes on a step, which comes in as a pedometer
+   interrupt or a step packet in the FIFO. A step arms the timer for when
+   the count is next due, further steps until then are folded into that
+   read. */
+void MPLSensor::notifyStepCount(void)
+{
+    VFUNC_LOG;
+
+    struct timespec t_now;
+    int64_t period, due;
+
+    if (!mDmpStepCountEnabled || mStepCountTimerArmed ||
+            !isStepCountEventDriven())
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &t_now);
+    period = mStepCountPollTime > 0 ? mStepCountPollTime : 0;
+    due = int64_t(mt_pre.tv_sec) * 1000000000LL + mt_pre.tv_nsec + period;
+    armStepCountTimer(due -
+            (int64_t(t_now.tv_sec) * 1000000000LL + t_now.tv_nsec));
+}
+
+void MPLSensor::armStepCountTimer(int64_t delay)
+{
+    VFUNC_LOG;
+
+    /* a zero delay disarms the timer */
+    if (delay < 1)
+        delay = 1;
+    if (armTimerFd(mStepCountTimerFd, delay) < 0) {
+        LOGE("HAL:ERR can't arm step count timer (%s)", strerror(errno));
+        return;
+    }
+    mStepCountTimerArmed = true;
+    LOGV_IF(PROCESS_VERBOSE, "HAL:step count due in %lld ns", delay);
+}
+
+void MPLSensor::disarmStepCountTimer(void)
+{
+    VFUNC_LOG;
+
+    armTimerFd(mStepCountTimerFd, 0);
+    mStepCountTimerArmed = false;
+}
+
+/* step count timer expired, report the count if it changed */
+int MPLSensor::readStepCountEvents(sensors_event_t* data, int count)
+{
+    VFUNC_LOG;
+
+    uint64_t expirations;
+    sensors_event_t temp;
+    struct timespec ts;
+
+    if (read(mStepCountTimerFd, &expirations, sizeof(expirations)) < 0)
+        return 0;
+    mStepCountTimerArmed = false;
+    clock_gettime(CLOCK_MONOTONIC, &mt_pre);
+
+    if (!mDmpStepCountEnabled || count <= 0)
+        return 0;
+
+    temp.version = sizeof(sensors_event_t);
+    temp.sensor = ID_SC;
+    temp.type = SENSOR_TYPE_STEP_COUNTER;
+    temp.acceleration.status = SENSOR_STATUS_UNRELIABLE;
+    if (!readStepCount(&temp))
+        return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    temp.timestamp = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    *data = temp;
+    return 1;
+}
+
 int MPLSensor::getDmpSignificantMotionFd()
 {
     VFUNC_LOG;
@@ -6051,7 +6473,7 @@ int MPLSensor::enableDmpSignificantMotion(int en)
         LOGV_IF(ENG_VERBOSE, "HAL:Enabling Significant Motion");
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 1, mpu.smd_enable, getTimestamp());
-        if (write_sysfs_int(mpu.smd_enable, 1) < 0) {
+        if (mSysfs.write(mpu.smd_enable, 1) < 0) {
             LOGE("HAL:ERR can't write DMP smd_enable");
             res = -1;   //Indicate an err
         }
@@ -6064,7 +6486,7 @@ int MPLSensor::enableDmpSignificantMotion(int en)
         // set DMP rate to 200Hz
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 200, mpu.accel_fifo_rate, getTimestamp());
-        if (write_sysfs_int(mpu.accel_fifo_rate, 200) < 0) {
+        if (mSysfs.write(mpu.accel_fifo_rate, 200) < 0) {
             res = -1;
             LOGE("HAL:ERR can't set rate to 200Hz");
             return res;
@@ -6087,7 +6509,7 @@ int MPLSensor::enableDmpSignificantMotion(int en)
         LOGV_IF(ENG_VERBOSE, "HAL:Disabling Significant Motion");
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 0, mpu.smd_enable, getTimestamp());
-        if (write_sysfs_int(mpu.smd_enable, 0) < 0) {
+        if (mSysfs.write(mpu.smd_enable, 0) < 0) {
             LOGE("HAL:ERR write DMP smd_enable");
         }
         mFeatureActiveMask &= ~INV_DMP_SIGNIFICANT_MOTION;
@@ -6109,7 +6531,7 @@ int MPLSensor::enableDmpSignificantMotion(int en)
         if(enabled_sensors) {
             LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 en, mpu.dmp_event_int_on, getTimestamp());
-            if (write_sysfs_int(mpu.dmp_event_int_on, en) < 0) {
+            if (mSysfs.write(mpu.dmp_event_int_on, en) < 0) {
                 res = -1;
                 LOGE("HAL:ERR can't enable DMP event interrupt");
             }
@@ -6166,16 +6588,16 @@ int MPLSensor::writeSignificantMotionParams(bool toggleEnable,
     // Write supplied values
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
             delayThreshold1, mpu.smd_delay_threshold, getTimestamp());
-    res = write_sysfs_int(mpu.smd_delay_threshold, delayThreshold1);
+    res = mSysfs.write(mpu.smd_delay_threshold, delayThreshold1);
     if (res == 0) {
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 delayThreshold2, mpu.smd_delay_threshold2, getTimestamp());
-        res = write_sysfs_int(mpu.smd_delay_threshold2, delayThreshold2);
+        res = mSysfs.write(mpu.smd_delay_threshold2, delayThreshold2);
     }
     if (res == 0) {
         LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%lld)",
                 motionThreshold, mpu.smd_threshold, getTimestamp());
-        res = write_sysfs_int(mpu.smd_threshold, motionThreshold);
+        res = mSysfs.write(mpu.smd_threshold, motionThreshold);
     }
 
     // Turn on enable
@@ -6192,7 +6614,6 @@ int MPLSensor::setBatchDataRates()
     VFUNC_LOG;
 
     int res = 0;
-    int tempFd = -1;
 
     int64_t gyroRate;
     int64_t accelRate;
@@ -6258,8 +6679,7 @@ int MPLSensor::setBatchDataRates()
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
             1000000000.f / gyroRate, mpu.gyro_rate,
             getTimestamp());
-    tempFd = open(mpu.gyro_rate, O_RDWR);
-    res = write_attribute_sensor(tempFd, 1000000000.f / gyroRate);
+    res = mSysfs.write(mpu.gyro_rate, 1000000000.f / gyroRate);
     if(res < 0) {
         LOGE("HAL:GYRO update delay error");
     }
@@ -6267,8 +6687,7 @@ int MPLSensor::setBatchDataRates()
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
             1000000000.f / accelRate, mpu.accel_rate,
             getTimestamp());
-    tempFd = open(mpu.accel_rate, O_RDWR);
-    res = write_attribute_sensor(tempFd, 1000000000.f / accelRate);
+    res = mSysfs.write(mpu.accel_rate, 1000000000.f / accelRate);
     LOGE_IF(res < 0, "HAL:ACCEL update delay error");
    
     if (compassRate < mCompassSensor->getMinDelay() * 1000LL) {
@@ -6290,7 +6709,6 @@ int MPLSensor::resetDataRates()
     VFUNC_LOG;
     
     int res = 0;
-    int tempFd = -1;
     int64_t wanted = 1000000000LL;
 
     int64_t gyroRate;
@@ -6344,15 +6762,13 @@ int MPLSensor::resetDataRates()
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
             1000000000.f / wanted, mpu.gyro_fifo_rate,
             getTimestamp());
-    tempFd = open(mpu.gyro_fifo_rate, O_RDWR);
-    res = write_attribute_sensor(tempFd, 1000000000.f / wanted);
+    res = mSysfs.write(mpu.gyro_fifo_rate, 1000000000.f / wanted);
     LOGE_IF(res < 0, "HAL:sampling frequency update delay error");
             
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
             1000000000.f / gyroRate, mpu.gyro_rate,
             getTimestamp());
-    tempFd = open(mpu.gyro_rate, O_RDWR);
-    res = write_attribute_sensor(tempFd, 1000000000.f / gyroRate);
+    res = mSysfs.write(mpu.gyro_rate, 1000000000.f / gyroRate);
     if(res < 0) {
         LOGE("HAL:GYRO update delay error");
     }
@@ -6360,8 +6776,7 @@ int MPLSensor::resetDataRates()
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %.0f > %s (%lld)",
             1000000000.f / accelRate, mpu.accel_rate,
             getTimestamp());
-    tempFd = open(mpu.accel_rate, O_RDWR);
-    res = write_attribute_sensor(tempFd, 1000000000.f / accelRate);
+    res = mSysfs.write(mpu.accel_rate, 1000000000.f / accelRate);
     LOGE_IF(res < 0, "HAL:ACCEL update delay error");
    
     if (compassRate < mCompassSensor->getMinDelay() * 1000LL) {
@@ -6437,6 +6852,26 @@ void MPLSensor::sys_dump(bool fileMode)
     read_sysfs_dir(fileMode, sysfs_path);
     read_sysfs_dir(fileMode, scan_element_path);
 
+    SysfsAttrCache::Stats stats;
+    mSysfs.getStats(&stats);
+    LOGI("HAL DEBUG:sysfs writes=%lu suppressed=%lu coalesced=%lu "
+         "reads=%lu opens=%lu",
+         stats.writes, stats.suppressed, stats.coalesced,
+         stats.reads, stats.opens);
+
+    LOGI("HAL DEBUG:reconfig windows=%lu max=%lld ns master_enable "
+         "calls=%lu writes=%lu",
+         mReconfigCount, mReconfigMaxTime,
+         mMasterEnableCalls, mMasterEnableWrites);
+    LOGI("HAL DEBUG:temperature reads=%lu max=%lld ns",
+         mTempReadCount, mTempReadMaxTime);
+    for (int i = 0; i < NumSensors; i++) {
+        if (!mActivationMaxLatency[i])
+            continue;
+        LOGI("HAL DEBUG:sensor %d activation last=%lld max=%lld ns",
+             i, mActivationLatency[i], mActivationMaxLatency[i]);
+    }
+
     dump_dmp_img("/data/local/read_img.h");
     return;
 }
@@ -29,6 +29,9 @@
 #include "sensors.h"
 #include "SensorBase.h"
 #include "InputEventReader.h"
+#include "FifoPacketDecoder.h"
+#include "SysfsAttrCache.h"
+#include "FlushTracker.h"
 
 #ifndef INVENSENSE_COMPASS_CAL
 #pragma message("unified HAL for AKM")
@@ -107,23 +110,6 @@ class PressureSensor;
         | (INV_DMP_PEDOMETER_STEP)                   \
         | (INV_DMP_6AXIS_QUATERNION)                 \
 )
-// data header format used by kernel driver.
-#define DATA_FORMAT_STEP           0x0001
-#define DATA_FORMAT_MARKER         0x0010
-#define DATA_FORMAT_PED_STANDALONE 0x0100
-#define DATA_FORMAT_PED_QUAT       0x0200
-#define DATA_FORMAT_6_AXIS         0x0400
-#define DATA_FORMAT_QUAT           0x0800
-#define DATA_FORMAT_COMPASS        0x1000
-#define DATA_FORMAT_GYRO           0x2000
-#define DATA_FORMAT_ACCEL          0x4000
-#define DATA_FORMAT_PRESSURE       0x8000
-#define DATA_FORMAT_MASK           0xffff
-
-#define BYTES_PER_SENSOR                8
-#define BYTES_PER_SENSOR_PACKET         16
-#define QUAT_ONLY_LAST_PACKET_OFFSET    16
-#define BYTES_QUAT_DATA                 24
 #define MAX_SUSPEND_BATCH_PACKET_SIZE   1024
 #define MAX_PACKET_SIZE                 80 //8 * 4 + (2 * 24)
 
@@ -202,6 +188,7 @@ public:
     virtual int enable(int32_t handle, int enabled);
     virtual int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
     virtual int flush(int handle);
+    int flushFifo(int *res);
     int checkBatchEnabled();
     int setBatch(int en, int toggleEnable);
     int32_t getEnableMask() { return mEnabled; }
@@ -248,6 +235,10 @@ public:
     int enableDmpPedometer(int, int);
     int readDmpPedometerEvents(sensors_event_t* data, int count, int32_t id, int32_t type, int outputType);
     int getDmpPedometerFd();
+    int getStepCountTimerFd() { return mStepCountTimerFd; };
+    int readStepCountEvents(sensors_event_t* data, int count);
+    int getTempTimerFd() { return mTempTimerFd; };
+    int readTemperatureEvents(void);
     bool checkPedometerSupport() {return (mDmpPedometerEnabled || mDmpStepCountEnabled);};
     bool checkOrientationSupport() {return ((isDmpDisplayOrientationOn()
                                        && (mDmpOrientationEnabled
@@ -282,6 +273,11 @@ protected:
     int setGyroInitialState();
     int setAccelInitialState();
     int masterEnable(int en);
+    int writeMasterEnable(int en);
+    bool inReconfig() const;
+    void beginReconfig();
+    int endReconfig();
+    void recordActivation(int what);
     int enablePedStandalone(int en);
     int enablePedStandaloneData(int en);
     int enablePedQuaternion(int);
@@ -310,6 +306,12 @@ protected:
     int inv_float_to_round2(float *fdata, short *sdata);
     int inv_long_to_float(long *ldata, float *fdata);
     int inv_read_temperature(long long *data);
+    void updateTemperature(void);
+    bool isStepCountEventDriven();
+    void notifyStepCount(void);
+    void armStepCountTimer(int64_t delay);
+    void disarmStepCountTimer(void);
+    int readStepCount(sensors_event_t *event);
     int inv_read_dmp_state(int fd);
     int inv_read_sensor_bias(int fd, long *data);
     void inv_get_sensors_orientation(void);
@@ -344,6 +346,33 @@ protected:
     int mSampleCount;
     pthread_mutex_t mMplMutex;
     pthread_mutex_t mHALMutex;
+    SysfsAttrCache mSysfs;
+
+    /* enable(), setDelay() and batch() reprogram the chip in a single
+       master disable window, see beginReconfig() */
+    class ReconfigScope {
+    public:
+        ReconfigScope(MPLSensor *sensor) : mSensor(sensor) { mSensor->beginReconfig(); }
+        ~ReconfigScope() { mSensor->endReconfig(); }
+    private:
+        MPLSensor *mSensor;
+    };
+    int mReconfigDepth;
+    pthread_t mReconfigThread;
+    bool mReconfigMasterTouched;
+    bool mReconfigMasterOff;
+    bool mReconfigMasterOn;
+    bool mReconfigDelayDirty;
+    bool mReconfigApplying;
+    int64_t mReconfigStart;
+    unsigned long mReconfigCount;
+    unsigned long mMasterEnableCalls;
+    unsigned long mMasterEnableWrites;
+    /* chip left off or system suspended since the last master enable,
+       see writeMasterEnable() */
+    bool mChipIdle;
+    int64_t mSuspendTime;
+    int64_t mReconfigMaxTime;
 
     char mIIOBuffer[(16 + 8 * 3 + 8) * IIO_BUFFER_LENGTH];
 
@@ -376,10 +405,14 @@ protected:
     int dmp_pedometer_fd;
     int mDmpPedometerEnabled;
     int mDmpStepCountEnabled;
+    int mStepCountTimerFd;      // fires when the step count is due
+    bool mStepCountTimerArmed;
 
     uint32_t mEnabled;
     uint32_t mBatchEnabled;
-    int32_t mFlushEnabled;
+    FlushTracker mFlushTracker;     // flushes waiting for the FIFO marker
+    int mFlushCompleteHandle;       // marker being reported
+    int mFlushCompleteCount;        // events still owed for it
     uint32_t mOldBatchEnabledMask;
     int64_t mBatchTimeoutInMs;
     sensors_event_t mPendingEvents[NumSensors];
@@ -387,6 +420,10 @@ protected:
     int64_t mBatchDelays[NumSensors];
     int64_t mBatchTimeouts[NumSensors];
     hfunc_t mHandlers[NumSensors];
+    /* enable() call to first event delivered */
+    int64_t mActivationStart[NumSensors];
+    int64_t mActivationLatency[NumSensors];
+    int64_t mActivationMaxLatency[NumSensors];
     short mCachedGyroData[3];
     long mCachedAccelData[3];
     long mCachedCompassData[3];
@@ -403,6 +440,11 @@ protected:
     short mTempScale;
     short mTempOffset;
     int64_t mTempCurrentTime;
+    int mTempTimerFd;                   // fires when a temperature read is due
+    long long mCachedTemperature[2];    // value, driver timestamp
+    bool mTempPending;                  // not passed to inv_build_temp() yet
+    unsigned long mTempReadCount;
+    int64_t mTempReadMaxTime;
     int mAccelScale;
     long mAccelSelfTestScale;
     long mGyroScale;
@@ -534,7 +576,7 @@ protected:
     char mLeftOverBuffer[24];
     bool mInitial6QuatValueAvailable;
     long mInitial6QuatValue[4];
-    bool mFlushBatchSet;
+    int mFlushBatchSet;             // markers not reported yet
     uint32_t mSkipReadEvents;
 
 private:
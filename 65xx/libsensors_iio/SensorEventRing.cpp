@@ -0,0 +1,77 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <string.h>
+
+#include "SensorEventRing.h"
+
+SensorEventRing::SensorEventRing()
+    : mHead(0),
+      mTail(0)
+{
+}
+
+int SensorEventRing::beginWrite(sensors_event_t **events)
+{
+    uint32_t head = __atomic_load_n(&mHead, __ATOMIC_ACQUIRE);
+    uint32_t pos = mTail & (CAPACITY - 1);
+    uint32_t space = CAPACITY - (mTail - head);
+
+    /* contiguous slots only, the rest is handed out on the next call */
+    if (space > CAPACITY - pos)
+        space = CAPACITY - pos;
+    *events = &mEvents[pos];
+    return space;
+}
+
+void SensorEventRing::endWrite(int count)
+{
+    __atomic_store_n(&mTail, mTail + count, __ATOMIC_RELEASE);
+}
+
+int SensorEventRing::read(sensors_event_t *events, int count)
+{
+    uint32_t tail = __atomic_load_n(&mTail, __ATOMIC_ACQUIRE);
+    uint32_t head = mHead;
+    uint32_t avail = tail - head;
+    uint32_t pos, chunk;
+
+    if ((uint32_t)count > avail)
+        count = avail;
+    pos = head & (CAPACITY - 1);
+    chunk = CAPACITY - pos;
+    if ((uint32_t)count <= chunk) {
+        memcpy(events, &mEvents[pos], count * sizeof(mEvents[0]));
+    } else {
+        memcpy(events, &mEvents[pos], chunk * sizeof(mEvents[0]));
+        memcpy(events + chunk, &mEvents[0],
+               (count - chunk) * sizeof(mEvents[0]));
+    }
+    __atomic_store_n(&mHead, head + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+bool SensorEventRing::empty() const
+{
+    return __atomic_load_n(&mTail, __ATOMIC_ACQUIRE) ==
+           __atomic_load_n(&mHead, __ATOMIC_ACQUIRE);
+}
+
+bool SensorEventRing::full() const
+{
+    return __atomic_load_n(&mTail, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&mHead, __ATOMIC_ACQUIRE) == CAPACITY;
+}
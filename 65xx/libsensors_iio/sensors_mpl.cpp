@@ -23,15 +23,20 @@
 #include <math.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 
+#include <sys/eventfd.h>
+
 #include <linux/input.h>
 
 #include <cutils/atomic.h>
+#include <cutils/properties.h>
 #include <utils/Log.h>
 
 #include "sensors.h"
 #include "MPLSensor.h"
+#include "SensorEventRing.h"
 
 /* 
  * Vendor-defined Accel Load Calibration File Method 
@@ -96,12 +101,23 @@ struct sensors_poll_context_t {
     int flush(int handle);
 
 private:
+    int pollSensors(int timeout);
+    int readSensorEvents(sensors_event_t *data, int count);
+
+    int startReaderThread(int cpu);
+    static void *readerThread(void *arg);
+    void readerLoop();
+    int readEventRing(sensors_event_t *data, int count);
+    void drainWakePipe();
+
     enum {
         mpl = 0,
         compass,
         dmpOrient,
         dmpSign,
         dmpPed,
+        stepTimer,
+        tempTimer,
         numSensorDrivers,   // wake pipe goes here
         numFds,
     };
@@ -113,6 +129,20 @@ private:
     static const size_t wake = numSensorDrivers;
     static const char WAKE_MESSAGE = 'W';
     int mWritePipeFd;
+    int mNumPollFds;
+
+    /* Reader thread mode: the FIFO is drained and fused on a dedicated
+       thread into mEventRing, pollEvents() only copies events out. The
+       reader also polls the wake pipe, which wakes it up on exit and when
+       pollEvents() has made room in a full ring. */
+    bool mReaderThreadEnabled;
+    pthread_t mReaderThread;
+    int mReaderCpu;
+    bool mReaderExit;
+    SensorEventRing *mEventRing;
+    int mEventRingFd;       // eventfd, ring no longer empty
+    int mPollWaiting;       // pollEvents() waits on mEventRingFd
+    int mReaderBlocked;     // reader waits on the wake pipe for room
 };
 
 /******************************************************************************/
@@ -158,6 +188,14 @@ sensors_poll_context_t::sensors_poll_context_t() {
     mPollFds[dmpPed].events = POLLPRI;
     mPollFds[dmpPed].revents = 0;
 
+    mPollFds[stepTimer].fd = ((MPLSensor*) mSensor)->getStepCountTimerFd();
+    mPollFds[stepTimer].events = POLLIN;
+    mPollFds[stepTimer].revents = 0;
+
+    mPollFds[tempTimer].fd = ((MPLSensor*) mSensor)->getTempTimerFd();
+    mPollFds[tempTimer].events = POLLIN;
+    mPollFds[tempTimer].revents = 0;
+
     /* Timer based sensor initialization */
     int wakeFds[2];
     int result = pipe(wakeFds);
@@ -169,10 +207,35 @@ sensors_poll_context_t::sensors_poll_context_t() {
     mPollFds[numSensorDrivers].fd = wakeFds[0];
     mPollFds[numSensorDrivers].events = POLLIN;
     mPollFds[numSensorDrivers].revents = 0;
+    mNumPollFds = numSensorDrivers;
+
+    mReaderThreadEnabled = false;
+    mReaderExit = false;
+    mEventRing = NULL;
+    mEventRingFd = -1;
+    mPollWaiting = 0;
+    mReaderBlocked = 0;
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("invn.hal.reader.thread", value, "0");
+    if (atoi(value)) {
+        property_get("invn.hal.reader.cpu", value, "-1");
+        startReaderThread(atoi(value));
+    }
 }
 
 sensors_poll_context_t::~sensors_poll_context_t() {
     FUNC_LOG;
+    if (mReaderThreadEnabled) {
+        const char wakeMessage(WAKE_MESSAGE);
+        __atomic_store_n(&mReaderExit, true, __ATOMIC_RELEASE);
+        int result = write(mWritePipeFd, &wakeMessage, 1);
+        LOGE_IF(result < 0,
+                "error sending wake message (%s)", strerror(errno));
+        pthread_join(mReaderThread, NULL);
+        close(mEventRingFd);
+        delete mEventRing;
+    }
     delete mSensor;
     delete mCompassSensor;
     for (int i = 0; i < numSensorDrivers; i++) {
@@ -201,17 +264,149 @@ int sensors_poll_context_t::setDelay(int handle, int64_t ns)
     return mSensor->setDelay(handle, ns);
 }
 
+void sensors_poll_context_t::drainWakePipe()
+{
+    char msg[16];
+
+    while (read(mPollFds[wake].fd, msg, sizeof(msg)) > 0)
+        ;
+    mPollFds[wake].revents = 0;
+}
+
+int sensors_poll_context_t::pollSensors(int timeout)
+{
+    int nb = poll(mPollFds, mNumPollFds, timeout);
+
+    if (nb > 0 && mNumPollFds > (int)wake &&
+            (mPollFds[wake].revents & POLLIN)) {
+        drainWakePipe();
+        nb--;
+    }
+    return nb;
+}
+
+int sensors_poll_context_t::startReaderThread(int cpu)
+{
+    mEventRingFd = eventfd(0, 0);
+    if (mEventRingFd < 0) {
+        LOGE("HAL:ERR can't create reader thread eventfd (%s)",
+             strerror(errno));
+        return -1;
+    }
+    mEventRing = new SensorEventRing();
+    mNumPollFds = numFds;
+    mReaderCpu = cpu;
+
+    mReaderThreadEnabled = true;
+    if (pthread_create(&mReaderThread, NULL, readerThread, this)) {
+        LOGE("HAL:ERR can't start reader thread, reading from pollEvents()");
+        mReaderThreadEnabled = false;
+        mNumPollFds = numSensorDrivers;
+        close(mEventRingFd);
+        mEventRingFd = -1;
+        delete mEventRing;
+        mEventRing = NULL;
+        return -1;
+    }
+    LOGI("HAL:reader thread started, cpu %d", cpu);
+    return 0;
+}
+
+void *sensors_poll_context_t::readerThread(void *arg)
+{
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)arg;
+
+    pthread_setname_np(pthread_self(), "invn_reader");
+    if (ctx->mReaderCpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(ctx->mReaderCpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0)
+            LOGE("HAL:ERR can't pin reader thread to cpu %d (%s)",
+                 ctx->mReaderCpu, strerror(errno));
+    }
+    ctx->readerLoop();
+    return NULL;
+}
+
+void sensors_poll_context_t::readerLoop()
+{
+    sensors_event_t *events;
+    int count, nb;
+
+    while (!__atomic_load_n(&mReaderExit, __ATOMIC_ACQUIRE)) {
+        count = mEventRing->beginWrite(&events);
+        if (count == 0) {
+            /* pollEvents() is behind, leave the data in the kernel FIFO
+               until it makes room */
+            LOGI_IF(SensorBase::ENG_VERBOSE, "HAL:event ring full");
+            __atomic_store_n(&mReaderBlocked, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (mEventRing->full()) {
+                struct pollfd pfd;
+                pfd.fd = mPollFds[wake].fd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                poll(&pfd, 1, -1);
+                drainWakePipe();
+            }
+            __atomic_store_n(&mReaderBlocked, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        nb = readSensorEvents(events, count);
+        if (nb <= 0)
+            continue;
+
+        mEventRing->endWrite(nb);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&mPollWaiting, __ATOMIC_RELAXED))
+            eventfd_write(mEventRingFd, 1);
+    }
+}
+
+int sensors_poll_context_t::readEventRing(sensors_event_t *data, int count)
+{
+    eventfd_t value;
+    int nb;
+
+    while ((nb = mEventRing->read(data, count)) == 0) {
+        __atomic_store_n(&mPollWaiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (mEventRing->empty())
+            eventfd_read(mEventRingFd, &value);
+        __atomic_store_n(&mPollWaiting, 0, __ATOMIC_RELAXED);
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&mReaderBlocked, __ATOMIC_RELAXED)) {
+        const char wakeMessage(WAKE_MESSAGE);
+        int result = write(mWritePipeFd, &wakeMessage, 1);
+        LOGE_IF(result < 0,
+                "error sending wake message (%s)", strerror(errno));
+    }
+    return nb;
+}
+
 int sensors_poll_context_t::pollEvents(sensors_event_t *data, int count)
 {
     VHANDLER_LOG;
 
+    if (mReaderThreadEnabled)
+        return readEventRing(data, count);
+    return readSensorEvents(data, count);
+}
+
+/* drain the FIFO and the DMP event fds into data */
+int sensors_poll_context_t::readSensorEvents(sensors_event_t *data, int count)
+{
     int nbEvents = 0;
     int nb, polltime = -1;
 
     polltime = ((MPLSensor*) mSensor)->getStepCountPollTime();
 
     // look for new events
-    nb = poll(mPollFds, numSensorDrivers, polltime);
+    nb = pollSensors(polltime);
     LOGI_IF(0, "poll nb=%d, count=%d, pt=%d", nb, count, polltime);
     if (nb > 0) {
         for (int i = 0; count && i < numSensorDrivers; i++) {
@@ -248,6 +443,16 @@ int sensors_poll_context_t::pollEvents(sensors_event_t *data, int count)
                     count -= nb;
                     nbEvents += nb;
                     data += nb;
+                } else if (i == stepTimer) {
+                    nb = ((MPLSensor*) mSensor)->readStepCountEvents(
+                            data, count);
+                    mPollFds[i].revents = 0;
+                    count -= nb;
+                    nbEvents += nb;
+                    data += nb;
+                } else if (i == tempTimer) {
+                    ((MPLSensor*) mSensor)->readTemperatureEvents();
+                    mPollFds[i].revents = 0;
                 }
                 #if 1
                 if(nb == 0) {
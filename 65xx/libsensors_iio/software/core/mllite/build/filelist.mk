@@ -18,6 +18,7 @@ HEADERS += $(MLLITE_DIR)/linux/mlos.h
 HEADERS += $(MLLITE_DIR)/linux/ml_stored_data.h
 HEADERS += $(MLLITE_DIR)/linux/ml_load_dmp.h
 HEADERS += $(MLLITE_DIR)/linux/ml_sysfs_helper.h
+HEADERS += $(MLLITE_DIR)/linux/ml_data_recorder.h
 
 # sources
 SOURCES := $(MLLITE_DIR)/data_builder.c
@@ -34,6 +35,7 @@ SOURCES += $(MLLITE_DIR)/linux/mlos_linux.c
 SOURCES += $(MLLITE_DIR)/linux/ml_stored_data.c
 SOURCES += $(MLLITE_DIR)/linux/ml_load_dmp.c
 SOURCES += $(MLLITE_DIR)/linux/ml_sysfs_helper.c
+SOURCES += $(MLLITE_DIR)/linux/ml_data_recorder.c
 
 
 INV_SOURCES += $(SOURCES)
@@ -28,6 +28,9 @@
 #include "results_holder.h"
 
 #include "log.h"
+#ifdef INV_PLAYBACK_DBG
+#include "ml_data_recorder.h"
+#endif
 #undef MPL_LOG_TAG
 #define MPL_LOG_TAG "MLLITE"
 
@@ -46,6 +49,9 @@ struct inv_data_builder_t {
     struct inv_db_save_mpl_t save_mpl;
     struct inv_db_save_accel_mpl_t save_accel_mpl;
     int compass_disturbance;
+    struct inv_sensor_transform_t gyro_transform;
+    struct inv_sensor_transform_t accel_transform;
+    struct inv_sensor_transform_t compass_transform;
 #ifdef INV_PLAYBACK_DBG
     int debug_mode;
     int last_mode;
@@ -53,7 +59,6 @@ struct inv_data_builder_t {
 #endif
 };
 
-void inv_apply_calibration(struct inv_single_sensor_t *sensor, const long *bias);
 static void inv_set_contiguous(void);
 
 static struct inv_data_builder_t inv_data_builder;
@@ -66,6 +71,25 @@ static struct inv_sensor_cal_t sensors;
 */
 void inv_turn_on_data_logging(FILE *file)
 {
+    struct inv_rec_config_t config;
+    struct inv_single_sensor_t *sensor[INV_REC_QUAT] = {
+        &sensors.gyro, &sensors.accel, &sensors.compass
+    };
+    int ii;
+
+    /* settings done before logging started are kept in the header */
+    memset(&config, 0, sizeof(config));
+    for (ii = 0; ii < INV_REC_QUAT; ii++) {
+        config.orientation[ii] = sensor[ii]->orientation;
+        config.sensitivity[ii] = sensor[ii]->sensitivity;
+        config.sample_rate_us[ii] = sensor[ii]->sample_rate_us;
+    }
+    config.sample_rate_us[INV_REC_QUAT] = sensors.quat.sample_rate_us;
+
+    if (inv_rec_start(file, &config)) {
+        MPL_LOGE("input data logging failed to start\n");
+        return;
+    }
     MPL_LOGV("input data logging started\n");
     inv_data_builder.file = file;
     inv_data_builder.debug_mode = RD_RECORD;
@@ -78,6 +102,7 @@ void inv_turn_off_data_logging()
 {
     MPL_LOGV("input data logging stopped\n");
     inv_data_builder.debug_mode = RD_NO_DEBUG;
+    inv_rec_stop();
     inv_data_builder.file = NULL;
 }
 #endif
@@ -199,11 +224,13 @@ long inv_get_compass_sensitivity(void)
 
 /** Sets orientation and sensitivity field for a sensor.
 * @param[out] sensor Structure to apply settings to
+* @param[out] transform Per sample transform built from the settings
 * @param[in] orientation Orientation description of how part is mounted.
 * @param[in] sensitivity A Scale factor to convert from hardware units to
 *            standard units (dps, uT, g).
 */
 void set_sensor_orientation_and_scale(struct inv_single_sensor_t *sensor,
+                                 struct inv_sensor_transform_t *transform,
                                  int orientation, long sensitivity)
 {
     int error = 0;
@@ -230,6 +257,28 @@ void set_sensor_orientation_and_scale(struct inv_single_sensor_t *sensor,
         MPL_LOGE("\n\nCritical error! Impossible mounting orientation given. Using Identity instead\n\n");
     }
     sensor->orientation = orientation;
+    inv_init_sensor_transform(transform, orientation, sensitivity);
+}
+
+/** Builds the transform inv_apply_calibration() uses from an orientation
+* and sensitivity. It gives the same results as
+* inv_convert_to_body_with_scale() with the sensitivity scaled by 2.
+* @param[out] transform Transform to fill in
+* @param[in] orientation Orientation description of how part is mounted.
+* @param[in] sensitivity A Scale factor to convert from hardware units to
+*            standard units (dps, uT, g).
+*/
+void inv_init_sensor_transform(struct inv_sensor_transform_t *transform,
+                               int orientation, long sensitivity)
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        transform->axis[i] = (orientation >> (3 * i)) & 0x03;
+        transform->scale[i] = sensitivity << 1;
+        if (orientation & (0x004 << (3 * i)))
+            transform->scale[i] = -transform->scale[i];
+    }
 }
 
 /** Sets the Orientation and Sensitivity of the gyro data.
@@ -245,14 +294,13 @@ void inv_set_gyro_orientation_and_scale(int orientation, long sensitivity)
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_G_ORIENT;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
-        fwrite(&orientation, sizeof(orientation), 1, inv_data_builder.file);
-        fwrite(&sensitivity, sizeof(sensitivity), 1, inv_data_builder.file);
+        long data[2] = {orientation, sensitivity};
+        inv_rec_put(PLAYBACK_DBG_TYPE_G_ORIENT, data, 2, 0);
     }
 #endif
-    set_sensor_orientation_and_scale(&sensors.gyro, orientation,
-                                     sensitivity);
+    set_sensor_orientation_and_scale(&sensors.gyro,
+                                     &inv_data_builder.gyro_transform,
+                                     orientation, sensitivity);
 }
 
 /** Set Gyro Sample rate in micro seconds.
@@ -262,9 +310,7 @@ void inv_set_gyro_sample_rate(long sample_rate_us)
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_G_SAMPLE_RATE;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
-        fwrite(&sample_rate_us, sizeof(sample_rate_us), 1, inv_data_builder.file);
+        inv_rec_put(PLAYBACK_DBG_TYPE_G_SAMPLE_RATE, &sample_rate_us, 1, 0);
     }
 #endif
     sensors.gyro.sample_rate_us = sample_rate_us;
@@ -281,9 +327,7 @@ void inv_set_accel_sample_rate(long sample_rate_us)
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_A_SAMPLE_RATE;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
-        fwrite(&sample_rate_us, sizeof(sample_rate_us), 1, inv_data_builder.file);
+        inv_rec_put(PLAYBACK_DBG_TYPE_A_SAMPLE_RATE, &sample_rate_us, 1, 0);
     }
 #endif
     sensors.accel.sample_rate_us = sample_rate_us;
@@ -300,9 +344,7 @@ void inv_set_compass_sample_rate(long sample_rate_us)
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_C_SAMPLE_RATE;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
-        fwrite(&sample_rate_us, sizeof(sample_rate_us), 1, inv_data_builder.file);
+        inv_rec_put(PLAYBACK_DBG_TYPE_C_SAMPLE_RATE, &sample_rate_us, 1, 0);
     }
 #endif
     sensors.compass.sample_rate_us = sample_rate_us;
@@ -334,9 +376,7 @@ void inv_set_quat_sample_rate(long sample_rate_us)
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_Q_SAMPLE_RATE;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
-        fwrite(&sample_rate_us, sizeof(sample_rate_us), 1, inv_data_builder.file);
+        inv_rec_put(PLAYBACK_DBG_TYPE_Q_SAMPLE_RATE, &sample_rate_us, 1, 0);
     }
 #endif
     sensors.quat.sample_rate_us = sample_rate_us;
@@ -438,14 +478,13 @@ void inv_set_accel_orientation_and_scale(int orientation, long sensitivity)
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_A_ORIENT;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
-        fwrite(&orientation, sizeof(orientation), 1, inv_data_builder.file);
-        fwrite(&sensitivity, sizeof(sensitivity), 1, inv_data_builder.file);
+        long data[2] = {orientation, sensitivity};
+        inv_rec_put(PLAYBACK_DBG_TYPE_A_ORIENT, data, 2, 0);
     }
 #endif
-    set_sensor_orientation_and_scale(&sensors.accel, orientation,
-                                     sensitivity);
+    set_sensor_orientation_and_scale(&sensors.accel,
+                                     &inv_data_builder.accel_transform,
+                                     orientation, sensitivity);
 }
 
 /** Sets the Orientation and Sensitivity of the gyro data.
@@ -461,13 +500,13 @@ void inv_set_compass_orientation_and_scale(int orientation, long sensitivity)
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_C_ORIENT;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
-        fwrite(&orientation, sizeof(orientation), 1, inv_data_builder.file);
-        fwrite(&sensitivity, sizeof(sensitivity), 1, inv_data_builder.file);
+        long data[2] = {orientation, sensitivity};
+        inv_rec_put(PLAYBACK_DBG_TYPE_C_ORIENT, data, 2, 0);
     }
 #endif
-    set_sensor_orientation_and_scale(&sensors.compass, orientation, sensitivity);
+    set_sensor_orientation_and_scale(&sensors.compass,
+                                     &inv_data_builder.compass_transform,
+                                     orientation, sensitivity);
 }
 
 void inv_matrix_vector_mult(const long *A, const long *x, long *y)
@@ -480,25 +519,26 @@ void inv_matrix_vector_mult(const long *A, const long *x, long *y)
 /** Takes raw data stored in the sensor, removes bias, and converts it to
 * calibrated data in the body frame. Also store raw data for body frame.
 * @param[in,out] sensor structure to modify
+* @param[in] transform orientation and sensitivity of the sensor, from
+*                      inv_init_sensor_transform()
 * @param[in] bias bias in the mounting frame, in hardware units scaled by
 *                 2^16. Length 3.
 */
-void inv_apply_calibration(struct inv_single_sensor_t *sensor, const long *bias)
+void inv_apply_calibration(struct inv_single_sensor_t *sensor,
+                           const struct inv_sensor_transform_t *transform,
+                           const long *bias)
 {
-    long raw32[3];
-
-    // Convert raw to calibrated
-    raw32[0] = (long)sensor->raw[0] << 15;
-    raw32[1] = (long)sensor->raw[1] << 15;
-    raw32[2] = (long)sensor->raw[2] << 15;
-
-    inv_convert_to_body_with_scale(sensor->orientation, sensor->sensitivity << 1, raw32, sensor->raw_scaled);
+    long raw32;
+    int i, axis;
 
-    raw32[0] -= bias[0] >> 1;
-    raw32[1] -= bias[1] >> 1;
-    raw32[2] -= bias[2] >> 1;
-
-    inv_convert_to_body_with_scale(sensor->orientation, sensor->sensitivity << 1, raw32, sensor->calibrated);
+    // Convert raw to calibrated, one body axis at a time
+    for (i = 0; i < 3; i++) {
+        axis = transform->axis[i];
+        raw32 = (long)sensor->raw[axis] << 15;
+        sensor->raw_scaled[i] = inv_q30_mult(raw32, transform->scale[i]);
+        sensor->calibrated[i] = inv_q30_mult(raw32 - (bias[axis] >> 1),
+                                             transform->scale[i]);
+    }
 
     sensor->status |= INV_CALIBRATED;
 }
@@ -522,7 +562,8 @@ void inv_set_compass_bias(const long *bias, int accuracy)
 {
     if (memcmp(inv_data_builder.save.compass_bias, bias, sizeof(inv_data_builder.save.compass_bias))) {
         memcpy(inv_data_builder.save.compass_bias, bias, sizeof(inv_data_builder.save.compass_bias));
-        inv_apply_calibration(&sensors.compass, inv_data_builder.save.compass_bias);
+        inv_apply_calibration(&sensors.compass, &inv_data_builder.compass_transform,
+                              inv_data_builder.save.compass_bias);
     }
     sensors.compass.accuracy = accuracy;
     inv_data_builder.save.compass_accuracy = accuracy;
@@ -587,7 +628,8 @@ void inv_set_accel_bias_mask(const long *bias, int accuracy, int mask)
             inv_data_builder.save_accel_mpl.accel_bias[2] = bias[2];
         }
 
-        inv_apply_calibration(&sensors.accel, inv_data_builder.save_accel_mpl.accel_bias);
+        inv_apply_calibration(&sensors.accel, &inv_data_builder.accel_transform,
+                              inv_data_builder.save_accel_mpl.accel_bias);
     }
     inv_set_accel_accuracy(accuracy);
     inv_set_message(INV_MSG_NEW_AB_EVENT, INV_MSG_NEW_AB_EVENT, 0);
@@ -628,6 +670,7 @@ void inv_set_mpl_gyro_bias(const long *bias, int accuracy)
             memcpy(inv_data_builder.save_mpl.gyro_bias, bias, 
                    sizeof(inv_data_builder.save_mpl.gyro_bias));
             inv_apply_calibration(&sensors.gyro,
+                                  &inv_data_builder.gyro_transform,
                                   inv_data_builder.save_mpl.gyro_bias);
         }
     }
@@ -782,10 +825,7 @@ inv_error_t inv_build_accel(const long *accel, int status, inv_time_t timestamp)
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_ACCEL;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
-        fwrite(accel, sizeof(accel[0]), 3, inv_data_builder.file);
-        fwrite(&timestamp, sizeof(timestamp), 1, inv_data_builder.file);
+        inv_rec_put(PLAYBACK_DBG_TYPE_ACCEL, accel, 3, timestamp);
     }
 #endif
 
@@ -794,7 +834,8 @@ inv_error_t inv_build_accel(const long *accel, int status, inv_time_t timestamp)
         sensors.accel.raw[1] = (short)accel[1];
         sensors.accel.raw[2] = (short)accel[2];
         sensors.accel.status |= INV_RAW_DATA;
-        inv_apply_calibration(&sensors.accel, inv_data_builder.save_accel_mpl.accel_bias);
+        inv_apply_calibration(&sensors.accel, &inv_data_builder.accel_transform,
+                              inv_data_builder.save_accel_mpl.accel_bias);
     } else {
         sensors.accel.calibrated[0] = accel[0];
         sensors.accel.calibrated[1] = accel[1];
@@ -821,10 +862,8 @@ inv_error_t inv_build_gyro(const short *gyro, inv_time_t timestamp)
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_GYRO;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
-        fwrite(gyro, sizeof(gyro[0]), 3, inv_data_builder.file);
-        fwrite(&timestamp, sizeof(timestamp), 1, inv_data_builder.file);
+        long data[3] = {gyro[0], gyro[1], gyro[2]};
+        inv_rec_put(PLAYBACK_DBG_TYPE_GYRO, data, 3, timestamp);
     }
 #endif
 
@@ -832,7 +871,8 @@ inv_error_t inv_build_gyro(const short *gyro, inv_time_t timestamp)
     sensors.gyro.status |= INV_NEW_DATA | INV_RAW_DATA | INV_SENSOR_ON;
     sensors.gyro.timestamp_prev = sensors.gyro.timestamp;
     sensors.gyro.timestamp = timestamp;
-    inv_apply_calibration(&sensors.gyro, inv_data_builder.save_mpl.gyro_bias);
+    inv_apply_calibration(&sensors.gyro, &inv_data_builder.gyro_transform,
+                          inv_data_builder.save_mpl.gyro_bias);
 
     return INV_SUCCESS;
 }
@@ -853,10 +893,7 @@ inv_error_t inv_build_compass(const long *compass, int status,
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_COMPASS;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
-        fwrite(compass, sizeof(compass[0]), 3, inv_data_builder.file);
-        fwrite(&timestamp, sizeof(timestamp), 1, inv_data_builder.file);
+        inv_rec_put(PLAYBACK_DBG_TYPE_COMPASS, compass, 3, timestamp);
     }
 #endif
 
@@ -867,7 +904,8 @@ inv_error_t inv_build_compass(const long *compass, int status,
         sensors.compass.raw[0] = (short)data[0];
         sensors.compass.raw[1] = (short)data[1];
         sensors.compass.raw[2] = (short)data[2];
-        inv_apply_calibration(&sensors.compass, inv_data_builder.save.compass_bias);
+        inv_apply_calibration(&sensors.compass, &inv_data_builder.compass_transform,
+                              inv_data_builder.save.compass_bias);
         sensors.compass.status |= INV_RAW_DATA;
     } else {
         sensors.compass.calibrated[0] = compass[0];
@@ -894,10 +932,7 @@ inv_error_t inv_build_temp(const long temp, inv_time_t timestamp)
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_TEMPERATURE;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
-        fwrite(&temp, sizeof(temp), 1, inv_data_builder.file);
-        fwrite(&timestamp, sizeof(timestamp), 1, inv_data_builder.file);
+        inv_rec_put(PLAYBACK_DBG_TYPE_TEMPERATURE, &temp, 1, timestamp);
     }
 #endif
     sensors.temp.calibrated[0] = temp;
@@ -925,10 +960,7 @@ inv_error_t inv_build_quat(const long *quat, int status, inv_time_t timestamp)
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_QUAT;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
-        fwrite(quat, sizeof(quat[0]), 4, inv_data_builder.file);
-        fwrite(&timestamp, sizeof(timestamp), 1, inv_data_builder.file);
+        inv_rec_put(PLAYBACK_DBG_TYPE_QUAT, quat, 4, timestamp);
     }
 #endif
 
@@ -974,8 +1006,7 @@ void inv_accel_was_turned_off()
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_COMPASS_OFF;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
+        inv_rec_put(PLAYBACK_DBG_TYPE_ACCEL_OFF, NULL, 0, 0);
     }
 #endif
     sensors.accel.status = 0;
@@ -988,8 +1019,7 @@ void inv_compass_was_turned_off()
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_COMPASS_OFF;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
+        inv_rec_put(PLAYBACK_DBG_TYPE_COMPASS_OFF, NULL, 0, 0);
     }
 #endif
     sensors.compass.status = 0;
@@ -1002,8 +1032,7 @@ void inv_quaternion_sensor_was_turned_off(void)
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_QUAT_OFF;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
+        inv_rec_put(PLAYBACK_DBG_TYPE_QUAT_OFF, NULL, 0, 0);
     }
 #endif
     sensors.quat.status = 0;
@@ -1016,8 +1045,7 @@ void inv_gyro_was_turned_off()
 {
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_GYRO_OFF;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
+        inv_rec_put(PLAYBACK_DBG_TYPE_GYRO_OFF, NULL, 0, 0);
     }
 #endif
     sensors.gyro.status = 0;
@@ -1133,8 +1161,7 @@ inv_error_t inv_execute_on_data(void)
 
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
-        int type = PLAYBACK_DBG_TYPE_EXECUTE;
-        fwrite(&type, sizeof(type), 1, inv_data_builder.file);
+        inv_rec_put(PLAYBACK_DBG_TYPE_EXECUTE, NULL, 0, 0);
     }
 #endif
     // Determine what new data we have
@@ -138,6 +138,16 @@ struct inv_sensor_cal_t {
     int status;
 };
 
+/** Orientation and sensitivity of a sensor folded into one step, built when
+* they are set so the per sample path does not decode the orientation.
+* Body axis i comes from mounting axis axis[i] times scale[i], which is
+* the sensitivity scaled by 2 with the sign of the axis.
+*/
+struct inv_sensor_transform_t {
+    int axis[3];
+    long scale[3];
+};
+
 // Useful for debug record and playback
 typedef enum {
     RD_NO_DEBUG,
@@ -219,6 +229,12 @@ void inv_set_accel_orientation_and_scale(int orientation,
         long sensitivity);
 void inv_set_compass_orientation_and_scale(int orientation,
         long sensitivity);
+void inv_init_sensor_transform(struct inv_sensor_transform_t *transform,
+                               int orientation, long sensitivity);
+void inv_apply_calibration(struct inv_single_sensor_t *sensor,
+                           const struct inv_sensor_transform_t *transform,
+                           const long *bias);
+
 void inv_set_gyro_sample_rate(long sample_rate_us);
 void inv_set_compass_sample_rate(long sample_rate_us);
 void inv_set_quat_sample_rate(long sample_rate_us);
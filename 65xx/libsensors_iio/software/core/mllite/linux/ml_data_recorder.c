@@ -0,0 +1,730 @@
+/*
+ $License:
+    Copyright (C) 2011 InvenSense Corporation, All Rights Reserved.
+ $
+ */
+
+/******************************************************************************
+ *
+ * $Id:$
+ *
+ *****************************************************************************/
+
+/**
+ * @defgroup ML_DATA_RECORDER
+ *
+ * @{
+ *      @file     ml_data_recorder.c
+ *      @brief    Recording of the MPL input data for playback.
+ *
+ *      Records are queued by the thread building the data in a lock-free
+ *      ring buffer and a background thread encodes and writes them, so
+ *      recording never blocks on file I/O. When the ring buffer is full
+ *      records are dropped and counted instead.
+ *
+ *      Records are grouped in fixed size blocks. Timestamps are stored as
+ *      the difference to the previous record of the block and sensor values
+ *      as the difference to the previous sample of the same sensor, both as
+ *      zigzag varints. The delta state starts over on every block so each
+ *      block decodes on its own and the block index at the end of the
+ *      recording allows seeking by timestamp.
+ */
+
+#undef MPL_LOG_NDEBUG
+#define MPL_LOG_NDEBUG 1 /* Use 0 to turn on MPL_LOGV output */
+#undef MPL_LOG_TAG
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "log.h"
+#undef MPL_LOG_TAG
+#define MPL_LOG_TAG "MPL-recorder"
+
+#include "ml_data_recorder.h"
+#include "mlmath.h"
+
+/*
+    Defines
+*/
+#define REC_RING_MASK           (INV_REC_RING_SIZE - 1)
+/* type byte, timestamp and 4 values as 10 byte varints */
+#define REC_MAX_RECORD_SIZE     (1 + 5 * 10)
+#define REC_NUM_TYPES           (PLAYBACK_DBG_TYPE_QUAT_OFF + 1)
+/* flush thread wakes up at least this often */
+#define REC_FLUSH_PERIOD_MS     (20)
+
+/*
+    Types
+*/
+struct rec_slot_t {
+    unsigned int seq;
+    struct inv_rec_sample_t sample;
+};
+
+struct rec_writer_t {
+    FILE *file;
+    pthread_t thread;
+    sem_t wake;
+    int stop;
+
+    /* bounded queue, any thread may put, the flush thread gets */
+    struct rec_slot_t ring[INV_REC_RING_SIZE];
+    unsigned int head;
+    unsigned int tail;
+    int wake_pending;
+    unsigned long dropped;
+
+    /* used by the flush thread only */
+    unsigned char block[INV_REC_BLOCK_SIZE];
+    size_t used;
+    int has_timestamp;
+    inv_time_t block_timestamp;
+    inv_time_t last_timestamp;
+    long long last_data[REC_NUM_TYPES][4];
+    struct inv_rec_index_entry_t *index;
+    uint32_t num_blocks;
+    uint32_t index_size;
+    inv_error_t error;
+};
+
+/*
+    Globals
+*/
+static struct rec_writer_t *rec_writer;
+
+/*
+    Record encoding
+*/
+static int rec_num_values(int type)
+{
+    switch (type) {
+    case PLAYBACK_DBG_TYPE_GYRO:
+    case PLAYBACK_DBG_TYPE_ACCEL:
+    case PLAYBACK_DBG_TYPE_COMPASS:
+        return 3;
+    case PLAYBACK_DBG_TYPE_QUAT:
+        return 4;
+    case PLAYBACK_DBG_TYPE_TEMPERATURE:
+    case PLAYBACK_DBG_TYPE_A_SAMPLE_RATE:
+    case PLAYBACK_DBG_TYPE_C_SAMPLE_RATE:
+    case PLAYBACK_DBG_TYPE_G_SAMPLE_RATE:
+    case PLAYBACK_DBG_TYPE_Q_SAMPLE_RATE:
+        return 1;
+    case PLAYBACK_DBG_TYPE_A_ORIENT:
+    case PLAYBACK_DBG_TYPE_G_ORIENT:
+    case PLAYBACK_DBG_TYPE_C_ORIENT:
+        return 2;
+    case PLAYBACK_DBG_TYPE_EXECUTE:
+    case PLAYBACK_DBG_TYPE_GYRO_OFF:
+    case PLAYBACK_DBG_TYPE_ACCEL_OFF:
+    case PLAYBACK_DBG_TYPE_COMPASS_OFF:
+    case PLAYBACK_DBG_TYPE_QUAT_OFF:
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/* sensor samples carry a timestamp and are delta coded */
+static int rec_is_sample(int type)
+{
+    return type == PLAYBACK_DBG_TYPE_GYRO ||
+           type == PLAYBACK_DBG_TYPE_ACCEL ||
+           type == PLAYBACK_DBG_TYPE_COMPASS ||
+           type == PLAYBACK_DBG_TYPE_TEMPERATURE ||
+           type == PLAYBACK_DBG_TYPE_QUAT;
+}
+
+static size_t rec_put_varint(unsigned char *p, long long value)
+{
+    uint64_t v = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    size_t len = 0;
+
+    while (v >= 0x80) {
+        p[len++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[len++] = (unsigned char)v;
+    return len;
+}
+
+static int rec_get_varint(const unsigned char **pos, const unsigned char *end,
+                          long long *value)
+{
+    const unsigned char *p = *pos;
+    uint64_t v = 0;
+    int shift = 0;
+
+    while (p < end && shift < 64) {
+        v |= (uint64_t)(*p & 0x7f) << shift;
+        if (!(*p++ & 0x80)) {
+            *pos = p;
+            *value = (long long)(v >> 1) ^ -(long long)(v & 1);
+            return 0;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+/*
+    Writer, flush thread side
+*/
+static void rec_reset_block(struct rec_writer_t *w)
+{
+    memset(w->block, 0, sizeof(w->block));
+    w->used = sizeof(struct inv_rec_block_t);
+    w->has_timestamp = 0;
+    w->last_timestamp = 0;
+    memset(w->last_data, 0, sizeof(w->last_data));
+}
+
+static void rec_flush_block(struct rec_writer_t *w)
+{
+    struct inv_rec_block_t *bh = (struct inv_rec_block_t *)w->block;
+    struct inv_rec_index_entry_t *entry;
+
+    if (bh->num_records == 0)
+        return;
+
+    bh->magic = INV_REC_BLOCK_MAGIC;
+    bh->size = w->used - sizeof(*bh);
+    if (!w->has_timestamp) {
+        bh->first_timestamp = w->block_timestamp;
+        bh->last_timestamp = w->block_timestamp;
+    }
+
+    if (w->num_blocks == w->index_size) {
+        uint32_t size = w->index_size ? 2 * w->index_size : 64;
+        entry = (struct inv_rec_index_entry_t *)
+                realloc(w->index, size * sizeof(*entry));
+        if (entry == NULL) {
+            w->error = INV_ERROR_MEMORY_EXAUSTED;
+            rec_reset_block(w);
+            return;
+        }
+        w->index = entry;
+        w->index_size = size;
+    }
+
+    if (fwrite(w->block, sizeof(w->block), 1, w->file) != 1) {
+        MPL_LOGE("cannot write recording block: %s\n", strerror(errno));
+        w->error = INV_ERROR_FILE_WRITE;
+    } else {
+        entry = &w->index[w->num_blocks++];
+        entry->first_timestamp = bh->first_timestamp;
+        entry->last_timestamp = bh->last_timestamp;
+    }
+    rec_reset_block(w);
+}
+
+static void rec_encode(struct rec_writer_t *w, const struct inv_rec_sample_t *s)
+{
+    struct inv_rec_block_t *bh = (struct inv_rec_block_t *)w->block;
+    unsigned char *p;
+    int num = rec_num_values(s->type);
+    int ii;
+
+    if (num < 0 || s->num != num)
+        return;
+
+    if (w->used + REC_MAX_RECORD_SIZE > sizeof(w->block))
+        rec_flush_block(w);
+
+    p = w->block + w->used;
+    *p++ = (unsigned char)s->type;
+    if (rec_is_sample(s->type)) {
+        p += rec_put_varint(p, s->timestamp - w->last_timestamp);
+        w->last_timestamp = s->timestamp;
+        w->block_timestamp = s->timestamp;
+        if (!w->has_timestamp) {
+            bh->first_timestamp = s->timestamp;
+            w->has_timestamp = 1;
+        }
+        bh->last_timestamp = s->timestamp;
+        for (ii = 0; ii < num; ii++) {
+            p += rec_put_varint(p, s->data[ii] - w->last_data[s->type][ii]);
+            w->last_data[s->type][ii] = s->data[ii];
+        }
+    } else {
+        for (ii = 0; ii < num; ii++)
+            p += rec_put_varint(p, s->data[ii]);
+    }
+    w->used = p - w->block;
+    bh->num_records++;
+}
+
+static void rec_drain(struct rec_writer_t *w)
+{
+    struct rec_slot_t *slot;
+    unsigned int tail = w->tail;
+
+    while (1) {
+        slot = &w->ring[tail & REC_RING_MASK];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != tail + 1)
+            break;
+        rec_encode(w, &slot->sample);
+        /* hand the slot back to the producers for the next lap */
+        __atomic_store_n(&slot->seq, tail + INV_REC_RING_SIZE,
+                         __ATOMIC_RELEASE);
+        tail++;
+    }
+    w->tail = tail;
+}
+
+static void *rec_thread(void *arg)
+{
+    struct rec_writer_t *w = (struct rec_writer_t *)arg;
+    struct timespec ts;
+
+    while (1) {
+        int stop = __atomic_load_n(&w->stop, __ATOMIC_ACQUIRE);
+
+        __atomic_store_n(&w->wake_pending, 0, __ATOMIC_RELAXED);
+        rec_drain(w);
+        if (stop)
+            break;
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += REC_FLUSH_PERIOD_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        sem_timedwait(&w->wake, &ts);
+    }
+
+    return NULL;
+}
+
+/*
+    Writer API
+*/
+/** Starts recording to a file.
+* Writes the segment header and starts the flush thread.
+* @param[in] file File to write to, must be open. Writes are appended at the
+*                 current position.
+* @param[in] config Sensor configuration stored in the header.
+* @return Returns INV_SUCCESS if successful or an error code if not.
+*/
+inv_error_t inv_rec_start(FILE *file, const struct inv_rec_config_t *config)
+{
+    struct rec_writer_t *w;
+    struct inv_rec_header_t header;
+    unsigned int ii;
+
+    if (rec_writer != NULL)
+        return INV_ERROR_OPENED;
+
+    w = (struct rec_writer_t *)calloc(1, sizeof(*w));
+    if (w == NULL)
+        return INV_ERROR_MEMORY_EXAUSTED;
+    w->file = file;
+    for (ii = 0; ii < INV_REC_RING_SIZE; ii++)
+        w->ring[ii].seq = ii;
+    rec_reset_block(w);
+
+    memset(&header, 0, sizeof(header));
+    header.magic = INV_REC_MAGIC;
+    header.version = INV_REC_VERSION;
+    header.header_size = sizeof(header);
+    header.block_size = INV_REC_BLOCK_SIZE;
+    if (config)
+        header.config = *config;
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        free(w);
+        return INV_ERROR_FILE_WRITE;
+    }
+
+    if (sem_init(&w->wake, 0, 0)) {
+        free(w);
+        return INV_ERROR_OS_CREATE_FAILED;
+    }
+    if (pthread_create(&w->thread, NULL, rec_thread, w)) {
+        sem_destroy(&w->wake);
+        free(w);
+        return INV_ERROR_OS_CREATE_FAILED;
+    }
+
+    __atomic_store_n(&rec_writer, w, __ATOMIC_RELEASE);
+    return INV_SUCCESS;
+}
+
+/** Queues a record, never blocks.
+* Drops the record when the ring buffer is full.
+* @param[in] type PLAYBACK_DBG_TYPE_xxx.
+* @param[in] data Values of the record, may be NULL if num is 0.
+* @param[in] num Number of values.
+* @param[in] timestamp Timestamp of sensor samples, ignored otherwise.
+*/
+void inv_rec_put(int type, const long *data, int num, inv_time_t timestamp)
+{
+    struct rec_writer_t *w = __atomic_load_n(&rec_writer, __ATOMIC_ACQUIRE);
+    struct rec_slot_t *slot;
+    unsigned int pos, seq;
+    int ii;
+
+    if (w == NULL || num < 0 || num > 4)
+        return;
+
+    pos = __atomic_load_n(&w->head, __ATOMIC_RELAXED);
+    while (1) {
+        slot = &w->ring[pos & REC_RING_MASK];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&w->head, &pos, pos + 1, 0,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if ((int)(seq - pos) < 0) {
+            /* full, the flush thread is behind */
+            __atomic_fetch_add(&w->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&w->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->sample.type = type;
+    slot->sample.num = num;
+    slot->sample.timestamp = timestamp;
+    for (ii = 0; ii < num; ii++)
+        slot->sample.data[ii] = data[ii];
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    /* wake the flush thread early once half full */
+    if (pos - __atomic_load_n(&w->tail, __ATOMIC_RELAXED) >=
+            INV_REC_RING_SIZE / 2 &&
+            !__atomic_exchange_n(&w->wake_pending, 1, __ATOMIC_RELAXED))
+        sem_post(&w->wake);
+}
+
+/** Stops recording.
+* Waits for the queued records to be written, then writes the last block
+* and the block index. The file is left open. Must not be called while
+* another thread is inside inv_rec_put().
+* @return Returns INV_SUCCESS if successful or an error code if not.
+*/
+inv_error_t inv_rec_stop(void)
+{
+    struct rec_writer_t *w = rec_writer;
+    struct inv_rec_index_t index;
+    inv_error_t result;
+
+    if (w == NULL)
+        return INV_SUCCESS;
+    __atomic_store_n(&rec_writer, NULL, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+    sem_post(&w->wake);
+    pthread_join(w->thread, NULL);
+    sem_destroy(&w->wake);
+
+    rec_flush_block(w);
+
+    index.magic = INV_REC_INDEX_MAGIC;
+    index.num_blocks = w->num_blocks;
+    index.dropped = w->dropped;
+    if (fwrite(&index, sizeof(index), 1, w->file) != 1 ||
+            (w->num_blocks && fwrite(w->index, sizeof(w->index[0]),
+                                     w->num_blocks, w->file) != w->num_blocks))
+        w->error = INV_ERROR_FILE_WRITE;
+    fflush(w->file);
+
+    if (w->dropped)
+        MPL_LOGE("recording dropped %lu records\n", w->dropped);
+
+    result = w->error;
+    free(w->index);
+    free(w);
+    return result;
+}
+
+/** Returns the number of records dropped by the current recording. */
+unsigned long inv_rec_get_dropped(void)
+{
+    struct rec_writer_t *w = __atomic_load_n(&rec_writer, __ATOMIC_ACQUIRE);
+
+    if (w == NULL)
+        return 0;
+    return __atomic_load_n(&w->dropped, __ATOMIC_RELAXED);
+}
+
+/*
+    Reader API
+*/
+static const struct inv_rec_header_t *rec_header_at(const unsigned char *data,
+                                                    size_t size, size_t pos)
+{
+    const struct inv_rec_header_t *header;
+
+    if (size < pos || size - pos < sizeof(*header))
+        return NULL;
+    header = (const struct inv_rec_header_t *)(data + pos);
+    if (header->magic != INV_REC_MAGIC ||
+            header->version != INV_REC_VERSION ||
+            header->header_size < sizeof(*header) ||
+            header->header_size > size - pos ||
+            header->block_size <= sizeof(struct inv_rec_block_t) + REC_MAX_RECORD_SIZE ||
+            header->block_size > (1 << 20))
+        return NULL;
+    return header;
+}
+
+/** Tells if data holds a recording in this format.
+* @param[in] data Start of the file.
+* @param[in] size Size of the file.
+*/
+int inv_rec_is_recording(const void *data, size_t size)
+{
+    return rec_header_at((const unsigned char *)data, size, 0) != NULL;
+}
+
+/** Opens a recording mapped in memory.
+* Finds the segments, their blocks and indexes. A recording that was not
+* stopped cleanly has no index, all its complete blocks are still read.
+* @param[out] reader Reader to set up.
+* @param[in] data Content of the recording, must stay mapped until
+*                 inv_rec_reader_close().
+* @param[in] size Size of data in bytes.
+* @return Returns INV_SUCCESS if successful or an error code if not.
+*/
+inv_error_t inv_rec_reader_open(struct inv_rec_reader_t *reader,
+                                const void *data, size_t size)
+{
+    const unsigned char *base = (const unsigned char *)data;
+    const struct inv_rec_header_t *header;
+    const struct inv_rec_block_t *bh;
+    const struct inv_rec_index_t *index;
+    struct inv_rec_segment_t *seg;
+    size_t pos = 0;
+
+    memset(reader, 0, sizeof(*reader));
+
+    while ((header = rec_header_at(base, size, pos)) != NULL) {
+        seg = (struct inv_rec_segment_t *)realloc(reader->segments,
+                (reader->num_segments + 1) * sizeof(*seg));
+        if (seg == NULL) {
+            inv_rec_reader_close(reader);
+            return INV_ERROR_MEMORY_EXAUSTED;
+        }
+        reader->segments = seg;
+        seg = &reader->segments[reader->num_segments++];
+
+        pos += header->header_size;
+        seg->header = header;
+        seg->blocks = base + pos;
+        seg->num_blocks = 0;
+        seg->index = NULL;
+
+        while (pos <= size && size - pos >= header->block_size) {
+            bh = (const struct inv_rec_block_t *)(base + pos);
+            if (bh->magic != INV_REC_BLOCK_MAGIC)
+                break;
+            seg->num_blocks++;
+            pos += header->block_size;
+        }
+
+        if (pos > size || size - pos < sizeof(*index))
+            break;
+        index = (const struct inv_rec_index_t *)(base + pos);
+        if (index->magic != INV_REC_INDEX_MAGIC)
+            break;
+        pos += sizeof(*index);
+        if (index->num_blocks != seg->num_blocks ||
+                (size - pos) / sizeof(seg->index[0]) < index->num_blocks)
+            break;
+        seg->index = (const struct inv_rec_index_entry_t *)(base + pos);
+        pos += index->num_blocks * sizeof(seg->index[0]);
+    }
+
+    if (reader->num_segments == 0)
+        return INV_ERROR_INVALID_PARAMETER;
+    return INV_SUCCESS;
+}
+
+/** Frees what inv_rec_reader_open() allocated. */
+void inv_rec_reader_close(struct inv_rec_reader_t *reader)
+{
+    free(reader->segments);
+    memset(reader, 0, sizeof(*reader));
+}
+
+static const struct inv_rec_block_t *rec_block(const struct inv_rec_segment_t *seg,
+                                               uint32_t block)
+{
+    return (const struct inv_rec_block_t *)
+           (seg->blocks + (size_t)block * seg->header->block_size);
+}
+
+/* the segment header configuration is replayed as records first */
+static int rec_config_record(const struct inv_rec_header_t *header, int step,
+                             struct inv_rec_sample_t *sample)
+{
+    static const int orient_types[] = {
+        PLAYBACK_DBG_TYPE_G_ORIENT,
+        PLAYBACK_DBG_TYPE_A_ORIENT,
+        PLAYBACK_DBG_TYPE_C_ORIENT,
+    };
+    static const int rate_types[] = {
+        PLAYBACK_DBG_TYPE_G_SAMPLE_RATE,
+        PLAYBACK_DBG_TYPE_A_SAMPLE_RATE,
+        PLAYBACK_DBG_TYPE_C_SAMPLE_RATE,
+        PLAYBACK_DBG_TYPE_Q_SAMPLE_RATE,
+    };
+
+    memset(sample, 0, sizeof(*sample));
+    if (step < 3) {
+        if (header->config.sensitivity[step] == 0)
+            return 0;
+        sample->type = orient_types[step];
+        sample->num = 2;
+        sample->data[0] = header->config.orientation[step];
+        sample->data[1] = header->config.sensitivity[step];
+        return 1;
+    }
+    step -= 3;
+    if (header->config.sample_rate_us[step] <= 0)
+        return 0;
+    sample->type = rate_types[step];
+    sample->num = 1;
+    sample->data[0] = header->config.sample_rate_us[step];
+    return 1;
+}
+#define REC_NUM_CONFIG_RECORDS  (3 + INV_REC_NUM_SENSORS)
+
+/** Reads the next record.
+* @param[in] reader Reader from inv_rec_reader_open().
+* @param[out] sample Next record.
+* @return Returns 1 when a record was read, 0 at the end of the recording
+*         and -1 if the recording is corrupted.
+*/
+int inv_rec_reader_next(struct inv_rec_reader_t *reader,
+                        struct inv_rec_sample_t *sample)
+{
+    const struct inv_rec_segment_t *seg;
+    const struct inv_rec_block_t *bh;
+    long long value;
+    int ii, type, num;
+
+    while (1) {
+        if (reader->segment >= reader->num_segments)
+            return 0;
+        seg = &reader->segments[reader->segment];
+
+        if (reader->config_sent < REC_NUM_CONFIG_RECORDS) {
+            if (rec_config_record(seg->header,
+                                  reader->config_sent++, sample))
+                return 1;
+            continue;
+        }
+
+        if (reader->left == 0) {
+            if (reader->block >= seg->num_blocks) {
+                reader->segment++;
+                reader->block = 0;
+                reader->config_sent = 0;
+                continue;
+            }
+            bh = rec_block(seg, reader->block++);
+            reader->pos = (const unsigned char *)(bh + 1);
+            reader->end = reader->pos +
+                MIN(bh->size, seg->header->block_size - sizeof(*bh));
+            reader->left = bh->num_records;
+            reader->last_timestamp = 0;
+            memset(reader->last_data, 0, sizeof(reader->last_data));
+            continue;
+        }
+        break;
+    }
+
+    if (reader->pos >= reader->end)
+        return -1;
+    type = *reader->pos++;
+    num = rec_num_values(type);
+    if (num < 0)
+        return -1;
+
+    memset(sample, 0, sizeof(*sample));
+    sample->type = type;
+    sample->num = num;
+    if (rec_is_sample(type)) {
+        if (rec_get_varint(&reader->pos, reader->end, &value))
+            return -1;
+        reader->last_timestamp += value;
+        sample->timestamp = reader->last_timestamp;
+        for (ii = 0; ii < num; ii++) {
+            if (rec_get_varint(&reader->pos, reader->end, &value))
+                return -1;
+            reader->last_data[type][ii] += value;
+            sample->data[ii] = reader->last_data[type][ii];
+        }
+    } else {
+        for (ii = 0; ii < num; ii++) {
+            if (rec_get_varint(&reader->pos, reader->end, &sample->data[ii]))
+                return -1;
+        }
+    }
+    reader->left--;
+    return 1;
+}
+
+static inv_time_t rec_block_last_timestamp(const struct inv_rec_segment_t *seg,
+                                           uint32_t block)
+{
+    if (seg->index)
+        return seg->index[block].last_timestamp;
+    return rec_block(seg, block)->last_timestamp;
+}
+
+/** Moves to the first block holding samples at or after a timestamp.
+* The configuration of the segment is replayed again before its records.
+* @param[in] reader Reader from inv_rec_reader_open().
+* @param[in] timestamp Timestamp to seek to.
+* @return Returns INV_SUCCESS if found or INV_ERROR_INVALID_PARAMETER if
+*         the recording ends before timestamp.
+*/
+inv_error_t inv_rec_reader_seek(struct inv_rec_reader_t *reader,
+                                inv_time_t timestamp)
+{
+    const struct inv_rec_segment_t *seg;
+    uint32_t lo, hi, mid;
+    int ii;
+
+    for (ii = 0; ii < reader->num_segments; ii++) {
+        seg = &reader->segments[ii];
+        if (seg->num_blocks == 0 ||
+                rec_block_last_timestamp(seg, seg->num_blocks - 1) < timestamp)
+            continue;
+
+        /* first block ending at or after timestamp */
+        lo = 0;
+        hi = seg->num_blocks - 1;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (rec_block_last_timestamp(seg, mid) < timestamp)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        reader->segment = ii;
+        reader->block = lo;
+        reader->config_sent = 0;
+        reader->left = 0;
+        return INV_SUCCESS;
+    }
+
+    reader->segment = reader->num_segments;
+    reader->left = 0;
+    return INV_ERROR_INVALID_PARAMETER;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,148 @@
+/*
+ $License:
+    Copyright (C) 2011 InvenSense Corporation, All Rights Reserved.
+ $
+ */
+
+/*******************************************************************************
+ *
+ * $Id:$
+ *
+ ******************************************************************************/
+
+#ifndef INV_MPL_DATA_RECORDER_H
+#define INV_MPL_DATA_RECORDER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    Includes.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include "mltypes.h"
+#include "data_builder.h"
+
+/*
+    Defines
+*/
+/* Recording file layout, all fields little endian:
+     segment header (struct inv_rec_header_t)
+     N blocks of block_size bytes, each one starting with an
+       inv_rec_block_t and followed by delta encoded records
+     block index (struct inv_rec_index_t and N inv_rec_index_entry_t),
+       missing when the recording was not stopped cleanly
+   A file may hold several segments one after the other, one for each
+   time recording was turned on. */
+#define INV_REC_MAGIC           (0x52564e49)    /* "INVR" */
+#define INV_REC_BLOCK_MAGIC     (0x42564e49)    /* "INVB" */
+#define INV_REC_INDEX_MAGIC     (0x49564e49)    /* "INVI" */
+#define INV_REC_VERSION         (1)
+#define INV_REC_BLOCK_SIZE      (4096)
+/* number of records the ring buffer holds, power of 2 */
+#define INV_REC_RING_SIZE       (8192)
+
+/* sensors in inv_rec_config_t */
+enum inv_rec_sensor_e {
+    INV_REC_GYRO,
+    INV_REC_ACCEL,
+    INV_REC_COMPASS,
+    INV_REC_QUAT,
+    INV_REC_NUM_SENSORS
+};
+
+/*
+    Types
+*/
+/** Sensor configuration when the recording started. */
+struct inv_rec_config_t {
+    int32_t orientation[INV_REC_NUM_SENSORS];
+    int32_t sensitivity[INV_REC_NUM_SENSORS];
+    int32_t sample_rate_us[INV_REC_NUM_SENSORS];
+};
+
+struct inv_rec_header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t block_size;
+    uint32_t reserved;
+    struct inv_rec_config_t config;
+} __attribute__((packed));
+
+struct inv_rec_block_t {
+    uint32_t magic;
+    uint16_t num_records;
+    /** bytes of records following this header */
+    uint16_t size;
+    int64_t first_timestamp;
+    int64_t last_timestamp;
+} __attribute__((packed));
+
+struct inv_rec_index_t {
+    uint32_t magic;
+    uint32_t num_blocks;
+    /** records dropped because the ring buffer was full */
+    uint64_t dropped;
+} __attribute__((packed));
+
+struct inv_rec_index_entry_t {
+    int64_t first_timestamp;
+    int64_t last_timestamp;
+} __attribute__((packed));
+
+/** One record, type is a PLAYBACK_DBG_TYPE_xxx value. */
+struct inv_rec_sample_t {
+    int type;
+    int num;
+    inv_time_t timestamp;
+    long long data[4];
+};
+
+struct inv_rec_segment_t {
+    const struct inv_rec_header_t *header;
+    const unsigned char *blocks;
+    uint32_t num_blocks;
+    /** NULL when the recording was not stopped cleanly */
+    const struct inv_rec_index_entry_t *index;
+};
+
+/** Reads a recording mapped in memory. */
+struct inv_rec_reader_t {
+    struct inv_rec_segment_t *segments;
+    int num_segments;
+    /* position */
+    int segment;
+    uint32_t block;
+    int config_sent;
+    const unsigned char *pos;
+    const unsigned char *end;
+    int left;
+    /* delta decoding state, reset on each block */
+    inv_time_t last_timestamp;
+    long long last_data[PLAYBACK_DBG_TYPE_QUAT_OFF + 1][4];
+};
+
+/*
+    APIs
+*/
+inv_error_t inv_rec_start(FILE *file, const struct inv_rec_config_t *config);
+void inv_rec_put(int type, const long *data, int num, inv_time_t timestamp);
+inv_error_t inv_rec_stop(void);
+unsigned long inv_rec_get_dropped(void);
+
+int inv_rec_is_recording(const void *data, size_t size);
+inv_error_t inv_rec_reader_open(struct inv_rec_reader_t *reader,
+                                const void *data, size_t size);
+void inv_rec_reader_close(struct inv_rec_reader_t *reader);
+int inv_rec_reader_next(struct inv_rec_reader_t *reader,
+                        struct inv_rec_sample_t *sample);
+inv_error_t inv_rec_reader_seek(struct inv_rec_reader_t *reader,
+                                inv_time_t timestamp);
+
+#ifdef __cplusplus
+}
+#endif
+#endif  /* INV_MPL_DATA_RECORDER_H */
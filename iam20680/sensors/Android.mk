@@ -87,6 +87,9 @@ LOCAL_SRC_FILES += SensorsMain.cpp
 LOCAL_SRC_FILES += SensorBase.cpp
 LOCAL_SRC_FILES += MPLSensor.cpp
 LOCAL_SRC_FILES += MPLSupport.cpp
+LOCAL_SRC_FILES += FlushQueue.cpp
+LOCAL_SRC_FILES += FlushTracker.cpp
+LOCAL_SRC_FILES += FifoDecoder.cpp
 
 LOCAL_SRC_FILES += tools/inv_sysfs_utils.c
 LOCAL_SRC_FILES += tools/inv_iio_buffer.c
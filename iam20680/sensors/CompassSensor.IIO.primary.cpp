@@ -115,7 +115,6 @@ void CompassSensor::enableIIOSysfs()
 
     char iio_device_node[MAX_CHIP_ID_LEN];
     const char* compass = dev_full_name;
-    size_t size, align, addr;
     int ret = 0;
 
     // enable 3-axis mag + timestamp into buffer
@@ -162,45 +161,13 @@ void CompassSensor::enableIIOSysfs()
                                 compassSysFs.timestamp_scale,
                                 &compassBufferScan.channels[TIMESTAMP_CHANNEL]);
 
-    // compute buffer size and alignment
-    size = 0;
-    align = 0;
-    for (size_t i = 0; i < ARRAY_SIZE(compassBufferScan.channels); ++i) {
-        if (compassBufferScan.channels[i].is_enabled) {
-            size += compassBufferScan.channels[i].size;
-            if (compassBufferScan.channels[i].size > align) {
-                align = compassBufferScan.channels[i].size;
-            }
-        }
-    }
-    // must be multiple of alignment
-    if (size % align != 0) {
-        size += align - (size % align);
-    }
-    compassBufferScan.size = size;
-
-    // compute addresses
-    addr = 0;
-    for (size_t idx = 0; idx < CHANNELS_NB; ++idx) {
-        for (size_t i = 0; i < ARRAY_SIZE(compassBufferScan.channels); ++i) {
-            if (compassBufferScan.channels[i].index == idx) {
-                if (compassBufferScan.channels[i].is_enabled) {
-                    size = compassBufferScan.channels[i].size;
-                    // handle address alignment
-                    if (addr % size != 0) {
-                        addr += size - (addr % size);
-                    }
-                    compassBufferScan.addresses[i] = addr;
-                    addr += size;
-                } else {
-                    compassBufferScan.addresses[i] = -1;
-                }
-            }
-        }
-    }
+    // compute buffer addresses, size and decoding path once
+    ret = inv_iio_buffer_layout_init(&compassBufferScan, CHANNELS_NB);
+    LOGE_IF(ret != 0, "HAL:compass buffer has no enabled channel");
 
     // print buffer scan
-    LOGV_IF(PROCESS_VERBOSE, "HAL:compass buffer scan size: %zu", compassBufferScan.size);
+    LOGV_IF(PROCESS_VERBOSE, "HAL:compass buffer scan size: %zu, format: %d",
+            compassBufferScan.size, compassBufferScan.format);
     for (size_t i = 0; i < CHANNELS_NB; ++i) {
         LOGV_IF(PROCESS_VERBOSE, "HAL:compass buffer channel #%zu", i);
         LOGV_IF(PROCESS_VERBOSE, "\taddress: %zd", compassBufferScan.addresses[i]);
@@ -336,8 +303,8 @@ int CompassSensor::readSample(int *data, int64_t *timestamp, int len) {
     (void)len;
 
     char *rdata = mIIOBuffer;
-    int64_t raw;
-    double sample;
+    float mag[3];
+    float *out[CHANNELS_NB] = { &mag[0], &mag[1], &mag[2], NULL };
     struct inv_iio_buffer_channel *channel;
     ssize_t address;
 
@@ -351,19 +318,14 @@ int CompassSensor::readSample(int *data, int64_t *timestamp, int len) {
     }
 
     if (mEnable) {
-        /* fill mag sample */
-        for (int i = MAG_X_CHANNEL; i <= MAG_Z_CHANNEL; ++i) {
-            channel = &compassBufferScan.channels[i];
-            address = compassBufferScan.addresses[i];
-            if (!channel->is_enabled) {
-                data[i - MAG_X_CHANNEL] = 0;
-            } else {
-                raw = inv_iio_buffer_channel_get_data(channel, &rdata[address]);
-                // apply offset + scale
-                sample = inv_iio_buffer_convert_data(channel, raw);
-                // sample is Gauss = 100uT, scale is 2^16 for 1 uT */
-                data[i - MAG_X_CHANNEL] = sample * 100.0 * (1 << 16);
-            }
+        /* fill mag sample, offset + scale applied, disabled axes are 0 */
+        if (inv_iio_buffer_layout_decode_float(&compassBufferScan, rdata, size,
+                                               out, 1) != 1) {
+            return 0;
+        }
+        for (int i = 0; i < 3; ++i) {
+            // sample is Gauss = 100uT, scale is 2^16 for 1 uT */
+            data[i] = mag[i] * 100.f * (1 << 16);
         }
         /* fill timestamp sample */
         channel = &compassBufferScan.channels[TIMESTAMP_CHANNEL];
@@ -371,8 +333,7 @@ int CompassSensor::readSample(int *data, int64_t *timestamp, int len) {
         if (!channel->is_enabled) {
             *timestamp = 0;
         } else {
-            raw = inv_iio_buffer_channel_get_data(channel, &rdata[address]);
-            *timestamp = raw;
+            *timestamp = inv_iio_buffer_channel_get_data(channel, &rdata[address]);
         }
         LOGV_IF(INPUT_DATA, "HAL:compass data : %d %d %d -- %" PRId64 "",
                 data[0], data[1], data[2], *timestamp);
@@ -109,11 +109,7 @@ private:
         TIMESTAMP_CHANNEL,
         CHANNELS_NB,
     };
-    struct buffer_scan {
-        struct inv_iio_buffer_channel channels[CHANNELS_NB];
-        ssize_t addresses[CHANNELS_NB];
-        size_t size;
-    } compassBufferScan;
+    struct inv_iio_buffer_layout compassBufferScan;
 
     // implementation specific
     signed char mCompassOrientation[9];
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2014-2019 InvenSense, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "FifoDecoder.h"
+#include "Log.h"
+
+FifoDecoder::FifoDecoder()
+{
+    memset(mChannels, 0, sizeof(mChannels));
+
+    mChannels[RawGyro].event.version = sizeof(sensors_event_t);
+    mChannels[RawGyro].event.sensor = ID_RG;
+    mChannels[RawGyro].event.type = SENSOR_TYPE_GYROSCOPE_UNCALIBRATED;
+    mChannels[RawGyro].event.gyro.status = SENSOR_STATUS_UNRELIABLE;
+    mChannels[Accelerometer].event.version = sizeof(sensors_event_t);
+    mChannels[Accelerometer].event.sensor = ID_A;
+    mChannels[Accelerometer].event.type = SENSOR_TYPE_ACCELEROMETER;
+    mChannels[Accelerometer].event.acceleration.status =
+        SENSOR_STATUS_UNRELIABLE;
+}
+
+void FifoDecoder::setMatrix(int what, const signed char *orient, float scale)
+{
+    for (int i = 0; i < 9; i++)
+        mChannels[what].matrix[i] = orient[i] * scale;
+}
+
+int FifoDecoder::decode(const char *buf, int size, int *used,
+                        sensors_event_t *data, int count,
+                        uint64_t enabled, const int64_t *enabledTime,
+                        int *marker)
+{
+    int ptr = 0;
+    int num = 0;
+
+    *marker = -1;
+    while (ptr < size && num < count) {
+        const char *rdata = buf + ptr;
+        unsigned short header;
+        int what;
+
+        memcpy(&header, rdata, sizeof(header));
+        switch (header) {
+            case DATA_FORMAT_RAW_GYRO:
+                what = RawGyro;
+                break;
+            case DATA_FORMAT_ACCEL:
+                what = Accelerometer;
+                break;
+            case DATA_FORMAT_MARKER:
+            case DATA_FORMAT_EMPTY_MARKER:
+                if (size - ptr < DATA_FORMAT_MARKER_SZ)
+                    goto out;
+                memcpy(marker, rdata + 4, sizeof(*marker));
+                ptr += DATA_FORMAT_MARKER_SZ;
+                goto out;
+            default:
+                LOGW("HAL:no header.");
+                ptr++;
+                continue;
+        }
+
+        /* gyro and accel packets have the same layout */
+        if (size - ptr < DATA_FORMAT_RAW_GYRO_SZ)
+            break;
+        ptr += DATA_FORMAT_RAW_GYRO_SZ;
+
+        Channel *ch = &mChannels[what];
+        int32_t raw[3];
+        int64_t timestamp;
+
+        memcpy(raw, rdata + 4, sizeof(raw));
+        memcpy(&timestamp, rdata + 16, sizeof(timestamp));
+
+        /* timestamp check */
+        bool update = (enabled & (1ULL << what)) &&
+                      timestamp > ch->prevTimestamp &&
+                      timestamp > enabledTime[what];
+        ch->prevTimestamp = timestamp;
+        if (!update)
+            continue;
+
+        /* uncalibrated gyro leaves its bias, data[3..5], at 0 */
+        sensors_event_t *s = &data[num++];
+        const float *m = ch->matrix;
+        *s = ch->event;
+        s->timestamp = timestamp;
+        s->data[0] = m[0] * raw[0] + m[1] * raw[1] + m[2] * raw[2];
+        s->data[1] = m[3] * raw[0] + m[4] * raw[1] + m[5] * raw[2];
+        s->data[2] = m[6] * raw[0] + m[7] * raw[1] + m[8] * raw[2];
+    }
+out:
+    *used = ptr;
+    return num;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2014-2019 InvenSense, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FIFO_DECODER_H
+#define ANDROID_FIFO_DECODER_H
+
+#include <stdint.h>
+#include <hardware/sensors.h>
+
+#include "InvnSensors.h"
+
+// data header format used by kernel driver.
+#define DATA_FORMAT_ACCEL           1
+#define DATA_FORMAT_RAW_GYRO        2
+#define DATA_FORMAT_EMPTY_MARKER    17
+#define DATA_FORMAT_MARKER          18
+
+// data size from kernel driver.
+#define DATA_FORMAT_ACCEL_SZ        24
+#define DATA_FORMAT_RAW_GYRO_SZ     24
+#define DATA_FORMAT_EMPTY_MARKER_SZ 8
+#define DATA_FORMAT_MARKER_SZ       8
+
+/*
+ * Decodes the gyro and accel packets of the driver FIFO straight into
+ * sensors_event_t slots. Mount matrix and scale are fused into one float
+ * matrix per sensor, so a packet costs one 3x3 multiply and the event
+ * copy.
+ */
+class FifoDecoder {
+public:
+    FifoDecoder();
+
+    /* body frame matrix of sensor 'what', mount matrix times scale */
+    void setMatrix(int what, const signed char *orient, float scale);
+
+    /*
+     * Decodes the packets of buf into data, for the sensors set in
+     * 'enabled' with timestamps after enabledTime[]. Stops after a marker
+     * packet (*marker is set to the sensor handle it carries, -1 if none
+     * was found), at a partial packet or once count events are written.
+     * Returns the number of events, *used the bytes consumed.
+     *
+     * Gyro and accel events skip the handlers and mDirty of MPLSensor,
+     * they have no sensor derived from them.
+     */
+    int decode(const char *buf, int size, int *used,
+               sensors_event_t *data, int count,
+               uint64_t enabled, const int64_t *enabledTime, int *marker);
+
+private:
+    struct Channel {
+        float matrix[9];
+        int64_t prevTimestamp;
+        sensors_event_t event;  /* version, sensor, type and status */
+    };
+
+    Channel mChannels[TotalNumSensors];
+};
+
+#endif  // ANDROID_FIFO_DECODER_H
@@ -0,0 +1,73 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "FlushQueue.h"
+
+FlushQueue::FlushQueue()
+    : mHead(0),
+      mTail(0)
+{
+    for (uint32_t i = 0; i < CAPACITY; i++) {
+        mSlots[i].seq = i;
+        mSlots[i].handle = -1;
+    }
+}
+
+bool FlushQueue::push(int handle)
+{
+    uint32_t pos = __atomic_load_n(&mTail, __ATOMIC_RELAXED);
+    Slot *slot;
+    int32_t diff;
+
+    for (;;) {
+        slot = &mSlots[pos & (CAPACITY - 1)];
+        diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            /* slot free, claim the position */
+            if (__atomic_compare_exchange_n(&mTail, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            /* consumer has not released the slot yet */
+            return false;
+        } else {
+            pos = __atomic_load_n(&mTail, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->handle = handle;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool FlushQueue::pop(int *handle)
+{
+    Slot *slot = &mSlots[mHead & (CAPACITY - 1)];
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != mHead + 1)
+        return false;
+    *handle = slot->handle;
+    __atomic_store_n(&slot->seq, mHead + CAPACITY, __ATOMIC_RELEASE);
+    mHead++;
+    return true;
+}
+
+bool FlushQueue::empty() const
+{
+    return __atomic_load_n(&mSlots[mHead & (CAPACITY - 1)].seq,
+                           __ATOMIC_ACQUIRE) != mHead + 1;
+}
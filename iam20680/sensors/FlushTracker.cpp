@@ -0,0 +1,168 @@
+/*
+* Copyright (C) 2014 Invensense, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "FlushTracker.h"
+
+/* handle state word */
+#define STATE_PENDING   (1ULL << 63)    /* hardware flush outstanding */
+#define STATE_GEN_SHIFT 48
+#define STATE_GEN_MASK  (0x7fffULL << STATE_GEN_SHIFT)
+#define STATE_NEXT_SHIFT 24
+#define STATE_NEXT_MASK (0xffffffULL << STATE_NEXT_SHIFT)
+#define STATE_COUNT_MASK 0xffffffULL
+
+#define STATE_COUNT(s)  ((int)((s) & STATE_COUNT_MASK))
+#define STATE_NEXT(s)   ((int)(((s) & STATE_NEXT_MASK) >> STATE_NEXT_SHIFT))
+#define STATE_GEN(s)    ((int)(((s) & STATE_GEN_MASK) >> STATE_GEN_SHIFT))
+
+/* queue entries carry the generation the flush was started with */
+static inline int entry(int handle, uint64_t state)
+{
+    return handle | (STATE_GEN(state) << 6);
+}
+
+FlushTracker::FlushTracker()
+{
+    for (int i = 0; i < MAX_HANDLES; i++)
+        mState[i] = 0;
+}
+
+int FlushTracker::add(int handle)
+{
+    uint64_t s, ns;
+
+    if (handle < 0 || handle >= MAX_HANDLES)
+        return FLUSH_INVALID;
+
+    s = __atomic_load_n(&mState[handle], __ATOMIC_SEQ_CST);
+    do {
+        if (s & STATE_PENDING)
+            ns = s + (1ULL << STATE_NEXT_SHIFT);
+        else    /* flushes left by a cancel() ride along */
+            ns = (s & STATE_GEN_MASK) | STATE_PENDING |
+                 (STATE_NEXT(s) + 1);
+    } while (!__atomic_compare_exchange_n(&mState[handle], &s, ns, false,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    if (s & STATE_PENDING)
+        return FLUSH_DEFERRED;
+
+    /* a handle is queued at most once, so the queue can't be full */
+    if (!mOrder.push(entry(handle, ns))) {
+        cancel(handle, 1);
+        return FLUSH_INVALID;
+    }
+    return FLUSH_START;
+}
+
+void FlushTracker::cancel(int handle, int failed)
+{
+    uint64_t s, ns;
+    int left;
+
+    if (handle < 0 || handle >= MAX_HANDLES)
+        return;
+
+    /* the queued entry goes stale with the generation */
+    s = __atomic_load_n(&mState[handle], __ATOMIC_SEQ_CST);
+    do {
+        left = STATE_COUNT(s) - failed + STATE_NEXT(s);
+        if (left < 0)
+            left = 0;
+        ns = ((s + (1ULL << STATE_GEN_SHIFT)) & STATE_GEN_MASK) |
+             ((uint64_t)left << STATE_NEXT_SHIFT);
+    } while (!__atomic_compare_exchange_n(&mState[handle], &s, ns, false,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+}
+
+bool FlushTracker::completeNext(int *handle, int *count, bool *restart)
+{
+    uint64_t s, ns = 0;
+    int e, h;
+
+    do {
+        if (!mOrder.pop(&e))
+            return false;
+        h = e & (MAX_HANDLES - 1);
+        s = __atomic_load_n(&mState[h], __ATOMIC_SEQ_CST);
+        do {
+            /* cancelled, its hardware flush has no marker */
+            if (!(s & STATE_PENDING) || entry(h, s) != e)
+                break;
+            if (STATE_NEXT(s))
+                ns = (s & STATE_GEN_MASK) | STATE_PENDING | STATE_NEXT(s);
+            else
+                ns = s & STATE_GEN_MASK;
+        } while (!__atomic_compare_exchange_n(&mState[h], &s, ns, false,
+                                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    } while (!(s & STATE_PENDING) || entry(h, s) != e);
+
+    *handle = h;
+    *count = STATE_COUNT(s);
+    *restart = STATE_NEXT(s) != 0;
+    if (*restart && !mOrder.push(entry(h, ns))) {
+        cancel(h, 0);
+        *restart = false;
+    }
+    return true;
+}
+
+bool FlushTracker::complete(int handle, int *count, bool *restart)
+{
+    uint64_t s, ns;
+
+    if (handle < 0 || handle >= MAX_HANDLES)
+        return false;
+
+    /* the queued entry goes stale with the generation */
+    s = __atomic_load_n(&mState[handle], __ATOMIC_SEQ_CST);
+    do {
+        if (!(s & STATE_PENDING))
+            return false;
+        ns = (s + (1ULL << STATE_GEN_SHIFT)) & STATE_GEN_MASK;
+        if (STATE_NEXT(s))
+            ns |= STATE_PENDING | STATE_NEXT(s);
+    } while (!__atomic_compare_exchange_n(&mState[handle], &s, ns, false,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+    *count = STATE_COUNT(s);
+    *restart = STATE_NEXT(s) != 0;
+    prune();
+    if (*restart && !mOrder.push(entry(handle, ns))) {
+        cancel(handle, 0);
+        *restart = false;
+    }
+    return true;
+}
+
+/* drops the entries of flushes no longer outstanding, which complete()
+   leaves anywhere in the queue. The others are queued again, behind any
+   add() meanwhile */
+void FlushTracker::prune()
+{
+    int live[FlushQueue::CAPACITY];
+    int n = 0, e, h, i;
+
+    while (n < FlushQueue::CAPACITY && mOrder.pop(&e)) {
+        h = e & (MAX_HANDLES - 1);
+        uint64_t s = __atomic_load_n(&mState[h], __ATOMIC_SEQ_CST);
+        if ((s & STATE_PENDING) && entry(h, s) == e)
+            live[n++] = e;
+    }
+    /* one live entry per handle fits, a push can only fail for one that
+       a cancel() made stale meanwhile */
+    for (i = 0; i < n; i++)
+        mOrder.push(live[i]);
+}
@@ -31,7 +31,6 @@
 #include <sys/syscall.h>
 #include <dlfcn.h>
 #include <pthread.h>
-#include <vector>
 #include <string>
 #include <string.h>
 
@@ -120,8 +119,6 @@ MPLSensor::MPLSensor(CompassSensor *compass) :
     mEnabled(0),
     mIIOReadSize(0),
     mPollTime(-1),
-    mGyroSensorPrevTimestamp(0),
-    mAccelSensorPrevTimestamp(0),
     mCompassPrevTimestamp(0)
 {
 
@@ -138,7 +135,8 @@ MPLSensor::MPLSensor(CompassSensor *compass) :
     memset(mGyroOrientationMatrix, 0, sizeof(mGyroOrientationMatrix));
     memset(mAccelOrientationMatrix, 0, sizeof(mAccelOrientationMatrix));
     memset(mCompassOrientationMatrix, 0, sizeof(mCompassOrientationMatrix));
-    mFlushSensorEnabledVector.resize(TotalNumSensors);
+    mFlushCompleteHandle = -1;
+    mFlushCompleteCount = 0;
     memset(mEnabledTime, 0, sizeof(mEnabledTime));
 #ifdef BATCH_MODE_SUPPORT
     mBatchEnabled = 0;
@@ -177,26 +175,23 @@ MPLSensor::MPLSensor(CompassSensor *compass) :
 
     /* initialize sensor data */
     memset(mPendingEvents, 0, sizeof(mPendingEvents));
-    mPendingEvents[RawGyro].version = sizeof(sensors_event_t);
-    mPendingEvents[RawGyro].sensor = ID_RG;
-    mPendingEvents[RawGyro].type = SENSOR_TYPE_GYROSCOPE_UNCALIBRATED;
-    mPendingEvents[RawGyro].gyro.status = SENSOR_STATUS_UNRELIABLE;
-    mPendingEvents[Accelerometer].version = sizeof(sensors_event_t);
-    mPendingEvents[Accelerometer].sensor = ID_A;
-    mPendingEvents[Accelerometer].type = SENSOR_TYPE_ACCELEROMETER;
-    mPendingEvents[Accelerometer].acceleration.status
-        = SENSOR_STATUS_UNRELIABLE;
     mPendingEvents[RawMagneticField].version = sizeof(sensors_event_t);
     mPendingEvents[RawMagneticField].sensor = ID_RM;
     mPendingEvents[RawMagneticField].type = SENSOR_TYPE_MAGNETIC_FIELD_UNCALIBRATED;
     mPendingEvents[RawMagneticField].magnetic.status =
         SENSOR_STATUS_UNRELIABLE;
 
-    /* Event Handlers */
-    mHandlers[RawGyro] = &MPLSensor::rawGyroHandler;
-    mHandlers[Accelerometer] = &MPLSensor::accelHandler;
+    /* Event Handlers, gyro and accel events come from mFifoDecoder */
+    mHandlers[RawGyro] = NULL;
+    mHandlers[Accelerometer] = NULL;
     mHandlers[RawMagneticField] = &MPLSensor::rawCompassHandler;
 
+    /* sensors computed from each source's data */
+    mDependents[RawGyro] = 0;
+    mDependents[Accelerometer] = 0;
+    mDependents[RawMagneticField] = 1ULL << RawMagneticField;
+    mDirty = 0;
+
     /* initialize delays to reasonable values */
     for (i = 0; i < TotalNumSensors; i++) {
         mDelays[i] = NS_PER_SECOND;
@@ -224,6 +219,8 @@ MPLSensor::MPLSensor(CompassSensor *compass) :
     write_sysfs_int(mpu.gyro_fsr, GYRO_FSR_SYSFS);
     read_sysfs_int(mpu.gyro_fsr, &mGyroFsrDps); /* read actual fsr */
 
+    updateDecoderMatrices();
+
 #ifdef BATCH_MODE_SUPPORT
     /* reset batch timeout */
     setBatchTimeout(0);
@@ -304,6 +301,18 @@ void MPLSensor::setDeviceProperties(void)
     }
 }
 
+/* mount matrix and fsr into the decoder's body frame matrices */
+void MPLSensor::updateDecoderMatrices(void)
+{
+    VFUNC_LOG;
+
+    float gyroScale = (float)mGyroFsrDps / MAX_LSB_DATA * M_PI / 180;
+    float accelScale = 1.f / (MAX_LSB_DATA / (float)mAccelFsrGee) * 9.80665f;
+
+    mFifoDecoder.setMatrix(RawGyro, mGyroOrientationMatrix, gyroScale);
+    mFifoDecoder.setMatrix(Accelerometer, mAccelOrientationMatrix, accelScale);
+}
+
 void MPLSensor::getSensorsOrientation(void)
 {
     VFUNC_LOG;
@@ -539,81 +548,6 @@ int MPLSensor::enable(int32_t handle, int en)
 }
 
 /*  these handlers transform mpl data into one of the Android sensor types */
-int MPLSensor::rawGyroHandler(sensors_event_t* s)
-{
-    VHANDLER_LOG;
-
-    int update = 0;
-    int data[3];
-    int i;
-    float scale = (float)mGyroFsrDps / MAX_LSB_DATA * M_PI / 180;
-
-    /* convert to body frame */
-    for (i = 0; i < 3 ; i++) {
-        data[i] = mCachedGyroData[0] * mGyroOrientationMatrix[i * 3] +
-                  mCachedGyroData[1] * mGyroOrientationMatrix[i * 3 + 1] +
-                  mCachedGyroData[2] * mGyroOrientationMatrix[i * 3 + 2];
-    }
-
-    for (i = 0; i < 3 ; i++) {
-        s->uncalibrated_gyro.uncalib[i] = (float)data[i] * scale;
-        s->uncalibrated_gyro.bias[i] = 0;
-    }
-
-    s->timestamp = mGyroSensorTimestamp;
-    s->gyro.status = SENSOR_STATUS_UNRELIABLE;
-
-    /* timestamp check */
-    if ((mGyroSensorTimestamp > mGyroSensorPrevTimestamp) &&
-        (mGyroSensorTimestamp > mEnabledTime[RawGyro])) {
-        update = 1;
-    }
-
-    mGyroSensorPrevTimestamp = mGyroSensorTimestamp;
-
-    LOGV_IF(HANDLER_DATA, "HAL:raw gyro data : %+f %+f %+f -- %" PRId64 " - %d",
-        s->uncalibrated_gyro.uncalib[0], s->uncalibrated_gyro.uncalib[1], s->uncalibrated_gyro.uncalib[2],
-        s->timestamp, update);
-
-    return update;
-}
-
-int MPLSensor::accelHandler(sensors_event_t* s)
-{
-    VHANDLER_LOG;
-
-    int update = 0;
-    int data[3];
-    int i;
-    float scale = 1.f / (MAX_LSB_DATA / (float)mAccelFsrGee) * 9.80665f;
-
-    /* convert to body frame */
-    for (i = 0; i < 3 ; i++) {
-        data[i] = mCachedAccelData[0] * mAccelOrientationMatrix[i * 3] +
-                  mCachedAccelData[1] * mAccelOrientationMatrix[i * 3 + 1] +
-                  mCachedAccelData[2] * mAccelOrientationMatrix[i * 3 + 2];
-    }
-    for (i = 0; i < 3 ; i++) {
-        s->acceleration.v[i] = (float)data[i] * scale;
-    }
-    s->timestamp = mAccelSensorTimestamp;
-    s->acceleration.status = SENSOR_STATUS_UNRELIABLE;
-
-    /*timestamp check */
-    if ((mAccelSensorTimestamp > mAccelSensorPrevTimestamp) &&
-        (mAccelSensorTimestamp > mEnabledTime[Accelerometer])) {
-        update = 1;
-    }
-
-    mAccelSensorPrevTimestamp = mAccelSensorTimestamp;
-
-    LOGV_IF(HANDLER_DATA, "HAL:accel data : %+f %+f %+f -- %" PRId64 " - %d",
-        s->acceleration.v[0], s->acceleration.v[1], s->acceleration.v[2],
-        s->timestamp, update);
-
-    return update;
-}
-
 int MPLSensor::rawCompassHandler(sensors_event_t* s)
 {
     VHANDLER_LOG;
@@ -668,11 +602,7 @@ int MPLSensor::metaHandler(sensors_event_t* s, int flags)
         case META_DATA_FLUSH_COMPLETE:
             s->type = SENSOR_TYPE_META_DATA;
             s->meta_data.what = flags;
-            s->meta_data.sensor = mFlushSensorEnabledVector[0];
-
-            pthread_mutex_lock(&mHALMutex);
-            mFlushSensorEnabledVector.erase(mFlushSensorEnabledVector.begin());
-            pthread_mutex_unlock(&mHALMutex);
+            s->meta_data.sensor = mFlushCompleteHandle;
             LOGV_IF(HANDLER_DATA,
                     "HAL:flush complete data: type=%d what=%d, "
                     "sensor=%d - %" PRId64 " - %d",
@@ -729,26 +659,29 @@ int MPLSensor::readEvents(sensors_event_t* data, int count)
 
     int numEventReceived = 0;
 
-    // handle flush complete event
-    if(!mFlushSensorEnabledVector.empty()) {
+    // handle flush complete events, one per flush() call
+    while (count > 0 && mFlushCompleteCount) {
         sensors_event_t temp;
         int sendEvent = metaHandler(&temp, META_DATA_FLUSH_COMPLETE);
-        if(sendEvent == 1 && count > 0) {
+        mFlushCompleteCount--;
+        if (sendEvent == 1) {
             *data++ = temp;
             count--;
             numEventReceived++;
         }
     }
 
-    for (int i = 0; i < ID_NUMBER; i++) {
-        int update = 0;
-        if (mEnabled & (1LL << i)) {
-            update = CALL_MEMBER_FN(this, mHandlers[i])(mPendingEvents + i);
-            if (update && (count > 0)) {
-                *data++ = mPendingEvents[i];
-                count--;
-                numEventReceived++;
-            }
+    /* only the sensors that got new data, in handle order */
+    uint64_t dirty = mDirty & mEnabled;
+    mDirty = 0;
+    while (dirty) {
+        int i = __builtin_ctzll(dirty);
+        dirty &= dirty - 1;
+        int update = CALL_MEMBER_FN(this, mHandlers[i])(mPendingEvents + i);
+        if (update && (count > 0)) {
+            *data++ = mPendingEvents[i];
+            count--;
+            numEventReceived++;
         }
     }
 
@@ -759,14 +692,10 @@ int MPLSensor::readMpuEvents(sensors_event_t* s, int count)
 {
     VHANDLER_LOG;
 
-    unsigned short header;
-    char *rdata;
     int rsize;
-    int sensor;
     int ptr = 0;
     int numEventReceived = 0;
-    int left_over = 0;
-    bool data_found;
+    int left_over;
 
     if (mEnabled == 0) {
         /* no sensor is enabled. read out all leftover */
@@ -787,103 +716,54 @@ int MPLSensor::readMpuEvents(sensors_event_t* s, int count)
     if (nbytes > count * packet_size) {
         nbytes = count * packet_size;
     }
-    rsize = read(mIIOfd, &mIIOReadBuffer[mIIOReadSize], nbytes);
-    LOGV_IF(PROCESS_VERBOSE, "HAL: nbytes=%d rsize=%d", nbytes, rsize);
-    if (rsize < 0) {
-        LOGE("HAL:failed to read IIO.  nbytes=%d rsize=%d", nbytes, rsize);
-        return 0;
+    /* the buffer can be full of events the last call had no room for */
+    if (nbytes > 0) {
+        rsize = read(mIIOfd, &mIIOReadBuffer[mIIOReadSize], nbytes);
+        LOGV_IF(PROCESS_VERBOSE, "HAL: nbytes=%d rsize=%d", nbytes, rsize);
+        if (rsize < 0) {
+            LOGE("HAL:failed to read IIO.  nbytes=%d rsize=%d", nbytes, rsize);
+            return 0;
+        }
+        mIIOReadSize += rsize;
     }
-    if (rsize == 0) {
+    if (mIIOReadSize == 0) {
         LOGI("HAL:no data from IIO.");
         return 0;
     }
 
-    mIIOReadSize += rsize;
-
-    while (ptr < mIIOReadSize) {
-        rdata = &mIIOReadBuffer[ptr];
-        header = *(unsigned short*)rdata;
-        data_found = false;
-        switch (header) {
-            case DATA_FORMAT_MARKER:
-                if ((mIIOReadSize - ptr) < DATA_FORMAT_MARKER_SZ) {
-                    left_over = mIIOReadSize - ptr;
-                    break;
-                }
-                sensor = *((int *) (rdata + 4));
-                mFlushSensorEnabledVector.push_back(sensor);
-                LOGV_IF(INPUT_DATA, "HAL:MARKER DETECTED what:%d", sensor);
-                ptr += DATA_FORMAT_MARKER_SZ;
-                data_found = true;
-                break;
-            case DATA_FORMAT_EMPTY_MARKER:
-                if ((mIIOReadSize - ptr) < DATA_FORMAT_EMPTY_MARKER_SZ) {
-                    left_over = mIIOReadSize - ptr;
-                    break;
-                }
-                sensor = *((int *) (rdata + 4));
-                mFlushSensorEnabledVector.push_back(sensor);
-                LOGV_IF(INPUT_DATA, "HAL:EMPTY MARKER DETECTED what:%d", sensor);
-                ptr += DATA_FORMAT_EMPTY_MARKER_SZ;
-                data_found = true;
-                break;
-            case DATA_FORMAT_RAW_GYRO:
-                if ((mIIOReadSize - ptr) < DATA_FORMAT_RAW_GYRO_SZ) {
-                    left_over = mIIOReadSize - ptr;
-                    break;
-                }
-                mCachedGyroData[0] = *((int *) (rdata + 4));
-                mCachedGyroData[1] = *((int *) (rdata + 8));
-                mCachedGyroData[2] = *((int *) (rdata + 12));
-                mGyroSensorTimestamp = *((long long*) (rdata + 16));
-                LOGV_IF(INPUT_DATA, "HAL:RAW GYRO DETECTED:0x%x : %d %d %d -- %" PRId64,
-                        header,
-                        mCachedGyroData[0], mCachedGyroData[1], mCachedGyroData[2],
-                        mGyroSensorTimestamp);
-                ptr += DATA_FORMAT_RAW_GYRO_SZ;
-                data_found = true;
-                break;
-            case DATA_FORMAT_ACCEL:
-                if ((mIIOReadSize - ptr) < DATA_FORMAT_ACCEL_SZ) {
-                    left_over = mIIOReadSize - ptr;
-                    break;
-                }
-                mCachedAccelData[0] = *((int *) (rdata + 4));
-                mCachedAccelData[1] = *((int *) (rdata + 8));
-                mCachedAccelData[2] = *((int *) (rdata + 12));
-                mAccelSensorTimestamp = *((long long*) (rdata +16));
-                LOGV_IF(INPUT_DATA, "HAL:ACCEL DETECTED:0x%x : %d %d %d -- %" PRId64,
-                        header,
-                        mCachedAccelData[0], mCachedAccelData[1], mCachedAccelData[2],
-                        mAccelSensorTimestamp);
-                ptr += DATA_FORMAT_ACCEL_SZ;
-                data_found = true;
-                break;
-            default:
-                LOGW("HAL:no header.");
-                ptr++;
-                data_found = false;
-                break;
-        }
+    /* packets go straight to s, stopping at each marker to queue the
+     * flush complete events behind the data that came before it */
+    while (count > 0) {
+        int used, marker;
+        int num;
 
-        if (data_found) {
-            int num = readEvents(&s[numEventReceived], count);
-            if (num > 0) {
-                count -= num;
-                numEventReceived += num;
-                if (count == 0)
-                    break;
-                if (count < 0) {
-                    LOGW("HAL:sensor_event_t buffer overflow");
-                    break;
-                }
-            }
+        /* owed by a marker the last call had no room for */
+        if (mFlushCompleteCount) {
+            num = readEvents(&s[numEventReceived], count);
+            count -= num;
+            numEventReceived += num;
+            continue;
         }
-        if (left_over) {
+
+        num = mFifoDecoder.decode(&mIIOReadBuffer[ptr],
+                                      mIIOReadSize - ptr, &used,
+                                      &s[numEventReceived], count,
+                                      mEnabled, mEnabledTime, &marker);
+        ptr += used;
+        count -= num;
+        numEventReceived += num;
+        LOGV_IF(INPUT_DATA, "HAL:decoded %d bytes, %d events", used, num);
+        if (marker < 0)
             break;
-        }
+
+        LOGV_IF(INPUT_DATA, "HAL:MARKER DETECTED what:%d", marker);
+        completeFlush(marker);
+        num = readEvents(&s[numEventReceived], count);
+        count -= num;
+        numEventReceived += num;
     }
 
+    left_over = mIIOReadSize - ptr;
     if (left_over > 0) {
         LOGV_IF(PROCESS_VERBOSE, "HAL: leftover mIIOReadSize=%d ptr=%d",
                 mIIOReadSize, ptr);
@@ -907,6 +787,7 @@ int MPLSensor::readCompassEvents(sensors_event_t* s, int count)
 
     if (mCompassSensor) {
         mCompassSensor->readSample(mCachedCompassData, &mCompassTimestamp, 3);
+        setDirty(RawMagneticField);
         int num = readEvents(&s[numEventReceived], count);
         if (num > 0) {
             count -= num;
@@ -1161,17 +1042,57 @@ int MPLSensor::flush(int handle)
         return -EINVAL;
     }
 
+    switch (mFlushTracker.add(handle)) {
+    case FlushTracker::FLUSH_INVALID:
+        LOGE("HAL:flush - handle=%d can't be tracked", handle);
+        return -EINVAL;
+    case FlushTracker::FLUSH_DEFERRED:
+        /* started again when the outstanding flush completes */
+        LOGV_IF(PROCESS_VERBOSE, "HAL: flush - %s (handle %d) deferred",
+                sname.c_str(), handle);
+        return 0;
+    default:
+        break;
+    }
+
     LOGV_IF(PROCESS_VERBOSE, "HAL: flush - select sensor %s (handle %d)",
             sname.c_str(),
             handle);
 
+    if (flushFifo(handle) < 0) {
+        mFlushTracker.cancel(handle, 1);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/* the marker of handle came in, the flush complete events it owes go out
+ * with the next readEvents(). Those of the marker before are out by then,
+ * readMpuEvents() decodes nothing while some are owed. */
+void MPLSensor::completeFlush(int handle)
+{
+    bool restart;
+
+    /* not a flush() of ours, or cancelled */
+    if (!mFlushTracker.complete(handle, &mFlushCompleteCount, &restart))
+        return;
+    mFlushCompleteHandle = handle;
+    // flushes that came in while it was outstanding
+    if (restart && flushFifo(handle) < 0)
+        mFlushTracker.cancel(handle, 0);
+}
+
+/* the driver pushes out the FIFO, followed by a marker */
+int MPLSensor::flushFifo(int handle)
+{
     /*write sysfs */
     LOGV_IF(SYSFS_VERBOSE, "HAL:sysfs:echo %d > %s (%" PRId64 ")",
             handle, mpu.flush_batch, getTimestamp());
 
     if (write_sysfs_int(mpu.flush_batch, handle) < 0) {
         LOGE("HAL:ERR can't write flush_batch");
+        return -1;
     }
-
     return 0;
 }
@@ -23,11 +23,12 @@
 #include <sys/types.h>
 #include <poll.h>
 #include <time.h>
-#include <vector>
 #include <string>
 
 #include "InvnSensors.h"
 #include "SensorBase.h"
+#include "FlushTracker.h"
+#include "FifoDecoder.h"
 #include "CompassSensor.IIO.primary.h"
 
 /*
@@ -55,18 +56,6 @@
 #define INV_THREE_AXIS_ACCEL        (1LL << Accelerometer)
 #define INV_THREE_AXIS_COMPASS      (1LL << MagneticField)
 
-// data header format used by kernel driver.
-#define DATA_FORMAT_ACCEL           1
-#define DATA_FORMAT_RAW_GYRO        2
-#define DATA_FORMAT_EMPTY_MARKER    17
-#define DATA_FORMAT_MARKER          18
-
-// data size from kernel driver.
-#define DATA_FORMAT_ACCEL_SZ        24
-#define DATA_FORMAT_RAW_GYRO_SZ     24
-#define DATA_FORMAT_EMPTY_MARKER_SZ 8
-#define DATA_FORMAT_MARKER_SZ       8
-
 // read max size from IIO
 #define MAX_READ_SIZE               2048
 
@@ -91,6 +80,8 @@ public:
     virtual int enable(int32_t handle, int enabled);
     virtual int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
     virtual int flush(int handle);
+    int flushFifo(int handle);
+    void completeFlush(int handle);
     virtual int setDelay(int handle, int64_t period_ns) { (void)handle; (void)period_ns; return 0; }
     virtual void getOrientationMatrix(int8_t *orient) { (void)orient; }
 
@@ -121,15 +112,17 @@ private:
 #endif
 
     /* data handlers */
-    int rawGyroHandler(sensors_event_t *data);
-    int accelHandler(sensors_event_t *data);
     int rawCompassHandler(sensors_event_t *data);
     int metaHandler(sensors_event_t *data, int flags); // for flush complete
 
+    /* new data from the chip sensor 'source' */
+    void setDirty(int source) { mDirty |= mDependents[source]; }
+
     void getHandle(int32_t handle, int &what, std::string &sname);
     void setDeviceProperties();
     void getSensorsOrientation(void);
     void writeRateSysfs(int64_t period_ns, char *sysfs_rate);
+    void updateDecoderMatrices(void);
     typedef int (*get_sensor_data_func)(float *values, int8_t *accuracy, int64_t *timestamp, int mode);
 
     CompassSensor *mCompassSensor;
@@ -151,26 +144,27 @@ private:
 #endif
     char mSysfsPath[MAX_SYSFS_NAME_LEN];
     char *sysfs_names_ptr;
-    std::vector<int> mFlushSensorEnabledVector;
+    FlushTracker mFlushTracker;
+    int mFlushCompleteHandle;
+    int mFlushCompleteCount;    /* flush complete events still owed */
     sensors_event_t mPendingEvents[TotalNumSensors];
     hfunc_t mHandlers[TotalNumSensors];
+    uint64_t mDependents[TotalNumSensors]; /* sensors fed by each source */
+    uint64_t mDirty;            /* sensors with data not handled yet */
 
     /* mount matrix */
     signed char mGyroOrientationMatrix[9];
     signed char mAccelOrientationMatrix[9];
     signed char mCompassOrientationMatrix[9];
 
+    /* gyro and accel packets to events */
+    FifoDecoder mFifoDecoder;
+
     /* sensor data */
-    int mCachedGyroData[3];
-    int mCachedAccelData[3];
     int mCachedCompassData[3];
 
     /* timestamp */
-    int64_t mGyroSensorTimestamp;
-    int64_t mAccelSensorTimestamp;
     int64_t mCompassTimestamp;
-    int64_t mGyroSensorPrevTimestamp;
-    int64_t mAccelSensorPrevTimestamp;
     int64_t mCompassPrevTimestamp;
 
     /* fsr */
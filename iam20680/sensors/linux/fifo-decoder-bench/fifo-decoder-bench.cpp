@@ -0,0 +1,368 @@
+/*
+ * Copyright (C) 2018 InvenSense, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "FifoDecoder.h"
+
+#define ODR_HZ          1000
+#define GYRO_FSR_DPS    2000
+#define ACCEL_FSR_GEE   4
+#define MAX_LSB_DATA    32768.0f
+
+/* x = -y, y = x, z = z */
+static const signed char orient[9] = { 0, -1, 0, 1, 0, 0, 0, 0, 1 };
+
+static float gyro_scale(void)
+{
+    return (float)GYRO_FSR_DPS / MAX_LSB_DATA * M_PI / 180;
+}
+
+static float accel_scale(void)
+{
+    return 1.f / (MAX_LSB_DATA / (float)ACCEL_FSR_GEE) * 9.80665f;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void put_packet(std::vector<char> &buf, unsigned short header,
+                       const int *data, int64_t ts)
+{
+    size_t off = buf.size();
+    size_t size = data ? DATA_FORMAT_RAW_GYRO_SZ : DATA_FORMAT_MARKER_SZ;
+
+    buf.resize(off + size);
+    memset(&buf[off], 0, size);
+    memcpy(&buf[off], &header, sizeof(header));
+    if (data) {
+        memcpy(&buf[off + 4], data, 3 * sizeof(int));
+        memcpy(&buf[off + 16], &ts, sizeof(ts));
+    }
+}
+
+/* a flush marker, carrying the handle of the flushed sensor */
+static void put_marker(std::vector<char> &buf, int handle)
+{
+    size_t off = buf.size();
+
+    put_packet(buf, DATA_FORMAT_MARKER, NULL, 0);
+    memcpy(&buf[off + 4], &handle, sizeof(handle));
+}
+
+/* gyro and accel at ODR_HZ, a flush marker every second, of gyro and
+   accel in turn */
+static void synthesize(std::vector<char> &buf, unsigned int seconds)
+{
+    int64_t ts = 1000000000LL;
+    int data[3];
+
+    srand(1);
+    for (unsigned int i = 0; i < seconds * ODR_HZ; i++) {
+        ts += 1000000000LL / ODR_HZ;
+        for (int k = 0; k < 3; k++)
+            data[k] = rand() % 65536 - 32768;
+        put_packet(buf, DATA_FORMAT_RAW_GYRO, data, ts);
+        for (int k = 0; k < 3; k++)
+            data[k] = rand() % 65536 - 32768;
+        put_packet(buf, DATA_FORMAT_ACCEL, data, ts + 1000);
+        if ((i % ODR_HZ) == ODR_HZ - 1)
+            put_marker(buf, (i / ODR_HZ) & 1 ? ID_A : ID_RG);
+    }
+}
+
+/* MPLSensor before the decoder: cache each packet, then run the handler
+   of every enabled sensor and copy its pending event out */
+class LegacyDecoder {
+public:
+    LegacyDecoder(uint64_t enabled) :
+        mEnabled(enabled), mGyroPrev(0), mAccelPrev(0)
+    {
+        memset(mPendingEvents, 0, sizeof(mPendingEvents));
+        memset(mEnabledTime, 0, sizeof(mEnabledTime));
+        mPendingEvents[RawGyro].version = sizeof(sensors_event_t);
+        mPendingEvents[RawGyro].sensor = ID_RG;
+        mPendingEvents[RawGyro].type = SENSOR_TYPE_GYROSCOPE_UNCALIBRATED;
+        mPendingEvents[RawGyro].gyro.status = SENSOR_STATUS_UNRELIABLE;
+        mPendingEvents[Accelerometer].version = sizeof(sensors_event_t);
+        mPendingEvents[Accelerometer].sensor = ID_A;
+        mPendingEvents[Accelerometer].type = SENSOR_TYPE_ACCELEROMETER;
+        mPendingEvents[Accelerometer].acceleration.status =
+            SENSOR_STATUS_UNRELIABLE;
+        mHandlers[RawGyro] = &LegacyDecoder::rawGyroHandler;
+        mHandlers[Accelerometer] = &LegacyDecoder::accelHandler;
+    }
+
+    int decode(const char *buf, int size, int *used,
+               sensors_event_t *s, int count, std::vector<int> *markers)
+    {
+        int ptr = 0, num = 0;
+
+        while (ptr < size) {
+            const char *rdata = buf + ptr;
+            unsigned short header = *(unsigned short *)rdata;
+            bool data_found = false;
+
+            switch (header) {
+                case DATA_FORMAT_MARKER:
+                    markers->push_back(*((int *) (rdata + 4)));
+                    ptr += DATA_FORMAT_MARKER_SZ;
+                    data_found = true;
+                    break;
+                case DATA_FORMAT_RAW_GYRO:
+                    mCachedGyroData[0] = *((int *) (rdata + 4));
+                    mCachedGyroData[1] = *((int *) (rdata + 8));
+                    mCachedGyroData[2] = *((int *) (rdata + 12));
+                    mGyroTimestamp = *((long long *) (rdata + 16));
+                    ptr += DATA_FORMAT_RAW_GYRO_SZ;
+                    data_found = true;
+                    break;
+                case DATA_FORMAT_ACCEL:
+                    mCachedAccelData[0] = *((int *) (rdata + 4));
+                    mCachedAccelData[1] = *((int *) (rdata + 8));
+                    mCachedAccelData[2] = *((int *) (rdata + 12));
+                    mAccelTimestamp = *((long long *) (rdata + 16));
+                    ptr += DATA_FORMAT_ACCEL_SZ;
+                    data_found = true;
+                    break;
+                default:
+                    ptr++;
+                    break;
+            }
+            if (data_found) {
+                int n = readEvents(&s[num], count);
+                count -= n;
+                num += n;
+                if (count == 0)
+                    break;
+            }
+        }
+        *used = ptr;
+        return num;
+    }
+
+private:
+    typedef int (LegacyDecoder::*hfunc_t)(sensors_event_t *);
+
+    int readEvents(sensors_event_t *data, int count)
+    {
+        int num = 0;
+
+        for (int i = 0; i < 2; i++) {
+            if (mEnabled & (1ULL << i)) {
+                int update = (this->*mHandlers[i])(mPendingEvents + i);
+                if (update && count > 0) {
+                    *data++ = mPendingEvents[i];
+                    count--;
+                    num++;
+                }
+            }
+        }
+        return num;
+    }
+
+    int rawGyroHandler(sensors_event_t *s)
+    {
+        int update = 0, data[3];
+        float scale = gyro_scale();
+
+        for (int i = 0; i < 3; i++)
+            data[i] = mCachedGyroData[0] * orient[i * 3] +
+                      mCachedGyroData[1] * orient[i * 3 + 1] +
+                      mCachedGyroData[2] * orient[i * 3 + 2];
+        for (int i = 0; i < 3; i++) {
+            s->uncalibrated_gyro.uncalib[i] = (float)data[i] * scale;
+            s->uncalibrated_gyro.bias[i] = 0;
+        }
+        s->timestamp = mGyroTimestamp;
+        if (mGyroTimestamp > mGyroPrev &&
+            mGyroTimestamp > mEnabledTime[RawGyro])
+            update = 1;
+        mGyroPrev = mGyroTimestamp;
+        return update;
+    }
+
+    int accelHandler(sensors_event_t *s)
+    {
+        int update = 0, data[3];
+        float scale = accel_scale();
+
+        for (int i = 0; i < 3; i++)
+            data[i] = mCachedAccelData[0] * orient[i * 3] +
+                      mCachedAccelData[1] * orient[i * 3 + 1] +
+                      mCachedAccelData[2] * orient[i * 3 + 2];
+        for (int i = 0; i < 3; i++)
+            s->acceleration.v[i] = (float)data[i] * scale;
+        s->timestamp = mAccelTimestamp;
+        if (mAccelTimestamp > mAccelPrev &&
+            mAccelTimestamp > mEnabledTime[Accelerometer])
+            update = 1;
+        mAccelPrev = mAccelTimestamp;
+        return update;
+    }
+
+    uint64_t mEnabled;
+    int64_t mEnabledTime[2];
+    sensors_event_t mPendingEvents[2];
+    hfunc_t mHandlers[2];
+    int mCachedGyroData[3], mCachedAccelData[3];
+    int64_t mGyroTimestamp, mAccelTimestamp, mGyroPrev, mAccelPrev;
+};
+
+struct Result {
+    std::vector<sensors_event_t> events;
+    std::vector<int> markers;   /* handle of each flush marker */
+    double ns;
+};
+
+static void run_legacy(const std::vector<char> &buf, int count,
+                       uint64_t enabled, Result *r)
+{
+    LegacyDecoder dec(enabled);
+    int64_t start;
+    int ptr = 0, used;
+
+    r->events.resize(buf.size() / DATA_FORMAT_MARKER_SZ);
+    r->markers.clear();
+    size_t total = 0;
+    start = now_ns();
+    while (ptr < (int)buf.size()) {
+        total += dec.decode(&buf[ptr], buf.size() - ptr, &used,
+                            &r->events[total], count, &r->markers);
+        ptr += used;
+    }
+    r->ns = now_ns() - start;
+    r->events.resize(total);
+}
+
+/* the loop of MPLSensor::readMpuEvents() */
+static void run_decoder(const std::vector<char> &buf, int count,
+                        uint64_t enabled, Result *r)
+{
+    FifoDecoder dec;
+    int64_t enabledTime[TotalNumSensors] = { 0 };
+    int64_t start;
+    int ptr = 0, used, marker;
+
+    dec.setMatrix(RawGyro, orient, gyro_scale());
+    dec.setMatrix(Accelerometer, orient, accel_scale());
+
+    r->events.resize(buf.size() / DATA_FORMAT_MARKER_SZ);
+    r->markers.clear();
+    size_t total = 0;
+    start = now_ns();
+    while (ptr < (int)buf.size()) {
+        int left = count;
+        while (left > 0) {
+            int num = dec.decode(&buf[ptr], buf.size() - ptr, &used,
+                                 &r->events[total], left, enabled,
+                                 enabledTime, &marker);
+            ptr += used;
+            total += num;
+            left -= num;
+            if (marker < 0)
+                break;
+            r->markers.push_back(marker);
+        }
+    }
+    r->ns = now_ns() - start;
+    r->events.resize(total);
+}
+
+static bool same(const Result &a, const Result &b)
+{
+    if (a.markers != b.markers || a.events.size() != b.events.size())
+        return false;
+    for (size_t i = 0; i < a.events.size(); i++) {
+        const sensors_event_t &x = a.events[i], &y = b.events[i];
+        if (x.version != y.version || x.sensor != y.sensor ||
+            x.type != y.type || x.timestamp != y.timestamp)
+            return false;
+        for (int k = 0; k < 6; k++)
+            if (x.data[k] != y.data[k])
+                return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct {
+        const char *name;
+        uint64_t enabled;
+    } configs[] = {
+        { "gyro+accel", (1ULL << RawGyro) | (1ULL << Accelerometer) },
+        { "gyro", 1ULL << RawGyro },
+    };
+    std::vector<char> buf;
+    unsigned int seconds = 60;
+    int count = 64, opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "s:c:")) != -1) {
+        switch (opt) {
+        case 's':
+            seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            count = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s seconds] [-c events per read]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (seconds < 1 || count < 1) {
+        fprintf(stderr, "bad duration or event count\n");
+        return EXIT_FAILURE;
+    }
+
+    synthesize(buf, seconds);
+    printf("%u s at %d Hz, %zu bytes, %d events per read\n",
+           seconds, ODR_HZ, buf.size(), count);
+
+    for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+        Result legacy, decoder;
+        double packets = 2.0 * seconds * ODR_HZ;
+
+        run_legacy(buf, count, configs[c].enabled, &legacy);
+        run_decoder(buf, count, configs[c].enabled, &decoder);
+        bool ok = same(legacy, decoder);
+        failed |= !ok;
+
+        printf("%-10s legacy  %6.1f ns/packet, %.4f%% of a CPU\n",
+               configs[c].name, legacy.ns / packets,
+               legacy.ns / seconds / 1e7);
+        printf("%-10s decoder %6.1f ns/packet, %.4f%% of a CPU, %.2fx, "
+               "%zu events %s\n",
+               configs[c].name, decoder.ns / packets,
+               decoder.ns / seconds / 1e7, legacy.ns / decoder.ns,
+               decoder.events.size(), ok ? "identical" : "MISMATCH");
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
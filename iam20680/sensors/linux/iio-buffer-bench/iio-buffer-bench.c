@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2018 InvenSense, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "inv_iio_buffer.h"
+
+/* data channels, followed by a le:s64 timestamp */
+struct bench_layout {
+    const char *name;
+    unsigned nb;
+    size_t size;
+    bool is_be;
+};
+
+static const struct bench_layout layouts[] = {
+    { "le:s16 x3", 3, 2, false },
+    { "le:s32 x3", 3, 4, false },
+    { "le:s32 x1", 1, 4, false },
+    { "be:s16 x3", 3, 2, true },
+};
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void layout_setup(const struct bench_layout *bench,
+                         struct inv_iio_buffer_layout *layout)
+{
+    struct inv_iio_buffer_channel *channel;
+    unsigned i;
+
+    memset(layout, 0, sizeof(*layout));
+    for (i = 0; i < bench->nb; ++i) {
+        channel = &layout->channels[i];
+        channel->is_enabled = true;
+        channel->index = i;
+        channel->size = bench->size;
+        channel->bits = bench->size * 8;
+        channel->is_signed = true;
+        channel->is_be = bench->is_be;
+        channel->offset = 0.5 * i;
+        channel->scale = 0.0015 * (i + 1);
+    }
+    channel = &layout->channels[bench->nb];
+    channel->is_enabled = true;
+    channel->index = bench->nb;
+    channel->size = 8;
+    channel->bits = 64;
+    channel->is_signed = true;
+    channel->scale = 1.0;
+    inv_iio_buffer_layout_init(layout, bench->nb + 1);
+}
+
+/* what the compass did for every scan before the layout decoder */
+static void decode_generic(const struct inv_iio_buffer_layout *layout,
+                           const uint8_t *buf, size_t scans, float **data)
+{
+    const struct inv_iio_buffer_channel *channel;
+    size_t n, i;
+    int64_t raw;
+
+    for (n = 0; n < scans; ++n) {
+        for (i = 0; i < layout->nb - 1; ++i) {
+            channel = &layout->channels[i];
+            raw = inv_iio_buffer_channel_get_data(channel,
+                                                  &buf[layout->addresses[i]]);
+            data[i][n] = inv_iio_buffer_convert_data(channel, raw);
+        }
+        buf += layout->size;
+    }
+}
+
+static int run(const struct bench_layout *bench, size_t scans, unsigned rounds)
+{
+    struct inv_iio_buffer_layout layout;
+    float *ref[INV_IIO_BUFFER_MAX_CHANNELS] = { NULL };
+    float *out[INV_IIO_BUFFER_MAX_CHANNELS] = { NULL };
+    uint8_t *buf;
+    int64_t t0, t_generic, t_layout;
+    size_t n, i;
+    unsigned r;
+    int errors = 0;
+
+    layout_setup(bench, &layout);
+    buf = malloc(scans * layout.size);
+    for (n = 0; n < scans * layout.size; ++n) {
+        buf[n] = rand();
+    }
+    for (i = 0; i < bench->nb; ++i) {
+        ref[i] = malloc(scans * sizeof(float));
+        out[i] = malloc(scans * sizeof(float));
+    }
+
+    t0 = now_ns();
+    for (r = 0; r < rounds; ++r) {
+        decode_generic(&layout, buf, scans, ref);
+    }
+    t_generic = now_ns() - t0;
+
+    t0 = now_ns();
+    for (r = 0; r < rounds; ++r) {
+        inv_iio_buffer_layout_decode_float(&layout, buf, scans * layout.size,
+                                           out, scans);
+    }
+    t_layout = now_ns() - t0;
+
+    for (i = 0; i < bench->nb; ++i) {
+        for (n = 0; n < scans; ++n) {
+            if (fabsf(out[i][n] - ref[i][n]) > 1e-5f * fabsf(ref[i][n]) + 1e-5f) {
+                if (errors++ < 4) {
+                    fprintf(stderr, "%s: scan %zu channel %zu: %f != %f\n",
+                            bench->name, n, i, out[i][n], ref[i][n]);
+                }
+            }
+        }
+    }
+
+    printf("%-10s format %d  generic %6.2f ns/scan  layout %6.2f ns/scan  "
+           "%.2fx%s\n", bench->name, layout.format,
+           (double)t_generic / rounds / scans, (double)t_layout / rounds / scans,
+           (double)t_generic / t_layout, errors ? "  MISMATCH" : "");
+
+    for (i = 0; i < bench->nb; ++i) {
+        free(ref[i]);
+        free(out[i]);
+    }
+    free(buf);
+
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    long scans = 64;
+    long rounds = 100000;
+    int errors = 0;
+    size_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        switch (opt) {
+        case 'n':
+            scans = strtol(optarg, NULL, 0);
+            break;
+        case 'r':
+            rounds = strtol(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n scans per buffer] [-r rounds]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (scans <= 0 || rounds <= 0) {
+        fprintf(stderr, "bad scan or round count\n");
+        return 1;
+    }
+
+    printf("%ld scans per buffer, %ld rounds\n", scans, rounds);
+    for (i = 0; i < sizeof(layouts) / sizeof(layouts[0]); ++i) {
+        errors += run(&layouts[i], scans, rounds);
+    }
+
+    return errors ? 1 : 0;
+}